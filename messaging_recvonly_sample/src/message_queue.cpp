@@ -0,0 +1,186 @@
+#include "message_queue.h"
+
+#include <algorithm>
+#include <functional>
+
+// キーはこの大きさまで事前に確保しておく
+#define MESSAGE_QUEUE_KEY_SIZE 64
+
+MessageQueue::MessageQueue(MessageQueueConfig config)
+    : config_(config), slots_(std::max<size_t>(config.capacity, 1)) {
+  for (auto& slot : slots_) {
+    slot.data.reserve(config_.slot_size);
+    if (config_.policy == MessageQueuePolicy::kCoalesce) {
+      slot.key.reserve(MESSAGE_QUEUE_KEY_SIZE);
+    }
+  }
+  if (config_.policy == MessageQueuePolicy::kCoalesce) {
+    key_.reserve(MESSAGE_QUEUE_KEY_SIZE);
+    size_t size = 1;
+    while (size < slots_.size() * 2) {
+      size *= 2;
+    }
+    index_.assign(size, -1);
+    index_mask_ = size - 1;
+  }
+}
+
+bool MessageQueue::Push(const std::string& data) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (closed_) {
+    stats_.dropped_newest++;
+    return false;
+  }
+
+  switch (config_.policy) {
+    case MessageQueuePolicy::kBlock:
+      if (count_ == slots_.size()) {
+        stats_.blocked++;
+        not_full_.wait(lock,
+                       [this]() { return closed_ || count_ < slots_.size(); });
+        if (closed_) {
+          stats_.dropped_newest++;
+          return false;
+        }
+      }
+      break;
+    case MessageQueuePolicy::kDropOldest:
+      if (count_ == slots_.size()) {
+        PopLocked();
+        stats_.dropped_oldest++;
+      }
+      break;
+    case MessageQueuePolicy::kDropNewest:
+      if (count_ == slots_.size()) {
+        stats_.dropped_newest++;
+        return false;
+      }
+      break;
+    case MessageQueuePolicy::kCoalesce: {
+      key_.clear();
+      size_t pos = data.find(config_.coalesce_delimiter);
+      if (pos != std::string::npos && pos > 0) {
+        key_.assign(data, 0, pos);
+        key_hash_ = std::hash<std::string>()(key_);
+        Slot* slot = FindLocked(key_, key_hash_);
+        if (slot != nullptr) {
+          // 順番は古いメッセージの位置のままにする
+          slot->data.assign(data);
+          stats_.pushed++;
+          stats_.coalesced++;
+          return true;
+        }
+      }
+      if (count_ == slots_.size()) {
+        PopLocked();
+        stats_.dropped_oldest++;
+      }
+      break;
+    }
+  }
+
+  PushLocked(data, key_);
+  lock.unlock();
+  not_empty_.notify_one();
+  return true;
+}
+
+bool MessageQueue::Pop(std::string& data) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  not_empty_.wait(lock, [this]() { return closed_ || count_ > 0; });
+  if (count_ == 0) {
+    return false;
+  }
+  data.swap(slots_[head_].data);
+  PopLocked();
+  stats_.popped++;
+  stats_.depth = count_;
+  lock.unlock();
+  not_full_.notify_one();
+  return true;
+}
+
+void MessageQueue::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  not_empty_.notify_all();
+  not_full_.notify_all();
+}
+
+MessageQueueStats MessageQueue::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void MessageQueue::PushLocked(const std::string& data, const std::string& key) {
+  size_t index = (head_ + count_) % slots_.size();
+  Slot& slot = slots_[index];
+  // 取り出す時にバッファを交換しているので、assign は確保済みのバッファにコピーする
+  slot.data.assign(data);
+  if (config_.policy == MessageQueuePolicy::kCoalesce) {
+    slot.key.assign(key);
+    if (!key.empty()) {
+      slot.hash = key_hash_;
+      InsertIndexLocked(index);
+    }
+  }
+  count_++;
+  stats_.pushed++;
+  stats_.depth = count_;
+  stats_.max_depth = std::max(stats_.max_depth, count_);
+}
+
+void MessageQueue::PopLocked() {
+  if (config_.policy == MessageQueuePolicy::kCoalesce &&
+      !slots_[head_].key.empty()) {
+    EraseIndexLocked(head_);
+  }
+  head_ = (head_ + 1) % slots_.size();
+  count_--;
+}
+
+// キューに積まれているメッセージのキーは重複しないので、見つかったスロットは 1 つだけ
+MessageQueue::Slot* MessageQueue::FindLocked(const std::string& key,
+                                             size_t hash) {
+  for (size_t i = hash & index_mask_; index_[i] >= 0;
+       i = (i + 1) & index_mask_) {
+    Slot& slot = slots_[index_[i]];
+    if (slot.hash == hash && slot.key == key) {
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+void MessageQueue::InsertIndexLocked(size_t slot) {
+  size_t i = slots_[slot].hash & index_mask_;
+  while (index_[i] >= 0) {
+    i = (i + 1) & index_mask_;
+  }
+  index_[i] = (int32_t)slot;
+}
+
+void MessageQueue::EraseIndexLocked(size_t slot) {
+  size_t i = slots_[slot].hash & index_mask_;
+  while (index_[i] != (int32_t)slot) {
+    i = (i + 1) & index_mask_;
+  }
+  // 墓標を残さないように、後ろに続く要素のうち手前に詰められるものを詰める
+  size_t j = i;
+  while (true) {
+    j = (j + 1) & index_mask_;
+    if (index_[j] < 0) {
+      break;
+    }
+    size_t home = slots_[index_[j]].hash & index_mask_;
+    // home が (i, j] の範囲に無ければ、i に移しても探索で見つけられる
+    bool in_range = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+    if (!in_range) {
+      index_[i] = index_[j];
+      i = j;
+    }
+  }
+  index_[i] = -1;
+}
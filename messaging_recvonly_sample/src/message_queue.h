@@ -0,0 +1,111 @@
+#ifndef MESSAGE_QUEUE_H_
+#define MESSAGE_QUEUE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// キューが一杯の時にどうするか
+enum class MessageQueuePolicy {
+  // 空きができるまで積む側を待たせる
+  kBlock,
+  // 一番古いメッセージを捨てて積む
+  kDropOldest,
+  // 積もうとしたメッセージを捨てる
+  kDropNewest,
+  // 同じキーのメッセージが積まれていれば、その内容を新しいメッセージで置き換える。
+  // 一杯の時に同じキーのメッセージが無ければ、一番古いメッセージを捨てて積む
+  kCoalesce,
+};
+
+struct MessageQueueConfig {
+  // kBlock は SDK のスレッドを待たせて全てのラベルの受信を止めるので、捨てる方をデフォルトにする
+  MessageQueuePolicy policy = MessageQueuePolicy::kDropOldest;
+  // 積んでおけるメッセージの数
+  size_t capacity = 256;
+  // 各スロットに事前に確保しておくメッセージの大きさ。
+  // これより大きいメッセージが来た場合はそのスロットだけ大きくして、以降も使い回す
+  size_t slot_size = 4096;
+  // kCoalesce の場合に、メッセージの先頭からこの文字の手前までをキーとして扱う。
+  // この文字を含まないメッセージと、キーが空のメッセージはまとめない
+  char coalesce_delimiter = ':';
+};
+
+struct MessageQueueStats {
+  uint64_t pushed = 0;
+  uint64_t popped = 0;
+  // 一杯だったために捨てた古いメッセージの数
+  uint64_t dropped_oldest = 0;
+  // 一杯だったか、閉じた後だったために捨てた新しいメッセージの数
+  uint64_t dropped_newest = 0;
+  // 同じキーの新しいメッセージで置き換えたメッセージの数
+  uint64_t coalesced = 0;
+  // kBlock で積む側を待たせた回数
+  uint64_t blocked = 0;
+  size_t depth = 0;
+  // キューに積まれていたメッセージの数の最大値
+  size_t max_depth = 0;
+
+  uint64_t GetDropped() const {
+    return dropped_oldest + dropped_newest + coalesced;
+  }
+};
+
+// OnMessage と、メッセージを処理するスレッドの間に置く固定長のキュー。
+//
+// スロットは作成時に全て確保して、メッセージはスロットのバッファにコピーする。
+// 取り出す時は呼び出し側の文字列とスロットのバッファを交換するので、
+// 定常状態ではメモリを確保しない。
+//
+// kCoalesce の場合は、キーからスロットを引く開番地法のハッシュ表も作成時に確保しておき、
+// 同じキーのメッセージを探す時にキュー全体を見ずに済むようにする。
+class MessageQueue {
+ public:
+  explicit MessageQueue(MessageQueueConfig config);
+
+  // メッセージを積む。捨てた場合は false を返す
+  bool Push(const std::string& data);
+  // メッセージを取り出して data と交換する。
+  // メッセージが無い場合は積まれるまで待ち、閉じた後で空になっていれば false を返す
+  bool Pop(std::string& data);
+  // 待っている Push と Pop を起こす。閉じた後も積まれていたメッセージは取り出せる
+  void Close();
+
+  MessageQueueStats GetStats() const;
+
+ private:
+  struct Slot {
+    std::string key;
+    std::string data;
+    // key のハッシュ値。key が空の場合は index_ に入れない
+    size_t hash = 0;
+  };
+
+  void PushLocked(const std::string& data, const std::string& key);
+  // head_ のスロットを取り除く
+  void PopLocked();
+  Slot* FindLocked(const std::string& key, size_t hash);
+  void InsertIndexLocked(size_t slot);
+  void EraseIndexLocked(size_t slot);
+
+  MessageQueueConfig config_;
+  mutable std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::vector<Slot> slots_;
+  size_t head_ = 0;
+  size_t count_ = 0;
+  bool closed_ = false;
+  MessageQueueStats stats_;
+  // キーを取り出すための作業用のバッファ
+  std::string key_;
+  size_t key_hash_ = 0;
+  // kCoalesce の場合の、キーが空でないスロットの番号のハッシュ表。
+  // 線形探索で、空きは -1。大きさは 2 の累乗で、容量の 2 倍以上にする
+  std::vector<int32_t> index_;
+  size_t index_mask_ = 0;
+};
+
+#endif
@@ -1,3 +1,8 @@
+#include <chrono>
+#include <map>
+#include <sstream>
+#include <thread>
+
 // Sora
 #include <sora/sora_client_context.h>
 
@@ -8,15 +13,50 @@
 #include <boost/optional/optional.hpp>
 
 #ifdef _WIN32
+#include <psapi.h>
 #include <rtc_base/win/scoped_com_initializer.h>
+#else
+#include <sys/resource.h>
 #endif
 
+#include "data_channel_config.h"
+#include "message_queue.h"
+
 struct MessagingRecvOnlySampleConfig {
   std::string signaling_url;
   std::string channel_id;
   boost::json::value data_channels;
+  bool data_only = false;
+  bool startup_report = false;
+  MessageQueueConfig queue;
+  // メッセージを処理する度にこの時間だけ待って、処理の遅い利用者を模擬する
+  int consume_delay_ms = 0;
+  std::chrono::steady_clock::time_point start_time;
+  std::chrono::steady_clock::time_point context_created_time;
 };
 
+// プロセスの最大 RSS (KiB)
+static int64_t GetMaxRssKb() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return (int64_t)counters.PeakWorkingSetSize / 1024;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#if defined(__APPLE__)
+  // macOS はバイト単位
+  return (int64_t)usage.ru_maxrss / 1024;
+#else
+  return (int64_t)usage.ru_maxrss;
+#endif
+#endif
+}
+
 class MessagingRecvOnlySample
     : public std::enable_shared_from_this<MessagingRecvOnlySample>,
       public sora::SoraSignalingObserver {
@@ -35,36 +75,26 @@ class MessagingRecvOnlySample
     config.signaling_urls.push_back(config_.signaling_url);
     config.channel_id = config_.channel_id;
     config.role = "recvonly";
+    if (config_.data_only) {
+      // 映像と音声は受信しない
+      config.video = false;
+      config.audio = false;
+    }
 
-    for (auto data_channel_value : config_.data_channels.as_array()) {
-      auto data_channel_object = data_channel_value.as_object();
-      sora::SoraSignalingConfig::DataChannel data_channel;
-      data_channel.label = data_channel_object["label"].as_string();
-      if (data_channel_object["direction"].is_string()) {
-        data_channel.direction = data_channel_object["direction"].as_string();
-      } else {
-        data_channel.direction = "recvonly";
+    config.data_channels =
+        ParseDataChannels(config_.data_channels, "recvonly");
+    for (const auto& data_channel : config.data_channels) {
+      // OnMessage は SDK のスレッドで呼ばれるので、ラベル毎のキューに積むだけにして、
+      // 処理はラベル毎のスレッドで行う。遅いラベルが他のラベルを止めることは無い
+      if (consumers_.count(data_channel.label) == 0) {
+        auto& consumer = consumers_[data_channel.label];
+        consumer.queue.reset(new MessageQueue(config_.queue));
+        consumer.thread.reset(
+            new std::thread([this, label = data_channel.label,
+                             queue = consumer.queue.get()]() {
+              Consume(label, queue);
+            }));
       }
-      if (data_channel_object["protocol"].is_string()) {
-        data_channel.protocol.emplace(
-            data_channel_object["protocol"].as_string());
-      }
-      if (data_channel_object["ordered"].is_bool()) {
-        data_channel.ordered = data_channel_object["ordered"].as_bool();
-      }
-      if (data_channel_object["compress"].is_bool()) {
-        data_channel.compress = data_channel_object["compress"].as_bool();
-      }
-      if (data_channel_object["max_packet_life_time"].is_number()) {
-        data_channel.max_packet_life_time = boost::json::value_to<int32_t>(
-            data_channel_object["max_packet_life_time"]);
-      }
-      if (data_channel_object["max_retransmits"].is_number()) {
-        data_channel.max_retransmits = boost::json::value_to<int32_t>(
-            data_channel_object["max_retransmits"]);
-      }
-
-      config.data_channels.push_back(data_channel);
     }
 
     conn_ = sora::SoraSignaling::Create(config);
@@ -76,21 +106,38 @@ class MessagingRecvOnlySample
     signals.async_wait(
         [this](const boost::system::error_code&, int) { conn_->Disconnect(); });
 
+    connect_time_ = std::chrono::steady_clock::now();
     conn_->Connect();
     ioc_->run();
+
+    for (auto& p : consumers_) {
+      p.second.queue->Close();
+    }
+    for (auto& p : consumers_) {
+      p.second.thread->join();
+      PrintQueueStats(p.first, p.second.queue->GetStats());
+    }
   }
 
   void OnSetOffer(std::string offer) override {}
   void OnDisconnect(sora::SoraSignalingErrorCode ec,
                     std::string message) override {
     RTC_LOG(LS_INFO) << "OnDisconnect: " << message;
+    // kBlock で待っている OnMessage を起こす
+    for (auto& p : consumers_) {
+      p.second.queue->Close();
+    }
     ioc_->stop();
   }
   void OnNotify(std::string text) override {}
   void OnPush(std::string text) override {}
   void OnMessage(std::string label, std::string data) override {
-    std::cout << "OnMessage: label=" << label << ", data=" << data.size()
-              << " bytes" << std::endl;
+    auto it = consumers_.find(label);
+    if (it == consumers_.end()) {
+      RTC_LOG(LS_WARNING) << "Unknown label: " << label;
+      return;
+    }
+    it->second.queue->Push(data);
   }
 
   void OnTrack(rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver)
@@ -98,13 +145,69 @@ class MessagingRecvOnlySample
   void OnRemoveTrack(
       rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver) override {}
 
-  void OnDataChannel(std::string label) override {}
+  void OnDataChannel(std::string label) override {
+    if (!config_.startup_report || startup_reported_) {
+      return;
+    }
+    startup_reported_ = true;
+    // プロセス開始から最初のデータチャネルが開くまでの時間を出力する
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed_ms = [this](std::chrono::steady_clock::time_point t) {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+                 t - config_.start_time)
+          .count();
+    };
+    std::cout << "{\"label\":\"" << label << "\""
+              << ",\"data_only\":" << (config_.data_only ? "true" : "false")
+              << ",\"context_created_ms\":"
+              << elapsed_ms(config_.context_created_time)
+              << ",\"connect_ms\":" << elapsed_ms(connect_time_)
+              << ",\"first_data_channel_ms\":" << elapsed_ms(now)
+              << ",\"max_rss_kb\":" << GetMaxRssKb() << "}" << std::endl;
+  }
 
  private:
+  struct Consumer {
+    std::unique_ptr<MessageQueue> queue;
+    std::unique_ptr<std::thread> thread;
+  };
+
+  void Consume(const std::string& label, MessageQueue* queue) {
+    std::string data;
+    data.reserve(config_.queue.slot_size);
+    while (queue->Pop(data)) {
+      std::stringstream ss;
+      ss << "OnMessage: label=" << label << ", data=" << data.size()
+         << " bytes\n";
+      std::cout << ss.str() << std::flush;
+      if (config_.consume_delay_ms > 0) {
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(config_.consume_delay_ms));
+      }
+    }
+  }
+
+  void PrintQueueStats(const std::string& label,
+                       const MessageQueueStats& stats) {
+    std::cout << "{\"label\":\"" << label << "\""
+              << ",\"pushed\":" << stats.pushed
+              << ",\"popped\":" << stats.popped
+              << ",\"dropped\":" << stats.GetDropped()
+              << ",\"dropped_oldest\":" << stats.dropped_oldest
+              << ",\"dropped_newest\":" << stats.dropped_newest
+              << ",\"coalesced\":" << stats.coalesced
+              << ",\"blocked\":" << stats.blocked
+              << ",\"max_depth\":" << stats.max_depth << "}" << std::endl;
+  }
+
   std::shared_ptr<sora::SoraClientContext> context_;
   MessagingRecvOnlySampleConfig config_;
+  std::chrono::steady_clock::time_point connect_time_;
+  bool startup_reported_ = false;
   std::shared_ptr<sora::SoraSignaling> conn_;
   std::unique_ptr<boost::asio::io_context> ioc_;
+  // 接続前に作って、以降は追加も削除もしない
+  std::map<std::string, Consumer> consumers_;
 };
 
 void add_optional_bool(CLI::App& app,
@@ -128,6 +231,8 @@ void add_optional_bool(CLI::App& app,
 }
 
 int main(int argc, char* argv[]) {
+  auto start_time = std::chrono::steady_clock::now();
+
 #ifdef _WIN32
   webrtc::ScopedCOMInitializer com_initializer(
       webrtc::ScopedCOMInitializer::kMTA);
@@ -172,6 +277,42 @@ int main(int argc, char* argv[]) {
          "--data-channels", data_channels,
          "Data channels specification (default: " + default_data_channels + ")")
       ->check(is_json);
+  app.add_flag("--data-only", config.data_only,
+               "Do not initialize video codecs and do not receive media");
+  app.add_flag("--startup-report", config.startup_report,
+               "Print elapsed time until the first data channel is opened");
+
+  // キューに関するオプション
+  auto queue_policy_map =
+      std::vector<std::pair<std::string, MessageQueuePolicy>>(
+          {{"block", MessageQueuePolicy::kBlock},
+           {"drop-oldest", MessageQueuePolicy::kDropOldest},
+           {"drop-newest", MessageQueuePolicy::kDropNewest},
+           {"coalesce", MessageQueuePolicy::kCoalesce}});
+  app.add_option("--queue-policy", config.queue.policy,
+                 "Policy when the per-label message queue is full "
+                 "(default: drop-oldest)")
+      ->transform(CLI::CheckedTransformer(queue_policy_map, CLI::ignore_case));
+  app.add_option("--queue-size", config.queue.capacity,
+                 "Number of messages queued per label (default: 256)")
+      ->check(CLI::Range(1, 65536));
+  app.add_option("--queue-slot-size", config.queue.slot_size,
+                 "Bytes preallocated for each queued message (default: 4096)")
+      ->check(CLI::Range(0, 1024 * 1024));
+  std::string coalesce_delimiter;
+  app.add_option("--coalesce-delimiter", coalesce_delimiter,
+                 "Character that ends the coalescing key (default: :)")
+      ->check(CLI::Validator(
+          [](std::string input) -> std::string {
+            if (input.size() != 1) {
+              return "Value " + input + " is not a single character";
+            }
+            return std::string();
+          },
+          "CHAR"));
+  app.add_option("--consume-delay-ms", config.consume_delay_ms,
+                 "Sleep after each message to emulate a slow consumer")
+      ->check(CLI::Range(0, 10000));
 
   try {
     app.parse(argc, argv);
@@ -179,6 +320,10 @@ int main(int argc, char* argv[]) {
     exit(app.exit(e));
   }
 
+  if (!coalesce_delimiter.empty()) {
+    config.queue.coalesce_delimiter = coalesce_delimiter[0];
+  }
+
   if (!data_channels.empty()) {
     config.data_channels = boost::json::parse(data_channels);
   } else {
@@ -194,8 +339,21 @@ int main(int argc, char* argv[]) {
   sora::SoraClientContextConfig context_config;
   context_config.use_audio_device = false;
   context_config.use_hardware_encoder = false;
+  if (config.data_only) {
+    // データチャネルしか使わないので、映像のエンコーダ/デコーダを用意しない。
+    // 対応コーデックの列挙やハードウェアエンコーダの検出を行わなくなるので起動が速くなる。
+    context_config.configure_media_dependencies =
+        [](const webrtc::PeerConnectionFactoryDependencies& dependencies,
+           cricket::MediaEngineDependencies& media_dependencies) {
+          media_dependencies.video_encoder_factory = nullptr;
+          media_dependencies.video_decoder_factory = nullptr;
+        };
+  }
   auto context = sora::SoraClientContext::Create(context_config);
 
+  config.start_time = start_time;
+  config.context_created_time = std::chrono::steady_clock::now();
+
   auto messaging_recvonly_sample =
       std::make_shared<MessagingRecvOnlySample>(context, config);
   messaging_recvonly_sample->Run();
@@ -0,0 +1,37 @@
+#include "data_channel_config.h"
+
+std::vector<sora::SoraSignalingConfig::DataChannel> ParseDataChannels(
+    const boost::json::value& data_channels,
+    const std::string& default_direction) {
+  std::vector<sora::SoraSignalingConfig::DataChannel> result;
+  for (auto data_channel_value : data_channels.as_array()) {
+    auto data_channel_object = data_channel_value.as_object();
+    sora::SoraSignalingConfig::DataChannel data_channel;
+    data_channel.label = data_channel_object["label"].as_string();
+    if (data_channel_object["direction"].is_string()) {
+      data_channel.direction = data_channel_object["direction"].as_string();
+    } else {
+      data_channel.direction = default_direction;
+    }
+    if (data_channel_object["protocol"].is_string()) {
+      data_channel.protocol.emplace(
+          data_channel_object["protocol"].as_string());
+    }
+    if (data_channel_object["ordered"].is_bool()) {
+      data_channel.ordered = data_channel_object["ordered"].as_bool();
+    }
+    if (data_channel_object["compress"].is_bool()) {
+      data_channel.compress = data_channel_object["compress"].as_bool();
+    }
+    if (data_channel_object["max_packet_life_time"].is_number()) {
+      data_channel.max_packet_life_time = boost::json::value_to<int32_t>(
+          data_channel_object["max_packet_life_time"]);
+    }
+    if (data_channel_object["max_retransmits"].is_number()) {
+      data_channel.max_retransmits = boost::json::value_to<int32_t>(
+          data_channel_object["max_retransmits"]);
+    }
+    result.push_back(data_channel);
+  }
+  return result;
+}
@@ -0,0 +1,19 @@
+#ifndef DATA_CHANNEL_CONFIG_H_
+#define DATA_CHANNEL_CONFIG_H_
+
+#include <string>
+#include <vector>
+
+// Boost
+#include <boost/json.hpp>
+
+// Sora
+#include <sora/sora_signaling.h>
+
+// --data-channels で指定した JSON の配列を SoraSignalingConfig::DataChannel のリストにする。
+// direction が指定されていない場合は default_direction を使う
+std::vector<sora::SoraSignalingConfig::DataChannel> ParseDataChannels(
+    const boost::json::value& data_channels,
+    const std::string& default_direction);
+
+#endif
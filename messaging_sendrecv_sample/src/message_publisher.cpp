@@ -0,0 +1,368 @@
+#include "message_publisher.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+// WebRTC
+#include <api/make_ref_counted.h>
+#include <api/stats/rtc_stats_collector_callback.h>
+#include <api/stats/rtcstats_objects.h>
+#include <rtc_base/logging.h>
+#include <rtc_base/time_utils.h>
+
+// 送るメッセージを確認する間隔
+#define PUBLISHER_SEND_INTERVAL_MS 10
+// GetStats を呼ぶ間隔。WebRTC は 50 ミリ秒の間は前回の結果を返すので、これより短くしても意味が無い
+#define PUBLISHER_STATS_INTERVAL_MS 50
+// SCTP に渡ったかを確認できていない送ったメッセージの最大数。これを超えた場合も送るのを止める
+#define PUBLISHER_MAX_PENDING 65536
+
+namespace {
+
+template <class T>
+std::string OptionalToJson(const boost::optional<T>& v) {
+  if (!v) {
+    return "null";
+  }
+  std::stringstream ss;
+  ss << std::boolalpha << *v;
+  return ss.str();
+}
+
+}  // namespace
+
+class MessagePublisher::Callback : public webrtc::RTCStatsCollectorCallback {
+ public:
+  Callback(std::shared_ptr<Shared> shared) : shared_(shared) {}
+
+  // シグナリングスレッドから呼ばれるので、ここでは結果を渡すだけにする
+  void OnStatsDelivered(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report)
+      override {
+    webrtc::MutexLock lock(&shared_->mutex);
+    MessagePublisher* publisher = shared_->publisher;
+    if (publisher == nullptr) {
+      return;
+    }
+    std::shared_ptr<Shared> shared = shared_;
+    boost::asio::post(publisher->ioc_, [shared, report]() {
+      webrtc::MutexLock lock(&shared->mutex);
+      if (shared->publisher != nullptr) {
+        shared->publisher->OnStatsDelivered(report);
+      }
+    });
+  }
+
+ private:
+  std::shared_ptr<Shared> shared_;
+};
+
+void MessagePublisher::Result::Add(const Pending& pending, int64_t delay_us) {
+  messages += pending.count;
+  bytes += pending.bytes;
+  data_channel_messages++;
+  delay_total_us += delay_us;
+  delay_max_us = std::max(delay_max_us, delay_us);
+}
+
+MessagePublisher::MessagePublisher(boost::asio::io_context& ioc,
+                                   MessagePublisherConfig config,
+                                   SendFunc send)
+    : ioc_(ioc),
+      config_(config),
+      send_(send),
+      send_timer_(ioc),
+      stats_timer_(ioc),
+      report_timer_(ioc),
+      shared_(std::make_shared<Shared>()) {
+  shared_->publisher = this;
+}
+
+MessagePublisher::~MessagePublisher() {
+  webrtc::MutexLock lock(&shared_->mutex);
+  shared_->publisher = nullptr;
+}
+
+bool MessagePublisher::Init() {
+  if (config_.file.empty()) {
+    return true;
+  }
+  std::ifstream ifs(config_.file, std::ios::binary);
+  if (!ifs) {
+    RTC_LOG(LS_ERROR) << "Failed to open " << config_.file;
+    return false;
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  file_data_ = ss.str();
+  if (file_data_.empty()) {
+    RTC_LOG(LS_ERROR) << config_.file << " is empty";
+    return false;
+  }
+  return true;
+}
+
+void MessagePublisher::SetPeerConnection(
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc) {
+  pc_ = pc;
+  collecting_ = false;
+}
+
+void MessagePublisher::AddChannel(
+    const sora::SoraSignalingConfig::DataChannel& data_channel) {
+  if (channels_.count(data_channel.label) != 0) {
+    return;
+  }
+  RTC_LOG(LS_INFO) << "Start publishing: label=" << data_channel.label;
+  Channel& channel = channels_[data_channel.label];
+  channel.config = data_channel;
+  channel.start_us = rtc::TimeMicros();
+  channel.pending.resize(PUBLISHER_MAX_PENDING);
+}
+
+void MessagePublisher::Start() {
+  int batch_count = std::max(1, config_.batch_size / config_.message_size);
+  payload_.reserve(batch_count * config_.message_size);
+  running_ = true;
+  report_us_ = rtc::TimeMicros();
+  ScheduleSend();
+  ScheduleStats();
+  ScheduleReport();
+}
+
+void MessagePublisher::Stop() {
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  send_timer_.cancel();
+  stats_timer_.cancel();
+  report_timer_.cancel();
+  int64_t now_us = rtc::TimeMicros();
+  for (const auto& p : channels_) {
+    PrintResult(p.first, p.second, p.second.total,
+                (now_us - p.second.start_us) / 1000000.0);
+  }
+}
+
+void MessagePublisher::ScheduleSend() {
+  send_timer_.expires_after(
+      std::chrono::milliseconds(PUBLISHER_SEND_INTERVAL_MS));
+  send_timer_.async_wait([this](const boost::system::error_code& ec) {
+    if (ec || !running_) {
+      return;
+    }
+    int64_t now_us = rtc::TimeMicros();
+    for (auto& p : channels_) {
+      Send(p.first, p.second, now_us);
+    }
+    ScheduleSend();
+  });
+}
+
+void MessagePublisher::ScheduleStats() {
+  stats_timer_.expires_after(
+      std::chrono::milliseconds(PUBLISHER_STATS_INTERVAL_MS));
+  stats_timer_.async_wait([this](const boost::system::error_code& ec) {
+    if (ec || !running_) {
+      return;
+    }
+    // 前回の結果がまだ返ってきていない場合は、リクエストを積み上げずに今回の分を飛ばす
+    if (pc_ != nullptr && !collecting_) {
+      collecting_ = true;
+      auto callback = rtc::make_ref_counted<Callback>(shared_);
+      pc_->GetStats(callback.get());
+    }
+    ScheduleStats();
+  });
+}
+
+void MessagePublisher::ScheduleReport() {
+  report_timer_.expires_after(std::chrono::seconds(config_.report_interval));
+  report_timer_.async_wait([this](const boost::system::error_code& ec) {
+    if (ec || !running_) {
+      return;
+    }
+    int64_t now_us = rtc::TimeMicros();
+    double seconds = (now_us - report_us_) / 1000000.0;
+    report_us_ = now_us;
+    for (auto& p : channels_) {
+      PrintResult(p.first, p.second, p.second.report, seconds);
+      p.second.report = Result();
+    }
+    ScheduleReport();
+  });
+}
+
+void MessagePublisher::Send(const std::string& label,
+                            Channel& channel,
+                            int64_t now_us) {
+  int batch_count = std::max(1, config_.batch_size / config_.message_size);
+  while (!channel.paused && !channel.closed &&
+         channel.pending_count < channel.pending.size()) {
+    // 今までに送っているはずのメッセージの数
+    uint64_t due;
+    if (config_.rate > 0) {
+      due = (uint64_t)((now_us - channel.start_us) * config_.rate / 1000000);
+      if (due <= channel.sent) {
+        break;
+      }
+    } else {
+      due = channel.sent + batch_count;
+    }
+    int count = (int)std::min<uint64_t>(due - channel.sent, batch_count);
+    FillPayload(count);
+    if (!send_(label, payload_)) {
+      RTC_LOG(LS_WARNING) << "Failed to send: label=" << label;
+      break;
+    }
+
+    Pending& pending =
+        channel.pending[(channel.pending_head + channel.pending_count) %
+                        channel.pending.size()];
+    pending.scheduled_us =
+        config_.rate > 0
+            ? channel.start_us +
+                  (int64_t)(channel.sent * 1000000 / config_.rate)
+            : now_us;
+    pending.bytes = (int)payload_.size();
+    pending.count = count;
+    channel.pending_count++;
+    channel.sent += count;
+    channel.buffered_bytes += pending.bytes;
+    if (channel.buffered_bytes >= config_.high_watermark) {
+      channel.paused = true;
+      channel.report.paused++;
+      channel.total.paused++;
+    }
+  }
+}
+
+void MessagePublisher::FillPayload(int count) {
+  payload_.resize(count * config_.message_size);
+  char* p = &payload_[0];
+  for (int i = 0; i < count; i++) {
+    if (!file_data_.empty()) {
+      // ファイルの終わりまで来たら先頭に戻る
+      size_t remaining = config_.message_size;
+      while (remaining > 0) {
+        size_t n = std::min(remaining, file_data_.size() - file_offset_);
+        std::memcpy(p, file_data_.data() + file_offset_, n);
+        p += n;
+        remaining -= n;
+        file_offset_ = (file_offset_ + n) % file_data_.size();
+      }
+    } else {
+      // 先頭に通し番号を入れて、残りは固定の値で埋める
+      size_t header = std::min<size_t>(sizeof(sequence_), config_.message_size);
+      std::memcpy(p, &sequence_, header);
+      std::memset(p + header, 'x', config_.message_size - header);
+      p += config_.message_size;
+      sequence_++;
+    }
+  }
+}
+
+void MessagePublisher::OnStatsDelivered(
+    rtc::scoped_refptr<const webrtc::RTCStatsReport> report) {
+  collecting_ = false;
+  // 待ち時間は、コールバックが呼ばれた時刻ではなく統計を集めた時刻までの時間にする。
+  // WebRTC は 50 ミリ秒の間は前回の結果を返すので、呼ばれた時刻を使うと実際より長くなる。
+  // 統計の時刻は UTC なので、集めてから経った時間を引いて rtc::TimeMicros の時刻にする
+  int64_t collected_us =
+      rtc::TimeMicros() -
+      std::max<int64_t>(0, rtc::TimeUTCMicros() - report->timestamp_us());
+  std::set<std::string> labels;
+  for (const auto* s :
+       report->GetStatsOfType<webrtc::RTCDataChannelStats>()) {
+    if (!s->label.is_defined() || !s->messages_sent.is_defined()) {
+      continue;
+    }
+    auto it = channels_.find(*s->label);
+    if (it == channels_.end() || it->second.closed) {
+      continue;
+    }
+    labels.insert(*s->label);
+    Confirm(it->second, *s->messages_sent, collected_us);
+    if (s->state.is_defined() && *s->state == "closed") {
+      Close(it->first, it->second, "data channel is closed");
+    }
+  }
+  // 送り始めた後に集めた統計にラベルが無い場合は、データチャネルが無くなっているので、
+  // 止めたままにならないように送るのをやめる
+  for (auto& p : channels_) {
+    if (!p.second.closed && labels.count(p.first) == 0 &&
+        collected_us > p.second.start_us) {
+      Close(p.first, p.second, "label is not found in stats");
+    }
+  }
+}
+
+void MessagePublisher::Close(const std::string& label,
+                             Channel& channel,
+                             const char* reason) {
+  RTC_LOG(LS_WARNING) << "Stop publishing: label=" << label
+                      << " reason=" << reason
+                      << " unconfirmed_bytes=" << channel.buffered_bytes;
+  channel.closed = true;
+  channel.paused = false;
+  channel.pending_count = 0;
+  channel.buffered_bytes = 0;
+}
+
+void MessagePublisher::Confirm(Channel& channel,
+                               uint64_t messages_sent,
+                               int64_t now_us) {
+  // messagesSent は SCTP に渡した時に増えるので、その分は送信待ちではなくなっている
+  while (channel.confirmed_data_channel_messages < messages_sent &&
+         channel.pending_count > 0) {
+    const Pending& pending = channel.pending[channel.pending_head];
+    int64_t delay_us = std::max<int64_t>(0, now_us - pending.scheduled_us);
+    channel.report.Add(pending, delay_us);
+    channel.total.Add(pending, delay_us);
+    channel.buffered_bytes -= pending.bytes;
+    channel.pending_head = (channel.pending_head + 1) % channel.pending.size();
+    channel.pending_count--;
+    channel.confirmed_data_channel_messages++;
+  }
+  if (channel.paused && channel.buffered_bytes <= config_.low_watermark) {
+    channel.paused = false;
+  }
+}
+
+void MessagePublisher::PrintResult(const std::string& label,
+                                   const Channel& channel,
+                                   const Result& result,
+                                   double seconds) {
+  if (seconds <= 0) {
+    return;
+  }
+  double delay_avg_ms =
+      result.data_channel_messages == 0
+          ? 0
+          : result.delay_total_us / 1000.0 / result.data_channel_messages;
+  std::stringstream ss;
+  ss << "{\"type\":\"" << (&result == &channel.total ? "total" : "report")
+     << "\",\"label\":\"" << label << "\""
+     << ",\"ordered\":" << OptionalToJson(channel.config.ordered)
+     << ",\"max_retransmits\":"
+     << OptionalToJson(channel.config.max_retransmits)
+     << ",\"max_packet_life_time\":"
+     << OptionalToJson(channel.config.max_packet_life_time)
+     << ",\"compress\":" << OptionalToJson(channel.config.compress)
+     << ",\"seconds\":" << seconds
+     << ",\"messages_per_sec\":" << result.messages / seconds
+     << ",\"mbytes_per_sec\":" << result.bytes / seconds / 1000000
+     << ",\"data_channel_messages_per_sec\":"
+     << result.data_channel_messages / seconds
+     << ",\"queue_delay_ms_avg\":" << delay_avg_ms
+     << ",\"queue_delay_ms_max\":" << result.delay_max_us / 1000.0
+     << ",\"buffered_bytes\":" << channel.buffered_bytes
+     << ",\"paused\":" << result.paused
+     << ",\"closed\":" << (channel.closed ? "true" : "false") << "}\n";
+  std::cout << ss.str() << std::flush;
+}
@@ -0,0 +1,147 @@
+#ifndef MESSAGE_PUBLISHER_H_
+#define MESSAGE_PUBLISHER_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+
+// WebRTC
+#include <api/peer_connection_interface.h>
+#include <api/scoped_refptr.h>
+#include <api/stats/rtc_stats_report.h>
+#include <rtc_base/synchronization/mutex.h>
+
+// Sora
+#include <sora/sora_signaling.h>
+
+struct MessagePublisherConfig {
+  // ラベル毎に 1 秒あたりに送るメッセージの数。0 の場合はバッファが許す限り送る
+  int rate = 100;
+  // 1 つのメッセージの大きさ (バイト)
+  int message_size = 1024;
+  // 小さいメッセージをこの大きさまでまとめて 1 回で送る。0 の場合はまとめない
+  int batch_size = 0;
+  // 指定した場合はファイルの内容を message_size 毎に区切って順番に送る
+  std::string file;
+  // 送信待ちのバイト数がこれを超えたら送るのを止めて、low_watermark を下回ったら再開する
+  int64_t high_watermark = 1024 * 1024;
+  int64_t low_watermark = 256 * 1024;
+  // 結果を出力する間隔 (秒)
+  int report_interval = 1;
+};
+
+// データチャネルのラベル毎に、指定したレートと大きさでメッセージを送る。
+//
+// SoraSignaling はデータチャネルの buffered_amount を公開していないので、
+// 送ったメッセージの数と、GetStats で取得した RTCDataChannelStats の messagesSent の差から
+// SCTP に渡っていない送信待ちのバイト数を求めて、その値で送信を止めたり再開したりする。
+// 送れなかったメッセージは数だけ覚えておいて後で送り、その間の時間は送信側の待ち時間に含める。
+//
+// 全て io_context のスレッドで動かすので、SoraSignaling と同じ io_context を渡すこと。
+class MessagePublisher {
+ public:
+  using SendFunc =
+      std::function<bool(const std::string& label, const std::string& data)>;
+
+  MessagePublisher(boost::asio::io_context& ioc,
+                   MessagePublisherConfig config,
+                   SendFunc send);
+  ~MessagePublisher();
+
+  // ファイルを読み込む。失敗した場合は false を返す
+  bool Init();
+  void SetPeerConnection(
+      rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc);
+  // データチャネルが開いたら呼ぶ。以降このラベルにメッセージを送る
+  void AddChannel(const sora::SoraSignalingConfig::DataChannel& data_channel);
+  void Start();
+  // 送信を止めて、ラベル毎の全体の結果を出力する
+  void Stop();
+
+ private:
+  // SCTP に渡ったかを確認できていない、送ったメッセージ
+  struct Pending {
+    // まとめたメッセージのうち、最初のメッセージを送るはずだった時刻
+    int64_t scheduled_us;
+    int bytes;
+    int count;
+  };
+
+  struct Result {
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    uint64_t data_channel_messages = 0;
+    uint64_t paused = 0;
+    int64_t delay_total_us = 0;
+    int64_t delay_max_us = 0;
+
+    void Add(const Pending& pending, int64_t delay_us);
+  };
+
+  struct Channel {
+    sora::SoraSignalingConfig::DataChannel config;
+    int64_t start_us = 0;
+    // 送ったメッセージの数。まとめて送った場合もまとめる前の数を数える
+    uint64_t sent = 0;
+    // RTCDataChannelStats の messagesSent
+    uint64_t confirmed_data_channel_messages = 0;
+    int64_t buffered_bytes = 0;
+    bool paused = false;
+    // 統計にラベルが無くなったか、データチャネルが閉じた。以降は送らない
+    bool closed = false;
+    // Pending のリングバッファ
+    std::vector<Pending> pending;
+    size_t pending_head = 0;
+    size_t pending_count = 0;
+
+    Result report;
+    Result total;
+  };
+
+  class Callback;
+  struct Shared {
+    webrtc::Mutex mutex;
+    MessagePublisher* publisher = nullptr;
+  };
+
+  void ScheduleSend();
+  void ScheduleStats();
+  void ScheduleReport();
+  void Send(const std::string& label, Channel& channel, int64_t now_us);
+  void FillPayload(int count);
+  void OnStatsDelivered(
+      rtc::scoped_refptr<const webrtc::RTCStatsReport> report);
+  void Confirm(Channel& channel, uint64_t messages_sent, int64_t now_us);
+  void Close(const std::string& label, Channel& channel, const char* reason);
+  void PrintResult(const std::string& label,
+                   const Channel& channel,
+                   const Result& result,
+                   double seconds);
+
+  boost::asio::io_context& ioc_;
+  MessagePublisherConfig config_;
+  SendFunc send_;
+  boost::asio::steady_timer send_timer_;
+  boost::asio::steady_timer stats_timer_;
+  boost::asio::steady_timer report_timer_;
+  std::shared_ptr<Shared> shared_;
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_;
+  bool collecting_ = false;
+  bool running_ = false;
+  int64_t report_us_ = 0;
+
+  std::map<std::string, Channel> channels_;
+  std::string file_data_;
+  size_t file_offset_ = 0;
+  uint64_t sequence_ = 0;
+  // 送るメッセージのバッファ。使い回す
+  std::string payload_;
+};
+
+#endif
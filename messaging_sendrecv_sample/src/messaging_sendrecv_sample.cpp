@@ -0,0 +1,269 @@
+#include <atomic>
+#include <chrono>
+
+// Sora
+#include <sora/sora_client_context.h>
+
+// CLI11
+#include <CLI/CLI.hpp>
+
+#ifdef _WIN32
+#include <rtc_base/win/scoped_com_initializer.h>
+#endif
+
+#include "data_channel_config.h"
+#include "message_publisher.h"
+
+struct MessagingSendRecvSampleConfig {
+  std::string signaling_url;
+  std::string channel_id;
+  std::string role = "sendonly";
+  boost::json::value data_channels;
+  MessagePublisherConfig publisher;
+  // 最初のデータチャネルが開いてから、この時間 (秒) が経ったら切断する。0 の場合は切断しない
+  int duration = 0;
+};
+
+class MessagingSendRecvSample
+    : public std::enable_shared_from_this<MessagingSendRecvSample>,
+      public sora::SoraSignalingObserver {
+ public:
+  MessagingSendRecvSample(std::shared_ptr<sora::SoraClientContext> context,
+                          MessagingSendRecvSampleConfig config)
+      : context_(context),
+        config_(config),
+        received_messages_(0),
+        received_bytes_(0) {}
+
+  void Run() {
+    ioc_.reset(new boost::asio::io_context(1));
+
+    publisher_.reset(new MessagePublisher(
+        *ioc_, config_.publisher,
+        [this](const std::string& label, const std::string& data) {
+          return conn_->SendDataChannel(label, data);
+        }));
+    if (!publisher_->Init()) {
+      return;
+    }
+
+    sora::SoraSignalingConfig config;
+    config.pc_factory = context_->peer_connection_factory();
+    config.io_context = ioc_.get();
+    config.observer = shared_from_this();
+    config.signaling_urls.push_back(config_.signaling_url);
+    config.channel_id = config_.channel_id;
+    config.role = config_.role;
+    // データチャネルのメッセージしか送受信しない
+    config.video = false;
+    config.audio = false;
+    config.data_channels =
+        ParseDataChannels(config_.data_channels, config_.role);
+    data_channels_ = config.data_channels;
+
+    conn_ = sora::SoraSignaling::Create(config);
+
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+        work_guard(ioc_->get_executor());
+
+    boost::asio::signal_set signals(*ioc_, SIGINT, SIGTERM);
+    signals.async_wait(
+        [this](const boost::system::error_code&, int) { Finish(); });
+
+    duration_timer_.reset(new boost::asio::steady_timer(*ioc_));
+
+    publisher_->Start();
+    conn_->Connect();
+    ioc_->run();
+
+    publisher_.reset();
+    if (config_.role == "sendrecv") {
+      std::cout << "{\"type\":\"received\",\"messages\":" << received_messages_
+                << ",\"bytes\":" << received_bytes_ << "}" << std::endl;
+    }
+  }
+
+  void OnSetOffer(std::string offer) override {
+    publisher_->SetPeerConnection(conn_->GetPeerConnection());
+  }
+  void OnDisconnect(sora::SoraSignalingErrorCode ec,
+                    std::string message) override {
+    RTC_LOG(LS_INFO) << "OnDisconnect: " << message;
+    publisher_->Stop();
+    ioc_->stop();
+  }
+  void OnNotify(std::string text) override {}
+  void OnPush(std::string text) override {}
+  void OnMessage(std::string label, std::string data) override {
+    received_messages_++;
+    received_bytes_ += data.size();
+  }
+
+  void OnTrack(rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver)
+      override {}
+  void OnRemoveTrack(
+      rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver) override {}
+
+  void OnDataChannel(std::string label) override {
+    // 送信は全て ioc_ のスレッドで行う
+    boost::asio::post(*ioc_, [self = shared_from_this(), label]() {
+      self->StartPublishing(label);
+    });
+  }
+
+ private:
+  void StartPublishing(const std::string& label) {
+    for (const auto& data_channel : data_channels_) {
+      if (data_channel.label != label || data_channel.direction == "recvonly") {
+        continue;
+      }
+      publisher_->AddChannel(data_channel);
+      if (config_.duration > 0 && !duration_started_) {
+        duration_started_ = true;
+        duration_timer_->expires_after(std::chrono::seconds(config_.duration));
+        duration_timer_->async_wait(
+            [this](const boost::system::error_code& ec) {
+              if (ec) {
+                return;
+              }
+              Finish();
+            });
+      }
+    }
+  }
+
+  // 送信を止めて結果を出力してから切断する
+  void Finish() {
+    publisher_->Stop();
+    conn_->Disconnect();
+  }
+
+  std::shared_ptr<sora::SoraClientContext> context_;
+  MessagingSendRecvSampleConfig config_;
+  std::vector<sora::SoraSignalingConfig::DataChannel> data_channels_;
+  std::shared_ptr<sora::SoraSignaling> conn_;
+  std::unique_ptr<boost::asio::io_context> ioc_;
+  std::unique_ptr<boost::asio::steady_timer> duration_timer_;
+  bool duration_started_ = false;
+  std::unique_ptr<MessagePublisher> publisher_;
+  std::atomic<uint64_t> received_messages_;
+  std::atomic<uint64_t> received_bytes_;
+};
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+  webrtc::ScopedCOMInitializer com_initializer(
+      webrtc::ScopedCOMInitializer::kMTA);
+  if (!com_initializer.Succeeded()) {
+    std::cerr << "CoInitializeEx failed" << std::endl;
+    return 1;
+  }
+#endif
+
+  MessagingSendRecvSampleConfig config;
+
+  auto is_json = CLI::Validator(
+      [](std::string input) -> std::string {
+        boost::json::error_code ec;
+        boost::json::parse(input, ec);
+        if (ec) {
+          return "Value " + input + " is not JSON Value";
+        }
+        return std::string();
+      },
+      "JSON Value");
+
+  CLI::App app("Messaging Sendrecv Sample for Sora C++ SDK");
+
+  int log_level = (int)rtc::LS_ERROR;
+  auto log_level_map = std::vector<std::pair<std::string, int>>(
+      {{"verbose", 0}, {"info", 1}, {"warning", 2}, {"error", 3}, {"none", 4}});
+  app.add_option("--log-level", log_level, "Log severity level threshold")
+      ->transform(CLI::CheckedTransformer(log_level_map, CLI::ignore_case));
+
+  // Sora に関するオプション
+  app.add_option("--signaling-url", config.signaling_url, "Signaling URL")
+      ->required();
+  app.add_option("--channel-id", config.channel_id, "Channel ID")->required();
+  app.add_option("--role", config.role, "Role (default: sendonly)")
+      ->check(CLI::IsMember({"sendonly", "sendrecv"}));
+
+  const std::string default_data_channels = "[{\"label\":\"#sora-bench\"}]";
+  std::string data_channels;
+  app.add_option(
+         "--data-channels", data_channels,
+         "Data channels specification (default: " + default_data_channels + ")")
+      ->check(is_json);
+
+  // 送信に関するオプション
+  app.add_option("--rate", config.publisher.rate,
+                 "Messages per second per label, 0 means unlimited "
+                 "(default: 100)")
+      ->check(CLI::Range(0, 1000000));
+  app.add_option("--message-size", config.publisher.message_size,
+                 "Message size in bytes (default: 1024)")
+      ->check(CLI::Range(1, 262144));
+  app.add_option("--batch-size", config.publisher.batch_size,
+                 "Pack small messages into one send up to this size in bytes "
+                 "(default: 0)")
+      ->check(CLI::Range(0, 262144));
+  app.add_option("--file", config.publisher.file,
+                 "Send the contents of this file instead of synthetic data")
+      ->check(CLI::ExistingFile);
+  app.add_option("--high-watermark", config.publisher.high_watermark,
+                 "Stop sending when buffered bytes exceed this value "
+                 "(default: 1048576)")
+      ->check(CLI::Range((int64_t)1, (int64_t)1024 * 1024 * 1024));
+  app.add_option("--low-watermark", config.publisher.low_watermark,
+                 "Resume sending when buffered bytes fall below this value "
+                 "(default: 262144)")
+      ->check(CLI::Range((int64_t)0, (int64_t)1024 * 1024 * 1024));
+  app.add_option("--duration", config.duration,
+                 "Disconnect after this many seconds (default: 0)")
+      ->check(CLI::Range(0, 86400));
+  app.add_option("--report-interval", config.publisher.report_interval,
+                 "Report interval in seconds (default: 1)")
+      ->check(CLI::Range(1, 3600));
+
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    exit(app.exit(e));
+  }
+
+  if (config.publisher.low_watermark >= config.publisher.high_watermark) {
+    std::cerr << "--low-watermark must be less than --high-watermark"
+              << std::endl;
+    return 1;
+  }
+
+  if (!data_channels.empty()) {
+    config.data_channels = boost::json::parse(data_channels);
+  } else {
+    config.data_channels = boost::json::parse(default_data_channels);
+  }
+
+  if (log_level != rtc::LS_NONE) {
+    rtc::LogMessage::LogToDebug((rtc::LoggingSeverity)log_level);
+    rtc::LogMessage::LogTimestamps();
+    rtc::LogMessage::LogThreads();
+  }
+
+  sora::SoraClientContextConfig context_config;
+  context_config.use_audio_device = false;
+  context_config.use_hardware_encoder = false;
+  // データチャネルしか使わないので、映像のエンコーダ/デコーダを用意しない
+  context_config.configure_media_dependencies =
+      [](const webrtc::PeerConnectionFactoryDependencies& dependencies,
+         cricket::MediaEngineDependencies& media_dependencies) {
+        media_dependencies.video_encoder_factory = nullptr;
+        media_dependencies.video_decoder_factory = nullptr;
+      };
+  auto context = sora::SoraClientContext::Create(context_config);
+
+  auto messaging_sendrecv_sample =
+      std::make_shared<MessagingSendRecvSample>(context, config);
+  messaging_sendrecv_sample->Run();
+
+  return 0;
+}
@@ -0,0 +1,284 @@
+// Sora
+#include <sora/sora_client_context.h>
+
+#include <iostream>
+#include <vector>
+
+// CLI11
+#include <CLI/CLI.hpp>
+
+// WebRTC
+#include <api/make_ref_counted.h>
+#include <api/stats/rtc_stats_collector_callback.h>
+#include <api/stats/rtcstats_objects.h>
+#include <rtc_base/helpers.h>
+
+#include "headless_audio_device.h"
+#include "loopback_connection.h"
+#include "process_usage.h"
+
+#ifdef _WIN32
+#include <rtc_base/win/scoped_com_initializer.h>
+#endif
+
+// Sora に接続せずに、プロセス内で送信側と受信側の PeerConnection を繋いで、
+// 音声ストリーム数毎の CPU 使用率を計測する。
+// サウンドカードを使う場合 (device) と使わない場合 (headless) を比較するために使う
+struct AudioBenchmarkConfig {
+  std::vector<std::string> audio_devices = {"device", "headless"};
+  std::vector<int> stream_counts = {1, 10, 50};
+  int warmup = 5;
+  int duration = 10;
+};
+
+namespace {
+
+template <typename T>
+T ValueOr(const webrtc::RTCStatsMember<T>& member, T default_value) {
+  return member.is_defined() ? *member : default_value;
+}
+
+class StatsCallback : public webrtc::RTCStatsCollectorCallback {
+ public:
+  StatsCallback(
+      std::function<void(rtc::scoped_refptr<const webrtc::RTCStatsReport>)>
+          on_delivered)
+      : on_delivered_(std::move(on_delivered)) {}
+
+  void OnStatsDelivered(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report)
+      override {
+    on_delivered_(report);
+  }
+
+ private:
+  std::function<void(rtc::scoped_refptr<const webrtc::RTCStatsReport>)>
+      on_delivered_;
+};
+
+}  // namespace
+
+class AudioBenchmark {
+ public:
+  AudioBenchmark(std::shared_ptr<sora::SoraClientContext> context,
+                 std::string audio_device,
+                 AudioBenchmarkConfig config)
+      : context_(context), audio_device_(audio_device), config_(config) {}
+
+  // 全てのケースが終わったら true、シグナルで中断した場合は false を返す
+  bool Run() {
+    ioc_.reset(new boost::asio::io_context(1));
+
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+        work_guard(ioc_->get_executor());
+
+    boost::asio::signal_set signals(*ioc_, SIGINT, SIGTERM);
+    signals.async_wait([this](const boost::system::error_code& ec, int) {
+      if (ec) {
+        return;
+      }
+      interrupted_ = true;
+      ioc_->stop();
+    });
+
+    timer_.reset(new boost::asio::steady_timer(*ioc_));
+    boost::asio::post(*ioc_, [this]() { StartCase(); });
+
+    ioc_->run();
+
+    conn_.reset();
+    tracks_.clear();
+    timer_.reset();
+    return !interrupted_;
+  }
+
+ private:
+  struct Snapshot {
+    int64_t timestamp_us = 0;
+    uint64_t total_samples_received = 0;
+    uint64_t concealed_samples = 0;
+  };
+
+  // 以下は全て ioc_ のスレッドから呼ぶ
+
+  void StartCase() {
+    if (case_index_ >= config_.stream_counts.size()) {
+      ioc_->stop();
+      return;
+    }
+    int stream_count = config_.stream_counts[case_index_];
+
+    // 受信した音声は AudioDeviceModule で全てミックスされて再生されるので、
+    // 受信側のトラックには何もしなくて良い
+    auto factory = context_->peer_connection_factory();
+    conn_ = LoopbackConnection::Create(
+        factory, LoopbackConnectionConfig(),
+        [](rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver) {});
+    if (conn_ == nullptr) {
+      ioc_->stop();
+      return;
+    }
+    for (int i = 0; i < stream_count; i++) {
+      auto track = factory->CreateAudioTrack(
+          rtc::CreateRandomString(16),
+          factory->CreateAudioSource(cricket::AudioOptions()).get());
+      conn_->AddTrack(track);
+      tracks_.push_back(track);
+    }
+    conn_->Connect();
+
+    timer_->expires_after(std::chrono::seconds(config_.warmup));
+    timer_->async_wait([this](boost::system::error_code ec) {
+      if (ec) {
+        return;
+      }
+      CollectStats([this](Snapshot snapshot) {
+        start_ = snapshot;
+        meter_.Reset();
+        timer_->expires_after(std::chrono::seconds(config_.duration));
+        timer_->async_wait([this](boost::system::error_code ec) {
+          if (ec) {
+            return;
+          }
+          CollectStats([this](Snapshot snapshot) {
+            Report(snapshot);
+            conn_.reset();
+            tracks_.clear();
+            case_index_++;
+            StartCase();
+          });
+        });
+      });
+    });
+  }
+
+  void CollectStats(std::function<void(Snapshot)> on_collected) {
+    // コールバックはシグナリングスレッドから呼ばれるので、ioc_ に戻す
+    conn_->GetReceiver()->GetStats(
+        rtc::make_ref_counted<StatsCallback>(
+            [this, on_collected](
+                rtc::scoped_refptr<const webrtc::RTCStatsReport> report) {
+              Snapshot snapshot;
+              snapshot.timestamp_us = report->timestamp_us();
+              for (const auto* s : report->GetStatsOfType<
+                                   webrtc::RTCInboundRTPStreamStats>()) {
+                if (ValueOr(s->kind, std::string()) != "audio") {
+                  continue;
+                }
+                snapshot.total_samples_received +=
+                    ValueOr(s->total_samples_received, (uint64_t)0);
+                snapshot.concealed_samples +=
+                    ValueOr(s->concealed_samples, (uint64_t)0);
+              }
+              boost::asio::post(*ioc_, [snapshot, on_collected]() {
+                on_collected(snapshot);
+              });
+            })
+            .get());
+  }
+
+  void Report(const Snapshot& end) {
+    int streams = config_.stream_counts[case_index_];
+    double cpu_percent = meter_.GetCpuPercent();
+    double sec = (end.timestamp_us - start_.timestamp_us) / 1000000.0;
+    uint64_t samples =
+        end.total_samples_received - start_.total_samples_received;
+    uint64_t concealed = end.concealed_samples - start_.concealed_samples;
+
+    std::cout << "{\"audio_device\":\"" << audio_device_ << "\""
+              << ",\"stream_count\":" << streams
+              << ",\"cpu_percent\":" << cpu_percent
+              << ",\"cpu_percent_per_stream\":" << cpu_percent / streams
+              << ",\"received_samples_per_sec_per_stream\":"
+              << (sec > 0 ? samples / sec / streams : 0)
+              << ",\"concealed_ratio\":"
+              << (samples > 0 ? (double)concealed / samples : 0)
+              << ",\"max_rss_kb\":" << GetProcessMaxRssKb() << "}"
+              << std::endl;
+  }
+
+  std::shared_ptr<sora::SoraClientContext> context_;
+  std::string audio_device_;
+  AudioBenchmarkConfig config_;
+  std::unique_ptr<boost::asio::io_context> ioc_;
+  std::unique_ptr<boost::asio::steady_timer> timer_;
+  bool interrupted_ = false;
+
+  // 以下は全て ioc_ のスレッドからしか触らない
+  size_t case_index_ = 0;
+  std::unique_ptr<LoopbackConnection> conn_;
+  std::vector<rtc::scoped_refptr<webrtc::AudioTrackInterface>> tracks_;
+  ProcessCpuMeter meter_;
+  Snapshot start_;
+};
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+  webrtc::ScopedCOMInitializer com_initializer(
+      webrtc::ScopedCOMInitializer::kMTA);
+  if (!com_initializer.Succeeded()) {
+    std::cerr << "CoInitializeEx failed" << std::endl;
+    return 1;
+  }
+#endif
+
+  AudioBenchmarkConfig config;
+
+  CLI::App app("Audio Benchmark for Sora C++ SDK Samples");
+
+  int log_level = (int)rtc::LS_ERROR;
+  auto log_level_map = std::vector<std::pair<std::string, int>>(
+      {{"verbose", 0}, {"info", 1}, {"warning", 2}, {"error", 3}, {"none", 4}});
+  app.add_option("--log-level", log_level, "Log severity level threshold")
+      ->transform(CLI::CheckedTransformer(log_level_map, CLI::ignore_case));
+  app.add_option("--audio-device", config.audio_devices,
+                 "Audio devices to measure (comma separated)")
+      ->delimiter(',')
+      ->check(CLI::IsMember({"device", "headless"}));
+  app.add_option("--stream-count", config.stream_counts,
+                 "Numbers of audio streams sent at the same time (comma "
+                 "separated)")
+      ->delimiter(',')
+      ->check(CLI::Range(1, 500));
+  app.add_option("--warmup", config.warmup, "Warm-up time in seconds")
+      ->check(CLI::Range(0, 60));
+  app.add_option("--duration", config.duration,
+                 "Measurement time in seconds")
+      ->check(CLI::Range(1, 3600));
+
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    exit(app.exit(e));
+  }
+
+  if (log_level != rtc::LS_NONE) {
+    rtc::LogMessage::LogToDebug((rtc::LoggingSeverity)log_level);
+    rtc::LogMessage::LogTimestamps();
+    rtc::LogMessage::LogThreads();
+  }
+
+  // AudioDeviceModule は PeerConnectionFactory 毎に 1 つなので、
+  // 比較する方法毎に SoraClientContext を作り直す
+  for (const auto& audio_device : config.audio_devices) {
+    sora::SoraClientContextConfig context_config;
+    if (audio_device == "headless") {
+      context_config.use_audio_device = false;
+      context_config.configure_media_dependencies =
+          [](const webrtc::PeerConnectionFactoryDependencies& dependencies,
+             cricket::MediaEngineDependencies& media_dependencies) {
+            media_dependencies.adm = CreateHeadlessAudioDeviceModule(
+                dependencies.task_queue_factory.get(),
+                HeadlessAudioDeviceConfig());
+          };
+    }
+    auto context = sora::SoraClientContext::Create(context_config);
+
+    AudioBenchmark benchmark(context, audio_device, config);
+    if (!benchmark.Run()) {
+      break;
+    }
+  }
+
+  return 0;
+}
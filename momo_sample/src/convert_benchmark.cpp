@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// CLI11
+#include <CLI/CLI.hpp>
+
+// WebRTC
+#include <api/video/nv12_buffer.h>
+#include <rtc_base/time_utils.h>
+
+#include "frame_converter.h"
+
+// SDLRenderer が受信した映像を描画用の ARGB に変換する処理の、1 フレームあたりのコストを計測する。
+//
+// 合成した NV12 の映像を以下の方法で変換して比較する。
+//   i420          : 同じ映像を I420 で受け取った場合
+//   nv12_via_i420 : NV12 を ToI420 で I420 に変換してから処理する場合 (従来の処理)
+//   nv12          : NV12 のまま処理する場合
+// nv12 と nv12_via_i420 の変換結果の差も出力するので、NV12 のまま処理しても
+// 同じ映像になっていることを確認できる。
+// --zoom を指定すると、SDLRenderer で拡大した時と同じように中央の範囲だけを変換する。
+struct ConvertBenchmarkConfig {
+  int width = 1280;
+  int height = 720;
+  std::vector<double> scales = {1.0, 0.5};
+  double zoom = 1.0;
+  int frames = 300;
+};
+
+namespace {
+
+// 輝度は横方向のグラデーション、色差は縦方向のグラデーションにする
+rtc::scoped_refptr<webrtc::NV12Buffer> CreateSyntheticNV12(int width,
+                                                           int height) {
+  rtc::scoped_refptr<webrtc::NV12Buffer> buffer =
+      webrtc::NV12Buffer::Create(width, height);
+  for (int y = 0; y < height; y++) {
+    uint8_t* row = buffer->MutableDataY() + y * buffer->StrideY();
+    for (int x = 0; x < width; x++) {
+      row[x] = (uint8_t)(16 + x * 219 / width);
+    }
+  }
+  int chroma_height = (height + 1) / 2;
+  int chroma_width = (width + 1) / 2;
+  for (int y = 0; y < chroma_height; y++) {
+    uint8_t* row = buffer->MutableDataUV() + y * buffer->StrideUV();
+    for (int x = 0; x < chroma_width; x++) {
+      row[x * 2] = (uint8_t)(16 + y * 224 / chroma_height);
+      row[x * 2 + 1] = (uint8_t)(240 - y * 224 / chroma_height);
+    }
+  }
+  return buffer;
+}
+
+struct Result {
+  double ns_per_frame = 0;
+  std::vector<uint8_t> image;
+};
+
+struct CropRect {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+// make_buffer は受信したフレームに相当するバッファをフレーム毎に返す
+template <class F>
+Result Measure(const ConvertBenchmarkConfig& config,
+               const CropRect& crop,
+               int width,
+               int height,
+               F make_buffer) {
+  Result result;
+  result.image.resize(width * height * 4);
+  int64_t total_ns = 0;
+  for (int i = 0; i < config.frames; i++) {
+    int64_t begin = rtc::TimeNanos();
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+        ToNV12OrI420(make_buffer());
+    ConvertToARGB(buffer, crop.x, crop.y, crop.width, crop.height,
+                  webrtc::kVideoRotation_0, width, height,
+                  result.image.data(), width * 4);
+    total_ns += rtc::TimeNanos() - begin;
+  }
+  result.ns_per_frame = (double)total_ns / config.frames;
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ConvertBenchmarkConfig config;
+
+  CLI::App app("Convert Benchmark for Sora C++ SDK Samples");
+
+  app.add_option("--width", config.width, "Width of synthetic video")
+      ->check(CLI::Range(16, 3840));
+  app.add_option("--height", config.height, "Height of synthetic video")
+      ->check(CLI::Range(16, 2160));
+  app.add_option("--scales", config.scales,
+                 "Output size relative to input (comma separated)")
+      ->delimiter(',')
+      ->check(CLI::Range(0.05, 1.0));
+  app.add_option("--zoom", config.zoom,
+                 "Convert only the center 1/zoom of the video")
+      ->check(CLI::Range(1.0, 16.0));
+  app.add_option("--frames", config.frames, "Number of frames per method")
+      ->check(CLI::Range(1, 100000));
+
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    exit(app.exit(e));
+  }
+
+  rtc::scoped_refptr<webrtc::NV12Buffer> nv12 =
+      CreateSyntheticNV12(config.width, config.height);
+  rtc::scoped_refptr<webrtc::I420BufferInterface> i420 = nv12->ToI420();
+
+  CropRect crop = {0, 0, config.width, config.height};
+  if (config.zoom > 1.0) {
+    crop.width = std::max(2, (int)(config.width / config.zoom) & ~1);
+    crop.height = std::max(2, (int)(config.height / config.zoom) & ~1);
+    crop.x = (config.width - crop.width) / 2 & ~1;
+    crop.y = (config.height - crop.height) / 2 & ~1;
+  }
+
+  // 出力の大きさは SDLRenderer と同じく切り出した範囲に対する比率にする
+  for (double scale : config.scales) {
+    int width = std::max(2, (int)(crop.width * scale) & ~1);
+    int height = std::max(2, (int)(crop.height * scale) & ~1);
+
+    Result i420_result = Measure(config, crop, width, height, [&i420]() {
+      return rtc::scoped_refptr<webrtc::VideoFrameBuffer>(i420);
+    });
+    Result via_i420_result =
+        Measure(config, crop, width, height, [&nv12]() {
+          return rtc::scoped_refptr<webrtc::VideoFrameBuffer>(nv12->ToI420());
+        });
+    Result nv12_result = Measure(config, crop, width, height, [&nv12]() {
+      return rtc::scoped_refptr<webrtc::VideoFrameBuffer>(nv12);
+    });
+
+    int max_diff = 0;
+    int64_t sum_diff = 0;
+    for (size_t i = 0; i < nv12_result.image.size(); i++) {
+      int diff = std::abs((int)nv12_result.image[i] -
+                          (int)via_i420_result.image[i]);
+      max_diff = std::max(max_diff, diff);
+      sum_diff += diff;
+    }
+
+    const std::pair<const char*, const Result*> results[] = {
+        {"i420", &i420_result},
+        {"nv12_via_i420", &via_i420_result},
+        {"nv12", &nv12_result},
+    };
+    for (const auto& result : results) {
+      std::cout << "{\"method\":\"" << result.first << "\""
+                << ",\"input\":\"" << config.width << "x" << config.height
+                << "\",\"crop\":\"" << crop.width << "x" << crop.height
+                << "\",\"output\":\"" << width << "x" << height << "\""
+                << ",\"frames\":" << config.frames << ",\"us_per_frame\":"
+                << result.second->ns_per_frame / 1000.0;
+      if (result.second == &nv12_result) {
+        std::cout << ",\"max_diff\":" << max_diff << ",\"mean_diff\":"
+                  << (double)sum_diff / nv12_result.image.size();
+      }
+      std::cout << "}" << std::endl;
+    }
+  }
+
+  return 0;
+}
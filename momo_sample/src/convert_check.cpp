@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// WebRTC
+#include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
+
+#include "frame_converter.h"
+
+// ConvertToARGB の変換結果を、合成した映像から計算した期待値と比較する。
+//
+// 同じ映像の NV12 と I420 を用意して、縮小しない場合、縮小する場合、拡大する場合を、
+// 奇数の幅と高さや、0 以外の切り出し位置を含めて確認する。
+// 期待値との差が許容値を超えた場合は 0 以外で終了する。
+
+// 縮小しない場合の許容値。libyuv の固定小数点の YUV -> RGB 変換の誤差
+#define CONVERT_CHECK_TOLERANCE 4
+// 縮小・拡大する場合の許容値。フィルタの標本位置と端の扱いの違いを含める。
+// 切り出し位置や色差の位置がずれた場合は、これより一桁以上大きい差になる
+#define CONVERT_CHECK_SCALED_TOLERANCE 12
+// 書き込んではいけない行末の余白に入れておく値
+#define CONVERT_CHECK_GUARD 0xa5
+#define CONVERT_CHECK_PADDING 12
+
+namespace {
+
+// 縮小しない場合は、切り出し位置や色差の位置がずれると分かるように、隣の画素と値が大きく変わる模様にする。
+// 縮小する場合は、フィルタの種類によらず期待値を計算できるように、位置に比例する模様にする。
+struct Pattern {
+  bool smooth;
+  int width;
+  int height;
+
+  int ChromaWidth() const { return (width + 1) / 2; }
+  int ChromaHeight() const { return (height + 1) / 2; }
+
+  double Y(double x, double y) const {
+    if (!smooth) {
+      return 16 + ((int)x * 7 + (int)y * 13) % 220;
+    }
+    double slope = std::min(1.0, 200.0 / (width + height));
+    return 26 + slope * (x + y);
+  }
+  double U(double cx, double cy) const {
+    if (!smooth) {
+      return 16 + ((int)cx * 11 + (int)cy * 3) % 225;
+    }
+    return 128 + ChromaSlope() * (cx - ChromaWidth() / 2.0);
+  }
+  double V(double cx, double cy) const {
+    if (!smooth) {
+      return 16 + ((int)cx * 5 + (int)cy * 17) % 225;
+    }
+    return 128 - ChromaSlope() * (cy - ChromaHeight() / 2.0);
+  }
+
+ private:
+  double ChromaSlope() const {
+    return std::min(1.0, 200.0 / std::max(ChromaWidth(), ChromaHeight()));
+  }
+};
+
+uint8_t Round(double v) {
+  return (uint8_t)std::max(0.0, std::min(255.0, std::round(v)));
+}
+
+rtc::scoped_refptr<webrtc::NV12Buffer> CreateNV12(const Pattern& pattern) {
+  rtc::scoped_refptr<webrtc::NV12Buffer> buffer =
+      webrtc::NV12Buffer::Create(pattern.width, pattern.height);
+  for (int y = 0; y < pattern.height; y++) {
+    uint8_t* row = buffer->MutableDataY() + y * buffer->StrideY();
+    for (int x = 0; x < pattern.width; x++) {
+      row[x] = Round(pattern.Y(x, y));
+    }
+  }
+  for (int y = 0; y < pattern.ChromaHeight(); y++) {
+    uint8_t* row = buffer->MutableDataUV() + y * buffer->StrideUV();
+    for (int x = 0; x < pattern.ChromaWidth(); x++) {
+      row[x * 2] = Round(pattern.U(x, y));
+      row[x * 2 + 1] = Round(pattern.V(x, y));
+    }
+  }
+  return buffer;
+}
+
+// NV12 を変換するのではなく、同じ模様から直接作る
+rtc::scoped_refptr<webrtc::I420Buffer> CreateI420(const Pattern& pattern) {
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      webrtc::I420Buffer::Create(pattern.width, pattern.height);
+  for (int y = 0; y < pattern.height; y++) {
+    uint8_t* row = buffer->MutableDataY() + y * buffer->StrideY();
+    for (int x = 0; x < pattern.width; x++) {
+      row[x] = Round(pattern.Y(x, y));
+    }
+  }
+  for (int y = 0; y < pattern.ChromaHeight(); y++) {
+    uint8_t* row_u = buffer->MutableDataU() + y * buffer->StrideU();
+    uint8_t* row_v = buffer->MutableDataV() + y * buffer->StrideV();
+    for (int x = 0; x < pattern.ChromaWidth(); x++) {
+      row_u[x] = Round(pattern.U(x, y));
+      row_v[x] = Round(pattern.V(x, y));
+    }
+  }
+  return buffer;
+}
+
+// BT.601 (limited range) で ARGB (メモリ上は B, G, R, A の順) に変換する
+void ToARGB(double y, double u, double v, uint8_t* argb) {
+  double luma = 1.164 * (y - 16);
+  argb[0] = Round(luma + 2.018 * (u - 128));
+  argb[1] = Round(luma - 0.391 * (u - 128) - 0.813 * (v - 128));
+  argb[2] = Round(luma + 1.596 * (v - 128));
+  argb[3] = 255;
+}
+
+// 出力の pos 番目の画素の中心に対応する、入力の位置。入力の範囲に収める
+double SourcePosition(int pos, int offset, int src_size, int dst_size) {
+  double p = offset + (pos + 0.5) * src_size / dst_size - 0.5;
+  return std::max((double)offset, std::min(p, (double)offset + src_size - 1));
+}
+
+struct Case {
+  int width;
+  int height;
+  int crop_x;
+  int crop_y;
+  int crop_width;
+  int crop_height;
+  int output_width;
+  int output_height;
+};
+
+// 期待値との差の最大値を返す。行末の余白に書き込んでいた場合は 255 を返す
+int Check(const Case& c,
+          const Pattern& pattern,
+          const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer) {
+  int stride = c.output_width * 4 + CONVERT_CHECK_PADDING;
+  std::vector<uint8_t> image(stride * c.output_height, CONVERT_CHECK_GUARD);
+  ConvertToARGB(ToNV12OrI420(buffer), c.crop_x, c.crop_y, c.crop_width,
+                c.crop_height, webrtc::kVideoRotation_0, c.output_width,
+                c.output_height, image.data(), stride);
+
+  bool scaled =
+      c.output_width != c.crop_width || c.output_height != c.crop_height;
+  int chroma_crop_width = (c.crop_width + 1) / 2;
+  int chroma_crop_height = (c.crop_height + 1) / 2;
+  int chroma_output_width = (c.output_width + 1) / 2;
+  int chroma_output_height = (c.output_height + 1) / 2;
+  int max_diff = 0;
+  for (int y = 0; y < c.output_height; y++) {
+    const uint8_t* row = image.data() + y * stride;
+    for (int x = 0; x < c.output_width; x++) {
+      double luma, u, v;
+      if (!scaled) {
+        // 色差は 2x2 の画素で同じ値を使う
+        int src_x = c.crop_x + x;
+        int src_y = c.crop_y + y;
+        luma = Round(pattern.Y(src_x, src_y));
+        u = Round(pattern.U(src_x / 2, src_y / 2));
+        v = Round(pattern.V(src_x / 2, src_y / 2));
+      } else {
+        luma = pattern.Y(
+            SourcePosition(x, c.crop_x, c.crop_width, c.output_width),
+            SourcePosition(y, c.crop_y, c.crop_height, c.output_height));
+        double cx = SourcePosition(x / 2, c.crop_x / 2, chroma_crop_width,
+                                   chroma_output_width);
+        double cy = SourcePosition(y / 2, c.crop_y / 2, chroma_crop_height,
+                                   chroma_output_height);
+        u = pattern.U(cx, cy);
+        v = pattern.V(cx, cy);
+      }
+      uint8_t expected[4];
+      ToARGB(luma, u, v, expected);
+      for (int i = 0; i < 4; i++) {
+        max_diff =
+            std::max(max_diff, std::abs((int)row[x * 4 + i] - expected[i]));
+      }
+    }
+    for (int i = c.output_width * 4; i < stride; i++) {
+      if (row[i] != CONVERT_CHECK_GUARD) {
+        return 255;
+      }
+    }
+  }
+  return max_diff;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const Case cases[] = {
+      // 縮小しない
+      {641, 361, 0, 0, 641, 361, 641, 361},
+      {641, 361, 10, 6, 301, 181, 301, 181},
+      {17, 9, 2, 2, 13, 5, 13, 5},
+      // 縮小する
+      {641, 361, 0, 0, 641, 361, 320, 180},
+      {641, 361, 0, 0, 641, 361, 213, 121},
+      {641, 361, 100, 50, 321, 181, 161, 91},
+      {17, 9, 0, 0, 17, 9, 9, 5},
+      // 拡大する (SDLRenderer で拡大した場合)
+      {641, 361, 200, 100, 81, 45, 243, 135},
+      {1280, 720, 318, 178, 643, 363, 1280, 720},
+  };
+
+  int failures = 0;
+  for (const Case& c : cases) {
+    bool scaled =
+        c.output_width != c.crop_width || c.output_height != c.crop_height;
+    Pattern pattern = {scaled, c.width, c.height};
+    int tolerance =
+        scaled ? CONVERT_CHECK_SCALED_TOLERANCE : CONVERT_CHECK_TOLERANCE;
+    const std::pair<const char*, rtc::scoped_refptr<webrtc::VideoFrameBuffer>>
+        inputs[] = {
+            {"nv12", CreateNV12(pattern)},
+            {"i420", CreateI420(pattern)},
+        };
+    for (const auto& input : inputs) {
+      int max_diff = Check(c, pattern, input.second);
+      bool ok = max_diff <= tolerance;
+      if (!ok) {
+        failures++;
+      }
+      std::cout << "{\"input\":\"" << input.first << "\",\"size\":\""
+                << c.width << "x" << c.height << "\",\"crop\":\"" << c.crop_x
+                << "," << c.crop_y << "," << c.crop_width << "x"
+                << c.crop_height << "\",\"output\":\"" << c.output_width << "x"
+                << c.output_height << "\",\"max_diff\":" << max_diff
+                << ",\"tolerance\":" << tolerance
+                << ",\"ok\":" << (ok ? "true" : "false") << "}" << std::endl;
+    }
+  }
+
+  std::cout << "{\"failures\":" << failures << "}" << std::endl;
+  return failures == 0 ? 0 : 1;
+}
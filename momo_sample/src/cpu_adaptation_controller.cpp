@@ -0,0 +1,275 @@
+#include "cpu_adaptation_controller.h"
+
+#include <algorithm>
+#include <regex>
+#include <thread>
+
+// WebRTC
+#include <api/make_ref_counted.h>
+#include <api/stats/rtc_stats_collector_callback.h>
+#include <api/stats/rtcstats_objects.h>
+#include <rtc_base/logging.h>
+
+namespace {
+
+template <typename T>
+T ValueOr(const webrtc::RTCStatsMember<T>& member, T default_value) {
+  return member.is_defined() ? *member : default_value;
+}
+
+class StatsCallback : public webrtc::RTCStatsCollectorCallback {
+ public:
+  StatsCallback(
+      std::function<void(rtc::scoped_refptr<const webrtc::RTCStatsReport>)>
+          on_delivered)
+      : on_delivered_(std::move(on_delivered)) {}
+
+  void OnStatsDelivered(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report)
+      override {
+    on_delivered_(report);
+  }
+
+ private:
+  std::function<void(rtc::scoped_refptr<const webrtc::RTCStatsReport>)>
+      on_delivered_;
+};
+
+}  // namespace
+
+bool ParseCpuAdaptationLadder(const std::string& text,
+                              std::vector<CpuAdaptationStep>* ladder) {
+  std::regex re("^([1-9][0-9]*)x([1-9][0-9]*)@([1-9][0-9]*)$");
+  std::vector<CpuAdaptationStep> result;
+  size_t begin = 0;
+  while (begin <= text.size()) {
+    size_t end = text.find(',', begin);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::string item = text.substr(begin, end - begin);
+    std::smatch m;
+    if (!std::regex_match(item, m, re)) {
+      return false;
+    }
+    CpuAdaptationStep step;
+    step.width = std::stoi(m[1].str());
+    step.height = std::stoi(m[2].str());
+    step.fps = std::stoi(m[3].str());
+    result.push_back(step);
+    begin = end + 1;
+  }
+  if (result.empty()) {
+    return false;
+  }
+  *ladder = std::move(result);
+  return true;
+}
+
+std::vector<CpuAdaptationStep> CreateDefaultCpuAdaptationLadder(int width,
+                                                                int height,
+                                                                int fps) {
+  int half_fps = std::max(1, fps / 2);
+  return {
+      {width, height, fps},
+      {width * 3 / 4, height * 3 / 4, fps},
+      {width / 2, height / 2, fps},
+      {width / 2, height / 2, half_fps},
+      {width / 4, height / 4, half_fps},
+  };
+}
+
+std::shared_ptr<CpuAdaptationController> CpuAdaptationController::Create(
+    boost::asio::io_context& ioc,
+    CpuAdaptationControllerConfig config,
+    rtc::scoped_refptr<webrtc::VideoTrackInterface> track) {
+  return std::shared_ptr<CpuAdaptationController>(
+      new CpuAdaptationController(ioc, std::move(config), track));
+}
+
+CpuAdaptationController::CpuAdaptationController(
+    boost::asio::io_context& ioc,
+    CpuAdaptationControllerConfig config,
+    rtc::scoped_refptr<webrtc::VideoTrackInterface> track)
+    : ioc_(ioc), config_(std::move(config)), track_(track), timer_(ioc) {}
+
+CpuAdaptationController::~CpuAdaptationController() {
+  timer_.cancel();
+  track_->RemoveSink(&sink_);
+}
+
+void CpuAdaptationController::SetPeerConnection(
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc) {
+  pc_ = pc;
+  step_ = 0;
+  overuse_ = 0;
+  underuse_ = 0;
+  changed_at_ = std::chrono::steady_clock::now();
+  prev_timestamp_us_ = 0;
+  meter_.Reset();
+  ScheduleNext();
+}
+
+void CpuAdaptationController::ScheduleNext() {
+  timer_.expires_after(config_.interval);
+  std::weak_ptr<CpuAdaptationController> wself = shared_from_this();
+  timer_.async_wait([wself](const boost::system::error_code& ec) {
+    auto self = wself.lock();
+    if (ec || self == nullptr) {
+      return;
+    }
+    self->RequestStats();
+  });
+}
+
+void CpuAdaptationController::RequestStats() {
+  if (pc_ == nullptr) {
+    return;
+  }
+  // 統計情報は別スレッドで返ってくるので、ioc_ のスレッドに戻してから処理する
+  std::weak_ptr<CpuAdaptationController> wself = shared_from_this();
+  boost::asio::io_context& ioc = ioc_;
+  pc_->GetStats(rtc::make_ref_counted<StatsCallback>(
+                    [wself, &ioc](rtc::scoped_refptr<
+                                  const webrtc::RTCStatsReport> report) {
+                      boost::asio::post(ioc, [wself, report]() {
+                        if (auto self = wself.lock()) {
+                          self->OnStats(report);
+                        }
+                      });
+                    })
+                    .get());
+}
+
+void CpuAdaptationController::OnStats(
+    rtc::scoped_refptr<const webrtc::RTCStatsReport> report) {
+  // サイマルキャストの場合、エンコードしたフレーム数は最も多い rid に合わせ、
+  // エンコード時間は全ての rid の合計にする
+  uint64_t frames_encoded = 0;
+  double total_encode_time = 0;
+  std::string quality_limitation_reason;
+  for (const auto* s :
+       report->GetStatsOfType<webrtc::RTCOutboundRTPStreamStats>()) {
+    if (ValueOr(s->kind, std::string()) != "video") {
+      continue;
+    }
+    frames_encoded = std::max<uint64_t>(
+        frames_encoded, ValueOr(s->frames_encoded, (uint32_t)0));
+    total_encode_time += ValueOr(s->total_encode_time, 0.0);
+    quality_limitation_reason =
+        ValueOr(s->quality_limitation_reason, std::string());
+  }
+  uint64_t source_frames = 0;
+  for (const auto* s : report->GetStatsOfType<webrtc::RTCVideoSourceStats>()) {
+    source_frames += ValueOr(s->frames, (uint32_t)0);
+  }
+
+  int64_t timestamp_us = report->timestamp_us();
+  double elapsed_sec = (timestamp_us - prev_timestamp_us_) / 1000000.0;
+  bool valid = prev_timestamp_us_ != 0 && elapsed_sec > 0 &&
+               frames_encoded >= prev_frames_encoded_ &&
+               source_frames >= prev_source_frames_;
+
+  Metrics metrics;
+  if (valid) {
+    uint64_t encoded = frames_encoded - prev_frames_encoded_;
+    uint64_t captured = source_frames - prev_source_frames_;
+    metrics.host_cpu_percent =
+        meter_.GetCpuPercent() /
+        std::max(1u, std::thread::hardware_concurrency());
+    metrics.encode_usage_percent =
+        (total_encode_time - prev_total_encode_time_) / elapsed_sec * 100;
+    metrics.drop_ratio =
+        captured > encoded ? (double)(captured - encoded) / captured : 0;
+    metrics.quality_limitation_reason = quality_limitation_reason;
+  }
+  prev_timestamp_us_ = timestamp_us;
+  prev_frames_encoded_ = frames_encoded;
+  prev_total_encode_time_ = total_encode_time;
+  prev_source_frames_ = source_frames;
+  meter_.Reset();
+
+  if (valid) {
+    Evaluate(metrics);
+  }
+  ScheduleNext();
+}
+
+void CpuAdaptationController::Evaluate(const Metrics& metrics) {
+  bool overuse = metrics.host_cpu_percent > config_.high_cpu_percent ||
+                 metrics.encode_usage_percent >
+                     config_.high_encode_usage_percent ||
+                 metrics.drop_ratio > config_.high_drop_ratio ||
+                 metrics.quality_limitation_reason == "cpu";
+  bool underuse = metrics.host_cpu_percent < config_.low_cpu_percent &&
+                  metrics.encode_usage_percent <
+                      config_.low_encode_usage_percent &&
+                  metrics.drop_ratio < config_.low_drop_ratio &&
+                  metrics.quality_limitation_reason != "cpu";
+  overuse_ = overuse ? overuse_ + 1 : 0;
+  underuse_ = underuse ? underuse_ + 1 : 0;
+
+  RTC_LOG(LS_VERBOSE) << "CpuAdaptation: step=" << step_
+                      << " host_cpu_percent=" << metrics.host_cpu_percent
+                      << " encode_usage_percent="
+                      << metrics.encode_usage_percent
+                      << " drop_ratio=" << metrics.drop_ratio
+                      << " quality_limitation_reason="
+                      << metrics.quality_limitation_reason
+                      << " overuse=" << overuse_ << " underuse=" << underuse_;
+
+  if (overuse_ >= config_.overuse_count &&
+      step_ + 1 < (int)config_.ladder.size()) {
+    Apply(step_ + 1, "overuse", metrics);
+    return;
+  }
+  // 下げた直後に上げると上げ下げを繰り返すので、しばらく待つ
+  auto now = std::chrono::steady_clock::now();
+  if (underuse_ >= config_.underuse_count && step_ > 0 &&
+      now - changed_at_ >= config_.hold_time) {
+    Apply(step_ - 1, "underuse", metrics);
+  }
+}
+
+void CpuAdaptationController::Apply(int step,
+                                    const char* reason,
+                                    const Metrics& metrics) {
+  const auto& from = config_.ladder[step_];
+  const auto& to = config_.ladder[step];
+  RTC_LOG(LS_INFO) << "CpuAdaptation: " << reason << " step=" << step_ << "->"
+                   << step << " " << from.width << "x" << from.height << "@"
+                   << from.fps << "->" << to.width << "x" << to.height << "@"
+                   << to.fps << " host_cpu_percent=" << metrics.host_cpu_percent
+                   << " encode_usage_percent=" << metrics.encode_usage_percent
+                   << " drop_ratio=" << metrics.drop_ratio
+                   << " quality_limitation_reason="
+                   << metrics.quality_limitation_reason;
+
+  step_ = step;
+  overuse_ = 0;
+  underuse_ = 0;
+  changed_at_ = std::chrono::steady_clock::now();
+
+  // シンクの要求は全てのシンクの中で最も小さい値が使われるので、
+  // ソースのリサイズとフレーム間引きはこのシンクで制限できる
+  rtc::VideoSinkWants wants;
+  wants.max_pixel_count = to.width * to.height;
+  wants.max_framerate_fps = to.fps;
+  track_->AddOrUpdateSink(&sink_, wants);
+
+  // エンコーダのレート制御にもフレームレートを伝える
+  for (const auto& sender : pc_->GetSenders()) {
+    if (sender->track().get() != track_.get()) {
+      continue;
+    }
+    webrtc::RtpParameters parameters = sender->GetParameters();
+    for (auto& encoding : parameters.encodings) {
+      encoding.max_framerate = to.fps;
+    }
+    webrtc::RTCError error = sender->SetParameters(parameters);
+    if (!error.ok()) {
+      RTC_LOG(LS_WARNING) << "CpuAdaptation: SetParameters failed: "
+                          << error.message();
+    }
+  }
+}
@@ -0,0 +1,121 @@
+#ifndef CPU_ADAPTATION_CONTROLLER_H_
+#define CPU_ADAPTATION_CONTROLLER_H_
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+
+// WebRTC
+#include <api/media_stream_interface.h>
+#include <api/peer_connection_interface.h>
+#include <api/scoped_refptr.h>
+#include <api/stats/rtc_stats_report.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_sink_interface.h>
+
+#include "process_usage.h"
+
+struct CpuAdaptationStep {
+  int width;
+  int height;
+  int fps;
+};
+
+// "1280x720@30,640x360@30,640x360@15" のような文字列をパースする。
+// 先頭が最も高品質な段階になるように並べること。
+bool ParseCpuAdaptationLadder(const std::string& text,
+                              std::vector<CpuAdaptationStep>* ladder);
+// 送信する解像度とフレームレートから、解像度を 3/4, 1/2 に落としてから
+// フレームレートを半分にする段階を作る
+std::vector<CpuAdaptationStep> CreateDefaultCpuAdaptationLadder(int width,
+                                                                int height,
+                                                                int fps);
+
+struct CpuAdaptationControllerConfig {
+  std::vector<CpuAdaptationStep> ladder;
+  // 評価する間隔
+  std::chrono::seconds interval = std::chrono::seconds(2);
+  // ホスト全体に対するプロセスの CPU 使用率 (%)
+  double high_cpu_percent = 85;
+  double low_cpu_percent = 50;
+  // エンコーダのスレッドがエンコードに使っている時間の割合 (%)
+  double high_encode_usage_percent = 85;
+  double low_encode_usage_percent = 50;
+  // キャプチャしたフレームのうち、エンコードされなかったフレームの割合
+  double high_drop_ratio = 0.1;
+  double low_drop_ratio = 0.02;
+  // 過負荷がこの回数続いたら 1 段階下げる
+  int overuse_count = 2;
+  // 余裕がある状態がこの回数続いたら 1 段階上げる
+  int underuse_count = 5;
+  // 下げた後、上げるまでに最低限待つ時間
+  std::chrono::seconds hold_time = std::chrono::seconds(10);
+};
+
+// エンコーダの統計情報とプロセスの CPU 使用率を監視して、
+// 過負荷の場合は送信する解像度とフレームレートを段階的に下げ、余裕ができたら戻す。
+//
+// 解像度とフレームレートはトラックにシンクの要求 (VideoSinkWants) を追加してソース側で落とし、
+// フレームレートは RtpSender のパラメータの max_framerate にも反映する。
+// 判断した内容は、判断の元になった値と一緒にログに出力する。
+//
+// 全てのメソッドは io_context のスレッドから呼ぶこと。
+class CpuAdaptationController
+    : public std::enable_shared_from_this<CpuAdaptationController> {
+ public:
+  static std::shared_ptr<CpuAdaptationController> Create(
+      boost::asio::io_context& ioc,
+      CpuAdaptationControllerConfig config,
+      rtc::scoped_refptr<webrtc::VideoTrackInterface> track);
+  ~CpuAdaptationController();
+
+  void SetPeerConnection(
+      rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc);
+
+ private:
+  // ソースに解像度とフレームレートの上限を伝えるためだけのシンク
+  class WantsSink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+   public:
+    void OnFrame(const webrtc::VideoFrame& frame) override {}
+  };
+
+  struct Metrics {
+    double host_cpu_percent = 0;
+    double encode_usage_percent = 0;
+    double drop_ratio = 0;
+    std::string quality_limitation_reason;
+  };
+
+  CpuAdaptationController(boost::asio::io_context& ioc,
+                          CpuAdaptationControllerConfig config,
+                          rtc::scoped_refptr<webrtc::VideoTrackInterface> track);
+
+  void ScheduleNext();
+  void RequestStats();
+  void OnStats(rtc::scoped_refptr<const webrtc::RTCStatsReport> report);
+  void Evaluate(const Metrics& metrics);
+  void Apply(int step, const char* reason, const Metrics& metrics);
+
+  boost::asio::io_context& ioc_;
+  CpuAdaptationControllerConfig config_;
+  rtc::scoped_refptr<webrtc::VideoTrackInterface> track_;
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_;
+  boost::asio::steady_timer timer_;
+  WantsSink sink_;
+  ProcessCpuMeter meter_;
+
+  int step_ = 0;
+  int overuse_ = 0;
+  int underuse_ = 0;
+  std::chrono::steady_clock::time_point changed_at_;
+  int64_t prev_timestamp_us_ = 0;
+  uint64_t prev_frames_encoded_ = 0;
+  double prev_total_encode_time_ = 0;
+  uint64_t prev_source_frames_ = 0;
+};
+
+#endif
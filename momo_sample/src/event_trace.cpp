@@ -0,0 +1,139 @@
+#include "event_trace.h"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+// WebRTC
+#include <rtc_base/logging.h>
+#include <rtc_base/platform_thread_types.h>
+#include <rtc_base/time_utils.h>
+
+std::atomic<bool> g_event_trace_enabled(false);
+
+namespace {
+
+// スレッド毎に記録できるイベントの数
+constexpr uint64_t kEventsPerThread = 16384;
+// 書き出している間に上書きされている可能性があるので、リングバッファが一周している場合は
+// 最も古いイベントからこの数だけ読み飛ばす
+constexpr uint64_t kOverwriteMargin = 64;
+
+struct Event {
+  std::atomic<const char*> name;
+  std::atomic<int64_t> start_us;
+  std::atomic<int64_t> duration_us;
+};
+
+struct ThreadBuffer {
+  uint64_t thread_id;
+  std::string thread_name;
+  std::unique_ptr<Event[]> events;
+  // 書き込むのは持ち主のスレッドだけ
+  std::atomic<uint64_t> count;
+};
+
+std::mutex g_buffers_mutex;
+// スレッドが終了してもイベントを書き出せるように、バッファは解放しない
+std::vector<ThreadBuffer*>* g_buffers = new std::vector<ThreadBuffer*>();
+
+std::string GetCurrentThreadName() {
+#ifndef _WIN32
+  char name[64] = {};
+  if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0) {
+    return name;
+  }
+#endif
+  return std::string();
+}
+
+ThreadBuffer* GetThreadBuffer() {
+  thread_local ThreadBuffer* buffer = nullptr;
+  if (buffer == nullptr) {
+    buffer = new ThreadBuffer();
+    buffer->thread_id = (uint64_t)rtc::CurrentThreadId();
+    buffer->thread_name = GetCurrentThreadName();
+    buffer->events.reset(new Event[kEventsPerThread]);
+    buffer->count = 0;
+    std::lock_guard<std::mutex> lock(g_buffers_mutex);
+    g_buffers->push_back(buffer);
+  }
+  return buffer;
+}
+
+std::string EscapeJson(const std::string& s) {
+  std::string r;
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      r += '\\';
+      r += c;
+    } else if ((unsigned char)c < 0x20) {
+      r += ' ';
+    } else {
+      r += c;
+    }
+  }
+  return r;
+}
+
+}  // namespace
+
+void StartEventTrace() {
+  g_event_trace_enabled = true;
+}
+
+int64_t GetTraceTimeUs() {
+  return rtc::TimeMicros();
+}
+
+void AddTraceEvent(const char* name, int64_t start_us, int64_t duration_us) {
+  ThreadBuffer* buffer = GetThreadBuffer();
+  uint64_t n = buffer->count.load(std::memory_order_relaxed);
+  Event& event = buffer->events[n % kEventsPerThread];
+  event.name.store(name, std::memory_order_relaxed);
+  event.start_us.store(start_us, std::memory_order_relaxed);
+  event.duration_us.store(duration_us, std::memory_order_relaxed);
+  buffer->count.store(n + 1, std::memory_order_release);
+}
+
+bool WriteEventTrace(const std::string& file) {
+  std::ofstream ofs(file, std::ios::out | std::ios::trunc);
+  if (!ofs) {
+    RTC_LOG(LS_ERROR) << "Failed to open trace file: " << file;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(g_buffers_mutex);
+  ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  for (const ThreadBuffer* buffer : *g_buffers) {
+    if (!first) {
+      ofs << ",";
+    }
+    first = false;
+    ofs << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+        << buffer->thread_id << ",\"args\":{\"name\":\""
+        << EscapeJson(buffer->thread_name) << "\"}}";
+
+    uint64_t count = buffer->count.load(std::memory_order_acquire);
+    uint64_t begin = count > kEventsPerThread
+                         ? count - kEventsPerThread + kOverwriteMargin
+                         : 0;
+    for (uint64_t i = begin; i < count; i++) {
+      const Event& event = buffer->events[i % kEventsPerThread];
+      ofs << ",{\"name\":\"" << event.name.load(std::memory_order_relaxed)
+          << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+          << ",\"ts\":" << event.start_us.load(std::memory_order_relaxed)
+          << ",\"dur\":" << event.duration_us.load(std::memory_order_relaxed)
+          << "}";
+    }
+  }
+  ofs << "]}" << std::endl;
+  RTC_LOG(LS_INFO) << "Wrote trace file: " << file;
+  return true;
+}
@@ -0,0 +1,200 @@
+#include "fake_video_capturer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+// WebRTC
+#include <api/make_ref_counted.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/video_frame.h>
+#include <rtc_base/logging.h>
+#include <rtc_base/time_utils.h>
+
+#include "latency_pattern.h"
+
+rtc::scoped_refptr<FakeVideoCapturer> FakeVideoCapturer::Create(
+    FakeVideoCapturerConfig config) {
+  auto capturer = rtc::make_ref_counted<FakeVideoCapturer>(config);
+  capturer->Start();
+  return capturer;
+}
+
+FakeVideoCapturer::FakeVideoCapturer(FakeVideoCapturerConfig config)
+    : config_(config),
+      buffer_pool_(false, 8),
+      file_buffer_pool_(false, 8),
+      running_(false) {}
+
+FakeVideoCapturer::~FakeVideoCapturer() {
+  Stop();
+}
+
+void FakeVideoCapturer::Start() {
+  if (!config_.y4m_file.empty() && !OpenY4mFile()) {
+    RTC_LOG(LS_ERROR) << "Failed to open Y4M file: " << config_.y4m_file
+                      << ". Use synthetic video instead.";
+  }
+  running_ = true;
+  thread_.reset(new std::thread([this]() { CaptureThread(); }));
+}
+
+void FakeVideoCapturer::Stop() {
+  running_ = false;
+  if (thread_ && thread_->joinable()) {
+    thread_->join();
+  }
+  thread_.reset();
+  if (file_ != nullptr) {
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+void FakeVideoCapturer::CaptureThread() {
+  auto interval = std::chrono::microseconds(1000000 / config_.fps);
+  auto next = std::chrono::steady_clock::now();
+  int64_t frame_count = 0;
+  while (running_) {
+    CaptureFrame(frame_count++);
+    next += interval;
+    auto now = std::chrono::steady_clock::now();
+    if (next < now) {
+      // 処理が間に合わなかった分は取り戻さずに、次のフレームから仕切り直す
+      next = now;
+    }
+    std::this_thread::sleep_until(next);
+  }
+}
+
+void FakeVideoCapturer::CaptureFrame(int64_t frame_count) {
+  int64_t timestamp_us = rtc::TimeMicros();
+
+  int adapted_width, adapted_height, crop_width, crop_height, crop_x, crop_y;
+  if (!AdaptFrame(config_.width, config_.height, timestamp_us, &adapted_width,
+                  &adapted_height, &crop_width, &crop_height, &crop_x,
+                  &crop_y)) {
+    return;
+  }
+
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer;
+  if (file_ != nullptr) {
+    rtc::scoped_refptr<webrtc::I420Buffer> frame = ReadY4mFrame();
+    if (frame == nullptr) {
+      return;
+    }
+    if (frame->width() == adapted_width && frame->height() == adapted_height) {
+      buffer = frame;
+    } else {
+      buffer = buffer_pool_.CreateI420Buffer(adapted_width, adapted_height);
+      if (buffer == nullptr) {
+        return;
+      }
+      buffer->ScaleFrom(*frame);
+    }
+  } else {
+    // スケーリングしなくて済むように、最初から縮小後の解像度で描画する
+    buffer = buffer_pool_.CreateI420Buffer(adapted_width, adapted_height);
+    if (buffer == nullptr) {
+      return;
+    }
+    DrawFrame(buffer.get(), frame_count);
+  }
+
+  if (config_.embed_timestamp) {
+    EncodeLatencyPattern(buffer->MutableDataY(), buffer->StrideY(),
+                         adapted_width, adapted_height, rtc::TimeUTCMillis());
+  }
+
+  OnFrame(webrtc::VideoFrame::Builder()
+              .set_video_frame_buffer(buffer)
+              .set_timestamp_us(timestamp_us)
+              .set_rotation(webrtc::kVideoRotation_0)
+              .build());
+}
+
+void FakeVideoCapturer::DrawFrame(webrtc::I420Buffer* buffer,
+                                  int64_t frame_count) {
+  int width = buffer->width();
+  int height = buffer->height();
+  int bar_width = std::max(1, width / 16);
+  int bar_x = (int)((frame_count * 4) % width);
+  for (int y = 0; y < height; y++) {
+    uint8_t* row = buffer->MutableDataY() + y * buffer->StrideY();
+    std::memset(row, 80, width);
+    std::memset(row + bar_x, 200, std::min(bar_width, width - bar_x));
+  }
+  for (int y = 0; y < buffer->ChromaHeight(); y++) {
+    std::memset(buffer->MutableDataU() + y * buffer->StrideU(), 128,
+                buffer->ChromaWidth());
+    std::memset(buffer->MutableDataV() + y * buffer->StrideV(), 128,
+                buffer->ChromaWidth());
+  }
+}
+
+bool FakeVideoCapturer::OpenY4mFile() {
+  file_ = std::fopen(config_.y4m_file.c_str(), "rb");
+  if (file_ == nullptr) {
+    return false;
+  }
+  // 例: YUV4MPEG2 W640 H480 F30:1 Ip A1:1 C420jpeg
+  char header[256];
+  if (std::fgets(header, sizeof(header), file_) == nullptr ||
+      std::strncmp(header, "YUV4MPEG2 ", 10) != 0) {
+    std::fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+  bool is_420 = true;
+  for (char* p = std::strtok(header + 10, " \n"); p != nullptr;
+       p = std::strtok(nullptr, " \n")) {
+    if (p[0] == 'W') {
+      file_width_ = std::atoi(p + 1);
+    } else if (p[0] == 'H') {
+      file_height_ = std::atoi(p + 1);
+    } else if (p[0] == 'C') {
+      is_420 = std::strncmp(p + 1, "420", 3) == 0;
+    }
+  }
+  if (file_width_ <= 0 || file_height_ <= 0 || !is_420) {
+    RTC_LOG(LS_ERROR) << "Unsupported Y4M file: " << config_.y4m_file;
+    std::fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+  file_data_offset_ = std::ftell(file_);
+  return true;
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer> FakeVideoCapturer::ReadY4mFrame() {
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      file_buffer_pool_.CreateI420Buffer(file_width_, file_height_);
+  if (buffer == nullptr) {
+    return nullptr;
+  }
+  // ファイルの最後まで読んだら先頭に戻る
+  for (int retry = 0; retry < 2; retry++) {
+    char frame_header[256];
+    if (std::fgets(frame_header, sizeof(frame_header), file_) != nullptr &&
+        std::strncmp(frame_header, "FRAME", 5) == 0) {
+      bool ok = true;
+      auto read_plane = [&](uint8_t* data, int stride, int width, int height) {
+        for (int y = 0; y < height && ok; y++) {
+          ok = std::fread(data + y * stride, 1, width, file_) == (size_t)width;
+        }
+      };
+      read_plane(buffer->MutableDataY(), buffer->StrideY(), file_width_,
+                 file_height_);
+      read_plane(buffer->MutableDataU(), buffer->StrideU(),
+                 buffer->ChromaWidth(), buffer->ChromaHeight());
+      read_plane(buffer->MutableDataV(), buffer->StrideV(),
+                 buffer->ChromaWidth(), buffer->ChromaHeight());
+      if (ok) {
+        return buffer;
+      }
+    }
+    std::fseek(file_, file_data_offset_, SEEK_SET);
+  }
+  return nullptr;
+}
@@ -0,0 +1,66 @@
+#ifndef FAKE_VIDEO_CAPTURER_H_
+#define FAKE_VIDEO_CAPTURER_H_
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+// WebRTC
+#include <api/scoped_refptr.h>
+#include <api/video/i420_buffer.h>
+#include <common_video/include/video_frame_buffer_pool.h>
+#include <media/base/adapted_video_track_source.h>
+
+struct FakeVideoCapturerConfig {
+  int width = 640;
+  int height = 480;
+  int fps = 30;
+  // 輝度プレーンにキャプチャ時刻を埋め込む (遅延計測用)
+  bool embed_timestamp = false;
+  // 指定した場合は Y4M ファイル (4:2:0 のみ) を繰り返し読み込んで送信する。
+  // ファイルの解像度が width, height と異なる場合は拡大縮小する。
+  std::string y4m_file;
+};
+
+// カメラを使わずに映像を生成するキャプチャラ。
+// 背景に動く縦縞を描画して、エンコーダが静止画として扱わないようにしている。
+// Y4M ファイルを指定した場合は、ファイルの映像を使う。
+class FakeVideoCapturer : public rtc::AdaptedVideoTrackSource {
+ public:
+  static rtc::scoped_refptr<FakeVideoCapturer> Create(
+      FakeVideoCapturerConfig config);
+
+  FakeVideoCapturer(FakeVideoCapturerConfig config);
+  ~FakeVideoCapturer() override;
+
+  bool is_screencast() const override { return false; }
+  absl::optional<bool> needs_denoising() const override { return false; }
+  webrtc::MediaSourceInterface::SourceState state() const override {
+    return webrtc::MediaSourceInterface::kLive;
+  }
+  bool remote() const override { return false; }
+
+ private:
+  void Start();
+  void Stop();
+  void CaptureThread();
+  void CaptureFrame(int64_t frame_count);
+  void DrawFrame(webrtc::I420Buffer* buffer, int64_t frame_count);
+  bool OpenY4mFile();
+  rtc::scoped_refptr<webrtc::I420Buffer> ReadY4mFrame();
+
+  FakeVideoCapturerConfig config_;
+  webrtc::VideoFrameBufferPool buffer_pool_;
+  // 以下は Y4M ファイルを使う場合だけ使う
+  webrtc::VideoFrameBufferPool file_buffer_pool_;
+  FILE* file_ = nullptr;
+  long file_data_offset_ = 0;
+  int file_width_ = 0;
+  int file_height_ = 0;
+  std::atomic<bool> running_;
+  std::unique_ptr<std::thread> thread_;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "frame_converter.h"
+
+// WebRTC
+#include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
+#include <libyuv/convert_argb.h>
+#include <libyuv/convert_from.h>
+#include <libyuv/video_common.h>
+
+namespace {
+
+bool IsNV12(const webrtc::VideoFrameBuffer& buffer) {
+  return buffer.type() == webrtc::VideoFrameBuffer::Type::kNV12;
+}
+
+void ConvertI420ToARGB(const webrtc::I420BufferInterface& buffer,
+                       int crop_x,
+                       int crop_y,
+                       int crop_width,
+                       int crop_height,
+                       uint8_t* dst,
+                       int dst_stride) {
+  int chroma_offset_u = crop_y / 2 * buffer.StrideU() + crop_x / 2;
+  int chroma_offset_v = crop_y / 2 * buffer.StrideV() + crop_x / 2;
+  libyuv::ConvertFromI420(
+      buffer.DataY() + crop_y * buffer.StrideY() + crop_x, buffer.StrideY(),
+      buffer.DataU() + chroma_offset_u, buffer.StrideU(),
+      buffer.DataV() + chroma_offset_v, buffer.StrideV(), dst, dst_stride,
+      crop_width, crop_height, libyuv::FOURCC_ARGB);
+}
+
+void ConvertNV12ToARGB(const webrtc::NV12BufferInterface& buffer,
+                       int crop_x,
+                       int crop_y,
+                       int crop_width,
+                       int crop_height,
+                       uint8_t* dst,
+                       int dst_stride) {
+  libyuv::NV12ToARGB(
+      buffer.DataY() + crop_y * buffer.StrideY() + crop_x, buffer.StrideY(),
+      buffer.DataUV() + crop_y / 2 * buffer.StrideUV() + crop_x / 2 * 2,
+      buffer.StrideUV(), dst, dst_stride, crop_width, crop_height);
+}
+
+}  // namespace
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> ToNV12OrI420(
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer) {
+  if (IsNV12(*buffer)) {
+    return buffer;
+  }
+  return buffer->ToI420();
+}
+
+const uint8_t* GetDataY(const webrtc::VideoFrameBuffer& buffer) {
+  return IsNV12(buffer) ? buffer.GetNV12()->DataY()
+                        : buffer.GetI420()->DataY();
+}
+
+int GetStrideY(const webrtc::VideoFrameBuffer& buffer) {
+  return IsNV12(buffer) ? buffer.GetNV12()->StrideY()
+                        : buffer.GetI420()->StrideY();
+}
+
+void ConvertToARGB(const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer,
+                   int crop_x,
+                   int crop_y,
+                   int crop_width,
+                   int crop_height,
+                   webrtc::VideoRotation rotation,
+                   int width,
+                   int height,
+                   uint8_t* dst,
+                   int dst_stride) {
+  bool scaled = width != crop_width || height != crop_height;
+
+  // 回転は NV12 のままではできないので、回転が必要な場合だけ I420 で処理する
+  if (IsNV12(*buffer) && (!scaled || rotation == webrtc::kVideoRotation_0)) {
+    const webrtc::NV12BufferInterface* nv12 = buffer->GetNV12();
+    if (!scaled) {
+      ConvertNV12ToARGB(*nv12, crop_x, crop_y, crop_width, crop_height, dst,
+                        dst_stride);
+      return;
+    }
+    rtc::scoped_refptr<webrtc::NV12Buffer> scaled_buffer =
+        webrtc::NV12Buffer::Create(width, height);
+    scaled_buffer->CropAndScaleFrom(*nv12, crop_x, crop_y, crop_width,
+                                    crop_height);
+    ConvertNV12ToARGB(*scaled_buffer, 0, 0, width, height, dst, dst_stride);
+    return;
+  }
+
+  rtc::scoped_refptr<webrtc::I420BufferInterface> i420 = buffer->ToI420();
+  if (!scaled) {
+    ConvertI420ToARGB(*i420, crop_x, crop_y, crop_width, crop_height, dst,
+                      dst_stride);
+    return;
+  }
+  rtc::scoped_refptr<webrtc::I420Buffer> scaled_buffer =
+      webrtc::I420Buffer::Create(width, height);
+  scaled_buffer->CropAndScaleFrom(*i420, crop_x, crop_y, crop_width,
+                                  crop_height);
+  if (rotation != webrtc::kVideoRotation_0) {
+    scaled_buffer = webrtc::I420Buffer::Rotate(*scaled_buffer, rotation);
+  }
+  ConvertI420ToARGB(*scaled_buffer, 0, 0, scaled_buffer->width(),
+                    scaled_buffer->height(), dst, dst_stride);
+}
@@ -0,0 +1,41 @@
+#ifndef FRAME_CONVERTER_H_
+#define FRAME_CONVERTER_H_
+
+#include <cstdint>
+
+// WebRTC
+#include <api/scoped_refptr.h>
+#include <api/video/video_frame_buffer.h>
+#include <api/video/video_rotation.h>
+
+// 受信した映像を描画用の ARGB に変換する。
+//
+// ハードウェアデコーダや MJPEG のデコード結果は NV12 の場合が多いので、NV12 は I420 に
+// 変換せずに NV12 のまま縮小して ARGB に変換する。
+// それ以外の種類 (ネイティブバッファなど) は ToI420 で I420 に変換してから処理する。
+
+// NV12 はそのまま返して、それ以外は ToI420 で I420 に変換して返す
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> ToNV12OrI420(
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer);
+
+// ToNV12OrI420 で変換した映像の輝度プレーン
+const uint8_t* GetDataY(const webrtc::VideoFrameBuffer& buffer);
+int GetStrideY(const webrtc::VideoFrameBuffer& buffer);
+
+// ToNV12OrI420 で変換した映像の (crop_x, crop_y, crop_width, crop_height) の範囲を
+// width x height に縮小して、1 行が dst_stride バイトの ARGB で dst に書き込む。
+// 切り出しは縮小の前にプレーンのポインタをずらして行うので、範囲外の画素は処理しない。
+// crop_x と crop_y は色差プレーンに合わせて偶数にすること。
+// 縮小する場合は rotation も適用する (その場合 width と height が入れ替わる)。
+void ConvertToARGB(const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer,
+                   int crop_x,
+                   int crop_y,
+                   int crop_width,
+                   int crop_height,
+                   webrtc::VideoRotation rotation,
+                   int width,
+                   int height,
+                   uint8_t* dst,
+                   int dst_stride);
+
+#endif
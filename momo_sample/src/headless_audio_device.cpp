@@ -0,0 +1,73 @@
+#include "headless_audio_device.h"
+
+#include <cmath>
+#include <memory>
+
+// WebRTC
+#include <api/array_view.h>
+#include <modules/audio_device/include/test_audio_device.h>
+#include <rtc_base/buffer.h>
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+
+// 正弦波を生成するキャプチャラ
+class ToneCapturer : public webrtc::TestAudioDeviceModule::Capturer {
+ public:
+  ToneCapturer(int sampling_frequency, int tone_frequency)
+      : sampling_frequency_(sampling_frequency),
+        phase_step_(2 * kPi * tone_frequency / sampling_frequency) {}
+
+  int SamplingFrequency() const override { return sampling_frequency_; }
+  int NumChannels() const override { return 1; }
+
+  bool Capture(rtc::BufferT<int16_t>* buffer) override {
+    buffer->SetData(
+        webrtc::TestAudioDeviceModule::SamplesPerFrame(sampling_frequency_),
+        [this](rtc::ArrayView<int16_t> data) {
+          for (auto& sample : data) {
+            // 振幅は最大値の 1/4 にしておく
+            sample = (int16_t)(std::sin(phase_) * 8192);
+            phase_ += phase_step_;
+            if (phase_ >= 2 * kPi) {
+              phase_ -= 2 * kPi;
+            }
+          }
+          return data.size();
+        });
+    return true;
+  }
+
+ private:
+  int sampling_frequency_;
+  double phase_step_;
+  double phase_ = 0;
+};
+
+}  // namespace
+
+rtc::scoped_refptr<webrtc::AudioDeviceModule> CreateHeadlessAudioDeviceModule(
+    webrtc::TaskQueueFactory* task_queue_factory,
+    const HeadlessAudioDeviceConfig& config) {
+  std::unique_ptr<webrtc::TestAudioDeviceModule::Capturer> capturer;
+  if (config.input_file.empty()) {
+    capturer.reset(
+        new ToneCapturer(config.sampling_frequency, config.tone_frequency));
+  } else {
+    capturer = webrtc::TestAudioDeviceModule::CreateWavFileReader(
+        config.input_file, true);
+  }
+
+  std::unique_ptr<webrtc::TestAudioDeviceModule::Renderer> renderer;
+  if (config.output_file.empty()) {
+    renderer = webrtc::TestAudioDeviceModule::CreateDiscardRenderer(
+        config.sampling_frequency);
+  } else {
+    renderer = webrtc::TestAudioDeviceModule::CreateWavFileWriter(
+        config.output_file, config.sampling_frequency);
+  }
+
+  return webrtc::TestAudioDeviceModule::Create(
+      task_queue_factory, std::move(capturer), std::move(renderer));
+}
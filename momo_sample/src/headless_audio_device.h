@@ -0,0 +1,29 @@
+#ifndef HEADLESS_AUDIO_DEVICE_H_
+#define HEADLESS_AUDIO_DEVICE_H_
+
+#include <string>
+
+// WebRTC
+#include <api/scoped_refptr.h>
+#include <api/task_queue/task_queue_factory.h>
+#include <modules/audio_device/include/audio_device.h>
+
+struct HeadlessAudioDeviceConfig {
+  // 送信する音声の WAV ファイル。繰り返し読み込む。
+  // 空の場合は tone_frequency の正弦波を生成する
+  std::string input_file;
+  int tone_frequency = 440;
+  // 受信した音声を書き出す WAV ファイル。空の場合は捨てる
+  std::string output_file;
+  int sampling_frequency = 48000;
+};
+
+// サウンドカードを使わない AudioDeviceModule を作る。
+//
+// 録音と再生は 10ms 毎のタイマー (task_queue_factory で作ったタスクキュー) で行うので、
+// 実際のデバイスを使う場合のようなリアルタイムスレッドは作られない。
+rtc::scoped_refptr<webrtc::AudioDeviceModule> CreateHeadlessAudioDeviceModule(
+    webrtc::TaskQueueFactory* task_queue_factory,
+    const HeadlessAudioDeviceConfig& config);
+
+#endif
@@ -0,0 +1,187 @@
+#include "latency_pattern.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr int kTimestampBits = 48;
+constexpr int kChecksumBits = 8;
+constexpr int kTimestampCell = 2;
+constexpr int kChecksumCell = kTimestampCell + kTimestampBits;
+constexpr uint8_t kWhite = 235;
+constexpr uint8_t kBlack = 16;
+
+uint8_t Checksum(uint64_t value) {
+  uint8_t sum = 0;
+  for (int i = 0; i < kTimestampBits / 8; i++) {
+    sum += (uint8_t)(value >> (i * 8));
+  }
+  return sum ^ 0x5a;
+}
+
+bool GetCellSize(int width, int height, int* cell_width, int* cell_height) {
+  *cell_width = width / kLatencyPatternCells;
+  *cell_height = std::min(*cell_width, height / 8);
+  // 圧縮のノイズに耐えられるように、最低でも 4x4 の大きさは必要
+  return *cell_width >= 4 && *cell_height >= 4;
+}
+
+}  // namespace
+
+void EncodeLatencyPattern(uint8_t* y,
+                          int stride,
+                          int width,
+                          int height,
+                          int64_t timestamp_ms) {
+  int cell_width, cell_height;
+  if (!GetCellSize(width, height, &cell_width, &cell_height)) {
+    return;
+  }
+
+  uint64_t value = (uint64_t)timestamp_ms & ((1ULL << kTimestampBits) - 1);
+  uint8_t checksum = Checksum(value);
+  uint8_t cells[kLatencyPatternCells];
+  cells[0] = kWhite;
+  cells[1] = kBlack;
+  for (int i = 0; i < kTimestampBits; i++) {
+    cells[kTimestampCell + i] = (value >> i) & 1 ? kWhite : kBlack;
+  }
+  for (int i = 0; i < kChecksumBits; i++) {
+    cells[kChecksumCell + i] = (checksum >> i) & 1 ? kWhite : kBlack;
+  }
+  cells[58] = kBlack;
+  cells[59] = kWhite;
+
+  for (int row = 0; row < cell_height; row++) {
+    uint8_t* p = y + row * stride;
+    for (int i = 0; i < kLatencyPatternCells; i++) {
+      std::memset(p + i * cell_width, cells[i], cell_width);
+    }
+  }
+}
+
+bool DecodeLatencyPattern(const uint8_t* y,
+                          int stride,
+                          int width,
+                          int height,
+                          int64_t* timestamp_ms) {
+  int cell_width, cell_height;
+  if (!GetCellSize(width, height, &cell_width, &cell_height)) {
+    return false;
+  }
+
+  // セルの境界は圧縮で崩れやすいので、中央の半分の範囲の平均を取る
+  auto sample = [&](int cell) {
+    int x0 = cell * cell_width + cell_width / 4;
+    int y0 = cell_height / 4;
+    int w = cell_width / 2;
+    int h = cell_height / 2;
+    int sum = 0;
+    for (int row = 0; row < h; row++) {
+      const uint8_t* p = y + (y0 + row) * stride + x0;
+      for (int col = 0; col < w; col++) {
+        sum += p[col];
+      }
+    }
+    return sum / (w * h) >= 128;
+  };
+
+  if (!sample(0) || sample(1) || sample(58) || !sample(59)) {
+    return false;
+  }
+  uint64_t value = 0;
+  for (int i = 0; i < kTimestampBits; i++) {
+    if (sample(kTimestampCell + i)) {
+      value |= 1ULL << i;
+    }
+  }
+  uint8_t checksum = 0;
+  for (int i = 0; i < kChecksumBits; i++) {
+    if (sample(kChecksumCell + i)) {
+      checksum |= 1 << i;
+    }
+  }
+  if (checksum != Checksum(value)) {
+    return false;
+  }
+  *timestamp_ms = (int64_t)value;
+  return true;
+}
+
+LatencyHistogram::LatencyHistogram() : count_(0), sum_(0), max_(0) {
+  for (auto& bucket : buckets_) {
+    bucket = 0;
+  }
+}
+
+void LatencyHistogram::Add(int64_t latency_ms) {
+  // 送受信でマシンが異なる場合、時計のずれで負の値になることがある
+  latency_ms = std::max<int64_t>(latency_ms, 0);
+  int index = std::min<int64_t>(latency_ms / kBucketWidthMs, kBucketCount - 1);
+  buckets_[index].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(latency_ms, std::memory_order_relaxed);
+  int64_t max = max_.load(std::memory_order_relaxed);
+  while (latency_ms > max &&
+         !max_.compare_exchange_weak(max, latency_ms,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+uint32_t LatencyHistogram::GetCount() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::GetPercentileMs(double percentile) const {
+  uint32_t count = GetCount();
+  if (count == 0) {
+    return 0;
+  }
+  return GetPercentile(count, percentile);
+}
+
+int64_t LatencyHistogram::GetPercentile(uint32_t count,
+                                        double percentile) const {
+  uint64_t threshold = (uint64_t)(count * percentile);
+  uint64_t total = 0;
+  for (int i = 0; i < kBucketCount; i++) {
+    total += buckets_[i].load(std::memory_order_relaxed);
+    if (total > threshold) {
+      return (int64_t)(i + 1) * kBucketWidthMs;
+    }
+  }
+  return (int64_t)kBucketCount * kBucketWidthMs;
+}
+
+std::string LatencyHistogram::ToJson(const std::string& name) const {
+  uint32_t count = GetCount();
+  std::string json = "{\"name\":\"" + name + "\"";
+  json += ",\"count\":" + std::to_string(count);
+  if (count > 0) {
+    json += ",\"mean_ms\":" +
+            std::to_string(sum_.load(std::memory_order_relaxed) / count);
+    json += ",\"p50_ms\":" + std::to_string(GetPercentile(count, 0.50));
+    json += ",\"p90_ms\":" + std::to_string(GetPercentile(count, 0.90));
+    json += ",\"p99_ms\":" + std::to_string(GetPercentile(count, 0.99));
+    json += ",\"max_ms\":" +
+            std::to_string(max_.load(std::memory_order_relaxed));
+  }
+  json += ",\"bucket_width_ms\":" + std::to_string(kBucketWidthMs);
+  json += ",\"buckets\":[";
+  bool first = true;
+  for (int i = 0; i < kBucketCount; i++) {
+    uint32_t n = buckets_[i].load(std::memory_order_relaxed);
+    if (n == 0) {
+      continue;
+    }
+    if (!first) {
+      json += ",";
+    }
+    json += "[" + std::to_string(i * kBucketWidthMs) + "," +
+            std::to_string(n) + "]";
+    first = false;
+  }
+  json += "]}";
+  return json;
+}
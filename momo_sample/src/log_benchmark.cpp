@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// CLI11
+#include <CLI/CLI.hpp>
+
+// WebRTC
+#include <rtc_base/logging.h>
+#include <rtc_base/time_utils.h>
+
+#include "async_log_sink.h"
+
+// 複数のスレッドから RTC_LOG を呼んで、1 メッセージあたりのログ出力のコストを計測する。
+// 標準エラー出力に同期で書き込む場合 (debug) と、AsyncLogSink を使う場合 (async) を比較する
+struct LogBenchmarkConfig {
+  std::vector<std::string> modes = {"debug", "async"};
+  int threads = 4;
+  int messages = 100000;
+  int message_size = 100;
+  std::string log_file = "log_benchmark.log";
+  size_t queue_size = 8192;
+};
+
+namespace {
+
+struct Result {
+  int64_t total_ns = 0;
+  int64_t max_ns = 0;
+};
+
+Result RunThreads(const LogBenchmarkConfig& config) {
+  std::string payload(config.message_size, 'x');
+  std::vector<Result> results(config.threads);
+  std::vector<std::thread> threads;
+  std::atomic<bool> start(false);
+  for (int i = 0; i < config.threads; i++) {
+    threads.push_back(std::thread([&config, &payload, &results, &start, i]() {
+      while (!start) {
+        std::this_thread::yield();
+      }
+      Result& result = results[i];
+      for (int n = 0; n < config.messages; n++) {
+        int64_t begin = rtc::TimeNanos();
+        RTC_LOG(LS_INFO) << "thread=" << i << " n=" << n << " " << payload;
+        int64_t elapsed = rtc::TimeNanos() - begin;
+        result.total_ns += elapsed;
+        result.max_ns = std::max(result.max_ns, elapsed);
+      }
+    }));
+  }
+  start = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  Result total;
+  for (const auto& result : results) {
+    total.total_ns += result.total_ns;
+    total.max_ns = std::max(total.max_ns, result.max_ns);
+  }
+  return total;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  LogBenchmarkConfig config;
+
+  CLI::App app("Log Benchmark for Sora C++ SDK Samples");
+
+  app.add_option("--mode", config.modes,
+                 "Log outputs to measure (comma separated)")
+      ->delimiter(',')
+      ->check(CLI::IsMember({"debug", "async"}));
+  app.add_option("--threads", config.threads, "Number of logging threads")
+      ->check(CLI::Range(1, 64));
+  app.add_option("--messages", config.messages,
+                 "Number of messages per thread")
+      ->check(CLI::Range(1, 100000000));
+  app.add_option("--message-size", config.message_size,
+                 "Payload size of each message in bytes")
+      ->check(CLI::Range(0, 65536));
+  app.add_option("--log-file", config.log_file,
+                 "Log file used in async mode");
+  app.add_option("--queue-size", config.queue_size,
+                 "Number of messages buffered in async mode");
+
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    exit(app.exit(e));
+  }
+
+  rtc::LogMessage::LogTimestamps();
+  rtc::LogMessage::LogThreads();
+
+  for (const auto& mode : config.modes) {
+    std::unique_ptr<AsyncLogSink> sink;
+    if (mode == "debug") {
+      rtc::LogMessage::LogToDebug(rtc::LS_INFO);
+    } else {
+      AsyncLogSinkConfig sink_config;
+      sink_config.file = config.log_file;
+      sink_config.queue_size = config.queue_size;
+      sink = AsyncLogSink::Create(sink_config);
+      if (sink == nullptr) {
+        std::cerr << "Failed to open " << config.log_file << std::endl;
+        return 1;
+      }
+      rtc::LogMessage::LogToDebug(rtc::LS_NONE);
+      rtc::LogMessage::AddLogToStream(sink.get(), rtc::LS_INFO);
+    }
+
+    int64_t begin = rtc::TimeNanos();
+    Result result = RunThreads(config);
+    int64_t log_ns = rtc::TimeNanos() - begin;
+    // 非同期の場合は、ファイルに書き終わるまでの時間も計測する
+    if (sink != nullptr) {
+      sink->Flush();
+    }
+    int64_t drain_ns = rtc::TimeNanos() - begin;
+
+    rtc::LogMessage::LogToDebug(rtc::LS_NONE);
+    if (sink != nullptr) {
+      rtc::LogMessage::RemoveLogToStream(sink.get());
+    }
+
+    int64_t messages = (int64_t)config.threads * config.messages;
+    std::cout << "{\"mode\":\"" << mode << "\""
+              << ",\"threads\":" << config.threads
+              << ",\"messages\":" << messages
+              << ",\"message_size\":" << config.message_size
+              << ",\"ns_per_message\":" << (double)result.total_ns / messages
+              << ",\"max_ns_per_message\":" << result.max_ns
+              << ",\"log_ms\":" << log_ns / 1000000.0
+              << ",\"drain_ms\":" << drain_ns / 1000000.0;
+    if (sink != nullptr) {
+      std::cout << ",\"written\":" << sink->GetWrittenMessages()
+                << ",\"dropped\":" << sink->GetDroppedMessages();
+    }
+    std::cout << "}" << std::endl;
+  }
+
+  return 0;
+}
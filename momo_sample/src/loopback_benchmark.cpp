@@ -0,0 +1,462 @@
+// Sora
+#include <sora/sora_client_context.h>
+
+#include <iostream>
+#include <vector>
+
+// CLI11
+#include <CLI/CLI.hpp>
+
+// WebRTC
+#include <api/stats/rtc_stats_collector_callback.h>
+#include <api/stats/rtcstats_objects.h>
+#include <rtc_base/time_utils.h>
+
+#include "fake_video_capturer.h"
+#include "latency_pattern.h"
+#include "loopback_connection.h"
+#include "process_usage.h"
+#include "sdl_renderer.h"
+
+#ifdef _WIN32
+#include <rtc_base/win/scoped_com_initializer.h>
+#endif
+
+// Sora に接続せずに、プロセス内で送信側と受信側の PeerConnection を繋いで、
+// コーデックと解像度の組み合わせ毎にエンコード → ネットワーク → デコード → 描画の性能を計測する
+struct LoopbackBenchmarkConfig {
+  std::vector<std::string> video_codec_types = {"VP8", "VP9", "AV1", "H264"};
+  std::vector<std::string> resolutions = {"QVGA", "VGA", "HD", "FHD", "4K"};
+  int stream_count = 1;
+  int fps = 30;
+  // 0 の場合は解像度毎のデフォルト値を使う
+  int video_bit_rate = 0;
+  bool use_sdl = false;
+  int window_width = 1280;
+  int window_height = 720;
+  int warmup = 5;
+  int duration = 10;
+};
+
+namespace {
+
+struct Resolution {
+  const char* name;
+  int width;
+  int height;
+  // デフォルトのビットレート (kbps)
+  int bit_rate;
+};
+
+const Resolution kResolutions[] = {
+    {"QVGA", 320, 240, 300},     {"VGA", 640, 480, 1000},
+    {"HD", 1280, 720, 2500},     {"FHD", 1920, 1080, 5000},
+    {"4K", 3840, 2160, 15000},
+};
+
+const Resolution* FindResolution(const std::string& name) {
+  for (const auto& r : kResolutions) {
+    if (name == r.name) {
+      return &r;
+    }
+  }
+  return nullptr;
+}
+
+template <typename T>
+T ValueOr(const webrtc::RTCStatsMember<T>& member, T default_value) {
+  return member.is_defined() ? *member : default_value;
+}
+
+class StatsCallback : public webrtc::RTCStatsCollectorCallback {
+ public:
+  StatsCallback(
+      std::function<void(rtc::scoped_refptr<const webrtc::RTCStatsReport>)>
+          on_delivered)
+      : on_delivered_(std::move(on_delivered)) {}
+
+  void OnStatsDelivered(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report)
+      override {
+    on_delivered_(report);
+  }
+
+ private:
+  std::function<void(rtc::scoped_refptr<const webrtc::RTCStatsReport>)>
+      on_delivered_;
+};
+
+// 受信した映像を描画せずに、埋め込まれたキャプチャ時刻から遅延だけを計測するシンク
+class LatencySink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  LatencySink(LatencyHistogram* histogram) : histogram_(histogram) {}
+
+  void OnFrame(const webrtc::VideoFrame& frame) override {
+    int64_t now_ms = rtc::TimeUTCMillis();
+    rtc::scoped_refptr<webrtc::I420BufferInterface> buffer =
+        frame.video_frame_buffer()->ToI420();
+    if (buffer == nullptr) {
+      return;
+    }
+    int64_t timestamp_ms;
+    if (DecodeLatencyPattern(buffer->DataY(), buffer->StrideY(),
+                             buffer->width(), buffer->height(),
+                             &timestamp_ms)) {
+      histogram_->Add(now_ms - timestamp_ms);
+    }
+  }
+
+ private:
+  LatencyHistogram* histogram_;
+};
+
+}  // namespace
+
+class LoopbackBenchmark {
+ public:
+  LoopbackBenchmark(std::shared_ptr<sora::SoraClientContext> context,
+                    LoopbackBenchmarkConfig config)
+      : context_(context), config_(config) {}
+
+  void Run() {
+    ioc_.reset(new boost::asio::io_context(1));
+
+    for (const auto& codec : config_.video_codec_types) {
+      for (const auto& resolution : config_.resolutions) {
+        cases_.push_back({codec, FindResolution(resolution)});
+      }
+    }
+
+    if (config_.use_sdl) {
+      renderer_.reset(new SDLRenderer(config_.window_width,
+                                      config_.window_height, false));
+      renderer_->SetDispatchFunction([this](std::function<void()> f) {
+        if (ioc_->stopped())
+          return;
+        boost::asio::dispatch(ioc_->get_executor(), f);
+      });
+    }
+
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+        work_guard(ioc_->get_executor());
+
+    boost::asio::signal_set signals(*ioc_, SIGINT, SIGTERM);
+    signals.async_wait(
+        [this](const boost::system::error_code&, int) { ioc_->stop(); });
+
+    timer_.reset(new boost::asio::steady_timer(*ioc_));
+    boost::asio::post(*ioc_, [this]() { StartCase(); });
+
+    ioc_->run();
+
+    StopCase();
+    timer_.reset();
+    renderer_.reset();
+  }
+
+ private:
+  struct Case {
+    std::string video_codec_type;
+    const Resolution* resolution;
+  };
+
+  struct Snapshot {
+    int64_t sender_timestamp_us = 0;
+    int64_t receiver_timestamp_us = 0;
+    uint64_t frames_encoded = 0;
+    double total_encode_time = 0;
+    uint64_t frames_decoded = 0;
+    double total_decode_time = 0;
+    int sent_width = 0;
+    int sent_height = 0;
+    int received_width = 0;
+    int received_height = 0;
+    std::string encoder_implementation;
+    std::string decoder_implementation;
+  };
+
+  // 以下は全て ioc_ のスレッドから呼ぶ
+
+  void StartCase() {
+    if (case_index_ >= cases_.size()) {
+      ioc_->stop();
+      return;
+    }
+    const Case& c = cases_[case_index_];
+
+    histogram_.reset(new LatencyHistogram());
+    sink_.reset(new LatencySink(histogram_.get()));
+
+    LoopbackConnectionConfig conn_config;
+    conn_config.video_codec_type = c.video_codec_type;
+    conn_config.video_bit_rate = config_.video_bit_rate > 0
+                                     ? config_.video_bit_rate
+                                     : c.resolution->bit_rate;
+    conn_config.maintain_resolution = true;
+    size_t index = case_index_;
+    conn_ = LoopbackConnection::Create(
+        context_->peer_connection_factory(), conn_config,
+        [this, index](
+            rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver) {
+          auto track = transceiver->receiver()->track();
+          if (track->kind() != webrtc::MediaStreamTrackInterface::kVideoKind) {
+            return;
+          }
+          rtc::scoped_refptr<webrtc::VideoTrackInterface> video_track(
+              static_cast<webrtc::VideoTrackInterface*>(track.get()));
+          boost::asio::post(*ioc_, [this, index, video_track]() {
+            // 前のケースの PeerConnection から遅れて届いた場合は無視する
+            if (index != case_index_ || sink_ == nullptr) {
+              return;
+            }
+            video_track->AddOrUpdateSink(sink_.get(), rtc::VideoSinkWants());
+            if (renderer_ != nullptr) {
+              renderer_->AddTrack(video_track.get());
+            }
+            received_tracks_.push_back(video_track);
+          });
+        });
+    if (conn_ == nullptr) {
+      ioc_->stop();
+      return;
+    }
+
+    for (int i = 0; i < config_.stream_count; i++) {
+      FakeVideoCapturerConfig fake_config;
+      fake_config.width = c.resolution->width;
+      fake_config.height = c.resolution->height;
+      fake_config.fps = config_.fps;
+      fake_config.embed_timestamp = true;
+      auto video_source = FakeVideoCapturer::Create(fake_config);
+      auto track = context_->peer_connection_factory()->CreateVideoTrack(
+          rtc::CreateRandomString(16), video_source.get());
+      conn_->AddTrack(track);
+      tracks_.push_back(track);
+    }
+    conn_->Connect();
+
+    // 接続して帯域やエンコーダが安定するまで待ってから計測する
+    timer_->expires_after(std::chrono::seconds(config_.warmup));
+    timer_->async_wait([this](boost::system::error_code ec) {
+      if (ec) {
+        return;
+      }
+      CollectStats([this](Snapshot snapshot) {
+        start_ = snapshot;
+        meter_.Reset();
+        timer_->expires_after(std::chrono::seconds(config_.duration));
+        timer_->async_wait([this](boost::system::error_code ec) {
+          if (ec) {
+            return;
+          }
+          CollectStats([this](Snapshot snapshot) {
+            Report(snapshot);
+            StopCase();
+            case_index_++;
+            StartCase();
+          });
+        });
+      });
+    });
+  }
+
+  void StopCase() {
+    for (auto track : received_tracks_) {
+      track->RemoveSink(sink_.get());
+      if (renderer_ != nullptr) {
+        renderer_->RemoveTrack(track.get());
+      }
+    }
+    received_tracks_.clear();
+    conn_.reset();
+    tracks_.clear();
+    sink_.reset();
+  }
+
+  void CollectStats(std::function<void(Snapshot)> on_collected) {
+    auto snapshot = std::make_shared<Snapshot>();
+    auto sender = conn_->GetSender();
+    auto receiver = conn_->GetReceiver();
+    // コールバックはシグナリングスレッドから呼ばれるので、集計が終わったら ioc_ に戻す
+    auto on_receiver_stats = rtc::make_ref_counted<StatsCallback>(
+        [this, snapshot, on_collected](
+            rtc::scoped_refptr<const webrtc::RTCStatsReport> report) {
+          AddReceiverStats(*report, *snapshot);
+          boost::asio::post(*ioc_, [snapshot, on_collected]() {
+            on_collected(*snapshot);
+          });
+        });
+    auto on_sender_stats = rtc::make_ref_counted<StatsCallback>(
+        [snapshot, receiver, on_receiver_stats](
+            rtc::scoped_refptr<const webrtc::RTCStatsReport> report) {
+          AddSenderStats(*report, *snapshot);
+          receiver->GetStats(on_receiver_stats.get());
+        });
+    sender->GetStats(on_sender_stats.get());
+  }
+
+  static void AddSenderStats(const webrtc::RTCStatsReport& report,
+                             Snapshot& snapshot) {
+    snapshot.sender_timestamp_us = report.timestamp_us();
+    for (const auto* s :
+         report.GetStatsOfType<webrtc::RTCOutboundRTPStreamStats>()) {
+      if (ValueOr(s->kind, std::string()) != "video") {
+        continue;
+      }
+      snapshot.frames_encoded += ValueOr(s->frames_encoded, (uint32_t)0);
+      snapshot.total_encode_time += ValueOr(s->total_encode_time, 0.0);
+      snapshot.sent_width = ValueOr(s->frame_width, (uint32_t)0);
+      snapshot.sent_height = ValueOr(s->frame_height, (uint32_t)0);
+      snapshot.encoder_implementation =
+          ValueOr(s->encoder_implementation, std::string());
+    }
+  }
+
+  static void AddReceiverStats(const webrtc::RTCStatsReport& report,
+                               Snapshot& snapshot) {
+    snapshot.receiver_timestamp_us = report.timestamp_us();
+    for (const auto* s :
+         report.GetStatsOfType<webrtc::RTCInboundRTPStreamStats>()) {
+      if (ValueOr(s->kind, std::string()) != "video") {
+        continue;
+      }
+      snapshot.frames_decoded += ValueOr(s->frames_decoded, (uint32_t)0);
+      snapshot.total_decode_time += ValueOr(s->total_decode_time, 0.0);
+      snapshot.received_width = ValueOr(s->frame_width, (uint32_t)0);
+      snapshot.received_height = ValueOr(s->frame_height, (uint32_t)0);
+      snapshot.decoder_implementation =
+          ValueOr(s->decoder_implementation, std::string());
+    }
+  }
+
+  void Report(const Snapshot& end) {
+    const Case& c = cases_[case_index_];
+    double cpu_percent = meter_.GetCpuPercent();
+    double send_sec =
+        (end.sender_timestamp_us - start_.sender_timestamp_us) / 1000000.0;
+    double recv_sec =
+        (end.receiver_timestamp_us - start_.receiver_timestamp_us) / 1000000.0;
+    uint64_t frames_encoded = end.frames_encoded - start_.frames_encoded;
+    uint64_t frames_decoded = end.frames_decoded - start_.frames_decoded;
+    double encode_time = end.total_encode_time - start_.total_encode_time;
+    double decode_time = end.total_decode_time - start_.total_decode_time;
+    int streams = config_.stream_count;
+
+    std::cout << "{\"video_codec_type\":\"" << c.video_codec_type << "\""
+              << ",\"resolution\":\"" << c.resolution->name << "\""
+              << ",\"stream_count\":" << streams
+              << ",\"fps\":" << config_.fps << ",\"video_bit_rate\":"
+              << (config_.video_bit_rate > 0 ? config_.video_bit_rate
+                                             : c.resolution->bit_rate)
+              << ",\"encoder_implementation\":\"" << end.encoder_implementation
+              << "\",\"decoder_implementation\":\""
+              << end.decoder_implementation << "\""
+              << ",\"sent_size\":\"" << end.sent_width << "x"
+              << end.sent_height << "\""
+              << ",\"received_size\":\"" << end.received_width << "x"
+              << end.received_height << "\""
+              << ",\"encode_fps_per_stream\":"
+              << (send_sec > 0 ? frames_encoded / send_sec / streams : 0)
+              << ",\"decode_fps_per_stream\":"
+              << (recv_sec > 0 ? frames_decoded / recv_sec / streams : 0)
+              << ",\"encode_ms_per_frame\":"
+              << (frames_encoded > 0 ? encode_time * 1000 / frames_encoded : 0)
+              << ",\"decode_ms_per_frame\":"
+              << (frames_decoded > 0 ? decode_time * 1000 / frames_decoded : 0)
+              << ",\"cpu_percent\":" << cpu_percent
+              << ",\"cpu_percent_per_stream\":" << cpu_percent / streams
+              << ",\"max_rss_kb\":" << GetProcessMaxRssKb()
+              << ",\"latency\":" << histogram_->ToJson("capture_to_receive")
+              << "}" << std::endl;
+  }
+
+  std::shared_ptr<sora::SoraClientContext> context_;
+  LoopbackBenchmarkConfig config_;
+  std::unique_ptr<boost::asio::io_context> ioc_;
+  std::unique_ptr<boost::asio::steady_timer> timer_;
+  std::unique_ptr<SDLRenderer> renderer_;
+
+  // 以下は全て ioc_ のスレッドからしか触らない
+  std::vector<Case> cases_;
+  size_t case_index_ = 0;
+  std::unique_ptr<LoopbackConnection> conn_;
+  std::vector<rtc::scoped_refptr<webrtc::VideoTrackInterface>> tracks_;
+  std::vector<rtc::scoped_refptr<webrtc::VideoTrackInterface>>
+      received_tracks_;
+  std::unique_ptr<LatencyHistogram> histogram_;
+  std::unique_ptr<LatencySink> sink_;
+  ProcessCpuMeter meter_;
+  Snapshot start_;
+};
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+  webrtc::ScopedCOMInitializer com_initializer(
+      webrtc::ScopedCOMInitializer::kMTA);
+  if (!com_initializer.Succeeded()) {
+    std::cerr << "CoInitializeEx failed" << std::endl;
+    return 1;
+  }
+#endif
+
+  LoopbackBenchmarkConfig config;
+
+  CLI::App app("Loopback Benchmark for Sora C++ SDK Samples");
+
+  int log_level = (int)rtc::LS_ERROR;
+  auto log_level_map = std::vector<std::pair<std::string, int>>(
+      {{"verbose", 0}, {"info", 1}, {"warning", 2}, {"error", 3}, {"none", 4}});
+  app.add_option("--log-level", log_level, "Log severity level threshold")
+      ->transform(CLI::CheckedTransformer(log_level_map, CLI::ignore_case));
+  bool hardware_encoder = false;
+  app.add_option("--hardware-encoder", hardware_encoder,
+                 "Enable HW Encorder (default: false)");
+  app.add_option("--video-codec-type", config.video_codec_types,
+                 "Video codecs to measure (comma separated)")
+      ->delimiter(',')
+      ->check(CLI::IsMember({"VP8", "VP9", "AV1", "H264"}));
+  app.add_option("--resolution", config.resolutions,
+                 "Video resolutions to measure (comma separated)")
+      ->delimiter(',')
+      ->check(CLI::IsMember({"QVGA", "VGA", "HD", "FHD", "4K"}));
+  app.add_option("--stream-count", config.stream_count,
+                 "Number of video streams sent at the same time")
+      ->check(CLI::Range(1, 100));
+  app.add_option("--fps", config.fps, "Video frame rate")
+      ->check(CLI::Range(1, 60));
+  app.add_option("--video-bit-rate", config.video_bit_rate,
+                 "Video bit rate per stream in kbps (0: depends on resolution)")
+      ->check(CLI::Range(0, 30000));
+  app.add_flag("--use-sdl", config.use_sdl,
+               "Show received video using SDL (default: null sink)");
+  app.add_option("--window-width", config.window_width, "SDL window width");
+  app.add_option("--window-height", config.window_height,
+                 "SDL window height");
+  app.add_option("--warmup", config.warmup, "Warm-up time in seconds")
+      ->check(CLI::Range(0, 60));
+  app.add_option("--duration", config.duration,
+                 "Measurement time in seconds")
+      ->check(CLI::Range(1, 3600));
+
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    exit(app.exit(e));
+  }
+
+  if (log_level != rtc::LS_NONE) {
+    rtc::LogMessage::LogToDebug((rtc::LoggingSeverity)log_level);
+    rtc::LogMessage::LogTimestamps();
+    rtc::LogMessage::LogThreads();
+  }
+
+  sora::SoraClientContextConfig context_config;
+  context_config.use_audio_device = false;
+  context_config.use_hardware_encoder = hardware_encoder;
+  auto context = sora::SoraClientContext::Create(context_config);
+
+  LoopbackBenchmark benchmark(context, config);
+  benchmark.Run();
+
+  return 0;
+}
@@ -0,0 +1,284 @@
+#include "loopback_connection.h"
+
+// WebRTC
+#include <api/jsep.h>
+#include <api/make_ref_counted.h>
+#include <api/set_local_description_observer_interface.h>
+#include <api/set_remote_description_observer_interface.h>
+#include <api/transport/bitrate_settings.h>
+#include <rtc_base/helpers.h>
+#include <rtc_base/logging.h>
+
+namespace {
+
+class CreateDescriptionObserver
+    : public webrtc::CreateSessionDescriptionObserver {
+ public:
+  CreateDescriptionObserver(
+      std::function<void(std::unique_ptr<webrtc::SessionDescriptionInterface>)>
+          on_success)
+      : on_success_(std::move(on_success)) {}
+
+  void OnSuccess(webrtc::SessionDescriptionInterface* desc) override {
+    on_success_(std::unique_ptr<webrtc::SessionDescriptionInterface>(desc));
+  }
+  void OnFailure(webrtc::RTCError error) override {
+    RTC_LOG(LS_ERROR) << "Failed to create session description: "
+                      << error.message();
+  }
+
+ private:
+  std::function<void(std::unique_ptr<webrtc::SessionDescriptionInterface>)>
+      on_success_;
+};
+
+class SetLocalDescriptionObserver
+    : public webrtc::SetLocalDescriptionObserverInterface {
+ public:
+  void OnSetLocalDescriptionComplete(webrtc::RTCError error) override {
+    if (!error.ok()) {
+      RTC_LOG(LS_ERROR) << "Failed to set local description: "
+                        << error.message();
+    }
+  }
+};
+
+class SetRemoteDescriptionObserver
+    : public webrtc::SetRemoteDescriptionObserverInterface {
+ public:
+  SetRemoteDescriptionObserver(std::function<void()> on_success)
+      : on_success_(std::move(on_success)) {}
+
+  void OnSetRemoteDescriptionComplete(webrtc::RTCError error) override {
+    if (!error.ok()) {
+      RTC_LOG(LS_ERROR) << "Failed to set remote description: "
+                        << error.message();
+      return;
+    }
+    if (on_success_) {
+      on_success_();
+    }
+  }
+
+ private:
+  std::function<void()> on_success_;
+};
+
+}  // namespace
+
+class LoopbackConnection::Observer : public webrtc::PeerConnectionObserver {
+ public:
+  Observer(std::function<void()> on_gathering_complete, OnTrackFunc on_track)
+      : on_gathering_complete_(std::move(on_gathering_complete)),
+        on_track_(std::move(on_track)) {}
+
+  void OnSignalingChange(
+      webrtc::PeerConnectionInterface::SignalingState new_state) override {}
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override {}
+  void OnIceGatheringChange(
+      webrtc::PeerConnectionInterface::IceGatheringState new_state) override {
+    if (new_state ==
+        webrtc::PeerConnectionInterface::IceGatheringState::
+            kIceGatheringComplete) {
+      on_gathering_complete_();
+    }
+  }
+  void OnIceCandidate(const webrtc::IceCandidateInterface* candidate) override {
+  }
+  void OnTrack(
+      rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver) override {
+    if (on_track_) {
+      on_track_(transceiver);
+    }
+  }
+
+ private:
+  std::function<void()> on_gathering_complete_;
+  OnTrackFunc on_track_;
+};
+
+std::unique_ptr<LoopbackConnection> LoopbackConnection::Create(
+    rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory,
+    LoopbackConnectionConfig config,
+    OnTrackFunc on_track) {
+  std::unique_ptr<LoopbackConnection> conn(
+      new LoopbackConnection(factory, config));
+  LoopbackConnection* p = conn.get();
+  conn->sender_observer_.reset(
+      new Observer([p]() { p->OnSenderGatheringComplete(); }, nullptr));
+  conn->receiver_observer_.reset(new Observer(
+      [p]() { p->OnReceiverGatheringComplete(); }, std::move(on_track)));
+
+  webrtc::PeerConnectionInterface::RTCConfiguration rtc_config;
+  rtc_config.sdp_semantics = webrtc::SdpSemantics::kUnifiedPlan;
+
+  auto sender = factory->CreatePeerConnectionOrError(
+      rtc_config,
+      webrtc::PeerConnectionDependencies(conn->sender_observer_.get()));
+  if (!sender.ok()) {
+    RTC_LOG(LS_ERROR) << "Failed to create sender PeerConnection: "
+                      << sender.error().message();
+    return nullptr;
+  }
+  conn->sender_ = sender.MoveValue();
+
+  auto receiver = factory->CreatePeerConnectionOrError(
+      rtc_config,
+      webrtc::PeerConnectionDependencies(conn->receiver_observer_.get()));
+  if (!receiver.ok()) {
+    RTC_LOG(LS_ERROR) << "Failed to create receiver PeerConnection: "
+                      << receiver.error().message();
+    return nullptr;
+  }
+  conn->receiver_ = receiver.MoveValue();
+
+  return conn;
+}
+
+LoopbackConnection::LoopbackConnection(
+    rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory,
+    LoopbackConnectionConfig config)
+    : factory_(factory),
+      config_(config),
+      stream_id_(rtc::CreateRandomString(16)) {}
+
+LoopbackConnection::~LoopbackConnection() {
+  // Observer より先に PeerConnection を閉じる
+  if (sender_ != nullptr) {
+    sender_->Close();
+  }
+  if (receiver_ != nullptr) {
+    receiver_->Close();
+  }
+  sender_ = nullptr;
+  receiver_ = nullptr;
+}
+
+bool LoopbackConnection::AddTrack(
+    rtc::scoped_refptr<webrtc::MediaStreamTrackInterface> track) {
+  auto result = sender_->AddTrack(track, {stream_id_});
+  if (!result.ok()) {
+    RTC_LOG(LS_ERROR) << "Failed to add track: " << result.error().message();
+    return false;
+  }
+  if (track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
+    for (auto transceiver : sender_->GetTransceivers()) {
+      if (transceiver->sender() == result.value()) {
+        SetCodecPreferences(transceiver);
+      }
+    }
+    SetSenderParameters(result.value());
+    video_track_count_++;
+  }
+  return true;
+}
+
+void LoopbackConnection::Connect() {
+  if (config_.video_bit_rate > 0 && video_track_count_ > 0) {
+    // 帯域推定が上がりきるのを待たずに、最初から指定したビットレートで送る
+    webrtc::BitrateSettings settings;
+    settings.start_bitrate_bps =
+        config_.video_bit_rate * 1000 * video_track_count_;
+    sender_->SetBitrate(settings);
+  }
+
+  auto pc = sender_;
+  sender_->CreateOffer(
+      rtc::make_ref_counted<CreateDescriptionObserver>(
+          [pc](std::unique_ptr<webrtc::SessionDescriptionInterface> desc) {
+            pc->SetLocalDescription(
+                std::move(desc),
+                rtc::make_ref_counted<SetLocalDescriptionObserver>());
+          })
+          .get(),
+      webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
+}
+
+rtc::scoped_refptr<webrtc::PeerConnectionInterface>
+LoopbackConnection::GetSender() const {
+  return sender_;
+}
+
+rtc::scoped_refptr<webrtc::PeerConnectionInterface>
+LoopbackConnection::GetReceiver() const {
+  return receiver_;
+}
+
+void LoopbackConnection::SetCodecPreferences(
+    rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver) {
+  if (config_.video_codec_type.empty()) {
+    return;
+  }
+  auto capabilities =
+      factory_->GetRtpSenderCapabilities(cricket::MEDIA_TYPE_VIDEO);
+  std::vector<webrtc::RtpCodecCapability> codecs;
+  for (const auto& codec : capabilities.codecs) {
+    if (codec.name == config_.video_codec_type) {
+      codecs.push_back(codec);
+    }
+  }
+  if (codecs.empty()) {
+    RTC_LOG(LS_WARNING) << "Codec not supported: " << config_.video_codec_type;
+    return;
+  }
+  auto error = transceiver->SetCodecPreferences(codecs);
+  if (!error.ok()) {
+    RTC_LOG(LS_WARNING) << "Failed to set codec preferences: "
+                        << error.message();
+  }
+}
+
+void LoopbackConnection::SetSenderParameters(
+    rtc::scoped_refptr<webrtc::RtpSenderInterface> sender) {
+  if (config_.video_bit_rate <= 0 && !config_.maintain_resolution) {
+    return;
+  }
+  webrtc::RtpParameters parameters = sender->GetParameters();
+  if (config_.video_bit_rate > 0) {
+    for (auto& encoding : parameters.encodings) {
+      encoding.min_bitrate_bps = config_.video_bit_rate * 1000;
+      encoding.max_bitrate_bps = config_.video_bit_rate * 1000;
+    }
+  }
+  if (config_.maintain_resolution) {
+    parameters.degradation_preference =
+        webrtc::DegradationPreference::MAINTAIN_RESOLUTION;
+  }
+  auto error = sender->SetParameters(parameters);
+  if (!error.ok()) {
+    RTC_LOG(LS_WARNING) << "Failed to set sender parameters: "
+                        << error.message();
+  }
+}
+
+void LoopbackConnection::OnSenderGatheringComplete() {
+  std::string sdp;
+  sender_->local_description()->ToString(&sdp);
+  auto offer = webrtc::CreateSessionDescription(webrtc::SdpType::kOffer, sdp);
+  auto pc = receiver_;
+  receiver_->SetRemoteDescription(
+      std::move(offer),
+      rtc::make_ref_counted<SetRemoteDescriptionObserver>([pc]() {
+        pc->CreateAnswer(
+            rtc::make_ref_counted<CreateDescriptionObserver>(
+                [pc](std::unique_ptr<webrtc::SessionDescriptionInterface>
+                         desc) {
+                  pc->SetLocalDescription(
+                      std::move(desc),
+                      rtc::make_ref_counted<SetLocalDescriptionObserver>());
+                })
+                .get(),
+            webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
+      }));
+}
+
+void LoopbackConnection::OnReceiverGatheringComplete() {
+  std::string sdp;
+  receiver_->local_description()->ToString(&sdp);
+  auto answer =
+      webrtc::CreateSessionDescription(webrtc::SdpType::kAnswer, sdp);
+  sender_->SetRemoteDescription(
+      std::move(answer),
+      rtc::make_ref_counted<SetRemoteDescriptionObserver>(nullptr));
+}
@@ -0,0 +1,70 @@
+#ifndef LOOPBACK_CONNECTION_H_
+#define LOOPBACK_CONNECTION_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+// WebRTC
+#include <api/peer_connection_interface.h>
+#include <api/scoped_refptr.h>
+
+struct LoopbackConnectionConfig {
+  // 送信側で使う映像コーデック (VP8, VP9, AV1, H264)。空の場合はデフォルトの優先順位になる
+  std::string video_codec_type;
+  // 映像のビットレート (kbps)。0 の場合は帯域推定に任せる
+  int video_bit_rate = 0;
+  // 帯域や CPU の状況に関わらず解像度を維持する
+  bool maintain_resolution = false;
+};
+
+// 同じ PeerConnectionFactory から送信側と受信側の PeerConnection を作り、
+// Sora を使わずにプロセス内で SDP を交換して接続する。
+//
+// 経路を単純にするために Trickle ICE は使わず、候補の収集が終わってから
+// 候補を含めた SDP を相手に渡す。
+class LoopbackConnection {
+ public:
+  // 受信側でトラックを受信した時にシグナリングスレッドから呼ばれる
+  typedef std::function<void(
+      rtc::scoped_refptr<webrtc::RtpTransceiverInterface>)>
+      OnTrackFunc;
+
+  static std::unique_ptr<LoopbackConnection> Create(
+      rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory,
+      LoopbackConnectionConfig config,
+      OnTrackFunc on_track);
+  ~LoopbackConnection();
+
+  // Connect の前に呼ぶこと
+  bool AddTrack(rtc::scoped_refptr<webrtc::MediaStreamTrackInterface> track);
+  void Connect();
+
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> GetSender() const;
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> GetReceiver() const;
+
+ private:
+  class Observer;
+
+  LoopbackConnection(
+      rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory,
+      LoopbackConnectionConfig config);
+
+  void SetCodecPreferences(
+      rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver);
+  void SetSenderParameters(
+      rtc::scoped_refptr<webrtc::RtpSenderInterface> sender);
+  void OnSenderGatheringComplete();
+  void OnReceiverGatheringComplete();
+
+  rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory_;
+  LoopbackConnectionConfig config_;
+  std::unique_ptr<Observer> sender_observer_;
+  std::unique_ptr<Observer> receiver_observer_;
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> sender_;
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> receiver_;
+  std::string stream_id_;
+  int video_track_count_ = 0;
+};
+
+#endif
@@ -2,6 +2,10 @@
 #include <sora/camera_device_capturer.h>
 #include <sora/sora_client_context.h>
 
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
 #include <regex>
 
 // CLI11
@@ -10,7 +14,20 @@
 // Boost
 #include <boost/optional/optional.hpp>
 
-#include "sdl_renderer.h"
+#include "cpu_adaptation_controller.h"
+#include "async_log_sink.h"
+#include "encoded_frame_recorder.h"
+#include "event_trace.h"
+#include "headless_audio_device.h"
+#include "metrics_server.h"
+#include "fake_video_capturer.h"
+#include "multi_track_publisher.h"
+#include "rtc_stats_sampler.h"
+#include "multi_window_renderer.h"
+#include "simulcast_rid_controller.h"
+#include "startup_profiler.h"
+#include "thread_affinity.h"
+#include "thumbnail_exporter.h"
 
 #ifdef _WIN32
 #include <rtc_base/win/scoped_com_initializer.h>
@@ -18,6 +35,7 @@
 
 struct MomoSampleConfig {
   std::string video_device;
+  std::string video_file;
   int fps = 15;
   bool use_native = true;
   bool hardware_encoder = false;
@@ -40,6 +58,8 @@ struct MomoSampleConfig {
   boost::optional<bool> data_channel_signaling;
   boost::optional<bool> ignore_disconnect_websocket;
 
+  std::string sora_api_url;
+
   std::string proxy_url;
   std::string proxy_username;
   std::string proxy_password;
@@ -49,13 +69,56 @@ struct MomoSampleConfig {
   int window_height = 480;
   bool show_me = false;
   bool fullscreen = false;
+  bool spotlight_layout = false;
+  int tiles_per_page = 0;
+  std::vector<int> render_cpus;
+  std::string render_thread_priority = "normal";
+  // 0 の場合は SDL_Renderer で描画する
+  int software_compositor_threads = 0;
+  int window_count = 1;
+  bool render_governor = false;
+
+  bool latency_sender = false;
+  bool latency_receiver = false;
+
+  int stats_interval = 0;
+  std::string stats_file;
+  std::string stats_format = "json";
+
+  std::string record_dir;
+  bool record_only = false;
+
+  std::string thumbnail_dir;
+  int thumbnail_interval = 5;
+  int thumbnail_width = 320;
+
+  int video_track_count = 1;
+  std::vector<std::string> track_resolutions;
+  std::vector<int> track_fps;
+  int track_report_interval = 5;
+
+  bool headless_audio = false;
+  HeadlessAudioDeviceConfig headless_audio_config;
+
+  bool cpu_adaptation = false;
+  std::vector<CpuAdaptationStep> cpu_adaptation_ladder;
+
+  bool serial_startup = false;
+  bool startup_report = false;
+
+  std::string trace_file;
+
+  int metrics_port = 0;
+  std::string metrics_address = "127.0.0.1";
 
   struct Size {
     int width;
     int height;
   };
 
-  Size GetSize() {
+  Size GetSize() { return ParseSize(resolution); }
+
+  static Size ParseSize(const std::string& resolution) {
     if (resolution == "QVGA") {
       return {320, 240};
     } else if (resolution == "VGA") {
@@ -82,45 +145,62 @@ struct MomoSampleConfig {
 class MomoSample : public std::enable_shared_from_this<MomoSample>,
                    public sora::SoraSignalingObserver {
  public:
-  MomoSample(std::shared_ptr<sora::SoraClientContext> context,
+  MomoSample(std::future<std::shared_ptr<sora::SoraClientContext>> context,
+             std::shared_ptr<StartupProfiler> profiler,
              MomoSampleConfig config)
-      : context_(context), config_(config) {}
+      : context_future_(std::move(context)),
+        profiler_(profiler),
+        config_(config) {}
 
   void Run() {
+    // 起動を速くするために、SoraClientContext の生成 (main で開始している) と
+    // カメラのオープンを別スレッドで行い、その間にメインスレッドで SDL を初期化する。
+    // シグナリングはカメラのオープンを待たずに開始して、トラックは offer を受け取るまでに作る。
+    ioc_.reset(new boost::asio::io_context(1));
+
+    if (config_.role != "recvonly" && config_.video_track_count == 1) {
+      video_source_future_ = std::async(
+          config_.serial_startup ? std::launch::deferred : std::launch::async,
+          [this]() {
+            auto video_source = CreateVideoSource();
+            profiler_->Mark("capturer_ready");
+            // 自分の映像をすぐに表示できるように、offer を待たずにトラックを作る
+            boost::asio::post(*ioc_, [this]() {
+              if (!CreateTracks()) {
+                conn_->Disconnect();
+              }
+            });
+            return video_source;
+          });
+    }
+
     if (config_.use_sdl) {
-      renderer_.reset(new SDLRenderer(
-          config_.window_width, config_.window_height, config_.fullscreen));
+      MultiWindowRendererConfig renderer_config;
+      renderer_config.window_count = config_.window_count;
+      renderer_config.width = config_.window_width;
+      renderer_config.height = config_.window_height;
+      renderer_config.fullscreen = config_.fullscreen;
+      renderer_config.software_compositor_threads =
+          config_.software_compositor_threads;
+      renderer_.reset(new MultiWindowRenderer(renderer_config));
+      renderer_->SetMeasureLatency(config_.latency_receiver);
+      renderer_->SetSpotlightLayout(config_.spotlight_layout);
+      renderer_->SetTilesPerPage(config_.tiles_per_page);
+      renderer_->SetRenderThreadOptions(config_.render_cpus,
+                                        config_.render_thread_priority);
+      renderer_->SetRenderGovernor(config_.render_governor);
+      profiler_->Mark("renderer_ready");
     }
 
-    auto size = config_.GetSize();
-    if (config_.role != "recvonly") {
-      sora::CameraDeviceCapturerConfig cam_config;
-      cam_config.width = size.width;
-      cam_config.height = size.height;
-      cam_config.fps = config_.fps;
-      cam_config.device_name = config_.video_device;
-      cam_config.use_native = config_.use_native;
-      auto video_source = sora::CreateCameraDeviceCapturer(cam_config);
-      if (video_source == nullptr) {
-        RTC_LOG(LS_ERROR) << "Failed to create video source.";
-        return;
-      }
+    context_ = context_future_.get();
 
-      std::string audio_track_id = rtc::CreateRandomString(16);
-      std::string video_track_id = rtc::CreateRandomString(16);
-      audio_track_ = context_->peer_connection_factory()->CreateAudioTrack(
-          audio_track_id, context_->peer_connection_factory()
-                              ->CreateAudioSource(cricket::AudioOptions())
-                              .get());
-      video_track_ = context_->peer_connection_factory()->CreateVideoTrack(
-          video_track_id, video_source.get());
-      if (config_.use_sdl && config_.show_me) {
-        renderer_->AddTrack(video_track_.get());
-      }
+    if (config_.startup_report && config_.role != "sendonly") {
+      remote_first_frame_sink_.reset(new FirstFrameSink([this]() {
+        profiler_->Mark("first_frame_received");
+        boost::asio::post(*ioc_, [this]() { MaybeReportStartup(); });
+      }));
     }
 
-    ioc_.reset(new boost::asio::io_context(1));
-
     sora::SoraSignalingConfig config;
     config.pc_factory = context_->peer_connection_factory();
     config.io_context = ioc_.get();
@@ -151,8 +231,56 @@ class MomoSample : public std::enable_shared_from_this<MomoSample>,
         context_->connection_context()->default_network_manager();
     config.socket_factory =
         context_->connection_context()->default_socket_factory();
+
+    if (config_.video_track_count > 1) {
+      RunMultiTrackPublisher(config);
+      return;
+    }
+
     conn_ = sora::SoraSignaling::Create(config);
 
+    if (config_.stats_interval > 0) {
+      RTCStatsSamplerConfig stats_config;
+      stats_config.interval = config_.stats_interval;
+      stats_config.file = config_.stats_file;
+      stats_config.format = config_.stats_format;
+      stats_sampler_.reset(new RTCStatsSampler(stats_config));
+      stats_sampler_->Start();
+    }
+
+    if (!config_.record_dir.empty()) {
+      EncodedFrameRecorderConfig recorder_config;
+      recorder_config.dir = config_.record_dir;
+      recorder_.reset(new EncodedFrameRecorder(recorder_config));
+      recorder_->Start();
+    }
+
+    if (!config_.thumbnail_dir.empty()) {
+      ThumbnailExporterConfig exporter_config;
+      exporter_config.dir = config_.thumbnail_dir;
+      exporter_config.interval = config_.thumbnail_interval;
+      exporter_config.width = config_.thumbnail_width;
+      thumbnail_exporter_.reset(new ThumbnailExporter(exporter_config));
+      thumbnail_exporter_->Start();
+    }
+
+    if (config_.metrics_port > 0) {
+      MetricsServerConfig metrics_config;
+      metrics_config.address = config_.metrics_address;
+      metrics_config.port = config_.metrics_port;
+      metrics_server_ = MetricsServer::Create(
+          *ioc_, metrics_config,
+          [this](MetricsWriter& writer) { CollectMetrics(writer); });
+      if (metrics_server_ == nullptr) {
+        return;
+      }
+    }
+
+    // 比較のために、従来通りトラックを作ってからシグナリングを開始する
+    if (config_.serial_startup && !CreateTracks()) {
+      return;
+    }
+
     boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
         work_guard(ioc_->get_executor());
 
@@ -160,6 +288,16 @@ class MomoSample : public std::enable_shared_from_this<MomoSample>,
     signals.async_wait(
         [this](const boost::system::error_code&, int) { conn_->Disconnect(); });
 
+#ifndef _WIN32
+    // SIGUSR1 を受け取ったら、終了せずにそこまでのトレースを書き出す
+    boost::asio::signal_set trace_signals(*ioc_);
+    if (!config_.trace_file.empty()) {
+      trace_signals.add(SIGUSR1);
+      WaitTraceSignal(trace_signals);
+    }
+#endif
+
+    profiler_->Mark("connect_start");
     conn_->Connect();
 
     if (config_.use_sdl) {
@@ -170,10 +308,50 @@ class MomoSample : public std::enable_shared_from_this<MomoSample>,
       });
     }
 
+    // サイマルキャストの受信時に、タイルの大きさに合わせて受信する rid を切り替える
+    if (config_.use_sdl && config_.simulcast.value_or(false) &&
+        config_.role != "sendonly" && !config_.sora_api_url.empty()) {
+      SimulcastRidControllerConfig rid_config;
+      rid_config.api_url = config_.sora_api_url;
+      rid_config.channel_id = config_.channel_id;
+      simulcast_rid_controller_.reset(
+          new SimulcastRidController(*ioc_, rid_config));
+      renderer_->SetTileSizeCallback(
+          [this](std::string track_id, int width, int height) {
+            boost::asio::post(*ioc_, [this, track_id, width, height]() {
+              simulcast_rid_controller_->SetTileSize(track_id, width, height);
+            });
+          });
+    }
+
     ioc_->run();
   }
 
   void OnSetOffer(std::string offer) override {
+    TRACE_EVENT("MomoSample::OnSetOffer");
+    profiler_->Mark("offer_received");
+    // カメラのオープンがまだ終わっていない場合は、ここで待つ
+    if (!CreateTracks()) {
+      conn_->Disconnect();
+      return;
+    }
+    if (stats_sampler_ != nullptr) {
+      stats_sampler_->SetPeerConnection(conn_->GetPeerConnection());
+    }
+    if (simulcast_rid_controller_ != nullptr) {
+      std::string connection_id = conn_->GetConnectionID();
+      boost::asio::post(*ioc_, [this, connection_id]() {
+        simulcast_rid_controller_->SetConnectionID(connection_id);
+      });
+    }
+    if (cpu_adaptation_controller_ != nullptr) {
+      auto pc = conn_->GetPeerConnection();
+      boost::asio::post(*ioc_, [this, pc]() {
+        if (cpu_adaptation_controller_ != nullptr) {
+          cpu_adaptation_controller_->SetPeerConnection(pc);
+        }
+      });
+    }
     std::string stream_id = rtc::CreateRandomString(16);
     if (audio_track_ != nullptr) {
       webrtc::RTCErrorOr<rtc::scoped_refptr<webrtc::RtpSenderInterface>>
@@ -188,32 +366,163 @@ class MomoSample : public std::enable_shared_from_this<MomoSample>,
   }
   void OnDisconnect(sora::SoraSignalingErrorCode ec,
                     std::string message) override {
+    TRACE_EVENT("MomoSample::OnDisconnect");
     RTC_LOG(LS_INFO) << "OnDisconnect: " << message;
+    if (local_first_frame_sink_ != nullptr) {
+      video_track_->RemoveSink(local_first_frame_sink_.get());
+    }
+    {
+      std::lock_guard<std::mutex> lock(remote_first_frame_mutex_);
+      if (remote_first_frame_track_ != nullptr) {
+        remote_first_frame_track_->RemoveSink(remote_first_frame_sink_.get());
+        remote_first_frame_track_ = nullptr;
+      }
+    }
+    stats_sampler_.reset();
+    recorder_.reset();
+    thumbnail_exporter_.reset();
+    cpu_adaptation_controller_.reset();
     renderer_.reset();
     ioc_->stop();
   }
-  void OnNotify(std::string text) override {}
+  void OnNotify(std::string text) override {
+    TRACE_EVENT("MomoSample::OnNotify");
+    boost::json::error_code ec;
+    auto json = boost::json::parse(text, ec);
+    if (ec || !json.is_object()) {
+      return;
+    }
+    const auto& obj = json.as_object();
+    auto event_type = obj.if_contains("event_type");
+    auto connection_id = obj.if_contains("connection_id");
+    if (event_type == nullptr || !event_type->is_string() ||
+        connection_id == nullptr || !connection_id->is_string()) {
+      return;
+    }
+
+    // 自分の接続が作られたら接続完了とする
+    if (event_type->as_string() == "connection.created" &&
+        connection_id->as_string() == conn_->GetConnectionID()) {
+      profiler_->Mark("connected");
+      boost::asio::post(*ioc_, [this]() {
+        connected_ = true;
+        MaybeReportStartup();
+      });
+      return;
+    }
+
+    // スポットライトでフォーカスされた送信者を大きく表示する
+    if (renderer_ == nullptr ||
+        event_type->as_string() != "spotlight.focused") {
+      return;
+    }
+    std::string focused_connection_id = connection_id->as_string().c_str();
+    boost::asio::post(*ioc_, [this, focused_connection_id]() {
+      if (renderer_ == nullptr) {
+        return;
+      }
+      spotlight_connection_id_ = focused_connection_id;
+      auto it = connection_tracks_.find(focused_connection_id);
+      if (it != connection_tracks_.end()) {
+        renderer_->SetSpotlightTrack(it->second);
+      }
+    });
+  }
   void OnPush(std::string text) override {}
-  void OnMessage(std::string label, std::string data) override {}
+  void OnMessage(std::string label, std::string data) override {
+    if (metrics_server_ == nullptr) {
+      return;
+    }
+    size_t size = data.size();
+    boost::asio::post(*ioc_, [this, label, size]() {
+      MessageCounter& counter = received_messages_[label];
+      counter.messages++;
+      counter.bytes += size;
+    });
+  }
 
   void OnTrack(rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver)
       override {
+    TRACE_EVENT("MomoSample::OnTrack");
+    if (recorder_ != nullptr) {
+      recorder_->AddReceiver(transceiver->receiver());
+    }
+    auto track = transceiver->receiver()->track();
+    if (remote_first_frame_sink_ != nullptr &&
+        track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
+      // 最初に受信した映像のトラックだけで計測する
+      std::lock_guard<std::mutex> lock(remote_first_frame_mutex_);
+      if (remote_first_frame_track_ == nullptr) {
+        remote_first_frame_track_ =
+            static_cast<webrtc::VideoTrackInterface*>(track.get());
+        remote_first_frame_track_->AddOrUpdateSink(
+            remote_first_frame_sink_.get(), rtc::VideoSinkWants());
+      }
+    }
+    if (thumbnail_exporter_ != nullptr &&
+        track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
+      thumbnail_exporter_->AddTrack(
+          static_cast<webrtc::VideoTrackInterface*>(track.get()));
+    }
     if (renderer_ == nullptr) {
       return;
     }
-    auto track = transceiver->receiver()->track();
     if (track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
+      // マルチストリームではストリーム ID が送信者の connection_id になっている
+      auto stream_ids = transceiver->receiver()->stream_ids();
+      if (simulcast_rid_controller_ != nullptr && !stream_ids.empty()) {
+        std::string track_id = track->id();
+        std::string sender_connection_id = stream_ids[0];
+        boost::asio::post(*ioc_, [this, track_id, sender_connection_id]() {
+          simulcast_rid_controller_->AddTrack(track_id, sender_connection_id);
+        });
+      }
+      if (!stream_ids.empty()) {
+        std::string track_id = track->id();
+        std::string sender_connection_id = stream_ids[0];
+        boost::asio::post(*ioc_, [this, track_id, sender_connection_id]() {
+          if (renderer_ == nullptr) {
+            return;
+          }
+          connection_tracks_[sender_connection_id] = track_id;
+          if (sender_connection_id == spotlight_connection_id_) {
+            renderer_->SetSpotlightTrack(track_id);
+          }
+        });
+      }
       renderer_->AddTrack(
           static_cast<webrtc::VideoTrackInterface*>(track.get()));
     }
   }
   void OnRemoveTrack(
       rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver) override {
+    TRACE_EVENT("MomoSample::OnRemoveTrack");
+    if (recorder_ != nullptr) {
+      recorder_->RemoveReceiver(receiver);
+    }
+    auto track = receiver->track();
+    if (thumbnail_exporter_ != nullptr &&
+        track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
+      thumbnail_exporter_->RemoveTrack(
+          static_cast<webrtc::VideoTrackInterface*>(track.get()));
+    }
     if (renderer_ == nullptr) {
       return;
     }
-    auto track = receiver->track();
     if (track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
+      std::string track_id = track->id();
+      boost::asio::post(*ioc_, [this, track_id]() {
+        for (auto it = connection_tracks_.begin();
+             it != connection_tracks_.end(); ++it) {
+          if (it->second == track_id) {
+            connection_tracks_.erase(it);
+            break;
+          }
+        }
+        if (simulcast_rid_controller_ != nullptr) {
+          simulcast_rid_controller_->RemoveTrack(track_id);
+        }
+      });
       renderer_->RemoveTrack(
           static_cast<webrtc::VideoTrackInterface*>(track.get()));
     }
@@ -222,13 +531,197 @@ class MomoSample : public std::enable_shared_from_this<MomoSample>,
   void OnDataChannel(std::string label) override {}
 
  private:
+  // カメラのオープンは時間がかかることがあるので、別スレッドから呼ばれる
+  rtc::scoped_refptr<webrtc::VideoTrackSourceInterface> CreateVideoSource() {
+    auto size = config_.GetSize();
+    if (config_.latency_sender || !config_.video_file.empty()) {
+      FakeVideoCapturerConfig fake_config;
+      fake_config.width = size.width;
+      fake_config.height = size.height;
+      fake_config.fps = config_.fps;
+      fake_config.embed_timestamp = config_.latency_sender;
+      fake_config.y4m_file = config_.video_file;
+      return FakeVideoCapturer::Create(fake_config);
+    }
+    sora::CameraDeviceCapturerConfig cam_config;
+    cam_config.width = size.width;
+    cam_config.height = size.height;
+    cam_config.fps = config_.fps;
+    cam_config.device_name = config_.video_device;
+    cam_config.use_native = config_.use_native;
+    return sora::CreateCameraDeviceCapturer(cam_config);
+  }
+
+  // 映像ソースができるのを待ってトラックを作る。
+  // 映像を送信しない場合と、既にトラックを作った場合は何もしない。
+  // ioc_ のスレッド (ioc_ を動かす前はメインスレッド) から呼ぶこと
+  bool CreateTracks() {
+    if (!video_source_future_.valid()) {
+      return true;
+    }
+    auto video_source = video_source_future_.get();
+    if (video_source == nullptr) {
+      RTC_LOG(LS_ERROR) << "Failed to create video source.";
+      return false;
+    }
+
+    std::string audio_track_id = rtc::CreateRandomString(16);
+    std::string video_track_id = rtc::CreateRandomString(16);
+    audio_track_ = context_->peer_connection_factory()->CreateAudioTrack(
+        audio_track_id, context_->peer_connection_factory()
+                            ->CreateAudioSource(cricket::AudioOptions())
+                            .get());
+    video_track_ = context_->peer_connection_factory()->CreateVideoTrack(
+        video_track_id, video_source.get());
+    if (config_.use_sdl && config_.show_me) {
+      renderer_->AddTrack(video_track_.get());
+    }
+    if (config_.startup_report) {
+      local_first_frame_sink_.reset(new FirstFrameSink([this]() {
+        profiler_->Mark("first_frame_captured");
+        boost::asio::post(*ioc_, [this]() { MaybeReportStartup(); });
+      }));
+      video_track_->AddOrUpdateSink(local_first_frame_sink_.get(),
+                                    rtc::VideoSinkWants());
+    }
+
+    if (config_.cpu_adaptation) {
+      CpuAdaptationControllerConfig adaptation_config;
+      adaptation_config.ladder = config_.cpu_adaptation_ladder;
+      if (adaptation_config.ladder.empty()) {
+        auto size = config_.GetSize();
+        adaptation_config.ladder = CreateDefaultCpuAdaptationLadder(
+            size.width, size.height, config_.fps);
+      }
+      cpu_adaptation_controller_ = CpuAdaptationController::Create(
+          *ioc_, adaptation_config, video_track_);
+    }
+    return true;
+  }
+
+  // 接続が完了して最初のフレームが届いたら、起動にかかった時間を出力して切断する。
+  // 送信のみの場合は、最初のフレームをキャプチャした時点とする
+  void MaybeReportStartup() {
+    if (!config_.startup_report || startup_reported_ ||
+        !profiler_->Has("connected")) {
+      return;
+    }
+    if (config_.role == "sendonly") {
+      if (video_track_ != nullptr && !profiler_->Has("first_frame_captured")) {
+        return;
+      }
+    } else if (!profiler_->Has("first_frame_received")) {
+      return;
+    }
+    startup_reported_ = true;
+    std::cout << "{\"serial_startup\":"
+              << (config_.serial_startup ? "true" : "false")
+              << ",\"startup\":" << profiler_->ToJson() << "}" << std::endl;
+    conn_->Disconnect();
+  }
+
+  // 複数の映像トラックを送信する場合は、トラック毎に接続を作る
+  void RunMultiTrackPublisher(sora::SoraSignalingConfig signaling_config) {
+    MultiTrackPublisherConfig publisher_config;
+    publisher_config.signaling_config = signaling_config;
+    for (int i = 0; i < config_.video_track_count; i++) {
+      // 指定した数がトラック数より少ない場合は、先頭から繰り返して使う
+      std::string resolution =
+          config_.track_resolutions.empty()
+              ? config_.resolution
+              : config_.track_resolutions[i % config_.track_resolutions.size()];
+      int fps = config_.track_fps.empty()
+                    ? config_.fps
+                    : config_.track_fps[i % config_.track_fps.size()];
+      auto size = MomoSampleConfig::ParseSize(resolution);
+      publisher_config.tracks.push_back({size.width, size.height, fps});
+    }
+    publisher_config.y4m_file = config_.video_file;
+    publisher_config.embed_timestamp = config_.latency_sender;
+    publisher_config.report_interval = config_.track_report_interval;
+    MultiTrackPublisher publisher(context_, *ioc_, publisher_config);
+
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+        work_guard(ioc_->get_executor());
+
+    boost::asio::signal_set signals(*ioc_, SIGINT, SIGTERM);
+    signals.async_wait([&publisher](const boost::system::error_code&, int) {
+      publisher.Disconnect();
+    });
+
+    publisher.Connect([this]() { ioc_->stop(); });
+
+    ioc_->run();
+  }
+
+  void CollectMetrics(MetricsWriter& writer) {
+    writer.Add("sora_connection_connected", "gauge", connected_ ? 1 : 0);
+    for (const auto& counter : received_messages_) {
+      writer.Add("sora_messaging_received_messages_total", "counter",
+                 "label", counter.first, counter.second.messages);
+    }
+    for (const auto& counter : received_messages_) {
+      writer.Add("sora_messaging_received_bytes_total", "counter", "label",
+                 counter.first, counter.second.bytes);
+    }
+    if (renderer_ != nullptr) {
+      renderer_->AppendMetrics(writer);
+    }
+    if (thumbnail_exporter_ != nullptr) {
+      writer.Add("sora_thumbnails_written_total", "counter",
+                 thumbnail_exporter_->GetWrittenThumbnails());
+      writer.Add("sora_thumbnails_skipped_total", "counter",
+                 thumbnail_exporter_->GetSkippedThumbnails());
+    }
+  }
+
+#ifndef _WIN32
+  void WaitTraceSignal(boost::asio::signal_set& signals) {
+    signals.async_wait(
+        [this, &signals](const boost::system::error_code& ec, int) {
+          if (ec) {
+            return;
+          }
+          WriteEventTrace(config_.trace_file);
+          WaitTraceSignal(signals);
+        });
+  }
+#endif
+
+  std::future<std::shared_ptr<sora::SoraClientContext>> context_future_;
+  std::shared_ptr<StartupProfiler> profiler_;
   std::shared_ptr<sora::SoraClientContext> context_;
   MomoSampleConfig config_;
+  std::future<rtc::scoped_refptr<webrtc::VideoTrackSourceInterface>>
+      video_source_future_;
   rtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track_;
   rtc::scoped_refptr<webrtc::VideoTrackInterface> video_track_;
   std::shared_ptr<sora::SoraSignaling> conn_;
   std::unique_ptr<boost::asio::io_context> ioc_;
-  std::unique_ptr<SDLRenderer> renderer_;
+  std::unique_ptr<MultiWindowRenderer> renderer_;
+  std::unique_ptr<RTCStatsSampler> stats_sampler_;
+  std::unique_ptr<EncodedFrameRecorder> recorder_;
+  std::unique_ptr<ThumbnailExporter> thumbnail_exporter_;
+  std::unique_ptr<SimulcastRidController> simulcast_rid_controller_;
+  std::shared_ptr<CpuAdaptationController> cpu_adaptation_controller_;
+  std::unique_ptr<MetricsServer> metrics_server_;
+  // 以下は ioc_ のスレッドからしか触らない
+  struct MessageCounter {
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+  };
+  // label -> MessageCounter
+  std::map<std::string, MessageCounter> received_messages_;
+  bool connected_ = false;
+  // sender_connection_id -> track_id
+  std::map<std::string, std::string> connection_tracks_;
+  std::string spotlight_connection_id_;
+  bool startup_reported_ = false;
+  std::unique_ptr<FirstFrameSink> local_first_frame_sink_;
+  // OnTrack はシグナリングスレッドから呼ばれるので排他する
+  std::unique_ptr<FirstFrameSink> remote_first_frame_sink_;
+  std::mutex remote_first_frame_mutex_;
+  rtc::scoped_refptr<webrtc::VideoTrackInterface> remote_first_frame_track_;
 };
 
 void add_optional_bool(CLI::App& app,
@@ -252,6 +745,9 @@ void add_optional_bool(CLI::App& app,
 }
 
 int main(int argc, char* argv[]) {
+  // 起動にかかった時間はここから計測する
+  auto profiler = std::make_shared<StartupProfiler>();
+
 #ifdef _WIN32
   webrtc::ScopedCOMInitializer com_initializer(
       webrtc::ScopedCOMInitializer::kMTA);
@@ -297,6 +793,8 @@ int main(int argc, char* argv[]) {
   app.add_option("--native", config.use_native, "Enable NVJPEG (default: true)");
   app.add_option("--hardware-encoder", config.hardware_encoder, "Enable HW Encorder (default: false)");
   app.add_option("--video-device", config.video_device, "Video Device");
+  app.add_option("--video-file", config.video_file,
+                 "Y4M file to send instead of camera");
   app.add_option("--fps", config.fps, "Video Frame rate")->check(CLI::Range(1, 60));
   int log_level = (int)rtc::LS_ERROR;
   auto log_level_map = std::vector<std::pair<std::string, int>>(
@@ -341,6 +839,9 @@ int main(int argc, char* argv[]) {
       ->check(CLI::Range(0, 8));
   add_optional_bool(app, "--simulcast", config.simulcast,
                     "Use simulcast (default: none)");
+  app.add_option("--sora-api-url", config.sora_api_url,
+                 "Sora API URL used to request simulcast rid matching the "
+                 "tile size (http only, requires --use-sdl)");
   add_optional_bool(app, "--data-channel-signaling",
                     config.data_channel_signaling,
                     "Use DataChannel for Sora signaling (default: none)");
@@ -354,12 +855,171 @@ int main(int argc, char* argv[]) {
   app.add_option("--proxy-password", config.proxy_password, "Proxy password");
 
   // SDL に関するオプション
-  app.add_flag("--use-sdl", config.use_sdl, "Show video using SDL");
+  auto use_sdl =
+      app.add_flag("--use-sdl", config.use_sdl, "Show video using SDL");
   app.add_option("--window-width", config.window_width, "SDL window width");
   app.add_option("--window-height", config.window_height, "SDL window height");
   app.add_flag("--fullscreen", config.fullscreen,
                "Use fullscreen window for videos");
   app.add_flag("--show-me", config.show_me, "Show self video");
+  app.add_flag("--spotlight-layout", config.spotlight_layout,
+               "Show the focused video large and others as thumbnails");
+  app.add_option("--tiles-per-page", config.tiles_per_page,
+                 "Max tiles per page (0: show all tiles)")
+      ->check(CLI::Range(0, 1000));
+  app.add_option_function<std::string>(
+         "--render-cpus",
+         [&config](const std::string& input) {
+           if (!ParseCpuList(input, config.render_cpus)) {
+             throw CLI::ValidationError("--render-cpus", input);
+           }
+         },
+         "CPUs to pin the render thread to (e.g. 2,4-5)")
+      ->needs(use_sdl);
+  app.add_option("--render-thread-priority", config.render_thread_priority,
+                 "Scheduling priority of the render thread (default: normal)")
+      ->check(CLI::IsMember({"normal", "high", "realtime"}))
+      ->needs(use_sdl);
+  app.add_option("--software-compositor-threads",
+                 config.software_compositor_threads,
+                 "Compose tiles on the CPU with N threads (0: disabled)")
+      ->check(CLI::Range(0, 64))
+      ->needs(use_sdl);
+  app.add_option("--window-count", config.window_count,
+                 "Number of windows to spread videos over")
+      ->check(CLI::Range(1, 16))
+      ->needs(use_sdl);
+  app.add_flag("--render-governor", config.render_governor,
+               "Lower frame rate of small tiles when rendering falls behind")
+      ->needs(use_sdl);
+
+  // 遅延計測に関するオプション
+  app.add_flag("--latency-sender", config.latency_sender,
+               "Send synthetic video with embedded capture timestamp instead "
+               "of camera");
+  app.add_flag("--latency-receiver", config.latency_receiver,
+               "Measure glass-to-glass latency of received video (requires "
+               "--use-sdl)");
+
+  // 統計情報に関するオプション
+  app.add_option("--stats-interval", config.stats_interval,
+                 "Interval in seconds to collect WebRTC stats (0: disabled)")
+      ->check(CLI::Range(0, 3600));
+  app.add_option("--stats-file", config.stats_file,
+                 "File to write WebRTC stats (default: sora_stats.jsonl or "
+                 "sora_stats.prom)");
+  app.add_option("--stats-format", config.stats_format,
+                 "Format of WebRTC stats file (default: json)")
+      ->check(CLI::IsMember({"json", "prometheus"}));
+
+  // 複数の映像トラックの送信に関するオプション
+  app.add_option("--video-track-count", config.video_track_count,
+                 "Number of video tracks to send (requires --role sendonly)")
+      ->check(CLI::Range(1, 100));
+  app.add_option("--track-resolution", config.track_resolutions,
+                 "Resolution of each video track (comma separated)")
+      ->delimiter(',')
+      ->check(is_valid_resolution);
+  app.add_option("--track-fps", config.track_fps,
+                 "Frame rate of each video track (comma separated)")
+      ->delimiter(',')
+      ->check(CLI::Range(1, 60));
+  app.add_option("--track-report-interval", config.track_report_interval,
+                 "Interval in seconds to print encoder stats of each track "
+                 "(0: disabled)")
+      ->check(CLI::Range(0, 3600));
+
+  // 音声デバイスを使わない場合のオプション
+  auto headless_audio = app.add_flag(
+      "--headless-audio", config.headless_audio,
+      "Use a timer-driven audio device instead of the sound card");
+  app.add_option("--audio-input-file",
+                 config.headless_audio_config.input_file,
+                 "WAV file to send in a loop (default: 440 Hz tone)")
+      ->check(CLI::ExistingFile)
+      ->needs(headless_audio);
+  app.add_option("--audio-output-file",
+                 config.headless_audio_config.output_file,
+                 "WAV file to write received audio (default: discard)")
+      ->needs(headless_audio);
+
+  // CPU 負荷に応じた送信映像の調整に関するオプション
+  auto cpu_adaptation = app.add_flag(
+      "--cpu-adaptation", config.cpu_adaptation,
+      "Lower resolution and frame rate of sent video when CPU is overused");
+  app.add_option_function<std::string>(
+         "--cpu-adaptation-ladder",
+         [&config](const std::string& input) {
+           if (!ParseCpuAdaptationLadder(input,
+                                         &config.cpu_adaptation_ladder)) {
+             throw CLI::ValidationError("--cpu-adaptation-ladder", input);
+           }
+         },
+         "Steps of [WIDTH]x[HEIGHT]@[FPS] from highest to lowest "
+         "(comma separated, default: derived from --resolution and --fps)")
+      ->needs(cpu_adaptation);
+
+  // ログファイルに関するオプション
+  std::string log_file;
+  int log_file_size = 10;
+  int log_file_count = 5;
+  app.add_option("--log-file", log_file,
+                 "Write logs to the file from a background thread instead of "
+                 "stderr");
+  app.add_option("--log-file-size", log_file_size,
+                 "Max size of a log file in MiB before rotation")
+      ->check(CLI::Range(1, 1024));
+  app.add_option("--log-file-count", log_file_count,
+                 "Number of rotated log files to keep")
+      ->check(CLI::Range(0, 100));
+
+  // メトリクスに関するオプション
+  auto metrics_port =
+      app.add_option("--metrics-port", config.metrics_port,
+                     "Port to serve Prometheus metrics on /metrics "
+                     "(0: disabled)")
+          ->check(CLI::Range(0, 65535));
+  app.add_option("--metrics-address", config.metrics_address,
+                 "Address to serve Prometheus metrics (default: 127.0.0.1)")
+      ->needs(metrics_port);
+
+  // トレースに関するオプション
+  app.add_option("--trace-file", config.trace_file,
+                 "Record timings of rendering and signaling callbacks and "
+                 "write them as Chrome trace JSON on exit (or on SIGUSR1)");
+
+  // 起動時間の計測に関するオプション
+  app.add_flag("--serial-startup", config.serial_startup,
+               "Start signaling after the window, camera and context are "
+               "ready one by one (for comparison)");
+  app.add_flag("--startup-report", config.startup_report,
+               "Print time to connect and time to first frame as JSON, then "
+               "disconnect");
+
+  // 録画に関するオプション
+  auto record_dir =
+      app.add_option("--record-dir", config.record_dir,
+                     "Directory to write received video as IVF files "
+                     "without decoding");
+  auto record_only_flag =
+      app.add_flag("--record-only", config.record_only,
+                   "Record received video without decoding")
+          ->needs(record_dir)
+          ->excludes(use_sdl);
+
+  // サムネイルに関するオプション
+  auto thumbnail_dir =
+      app.add_option("--thumbnail-dir", config.thumbnail_dir,
+                     "Directory to write JPEG thumbnails of received video")
+          ->excludes(record_only_flag);
+  app.add_option("--thumbnail-interval", config.thumbnail_interval,
+                 "Interval of writing thumbnails in seconds (default: 5)")
+      ->check(CLI::Range(1, 3600))
+      ->needs(thumbnail_dir);
+  app.add_option("--thumbnail-width", config.thumbnail_width,
+                 "Width of thumbnails (default: 320)")
+      ->check(CLI::Range(16, 1920))
+      ->needs(thumbnail_dir);
 
   try {
     app.parse(argc, argv);
@@ -367,26 +1027,103 @@ int main(int argc, char* argv[]) {
     exit(app.exit(e));
   }
 
+  if (config.video_track_count > 1 && config.role != "sendonly") {
+    std::cerr << "--video-track-count requires --role sendonly" << std::endl;
+    return 1;
+  }
+  if (config.video_track_count > 1 && config.cpu_adaptation) {
+    std::cerr << "--cpu-adaptation cannot be used with --video-track-count"
+              << std::endl;
+    return 1;
+  }
+  if (config.video_track_count > 1 && config.metrics_port > 0) {
+    std::cerr << "--metrics-port cannot be used with --video-track-count"
+              << std::endl;
+    return 1;
+  }
+
   // メタデータのパース
   if (!metadata.empty()) {
     config.metadata = boost::json::parse(metadata);
   }
 
+  if (config.stats_file.empty()) {
+    config.stats_file = config.stats_format == "prometheus"
+                            ? "sora_stats.prom"
+                            : "sora_stats.jsonl";
+  }
+
+  std::unique_ptr<AsyncLogSink> log_sink;
   if (log_level != rtc::LS_NONE) {
-    rtc::LogMessage::LogToDebug((rtc::LoggingSeverity)log_level);
+    if (log_file.empty()) {
+      rtc::LogMessage::LogToDebug((rtc::LoggingSeverity)log_level);
+    } else {
+      // ログを出力するスレッドがファイルへの書き込みを待たないようにする
+      AsyncLogSinkConfig log_config;
+      log_config.file = log_file;
+      log_config.max_file_size = (int64_t)log_file_size * 1024 * 1024;
+      log_config.max_files = log_file_count;
+      log_sink = AsyncLogSink::Create(log_config);
+      if (log_sink == nullptr) {
+        std::cerr << "Failed to open log file: " << log_file << std::endl;
+        return 1;
+      }
+      rtc::LogMessage::LogToDebug(rtc::LS_NONE);
+      rtc::LogMessage::AddLogToStream(log_sink.get(),
+                                      (rtc::LoggingSeverity)log_level);
+    }
     rtc::LogMessage::LogTimestamps();
     rtc::LogMessage::LogThreads();
   }
 
+  if (!config.trace_file.empty()) {
+    StartEventTrace();
+  }
+
   if (config.hardware_encoder == false) {
     config.use_hardware_encoder = false;
   }
   
-  auto context =
-      sora::SoraClientContext::Create(sora::SoraClientContextConfig());
-  auto momosample = std::make_shared<MomoSample>(context, config);
+  sora::SoraClientContextConfig context_config;
+  if (config.headless_audio) {
+    context_config.use_audio_device = false;
+  }
+  if (config.record_only || config.headless_audio) {
+    bool record_only = config.record_only;
+    bool headless_audio = config.headless_audio;
+    HeadlessAudioDeviceConfig headless_audio_config =
+        config.headless_audio_config;
+    context_config.configure_media_dependencies =
+        [record_only, headless_audio, headless_audio_config](
+            const webrtc::PeerConnectionFactoryDependencies& dependencies,
+            cricket::MediaEngineDependencies& media_dependencies) {
+          if (record_only) {
+            media_dependencies.video_decoder_factory =
+                CreateRecordOnlyVideoDecoderFactory(
+                    std::move(media_dependencies.video_decoder_factory));
+          }
+          if (headless_audio) {
+            media_dependencies.adm = CreateHeadlessAudioDeviceModule(
+                dependencies.task_queue_factory.get(), headless_audio_config);
+          }
+        };
+  }
+  // SoraClientContext の生成は時間がかかるので、SDL の初期化やカメラのオープンと並行して行う
+  auto context = std::async(
+      config.serial_startup ? std::launch::deferred : std::launch::async,
+      [context_config, profiler]() {
+        auto context = sora::SoraClientContext::Create(context_config);
+        profiler->Mark("context_ready");
+        return context;
+      });
+  auto momosample =
+      std::make_shared<MomoSample>(std::move(context), profiler, config);
 
   momosample->Run();
 
+  if (!config.trace_file.empty()) {
+    WriteEventTrace(config.trace_file);
+  }
+
   return 0;
 }
@@ -0,0 +1,276 @@
+#include "multi_track_publisher.h"
+
+#include <iostream>
+
+// WebRTC
+#include <api/make_ref_counted.h>
+#include <api/stats/rtc_stats_collector_callback.h>
+#include <api/stats/rtcstats_objects.h>
+#include <rtc_base/helpers.h>
+#include <rtc_base/logging.h>
+
+#include "fake_video_capturer.h"
+
+namespace {
+
+template <typename T>
+T ValueOr(const webrtc::RTCStatsMember<T>& member, T default_value) {
+  return member.is_defined() ? *member : default_value;
+}
+
+class StatsCallback : public webrtc::RTCStatsCollectorCallback {
+ public:
+  StatsCallback(
+      std::function<void(rtc::scoped_refptr<const webrtc::RTCStatsReport>)>
+          on_delivered)
+      : on_delivered_(std::move(on_delivered)) {}
+
+  void OnStatsDelivered(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report)
+      override {
+    on_delivered_(report);
+  }
+
+ private:
+  std::function<void(rtc::scoped_refptr<const webrtc::RTCStatsReport>)>
+      on_delivered_;
+};
+
+}  // namespace
+
+class MultiTrackPublisher::Publisher
+    : public std::enable_shared_from_this<Publisher>,
+      public sora::SoraSignalingObserver {
+ public:
+  Publisher(boost::asio::io_context& ioc,
+            int index,
+            MultiTrackPublisherConfig::Track track,
+            rtc::scoped_refptr<webrtc::VideoTrackInterface> video_track,
+            rtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track,
+            std::function<void()> on_disconnected)
+      : ioc_(ioc),
+        index_(index),
+        track_(track),
+        video_track_(video_track),
+        audio_track_(audio_track),
+        on_disconnected_(on_disconnected) {}
+
+  void Connect(sora::SoraSignalingConfig config) {
+    config.observer = shared_from_this();
+    config.audio = audio_track_ != nullptr;
+    conn_ = sora::SoraSignaling::Create(config);
+    conn_->Connect();
+  }
+  void Disconnect() {
+    if (conn_ != nullptr) {
+      conn_->Disconnect();
+    }
+  }
+
+  void Report(double process_cpu_percent) {
+    if (conn_ == nullptr) {
+      return;
+    }
+    auto pc = conn_->GetPeerConnection();
+    if (pc == nullptr) {
+      return;
+    }
+    auto self = shared_from_this();
+    pc->GetStats(rtc::make_ref_counted<StatsCallback>(
+                     [self, process_cpu_percent](
+                         rtc::scoped_refptr<const webrtc::RTCStatsReport>
+                             report) {
+                       boost::asio::post(self->ioc_, [self, report,
+                                                      process_cpu_percent]() {
+                         self->OnStats(report, process_cpu_percent);
+                       });
+                     })
+                     .get());
+  }
+
+  void OnSetOffer(std::string offer) override {
+    std::string stream_id = rtc::CreateRandomString(16);
+    if (audio_track_ != nullptr) {
+      conn_->GetPeerConnection()->AddTrack(audio_track_, {stream_id});
+    }
+    conn_->GetPeerConnection()->AddTrack(video_track_, {stream_id});
+  }
+  void OnDisconnect(sora::SoraSignalingErrorCode ec,
+                    std::string message) override {
+    RTC_LOG(LS_INFO) << "OnDisconnect: track=" << index_
+                     << " message=" << message;
+    boost::asio::post(ioc_, on_disconnected_);
+  }
+  void OnNotify(std::string text) override {}
+  void OnPush(std::string text) override {}
+  void OnMessage(std::string label, std::string data) override {}
+  void OnTrack(rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver)
+      override {}
+  void OnRemoveTrack(
+      rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver) override {}
+  void OnDataChannel(std::string label) override {}
+
+ private:
+  void OnStats(rtc::scoped_refptr<const webrtc::RTCStatsReport> report,
+               double process_cpu_percent) {
+    uint64_t frames_encoded = 0;
+    double total_encode_time = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::string quality_limitation_reason;
+    std::string encoder_implementation;
+    // サイマルキャストの場合は全ての rid の合計にする
+    for (const auto* s :
+         report->GetStatsOfType<webrtc::RTCOutboundRTPStreamStats>()) {
+      if (ValueOr(s->kind, std::string()) != "video") {
+        continue;
+      }
+      frames_encoded += ValueOr(s->frames_encoded, (uint32_t)0);
+      total_encode_time += ValueOr(s->total_encode_time, 0.0);
+      uint32_t w = ValueOr(s->frame_width, (uint32_t)0);
+      uint32_t h = ValueOr(s->frame_height, (uint32_t)0);
+      if (w * h > width * height) {
+        width = w;
+        height = h;
+      }
+      quality_limitation_reason =
+          ValueOr(s->quality_limitation_reason, std::string());
+      encoder_implementation =
+          ValueOr(s->encoder_implementation, std::string());
+    }
+
+    int64_t timestamp_us = report->timestamp_us();
+    double elapsed_sec = (timestamp_us - prev_timestamp_us_) / 1000000.0;
+    double encode_fps = 0;
+    double encode_ms_per_frame = 0;
+    double encode_cpu_percent = 0;
+    if (prev_timestamp_us_ != 0 && elapsed_sec > 0 &&
+        frames_encoded >= prev_frames_encoded_) {
+      uint64_t frames = frames_encoded - prev_frames_encoded_;
+      double encode_time = total_encode_time - prev_total_encode_time_;
+      encode_fps = frames / elapsed_sec;
+      encode_ms_per_frame = frames > 0 ? encode_time * 1000 / frames : 0;
+      // エンコーダが 1 コアを使い切った場合に 100 になる
+      encode_cpu_percent = encode_time / elapsed_sec * 100;
+    }
+    prev_timestamp_us_ = timestamp_us;
+    prev_frames_encoded_ = frames_encoded;
+    prev_total_encode_time_ = total_encode_time;
+
+    std::cout << "{\"track\":" << index_ << ",\"connection_id\":\""
+              << conn_->GetConnectionID() << "\""
+              << ",\"target_size\":\"" << track_.width << "x" << track_.height
+              << "\",\"target_fps\":" << track_.fps << ",\"sent_size\":\""
+              << width << "x" << height << "\""
+              << ",\"encode_fps\":" << encode_fps
+              << ",\"encode_ms_per_frame\":" << encode_ms_per_frame
+              << ",\"encode_cpu_percent\":" << encode_cpu_percent
+              << ",\"quality_limitation_reason\":\""
+              << quality_limitation_reason << "\""
+              << ",\"encoder_implementation\":\"" << encoder_implementation
+              << "\",\"process_cpu_percent\":" << process_cpu_percent << "}"
+              << std::endl;
+  }
+
+  boost::asio::io_context& ioc_;
+  int index_;
+  MultiTrackPublisherConfig::Track track_;
+  rtc::scoped_refptr<webrtc::VideoTrackInterface> video_track_;
+  rtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track_;
+  std::function<void()> on_disconnected_;
+  std::shared_ptr<sora::SoraSignaling> conn_;
+
+  // 以下は ioc_ のスレッドからしか触らない
+  int64_t prev_timestamp_us_ = 0;
+  uint64_t prev_frames_encoded_ = 0;
+  double prev_total_encode_time_ = 0;
+};
+
+MultiTrackPublisher::MultiTrackPublisher(
+    std::shared_ptr<sora::SoraClientContext> context,
+    boost::asio::io_context& ioc,
+    MultiTrackPublisherConfig config)
+    : context_(context), ioc_(ioc), config_(config), timer_(ioc) {}
+
+MultiTrackPublisher::~MultiTrackPublisher() {
+  timer_.cancel();
+  publishers_.clear();
+}
+
+void MultiTrackPublisher::Connect(std::function<void()> on_disconnected) {
+  on_disconnected_ = on_disconnected;
+
+  auto factory = context_->peer_connection_factory();
+  for (int i = 0; i < (int)config_.tracks.size(); i++) {
+    const auto& track = config_.tracks[i];
+    FakeVideoCapturerConfig fake_config;
+    fake_config.width = track.width;
+    fake_config.height = track.height;
+    fake_config.fps = track.fps;
+    fake_config.embed_timestamp = config_.embed_timestamp;
+    fake_config.y4m_file = config_.y4m_file;
+    auto video_source = FakeVideoCapturer::Create(fake_config);
+    auto video_track = factory->CreateVideoTrack(rtc::CreateRandomString(16),
+                                                 video_source.get());
+
+    // 音声は最初の接続だけで送信する
+    rtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track;
+    if (i == 0 && config_.signaling_config.audio) {
+      audio_track = factory->CreateAudioTrack(
+          rtc::CreateRandomString(16),
+          factory->CreateAudioSource(cricket::AudioOptions()).get());
+    }
+
+    auto publisher = std::make_shared<Publisher>(
+        ioc_, i, track, video_track, audio_track,
+        [this]() { OnPublisherDisconnected(); });
+    publishers_.push_back(publisher);
+  }
+
+  connected_count_ = (int)publishers_.size();
+  for (auto& publisher : publishers_) {
+    sora::SoraSignalingConfig config = config_.signaling_config;
+    config.pc_factory = factory;
+    config.io_context = &ioc_;
+    config.video = true;
+    publisher->Connect(config);
+  }
+
+  meter_.Reset();
+  ScheduleReport();
+}
+
+void MultiTrackPublisher::Disconnect() {
+  timer_.cancel();
+  for (auto& publisher : publishers_) {
+    publisher->Disconnect();
+  }
+}
+
+void MultiTrackPublisher::OnPublisherDisconnected() {
+  connected_count_--;
+  if (connected_count_ == 0) {
+    timer_.cancel();
+    if (on_disconnected_) {
+      on_disconnected_();
+    }
+  }
+}
+
+void MultiTrackPublisher::ScheduleReport() {
+  if (config_.report_interval <= 0) {
+    return;
+  }
+  timer_.expires_after(std::chrono::seconds(config_.report_interval));
+  timer_.async_wait([this](const boost::system::error_code& ec) {
+    if (ec) {
+      return;
+    }
+    double cpu_percent = meter_.GetCpuPercent();
+    meter_.Reset();
+    for (auto& publisher : publishers_) {
+      publisher->Report(cpu_percent);
+    }
+    ScheduleReport();
+  });
+}
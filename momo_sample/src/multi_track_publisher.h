@@ -0,0 +1,69 @@
+#ifndef MULTI_TRACK_PUBLISHER_H_
+#define MULTI_TRACK_PUBLISHER_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+
+// Sora
+#include <sora/sora_client_context.h>
+#include <sora/sora_signaling.h>
+
+#include "process_usage.h"
+
+struct MultiTrackPublisherConfig {
+  struct Track {
+    int width;
+    int height;
+    int fps;
+  };
+
+  // observer, pc_factory, io_context 以外はこの設定を全ての接続で使う
+  sora::SoraSignalingConfig signaling_config;
+  std::vector<Track> tracks;
+  // 空の場合は合成した映像を送信する
+  std::string y4m_file;
+  bool embed_timestamp = false;
+  // トラック毎のエンコード状況を出力する間隔 (秒)。0 の場合は出力しない
+  int report_interval = 5;
+};
+
+// 1 つのプロセスから複数の映像トラックを送信する。
+//
+// Sora は 1 つの接続で 1 本の映像しか送信できないので、トラック毎に接続を作るが、
+// SoraClientContext (スレッドやエンコーダファクトリ) は全ての接続で共有する。
+// エンコードはトラック毎のエンコーダのタスクキューで行われるので、複数のコアに分散される。
+//
+// 全てのメソッドは io_context のスレッドから呼ぶこと。
+class MultiTrackPublisher {
+ public:
+  MultiTrackPublisher(std::shared_ptr<sora::SoraClientContext> context,
+                      boost::asio::io_context& ioc,
+                      MultiTrackPublisherConfig config);
+  ~MultiTrackPublisher();
+
+  // 全ての接続が切断されたら on_disconnected が呼ばれる
+  void Connect(std::function<void()> on_disconnected);
+  void Disconnect();
+
+ private:
+  class Publisher;
+
+  void OnPublisherDisconnected();
+  void ScheduleReport();
+
+  std::shared_ptr<sora::SoraClientContext> context_;
+  boost::asio::io_context& ioc_;
+  MultiTrackPublisherConfig config_;
+  boost::asio::steady_timer timer_;
+  std::vector<std::shared_ptr<Publisher>> publishers_;
+  std::function<void()> on_disconnected_;
+  int connected_count_ = 0;
+  ProcessCpuMeter meter_;
+};
+
+#endif
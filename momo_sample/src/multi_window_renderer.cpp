@@ -0,0 +1,210 @@
+#include "multi_window_renderer.h"
+
+#include <algorithm>
+
+// WebRTC
+#include <rtc_base/logging.h>
+
+MultiWindowRenderer::MultiWindowRenderer(MultiWindowRendererConfig config)
+    : next_window_(0) {
+  for (int i = 0; i < std::max(1, config.window_count); i++) {
+    renderers_.push_back(std::unique_ptr<SDLRenderer>(
+        new SDLRenderer(config.width, config.height, config.fullscreen,
+                        config.software_compositor_threads)));
+  }
+  if (renderers_.size() > 1) {
+    // ディスプレイが足りない場合は、同じディスプレイに重ねて置く
+    int displays = std::max(1, SDL_GetNumVideoDisplays());
+    for (size_t i = 0; i < renderers_.size(); i++) {
+      renderers_[i]->MoveToDisplay(i % displays);
+    }
+    RTC_LOG(LS_INFO) << "Created " << renderers_.size() << " windows on "
+                     << displays << " displays";
+  }
+  // SDL_PollEvent は全てのウインドウのイベントを返すので、最初のウインドウでまとめて取り出す
+  renderers_[0]->SetEventCallback(
+      [this](const SDL_Event& e) { HandleEvent(e); });
+  for (size_t i = 1; i < renderers_.size(); i++) {
+    renderers_[i]->SetPollEvent(false);
+  }
+}
+
+int MultiWindowRenderer::GetWindowCount() const {
+  return renderers_.size();
+}
+
+void MultiWindowRenderer::SetDispatchFunction(
+    std::function<void(std::function<void()>)> dispatch) {
+  // PollEvent を呼ぶのは最初のウインドウだけだが、RenderGovernor によるフレームレートの制限を
+  // トラックに伝えるのにも使うので、全てのウインドウに設定する
+  for (auto& renderer : renderers_) {
+    renderer->SetDispatchFunction(dispatch);
+  }
+}
+
+void MultiWindowRenderer::SetMeasureLatency(bool measure_latency) {
+  for (auto& renderer : renderers_) {
+    renderer->SetMeasureLatency(measure_latency);
+  }
+}
+
+void MultiWindowRenderer::SetTileSizeCallback(
+    std::function<void(std::string track_id, int width, int height)>
+        callback) {
+  for (auto& renderer : renderers_) {
+    renderer->SetTileSizeCallback(callback);
+  }
+}
+
+void MultiWindowRenderer::SetSpotlightLayout(bool spotlight) {
+  for (auto& renderer : renderers_) {
+    renderer->SetSpotlightLayout(spotlight);
+  }
+}
+
+void MultiWindowRenderer::SetSpotlightTrack(const std::string& track_id) {
+  int window;
+  {
+    webrtc::MutexLock lock(&lock_);
+    spotlight_track_id_ = track_id;
+    auto it = track_windows_.find(track_id);
+    // まだ追加されていないトラックの場合は、AddTrack で設定する
+    if (it == track_windows_.end()) {
+      return;
+    }
+    window = it->second;
+  }
+  renderers_[window]->SetSpotlightTrack(track_id);
+}
+
+void MultiWindowRenderer::SetTilesPerPage(int tiles_per_page) {
+  for (auto& renderer : renderers_) {
+    renderer->SetTilesPerPage(tiles_per_page);
+  }
+}
+
+void MultiWindowRenderer::SetRenderThreadOptions(
+    const std::vector<int>& cpus,
+    const std::string& priority) {
+  for (size_t i = 0; i < renderers_.size(); i++) {
+    if (renderers_.size() == 1 || cpus.empty()) {
+      renderers_[i]->SetRenderThreadOptions(cpus, priority);
+    } else {
+      renderers_[i]->SetRenderThreadOptions({cpus[i % cpus.size()]},
+                                            priority);
+    }
+  }
+}
+
+std::vector<SDLRenderer::SinkStats> MultiWindowRenderer::GetSinkStats() {
+  std::vector<SDLRenderer::SinkStats> stats;
+  for (auto& renderer : renderers_) {
+    std::vector<SDLRenderer::SinkStats> v = renderer->GetSinkStats();
+    stats.insert(stats.end(), v.begin(), v.end());
+  }
+  return stats;
+}
+
+void MultiWindowRenderer::SetStatsOverlay(bool overlay) {
+  for (auto& renderer : renderers_) {
+    renderer->SetStatsOverlay(overlay);
+  }
+}
+
+void MultiWindowRenderer::SetRenderGovernor(bool enabled) {
+  for (auto& renderer : renderers_) {
+    renderer->SetRenderGovernor(enabled);
+  }
+}
+
+int MultiWindowRenderer::GetRenderGovernorLevel() {
+  int level = 0;
+  for (auto& renderer : renderers_) {
+    level = std::max(level, renderer->GetRenderGovernorLevel());
+  }
+  return level;
+}
+
+void MultiWindowRenderer::SetRenderGovernorBudget(int64_t budget_us) {
+  for (auto& renderer : renderers_) {
+    renderer->SetRenderGovernorBudget(budget_us);
+  }
+}
+
+void MultiWindowRenderer::SetRecordPresentIntervals(bool record) {
+  for (auto& renderer : renderers_) {
+    renderer->SetRecordPresentIntervals(record);
+  }
+}
+
+std::vector<int64_t> MultiWindowRenderer::TakePresentIntervalsUs() {
+  std::vector<int64_t> intervals;
+  for (auto& renderer : renderers_) {
+    std::vector<int64_t> v = renderer->TakePresentIntervalsUs();
+    intervals.insert(intervals.end(), v.begin(), v.end());
+  }
+  return intervals;
+}
+
+void MultiWindowRenderer::AssignTrack(const std::string& track_id,
+                                      int window) {
+  if (window < 0 || window >= (int)renderers_.size()) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Invalid window " << window
+                        << " for track " << track_id;
+    return;
+  }
+  webrtc::MutexLock lock(&lock_);
+  assigned_windows_[track_id] = window;
+}
+
+void MultiWindowRenderer::AddTrack(webrtc::VideoTrackInterface* track) {
+  std::string track_id = track->id();
+  int window;
+  bool spotlight;
+  {
+    webrtc::MutexLock lock(&lock_);
+    auto it = assigned_windows_.find(track_id);
+    if (it != assigned_windows_.end()) {
+      window = it->second;
+    } else {
+      window = next_window_;
+      next_window_ = (next_window_ + 1) % renderers_.size();
+    }
+    track_windows_[track_id] = window;
+    spotlight = track_id == spotlight_track_id_;
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": track_id=" << track_id
+                   << " window=" << window;
+  renderers_[window]->AddTrack(track);
+  if (spotlight) {
+    renderers_[window]->SetSpotlightTrack(track_id);
+  }
+}
+
+void MultiWindowRenderer::RemoveTrack(webrtc::VideoTrackInterface* track) {
+  int window;
+  {
+    webrtc::MutexLock lock(&lock_);
+    auto it = track_windows_.find(track->id());
+    if (it == track_windows_.end()) {
+      return;
+    }
+    window = it->second;
+    track_windows_.erase(it);
+  }
+  renderers_[window]->RemoveTrack(track);
+}
+
+void MultiWindowRenderer::AppendMetrics(MetricsWriter& writer) {
+  for (size_t i = 0; i < renderers_.size(); i++) {
+    renderers_[i]->AppendMetrics(writer, std::to_string(i));
+  }
+}
+
+void MultiWindowRenderer::HandleEvent(const SDL_Event& e) {
+  for (auto& renderer : renderers_) {
+    if (renderer->HandleEvent(e)) {
+      break;
+    }
+  }
+}
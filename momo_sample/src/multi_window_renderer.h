@@ -0,0 +1,82 @@
+#ifndef MULTI_WINDOW_RENDERER_H_
+#define MULTI_WINDOW_RENDERER_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// WebRTC
+#include <api/media_stream_interface.h>
+#include <rtc_base/synchronization/mutex.h>
+
+#include "sdl_renderer.h"
+
+struct MultiWindowRendererConfig {
+  int window_count = 1;
+  int width = 640;
+  int height = 480;
+  bool fullscreen = false;
+  // 0 の場合は SDL_Renderer で描画する
+  int software_compositor_threads = 0;
+};
+
+// 複数の SDLRenderer のウインドウに映像を振り分けて表示する。
+//
+// ウインドウ毎に描画スレッドとシンクとレイアウトを持つので、大量のタイルを表示する場合でも
+// 1 つの描画スレッドで全てのタイルを処理せずに済む。
+// ウインドウはディスプレイが複数ある場合は順番に別のディスプレイに配置する。
+// トラックは AssignTrack で指定したウインドウに、指定していない場合はラウンドロビンで振り分ける。
+// SDL のイベントは最初のウインドウでまとめて取り出して、イベントの対象のウインドウに渡す。
+// dispatch は全てのウインドウに設定して、各ウインドウのタイルの VideoSinkWants の更新に使う。
+class MultiWindowRenderer {
+ public:
+  // メインスレッドで作ること
+  MultiWindowRenderer(MultiWindowRendererConfig config);
+
+  int GetWindowCount() const;
+
+  void SetDispatchFunction(std::function<void(std::function<void()>)> dispatch);
+  void SetMeasureLatency(bool measure_latency);
+  void SetTileSizeCallback(
+      std::function<void(std::string track_id, int width, int height)>
+          callback);
+  void SetSpotlightLayout(bool spotlight);
+  // track_id を表示しているウインドウの話者だけを切り替える
+  void SetSpotlightTrack(const std::string& track_id);
+  void SetTilesPerPage(int tiles_per_page);
+  // ウインドウが複数ある場合は、cpus の CPU をウインドウ毎に 1 つずつ順番に割り当てる
+  void SetRenderThreadOptions(const std::vector<int>& cpus,
+                              const std::string& priority);
+  // 全てのウインドウのシンクの統計をまとめて返す
+  std::vector<SDLRenderer::SinkStats> GetSinkStats();
+  void SetStatsOverlay(bool overlay);
+  // ウインドウ毎に描画の時間を見て、そのウインドウのタイルのフレームレートを制限する
+  void SetRenderGovernor(bool enabled);
+  // 全てのウインドウの RenderGovernor の段階のうち、一番高いもの
+  int GetRenderGovernorLevel();
+  void SetRenderGovernorBudget(int64_t budget_us);
+  // 全てのウインドウの描画の間隔をまとめて取り出す
+  void SetRecordPresentIntervals(bool record);
+  std::vector<int64_t> TakePresentIntervalsUs();
+
+  // track_id のトラックを window 番目のウインドウに表示する。AddTrack より前に呼ぶこと
+  void AssignTrack(const std::string& track_id, int window);
+  void AddTrack(webrtc::VideoTrackInterface* track);
+  void RemoveTrack(webrtc::VideoTrackInterface* track);
+
+  void AppendMetrics(MetricsWriter& writer);
+
+ private:
+  void HandleEvent(const SDL_Event& e);
+
+  std::vector<std::unique_ptr<SDLRenderer>> renderers_;
+  webrtc::Mutex lock_;
+  std::map<std::string, int> assigned_windows_;
+  std::map<std::string, int> track_windows_;
+  std::string spotlight_track_id_;
+  int next_window_;
+};
+
+#endif
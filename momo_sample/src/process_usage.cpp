@@ -0,0 +1,85 @@
+#include "process_usage.h"
+
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+int64_t NowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+int64_t GetProcessCpuTimeUs() {
+#ifdef _WIN32
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time,
+                       &kernel_time, &user_time)) {
+    return 0;
+  }
+  auto to_us = [](const FILETIME& t) {
+    // 100 ナノ秒単位
+    return (int64_t)(((uint64_t)t.dwHighDateTime << 32) | t.dwLowDateTime) /
+           10;
+  };
+  return to_us(kernel_time) + to_us(user_time);
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return (int64_t)usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec +
+         (int64_t)usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec;
+#endif
+}
+
+int64_t GetProcessMaxRssKb() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return (int64_t)counters.PeakWorkingSetSize / 1024;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#if defined(__APPLE__)
+  // macOS はバイト単位
+  return (int64_t)usage.ru_maxrss / 1024;
+#else
+  return (int64_t)usage.ru_maxrss;
+#endif
+#endif
+}
+
+ProcessCpuMeter::ProcessCpuMeter() {
+  Reset();
+}
+
+void ProcessCpuMeter::Reset() {
+  start_cpu_time_us_ = GetProcessCpuTimeUs();
+  start_time_us_ = NowUs();
+}
+
+double ProcessCpuMeter::GetCpuPercent() const {
+  int64_t elapsed_us = NowUs() - start_time_us_;
+  if (elapsed_us <= 0) {
+    return 0;
+  }
+  return (GetProcessCpuTimeUs() - start_cpu_time_us_) * 100.0 / elapsed_us;
+}
+
+double ProcessCpuMeter::GetElapsedSec() const {
+  return (NowUs() - start_time_us_) / 1000000.0;
+}
@@ -0,0 +1,25 @@
+#ifndef PROCESS_USAGE_H_
+#define PROCESS_USAGE_H_
+
+#include <cstdint>
+
+// プロセス全体で使った CPU 時間 (ユーザー + カーネル) をマイクロ秒で返す
+int64_t GetProcessCpuTimeUs();
+// プロセスの最大 RSS を KiB で返す
+int64_t GetProcessMaxRssKb();
+
+// 計測区間の CPU 使用率を計算する。
+// 1 コアを使い切った場合に 100 になる。
+class ProcessCpuMeter {
+ public:
+  ProcessCpuMeter();
+  void Reset();
+  double GetCpuPercent() const;
+  double GetElapsedSec() const;
+
+ private:
+  int64_t start_cpu_time_us_;
+  int64_t start_time_us_;
+};
+
+#endif
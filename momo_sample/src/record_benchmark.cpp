@@ -0,0 +1,220 @@
+// Sora
+#include <sora/sora_client_context.h>
+
+#include <iostream>
+#include <vector>
+
+// CLI11
+#include <CLI/CLI.hpp>
+
+#include "encoded_frame_recorder.h"
+#include "fake_video_capturer.h"
+#include "loopback_connection.h"
+#include "process_usage.h"
+
+#ifdef _WIN32
+#include <rtc_base/win/scoped_com_initializer.h>
+#endif
+
+// プロセス内で送信側と受信側の PeerConnection を繋いで、
+// 受信した映像を EncodedFrameRecorder で録画した時のスループットを計測する
+struct RecordBenchmarkConfig {
+  int track_count = 10;
+  int track_width = 640;
+  int track_height = 480;
+  int fps = 30;
+  std::string video_codec_type = "VP8";
+  std::string record_dir = ".";
+  bool record_only = false;
+  int warmup = 3;
+  int duration = 10;
+};
+
+class RecordBenchmark {
+ public:
+  RecordBenchmark(std::shared_ptr<sora::SoraClientContext> context,
+                  RecordBenchmarkConfig config)
+      : context_(context), config_(config) {}
+
+  bool Run() {
+    ioc_.reset(new boost::asio::io_context(1));
+
+    EncodedFrameRecorderConfig recorder_config;
+    recorder_config.dir = config_.record_dir;
+    recorder_.reset(new EncodedFrameRecorder(recorder_config));
+    recorder_->Start();
+
+    LoopbackConnectionConfig conn_config;
+    conn_config.video_codec_type = config_.video_codec_type;
+    conn_ = LoopbackConnection::Create(
+        context_->peer_connection_factory(), conn_config,
+        [this](rtc::scoped_refptr<webrtc::RtpTransceiverInterface>
+                   transceiver) {
+          recorder_->AddReceiver(transceiver->receiver());
+        });
+    if (conn_ == nullptr) {
+      return false;
+    }
+
+    for (int i = 0; i < config_.track_count; i++) {
+      FakeVideoCapturerConfig fake_config;
+      fake_config.width = config_.track_width;
+      fake_config.height = config_.track_height;
+      fake_config.fps = config_.fps;
+      auto video_source = FakeVideoCapturer::Create(fake_config);
+      auto track = context_->peer_connection_factory()->CreateVideoTrack(
+          rtc::CreateRandomString(16), video_source.get());
+      if (!conn_->AddTrack(track)) {
+        return false;
+      }
+      tracks_.push_back(track);
+    }
+    conn_->Connect();
+
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+        work_guard(ioc_->get_executor());
+
+    boost::asio::signal_set signals(*ioc_, SIGINT, SIGTERM);
+    signals.async_wait(
+        [this](const boost::system::error_code&, int) { ioc_->stop(); });
+
+    // 接続とキーフレームの到着を待ってから計測する
+    ProcessCpuMeter meter;
+    uint64_t start_frames = 0;
+    uint64_t start_bytes = 0;
+    uint64_t start_dropped = 0;
+    boost::asio::steady_timer timer(*ioc_);
+    timer.expires_after(std::chrono::seconds(config_.warmup));
+    timer.async_wait([&](boost::system::error_code ec) {
+      if (ec) {
+        return;
+      }
+      meter.Reset();
+      start_frames = recorder_->GetWrittenFrames();
+      start_bytes = recorder_->GetWrittenBytes();
+      start_dropped = recorder_->GetDroppedFrames();
+      timer.expires_after(std::chrono::seconds(config_.duration));
+      timer.async_wait([this](boost::system::error_code ec) {
+        if (ec) {
+          return;
+        }
+        ioc_->stop();
+      });
+    });
+
+    ioc_->run();
+
+    double elapsed_sec = meter.GetElapsedSec();
+    double cpu_percent = meter.GetCpuPercent();
+    uint64_t frames = recorder_->GetWrittenFrames() - start_frames;
+    uint64_t bytes = recorder_->GetWrittenBytes() - start_bytes;
+    uint64_t dropped = recorder_->GetDroppedFrames() - start_dropped;
+
+    conn_.reset();
+    recorder_.reset();
+    tracks_.clear();
+
+    std::cout << "{\"track_count\":" << config_.track_count
+              << ",\"track_width\":" << config_.track_width
+              << ",\"track_height\":" << config_.track_height
+              << ",\"fps\":" << config_.fps << ",\"video_codec_type\":\""
+              << config_.video_codec_type << "\""
+              << ",\"record_only\":" << (config_.record_only ? "true" : "false")
+              << ",\"elapsed_sec\":" << elapsed_sec
+              << ",\"recorded_frames\":" << frames
+              << ",\"recorded_fps\":"
+              << (elapsed_sec > 0 ? frames / elapsed_sec : 0)
+              << ",\"recorded_mbps\":"
+              << (elapsed_sec > 0 ? bytes * 8 / elapsed_sec / 1000000 : 0)
+              << ",\"dropped_frames\":" << dropped
+              << ",\"cpu_percent\":" << cpu_percent
+              << ",\"max_rss_kb\":" << GetProcessMaxRssKb() << "}"
+              << std::endl;
+    return true;
+  }
+
+ private:
+  std::shared_ptr<sora::SoraClientContext> context_;
+  RecordBenchmarkConfig config_;
+  std::unique_ptr<boost::asio::io_context> ioc_;
+  std::unique_ptr<EncodedFrameRecorder> recorder_;
+  std::unique_ptr<LoopbackConnection> conn_;
+  std::vector<rtc::scoped_refptr<webrtc::VideoTrackInterface>> tracks_;
+};
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+  webrtc::ScopedCOMInitializer com_initializer(
+      webrtc::ScopedCOMInitializer::kMTA);
+  if (!com_initializer.Succeeded()) {
+    std::cerr << "CoInitializeEx failed" << std::endl;
+    return 1;
+  }
+#endif
+
+  RecordBenchmarkConfig config;
+
+  CLI::App app("Record Benchmark for Sora C++ SDK Samples");
+
+  int log_level = (int)rtc::LS_ERROR;
+  auto log_level_map = std::vector<std::pair<std::string, int>>(
+      {{"verbose", 0}, {"info", 1}, {"warning", 2}, {"error", 3}, {"none", 4}});
+  app.add_option("--log-level", log_level, "Log severity level threshold")
+      ->transform(CLI::CheckedTransformer(log_level_map, CLI::ignore_case));
+  app.add_option("--track-count", config.track_count,
+                 "Number of synthetic video tracks")
+      ->check(CLI::Range(1, 1000));
+  app.add_option("--track-width", config.track_width,
+                 "Width of synthetic video")
+      ->check(CLI::Range(16, 3840));
+  app.add_option("--track-height", config.track_height,
+                 "Height of synthetic video")
+      ->check(CLI::Range(16, 2160));
+  app.add_option("--fps", config.fps, "Frame rate of synthetic video")
+      ->check(CLI::Range(1, 60));
+  app.add_option("--video-codec-type", config.video_codec_type,
+                 "Video codec for send")
+      ->check(CLI::IsMember({"VP8", "VP9", "AV1", "H264"}));
+  app.add_option("--record-dir", config.record_dir,
+                 "Directory to write IVF files");
+  app.add_flag("--record-only", config.record_only,
+               "Do not decode received video");
+  app.add_option("--warmup", config.warmup, "Warm-up time in seconds")
+      ->check(CLI::Range(0, 60));
+  app.add_option("--duration", config.duration,
+                 "Measurement time in seconds")
+      ->check(CLI::Range(1, 3600));
+
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    exit(app.exit(e));
+  }
+
+  if (log_level != rtc::LS_NONE) {
+    rtc::LogMessage::LogToDebug((rtc::LoggingSeverity)log_level);
+    rtc::LogMessage::LogTimestamps();
+    rtc::LogMessage::LogThreads();
+  }
+
+  sora::SoraClientContextConfig context_config;
+  context_config.use_audio_device = false;
+  context_config.use_hardware_encoder = false;
+  if (config.record_only) {
+    context_config.configure_media_dependencies =
+        [](const webrtc::PeerConnectionFactoryDependencies& dependencies,
+           cricket::MediaEngineDependencies& media_dependencies) {
+          media_dependencies.video_decoder_factory =
+              CreateRecordOnlyVideoDecoderFactory(
+                  std::move(media_dependencies.video_decoder_factory));
+        };
+  }
+  auto context = sora::SoraClientContext::Create(context_config);
+
+  RecordBenchmark benchmark(context, config);
+  if (!benchmark.Run()) {
+    return 1;
+  }
+
+  return 0;
+}
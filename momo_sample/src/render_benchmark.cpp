@@ -0,0 +1,368 @@
+// Sora
+#include <sora/sora_client_context.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// CLI11
+#include <CLI/CLI.hpp>
+
+#include "fake_video_capturer.h"
+#include "process_usage.h"
+#include "multi_window_renderer.h"
+#include "thread_affinity.h"
+
+#ifdef _WIN32
+#include <rtc_base/win/scoped_com_initializer.h>
+#endif
+
+// Sora に接続せずに、合成した映像のトラックを大量に MultiWindowRenderer に追加して、
+// 描画にかかる CPU 使用率とメモリ使用量を計測する。
+// 描画スレッドの CPU の固定や優先度の効果を比べるために、描画の間隔のばらつきも出力する。
+// --software-compositor-threads を指定すると、SDL_Renderer を使わないソフトウェア合成で描画する。
+// --window-count を指定すると、ウインドウ毎の描画スレッドにトラックを振り分けて描画する。
+// --render-governor を指定すると、描画が間に合わない場合に小さいタイルからフレームレートを落とすので、
+// --track-count を増やしながら実行して、描画の間隔と描画したフレーム数を比べる
+struct RenderBenchmarkConfig {
+  int track_count = 100;
+  int track_width = 640;
+  int track_height = 480;
+  int fps = 30;
+  int tiles_per_page = 9;
+  bool spotlight_layout = false;
+  int warmup = 3;
+  int duration = 10;
+  int window_width = 1280;
+  int window_height = 720;
+  std::vector<int> render_cpus;
+  std::string render_thread_priority = "normal";
+  // CPU を使い続けるだけのスレッドの数
+  int load_threads = 0;
+  // 0 の場合は SDL_Renderer で描画する
+  int software_compositor_threads = 0;
+  int window_count = 1;
+  // "round-robin" は追加した順に振り分けて、"explicit" は AssignTrack で連続した範囲に振り分ける
+  std::string window_assign = "round-robin";
+  bool render_governor = false;
+};
+
+namespace {
+
+struct PresentIntervalStats {
+  double mean_ms = 0;
+  double stddev_ms = 0;
+  double p50_ms = 0;
+  double p99_ms = 0;
+  double max_ms = 0;
+};
+
+PresentIntervalStats GetPresentIntervalStats(std::vector<int64_t> intervals) {
+  PresentIntervalStats stats;
+  if (intervals.empty()) {
+    return stats;
+  }
+  std::sort(intervals.begin(), intervals.end());
+  double sum = 0;
+  for (int64_t interval : intervals) {
+    sum += interval;
+  }
+  double mean = sum / intervals.size();
+  double variance = 0;
+  for (int64_t interval : intervals) {
+    variance += (interval - mean) * (interval - mean);
+  }
+  variance /= intervals.size();
+  stats.mean_ms = mean / 1000.0;
+  stats.stddev_ms = std::sqrt(variance) / 1000.0;
+  stats.p50_ms = intervals[intervals.size() / 2] / 1000.0;
+  stats.p99_ms = intervals[(intervals.size() - 1) * 99 / 100] / 1000.0;
+  stats.max_ms = intervals.back() / 1000.0;
+  return stats;
+}
+
+// 表示していないタイルのトラックはシンクが外れて、FakeVideoCapturer が
+// フレームを作らなくなるので、全てのソースにこのシンクを付けて作り続けさせる
+class CountingNullSink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  void OnFrame(const webrtc::VideoFrame& frame) override {
+    frames_.fetch_add(1, std::memory_order_relaxed);
+  }
+  uint64_t GetFrames() const {
+    return frames_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<uint64_t> frames_{0};
+};
+
+}  // namespace
+
+class RenderBenchmark {
+ public:
+  RenderBenchmark(std::shared_ptr<sora::SoraClientContext> context,
+                  RenderBenchmarkConfig config)
+      : context_(context), config_(config) {}
+
+  void Run() {
+    ioc_.reset(new boost::asio::io_context(1));
+
+    MultiWindowRendererConfig renderer_config;
+    renderer_config.window_count = config_.window_count;
+    renderer_config.width = config_.window_width;
+    renderer_config.height = config_.window_height;
+    renderer_config.software_compositor_threads =
+        config_.software_compositor_threads;
+    renderer_.reset(new MultiWindowRenderer(renderer_config));
+    renderer_->SetTilesPerPage(config_.tiles_per_page);
+    renderer_->SetSpotlightLayout(config_.spotlight_layout);
+    renderer_->SetRenderThreadOptions(config_.render_cpus,
+                                      config_.render_thread_priority);
+    renderer_->SetRecordPresentIntervals(true);
+    renderer_->SetRenderGovernor(config_.render_governor);
+
+    // 他のプロセスやデコーダのスレッドと CPU を取り合う状況を再現する
+    std::atomic<bool> load_running(true);
+    std::vector<std::thread> load_threads;
+    for (int i = 0; i < config_.load_threads; i++) {
+      load_threads.push_back(std::thread([&load_running]() {
+        volatile uint64_t n = 0;
+        while (load_running.load(std::memory_order_relaxed)) {
+          n = n + 1;
+        }
+      }));
+    }
+
+    for (int i = 0; i < config_.track_count; i++) {
+      FakeVideoCapturerConfig fake_config;
+      fake_config.width = config_.track_width;
+      fake_config.height = config_.track_height;
+      fake_config.fps = config_.fps;
+      auto video_source = FakeVideoCapturer::Create(fake_config);
+      std::unique_ptr<CountingNullSink> null_sink(new CountingNullSink());
+      video_source->AddOrUpdateSink(null_sink.get(), rtc::VideoSinkWants());
+      auto track = context_->peer_connection_factory()->CreateVideoTrack(
+          rtc::CreateRandomString(16), video_source.get());
+      if (config_.window_assign == "explicit") {
+        renderer_->AssignTrack(
+            track->id(), i * config_.window_count / config_.track_count);
+      }
+      renderer_->AddTrack(track.get());
+      tracks_.push_back(track);
+      video_sources_.push_back(video_source);
+      null_sinks_.push_back(std::move(null_sink));
+    }
+
+    renderer_->SetDispatchFunction([this](std::function<void()> f) {
+      if (ioc_->stopped())
+        return;
+      boost::asio::dispatch(ioc_->get_executor(), f);
+    });
+
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+        work_guard(ioc_->get_executor());
+
+    boost::asio::signal_set signals(*ioc_, SIGINT, SIGTERM);
+    signals.async_wait(
+        [this](const boost::system::error_code&, int) { ioc_->stop(); });
+
+    // 起動直後の負荷を除くために、ウォームアップ後から計測する
+    ProcessCpuMeter meter;
+    boost::asio::steady_timer timer(*ioc_);
+    timer.expires_after(std::chrono::seconds(config_.warmup));
+    timer.async_wait([this, &meter, &timer](boost::system::error_code ec) {
+      if (ec) {
+        return;
+      }
+      meter.Reset();
+      renderer_->TakePresentIntervalsUs();
+      frames_rendered_at_start_ = GetFramesRendered();
+      frames_captured_at_start_ = GetFramesCaptured();
+      timer.expires_after(std::chrono::seconds(config_.duration));
+      timer.async_wait([this](boost::system::error_code ec) {
+        if (ec) {
+          return;
+        }
+        ioc_->stop();
+      });
+    });
+
+    ioc_->run();
+
+    PresentIntervalStats present =
+        GetPresentIntervalStats(renderer_->TakePresentIntervalsUs());
+    uint64_t frames_rendered = GetFramesRendered() - frames_rendered_at_start_;
+    uint64_t frames_captured = GetFramesCaptured() - frames_captured_at_start_;
+    int governor_level = renderer_->GetRenderGovernorLevel();
+    load_running = false;
+    for (auto& thread : load_threads) {
+      thread.join();
+    }
+
+    std::cout << "{\"track_count\":" << config_.track_count
+              << ",\"track_width\":" << config_.track_width
+              << ",\"track_height\":" << config_.track_height
+              << ",\"fps\":" << config_.fps
+              << ",\"tiles_per_page\":" << config_.tiles_per_page
+              << ",\"spotlight_layout\":"
+              << (config_.spotlight_layout ? "true" : "false")
+              << ",\"render_cpus\":" << config_.render_cpus.size()
+              << ",\"render_thread_priority\":\""
+              << config_.render_thread_priority << "\""
+              << ",\"load_threads\":" << config_.load_threads
+              << ",\"software_compositor_threads\":"
+              << config_.software_compositor_threads
+              << ",\"window_count\":" << config_.window_count
+              << ",\"window_assign\":\"" << config_.window_assign << "\""
+              << ",\"render_governor\":"
+              << (config_.render_governor ? "true" : "false")
+              << ",\"governor_level\":" << governor_level
+              << ",\"elapsed_sec\":" << meter.GetElapsedSec()
+              << ",\"cpu_percent\":" << meter.GetCpuPercent()
+              << ",\"max_rss_kb\":" << GetProcessMaxRssKb()
+              << ",\"present_interval_mean_ms\":" << present.mean_ms
+              << ",\"present_interval_stddev_ms\":" << present.stddev_ms
+              << ",\"present_interval_p50_ms\":" << present.p50_ms
+              << ",\"present_interval_p99_ms\":" << present.p99_ms
+              << ",\"present_interval_max_ms\":" << present.max_ms
+              << ",\"frames_rendered_per_sec\":"
+              << frames_rendered / meter.GetElapsedSec()
+              << ",\"frames_captured_per_sec\":"
+              << frames_captured / meter.GetElapsedSec() << "}"
+              << std::endl;
+
+    renderer_.reset();
+    tracks_.clear();
+    for (size_t i = 0; i < video_sources_.size(); i++) {
+      video_sources_[i]->RemoveSink(null_sinks_[i].get());
+    }
+    video_sources_.clear();
+    null_sinks_.clear();
+  }
+
+ private:
+  // 全てのタイルで描画したフレームの数
+  uint64_t GetFramesRendered() {
+    uint64_t frames = 0;
+    for (const SDLRenderer::SinkStats& stats : renderer_->GetSinkStats()) {
+      frames += stats.frames_rendered;
+    }
+    return frames;
+  }
+
+  // 全てのソースが作ったフレームの数
+  uint64_t GetFramesCaptured() {
+    uint64_t frames = 0;
+    for (const auto& sink : null_sinks_) {
+      frames += sink->GetFrames();
+    }
+    return frames;
+  }
+
+  std::shared_ptr<sora::SoraClientContext> context_;
+  RenderBenchmarkConfig config_;
+  std::unique_ptr<boost::asio::io_context> ioc_;
+  std::unique_ptr<MultiWindowRenderer> renderer_;
+  std::vector<rtc::scoped_refptr<webrtc::VideoTrackInterface>> tracks_;
+  std::vector<rtc::scoped_refptr<FakeVideoCapturer>> video_sources_;
+  std::vector<std::unique_ptr<CountingNullSink>> null_sinks_;
+  uint64_t frames_rendered_at_start_ = 0;
+  uint64_t frames_captured_at_start_ = 0;
+};
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+  webrtc::ScopedCOMInitializer com_initializer(
+      webrtc::ScopedCOMInitializer::kMTA);
+  if (!com_initializer.Succeeded()) {
+    std::cerr << "CoInitializeEx failed" << std::endl;
+    return 1;
+  }
+#endif
+
+  RenderBenchmarkConfig config;
+
+  CLI::App app("Render Benchmark for Sora C++ SDK Samples");
+
+  int log_level = (int)rtc::LS_ERROR;
+  auto log_level_map = std::vector<std::pair<std::string, int>>(
+      {{"verbose", 0}, {"info", 1}, {"warning", 2}, {"error", 3}, {"none", 4}});
+  app.add_option("--log-level", log_level, "Log severity level threshold")
+      ->transform(CLI::CheckedTransformer(log_level_map, CLI::ignore_case));
+  app.add_option("--track-count", config.track_count,
+                 "Number of synthetic video tracks")
+      ->check(CLI::Range(1, 1000));
+  app.add_option("--track-width", config.track_width,
+                 "Width of synthetic video")
+      ->check(CLI::Range(16, 3840));
+  app.add_option("--track-height", config.track_height,
+                 "Height of synthetic video")
+      ->check(CLI::Range(16, 2160));
+  app.add_option("--fps", config.fps, "Frame rate of synthetic video")
+      ->check(CLI::Range(1, 60));
+  app.add_option("--tiles-per-page", config.tiles_per_page,
+                 "Max tiles per page (0: show all tiles)")
+      ->check(CLI::Range(0, 1000));
+  app.add_flag("--spotlight-layout", config.spotlight_layout,
+               "Use spotlight layout");
+  app.add_option("--warmup", config.warmup, "Warm-up time in seconds")
+      ->check(CLI::Range(0, 60));
+  app.add_option("--duration", config.duration,
+                 "Measurement time in seconds")
+      ->check(CLI::Range(1, 3600));
+  app.add_option("--window-width", config.window_width, "SDL window width");
+  app.add_option("--window-height", config.window_height,
+                 "SDL window height");
+  app.add_option_function<std::string>(
+      "--render-cpus",
+      [&config](const std::string& input) {
+        if (!ParseCpuList(input, config.render_cpus)) {
+          throw CLI::ValidationError("--render-cpus", input);
+        }
+      },
+      "CPUs to pin the render thread to (e.g. 2,4-5)");
+  app.add_option("--render-thread-priority", config.render_thread_priority,
+                 "Scheduling priority of the render thread (default: normal)")
+      ->check(CLI::IsMember({"normal", "high", "realtime"}));
+  app.add_option("--load-threads", config.load_threads,
+                 "Number of busy-loop threads to add synthetic CPU load")
+      ->check(CLI::Range(0, 256));
+  app.add_option("--software-compositor-threads",
+                 config.software_compositor_threads,
+                 "Compose tiles on the CPU with N threads (0: disabled)")
+      ->check(CLI::Range(0, 64));
+  app.add_option("--window-count", config.window_count,
+                 "Number of windows, each with its own render thread")
+      ->check(CLI::Range(1, 16));
+  app.add_option("--window-assign", config.window_assign,
+                 "How to assign tracks to windows (default: round-robin)")
+      ->check(CLI::IsMember({"round-robin", "explicit"}));
+  app.add_flag("--render-governor", config.render_governor,
+               "Lower frame rate of small tiles when rendering falls behind");
+
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    exit(app.exit(e));
+  }
+
+  if (log_level != rtc::LS_NONE) {
+    rtc::LogMessage::LogToDebug((rtc::LoggingSeverity)log_level);
+    rtc::LogMessage::LogTimestamps();
+    rtc::LogMessage::LogThreads();
+  }
+
+  sora::SoraClientContextConfig context_config;
+  context_config.use_audio_device = false;
+  context_config.use_hardware_encoder = false;
+  auto context = sora::SoraClientContext::Create(context_config);
+
+  RenderBenchmark benchmark(context, config);
+  benchmark.Run();
+
+  return 0;
+}
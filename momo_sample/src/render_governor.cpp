@@ -0,0 +1,104 @@
+#include "render_governor.h"
+
+#include <algorithm>
+
+// 判断に使う描画の回数
+#define GOVERNOR_WINDOW 15
+// 平均の描画時間が予算のこの割合を超えたら段階を上げる
+#define GOVERNOR_HIGH_PERCENT 90
+// 平均の描画時間が予算のこの割合を下回る判断が GOVERNOR_RECOVER_WINDOWS 回続いたら段階を下げる
+#define GOVERNOR_LOW_PERCENT 60
+#define GOVERNOR_RECOVER_WINDOWS 4
+// 1 段階で制限するタイルの割合の分母。GOVERNOR_STEPS_PER_TIER 段階で全てのタイルが次のフレームレートになる
+#define GOVERNOR_STEPS_PER_TIER 4
+
+namespace {
+
+// 段階が進むにつれて、重要度の低いタイルから順にこのフレームレートまで落とす
+const int kTierFps[] = {15, 5, 2};
+const int kTierCount = sizeof(kTierFps) / sizeof(kTierFps[0]);
+const int kMaxLevel = kTierCount * GOVERNOR_STEPS_PER_TIER;
+
+}  // namespace
+
+RenderGovernor::RenderGovernor(int64_t budget_us)
+    : budget_us_(budget_us),
+      level_(0),
+      samples_(0),
+      total_us_(0),
+      mean_us_(0),
+      headroom_windows_(0),
+      settling_(false) {}
+
+bool RenderGovernor::AddRenderTime(int64_t render_us) {
+  total_us_ += render_us;
+  if (++samples_ < GOVERNOR_WINDOW) {
+    return false;
+  }
+  mean_us_ = total_us_ / samples_;
+  samples_ = 0;
+  total_us_ = 0;
+  if (settling_) {
+    settling_ = false;
+    return false;
+  }
+
+  int level = level_;
+  if (mean_us_ * 100 > budget_us_ * GOVERNOR_HIGH_PERCENT) {
+    headroom_windows_ = 0;
+    level = std::min(level_ + 1, kMaxLevel);
+  } else if (mean_us_ * 100 < budget_us_ * GOVERNOR_LOW_PERCENT) {
+    if (++headroom_windows_ >= GOVERNOR_RECOVER_WINDOWS) {
+      headroom_windows_ = 0;
+      level = std::max(level_ - 1, 0);
+    }
+  } else {
+    headroom_windows_ = 0;
+  }
+  if (level == level_) {
+    return false;
+  }
+  level_ = level;
+  settling_ = true;
+  return true;
+}
+
+void RenderGovernor::Reset() {
+  level_ = 0;
+  samples_ = 0;
+  total_us_ = 0;
+  mean_us_ = 0;
+  headroom_windows_ = 0;
+  settling_ = false;
+}
+
+void RenderGovernor::SetBudget(int64_t budget_us) {
+  budget_us_ = budget_us;
+}
+
+int RenderGovernor::GetLevel() const {
+  return level_;
+}
+
+int64_t RenderGovernor::GetMeanRenderUs() const {
+  return mean_us_;
+}
+
+int RenderGovernor::GetMaxFramerate(int index, int tile_count) const {
+  int max_fps = 0;
+  for (int tier = 0; tier < kTierCount; tier++) {
+    int steps = level_ - tier * GOVERNOR_STEPS_PER_TIER;
+    if (steps <= 0) {
+      break;
+    }
+    // この段階のフレームレートまで落とすタイルの数。切り上げて、1 段階で少なくとも 1 つは落とす
+    int count = std::min(
+        tile_count, (tile_count * steps + GOVERNOR_STEPS_PER_TIER - 1) /
+                        GOVERNOR_STEPS_PER_TIER);
+    if (index >= count) {
+      break;
+    }
+    max_fps = kTierFps[tier];
+  }
+  return max_fps;
+}
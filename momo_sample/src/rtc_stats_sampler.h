@@ -0,0 +1,100 @@
+#ifndef RTC_STATS_SAMPLER_H_
+#define RTC_STATS_SAMPLER_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Boost
+#include <boost/asio.hpp>
+
+// WebRTC
+#include <api/peer_connection_interface.h>
+#include <api/scoped_refptr.h>
+#include <api/stats/rtc_stats_report.h>
+#include <rtc_base/synchronization/mutex.h>
+
+struct RTCStatsSamplerConfig {
+  // 統計情報を取得する間隔 (秒)
+  int interval = 0;
+  std::string file;
+  // "json" の場合は JSON Lines で追記し、
+  // "prometheus" の場合は Prometheus のテキスト形式でファイルを置き換える
+  std::string format = "json";
+};
+
+// PeerConnection の GetStats を定期的に呼び出して、
+// SSRC 毎のビットレートやフレームレートなどの差分をファイルに出力する。
+//
+// タイマー、差分の計算、ファイルへの書き込みは全て専用のスレッドで行うので、
+// 描画スレッドやシグナリングスレッドをブロックすることはない。
+class RTCStatsSampler {
+ public:
+  RTCStatsSampler(RTCStatsSamplerConfig config);
+  ~RTCStatsSampler();
+
+  void Start();
+  void SetPeerConnection(
+      rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc);
+
+ private:
+  // 同時に扱える SSRC の最大数
+  static constexpr int kMaxSlots = 64;
+
+  struct Slot {
+    bool used = false;
+    bool seen = false;
+    bool outbound = false;
+    bool video = false;
+    uint32_t ssrc = 0;
+    int64_t timestamp_us = 0;
+    uint64_t bytes = 0;
+    uint64_t packets = 0;
+    int64_t packets_lost = 0;
+    uint64_t frames = 0;
+    uint64_t frames_dropped = 0;
+    double jitter_buffer_delay = 0;
+    uint64_t jitter_buffer_emitted_count = 0;
+
+    double bitrate_bps = 0;
+    double fps = 0;
+    double loss_rate = 0;
+    double jitter_buffer_delay_ms = 0;
+    double jitter_ms = 0;
+    double rtt_ms = 0;
+  };
+
+  class Callback;
+  struct Shared {
+    webrtc::Mutex mutex;
+    RTCStatsSampler* sampler = nullptr;
+  };
+
+  void ScheduleNext();
+  void Collect();
+  void OnStatsDelivered(rtc::scoped_refptr<const webrtc::RTCStatsReport> report);
+  Slot* FindSlot(uint32_t ssrc, bool outbound);
+  void WriteJson(int64_t timestamp_us);
+  void WritePrometheus();
+
+  RTCStatsSamplerConfig config_;
+  boost::asio::io_context ioc_;
+  boost::asio::steady_timer timer_;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+      work_guard_;
+  std::thread thread_;
+  std::shared_ptr<Shared> shared_;
+  webrtc::Mutex pc_lock_;
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_;
+  std::atomic<bool> collecting_;
+
+  // 以下は全て ioc_ のスレッドからしか触らない
+  std::array<Slot, kMaxSlots> slots_;
+  double connection_rtt_ms_;
+  std::string buffer_;
+};
+
+#endif
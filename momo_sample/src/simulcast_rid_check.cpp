@@ -0,0 +1,348 @@
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/json.hpp>
+
+// WebRTC
+#include <rtc_base/logging.h>
+
+#include "simulcast_rid_controller.h"
+
+// SimulcastRidController が Sora API に送る RequestSimulcastRid を、
+// ローカルに立てた HTTP サーバで記録して、タイルの大きさの変化に対して
+// 期待通りの rid と connection_id の組み合わせを要求しているかを確認する。
+// 期待と異なる場合は 0 以外で終了する。
+//
+// 負荷の高い環境でも結果が変わらないように、決まった時刻に操作するのではなく、
+// 前の操作で期待する数のリクエストが届いたのを確認してから次の操作をする。
+
+namespace http = boost::beast::http;
+using tcp = boost::asio::ip::tcp;
+
+namespace {
+
+const char kChannelID[] = "sora";
+const char kConnectionID[] = "recv-connection";
+
+struct RecordedRequest {
+  std::chrono::steady_clock::time_point received_at;
+  std::string target;
+  std::string channel_id;
+  std::string recv_connection_id;
+  std::string send_connection_id;
+  std::string rid;
+};
+
+// 受け取ったリクエストを記録して 200 を返すだけの HTTP サーバ
+class RequestRecorder {
+ public:
+  RequestRecorder(boost::asio::io_context& ioc)
+      : acceptor_(ioc, tcp::endpoint(boost::asio::ip::address_v4::loopback(),
+                                     0)) {}
+
+  unsigned short GetPort() const { return acceptor_.local_endpoint().port(); }
+  const std::vector<RecordedRequest>& GetRequests() const { return requests_; }
+
+  void Start() { Accept(); }
+  void Stop() {
+    boost::system::error_code ec;
+    acceptor_.close(ec);
+  }
+
+ private:
+  class Session : public std::enable_shared_from_this<Session> {
+   public:
+    Session(tcp::socket socket, RequestRecorder* recorder)
+        : stream_(std::move(socket)), recorder_(recorder) {}
+
+    void Run() {
+      auto self = shared_from_this();
+      http::async_read(stream_, buffer_, req_,
+                       [self](boost::system::error_code ec, std::size_t) {
+                         if (ec) {
+                           std::cerr << "read failed: " << ec.message()
+                                     << std::endl;
+                           return;
+                         }
+                         self->recorder_->Record(self->req_);
+                         self->Respond();
+                       });
+    }
+
+   private:
+    void Respond() {
+      res_.result(http::status::ok);
+      res_.version(req_.version());
+      res_.set(http::field::content_type, "application/json");
+      res_.body() = "{}";
+      res_.prepare_payload();
+      auto self = shared_from_this();
+      http::async_write(stream_, res_,
+                        [self](boost::system::error_code, std::size_t) {
+                          boost::system::error_code ignored;
+                          self->stream_.socket().shutdown(
+                              tcp::socket::shutdown_both, ignored);
+                        });
+    }
+
+    boost::beast::tcp_stream stream_;
+    RequestRecorder* recorder_;
+    boost::beast::flat_buffer buffer_;
+    http::request<http::string_body> req_;
+    http::response<http::string_body> res_;
+  };
+
+  void Accept() {
+    acceptor_.async_accept(
+        [this](boost::system::error_code ec, tcp::socket socket) {
+          if (ec) {
+            return;
+          }
+          std::make_shared<Session>(std::move(socket), this)->Run();
+          Accept();
+        });
+  }
+
+  void Record(const http::request<http::string_body>& req) {
+    RecordedRequest r;
+    r.received_at = std::chrono::steady_clock::now();
+    r.target = std::string(req["x-sora-target"]);
+    boost::system::error_code ec;
+    boost::json::value body = boost::json::parse(req.body(), ec);
+    if (!ec && body.is_object()) {
+      auto get = [&body](const char* key) -> std::string {
+        const boost::json::value* v = body.as_object().if_contains(key);
+        return v != nullptr && v->is_string() ? std::string(v->as_string())
+                                              : std::string();
+      };
+      r.channel_id = get("channel_id");
+      r.recv_connection_id = get("recv_connection_id");
+      r.send_connection_id = get("send_connection_id");
+      r.rid = get("rid");
+    }
+    requests_.push_back(r);
+  }
+
+  tcp::acceptor acceptor_;
+  std::vector<RecordedRequest> requests_;
+};
+
+// リクエストが届いたかを確認する間隔
+#define RID_CHECK_POLL_INTERVAL_MS 10
+// 期待する数のリクエストが届くのを待つ最大時間
+#define RID_CHECK_DEADLINE_MS 10000
+// 期待する数のリクエストが届いた後、余計なリクエストが来ないことを確認する時間
+#define RID_CHECK_QUIET_MS 300
+
+struct Step {
+  std::function<void()> action;
+  // この操作の後で、それまでに届いているはずのリクエストの数
+  size_t expected_requests;
+};
+
+// 操作をして、期待する数のリクエストが届いて、その後しばらく増えないのを確認してから
+// 次の操作をする。時間内に届かなかった場合は残りの操作をせずに終わる
+class StepRunner {
+ public:
+  StepRunner(boost::asio::io_context& ioc,
+             RequestRecorder& recorder,
+             std::vector<Step> steps)
+      : timer_(ioc), recorder_(recorder), steps_(std::move(steps)) {}
+
+  int GetFailures() const { return failures_; }
+  // steps[index] の操作をした時刻
+  std::chrono::steady_clock::time_point GetStartedAt(size_t index) const {
+    return started_at_[index];
+  }
+
+  void Start() { Next(); }
+
+ private:
+  void Next() {
+    if (index_ == steps_.size()) {
+      recorder_.Stop();
+      return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    started_at_.push_back(now);
+    deadline_ = now + std::chrono::milliseconds(RID_CHECK_DEADLINE_MS);
+    reached_ = false;
+    steps_[index_].action();
+    Poll();
+  }
+
+  void Poll() {
+    timer_.expires_after(std::chrono::milliseconds(
+        reached_ ? RID_CHECK_QUIET_MS : RID_CHECK_POLL_INTERVAL_MS));
+    timer_.async_wait([this](const boost::system::error_code& ec) {
+      if (ec) {
+        return;
+      }
+      size_t count = recorder_.GetRequests().size();
+      size_t expected = steps_[index_].expected_requests;
+      if (count > expected) {
+        std::cerr << "step " << index_ << ": " << count
+                  << " requests, expected " << expected << std::endl;
+        failures_++;
+        recorder_.Stop();
+        return;
+      }
+      if (reached_) {
+        index_++;
+        Next();
+        return;
+      }
+      if (count == expected) {
+        reached_ = true;
+      } else if (std::chrono::steady_clock::now() >= deadline_) {
+        std::cerr << "step " << index_ << ": timed out with " << count
+                  << " requests, expected " << expected << std::endl;
+        failures_++;
+        recorder_.Stop();
+        return;
+      }
+      Poll();
+    });
+  }
+
+  boost::asio::steady_timer timer_;
+  RequestRecorder& recorder_;
+  std::vector<Step> steps_;
+  size_t index_ = 0;
+  std::vector<std::chrono::steady_clock::time_point> started_at_;
+  std::chrono::steady_clock::time_point deadline_;
+  bool reached_ = false;
+  int failures_ = 0;
+};
+
+int CheckSelectSimulcastRid() {
+  struct Case {
+    const char* current;
+    int width;
+    int height;
+    const char* expected;
+  };
+  const Case cases[] = {
+      // 初回は閾値だけで選ぶ
+      {"", 320, 180, "r0"},
+      {"", 640, 360, "r1"},
+      {"", 1280, 720, "r2"},
+      // 閾値を少し超えただけでは上げない
+      {"r0", 340, 190, "r0"},
+      {"r0", 640, 360, "r1"},
+      // 閾値を少し下回っただけでは下げない
+      {"r2", 600, 340, "r2"},
+      {"r2", 320, 180, "r1"},
+      {"r2", 160, 90, "r0"},
+  };
+  int failures = 0;
+  for (const auto& c : cases) {
+    std::string rid = SelectSimulcastRid(c.current, c.width, c.height);
+    if (rid != c.expected) {
+      std::cerr << "SelectSimulcastRid(\"" << c.current << "\", " << c.width
+                << ", " << c.height << ") = " << rid << ", expected "
+                << c.expected << std::endl;
+      failures++;
+    }
+  }
+  return failures;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  rtc::LogMessage::LogToDebug(rtc::LS_WARNING);
+
+  int failures = CheckSelectSimulcastRid();
+
+  boost::asio::io_context ioc;
+  RequestRecorder recorder(ioc);
+  recorder.Start();
+
+  SimulcastRidControllerConfig config;
+  config.api_url =
+      "http://127.0.0.1:" + std::to_string(recorder.GetPort()) + "/";
+  config.channel_id = kChannelID;
+  config.hold_time = std::chrono::milliseconds(300);
+  config.debounce_time = std::chrono::milliseconds(50);
+  SimulcastRidController controller(ioc, config);
+
+  std::vector<Step> steps = {
+      {[&]() {
+         controller.SetConnectionID(kConnectionID);
+         controller.AddTrack("track-1", "sender-1");
+         controller.AddTrack("track-2", "sender-2");
+         controller.SetTileSize("track-1", 1280, 720);
+         controller.SetTileSize("track-2", 320, 180);
+       },
+       2},
+      // 切り替えた直後なので、hold_time が経つまで待ってから要求する
+      {[&]() { controller.SetTileSize("track-1", 160, 90); }, 3},
+      // ヒステリシスの範囲内なので要求しない
+      {[&]() { controller.SetTileSize("track-2", 340, 190); }, 3},
+      {[&]() { controller.SetTileSize("track-2", 640, 360); }, 4},
+      // 削除したトラックの大きさが変わっても要求しない
+      {[&]() {
+         controller.RemoveTrack("track-1");
+         controller.SetTileSize("track-1", 1280, 720);
+       },
+       4},
+  };
+  StepRunner runner(ioc, recorder, steps);
+  runner.Start();
+  ioc.run();
+  failures += runner.GetFailures();
+
+  // 送信者毎に、届いた順に並べた rid を比較する
+  std::map<std::string, std::vector<std::string>> expected = {
+      {"sender-1", {"r2", "r0"}},
+      {"sender-2", {"r0", "r1"}},
+  };
+  std::map<std::string, std::vector<std::string>> actual;
+  std::map<std::string, std::vector<std::chrono::steady_clock::time_point>>
+      times;
+  for (const auto& r : recorder.GetRequests()) {
+    if (r.target != "Sora_20201005.RequestSimulcastRid" ||
+        r.channel_id != kChannelID || r.recv_connection_id != kConnectionID) {
+      std::cerr << "Unexpected request: target=" << r.target
+                << " channel_id=" << r.channel_id
+                << " recv_connection_id=" << r.recv_connection_id
+                << std::endl;
+      failures++;
+    }
+    actual[r.send_connection_id].push_back(r.rid);
+    times[r.send_connection_id].push_back(r.received_at);
+  }
+  if (actual != expected) {
+    for (const auto& p : actual) {
+      std::cerr << "sender=" << p.first << " rids=";
+      for (const auto& rid : p.second) {
+        std::cerr << rid << " ";
+      }
+      std::cerr << std::endl;
+    }
+    std::cerr << "Unexpected rid requests" << std::endl;
+    failures++;
+  } else {
+    // 同じ送信者への 2 回目の要求は、1 回目の要求のきっかけになった操作から
+    // hold_time 以上経ってから届く。1 回目の要求が届くのが遅れても結果は変わらない
+    auto& t = times["sender-1"];
+    if (t[1] - runner.GetStartedAt(0) < config.hold_time) {
+      std::cerr << "hold_time is not respected" << std::endl;
+      failures++;
+    }
+  }
+
+  std::cout << "{\"requests\":" << recorder.GetRequests().size()
+            << ",\"failures\":" << failures << "}" << std::endl;
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+#include "simulcast_rid_controller.h"
+
+#include <memory>
+#include <regex>
+
+// Boost
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/json.hpp>
+
+// WebRTC
+#include <rtc_base/logging.h>
+
+namespace http = boost::beast::http;
+
+namespace {
+
+struct RidLayer {
+  const char* rid;
+  // この rid で十分なタイルの最大画素数
+  int max_pixels;
+};
+
+// Sora のサイマルキャストは r0 が 1/4、r1 が 1/2、r2 が元の解像度なので、
+// 元の解像度が HD の場合に丁度良くなる値にしている
+const RidLayer kRidLayers[] = {
+    {"r0", 320 * 180},
+    {"r1", 640 * 360},
+    {"r2", 0},
+};
+
+int RidIndex(const std::string& rid) {
+  for (int i = 0; i < 3; i++) {
+    if (rid == kRidLayers[i].rid) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+class RequestSession : public std::enable_shared_from_this<RequestSession> {
+ public:
+  RequestSession(boost::asio::io_context& ioc) : resolver_(ioc), stream_(ioc) {}
+
+  void Run(const std::string& host,
+           const std::string& port,
+           http::request<http::string_body> req) {
+    req_ = std::move(req);
+    auto self = shared_from_this();
+    resolver_.async_resolve(
+        host, port,
+        [self](boost::system::error_code ec,
+               boost::asio::ip::tcp::resolver::results_type results) {
+          if (ec) {
+            return self->Fail(ec, "resolve");
+          }
+          self->stream_.expires_after(std::chrono::seconds(5));
+          self->stream_.async_connect(
+              results, [self](boost::system::error_code ec,
+                              boost::asio::ip::tcp::endpoint) {
+                if (ec) {
+                  return self->Fail(ec, "connect");
+                }
+                self->OnConnect();
+              });
+        });
+  }
+
+ private:
+  void OnConnect() {
+    auto self = shared_from_this();
+    http::async_write(
+        stream_, req_, [self](boost::system::error_code ec, std::size_t) {
+          if (ec) {
+            return self->Fail(ec, "write");
+          }
+          http::async_read(
+              self->stream_, self->buffer_, self->res_,
+              [self](boost::system::error_code ec, std::size_t) {
+                if (ec) {
+                  return self->Fail(ec, "read");
+                }
+                if (self->res_.result() != http::status::ok) {
+                  RTC_LOG(LS_WARNING)
+                      << "RequestSimulcastRid failed: status="
+                      << self->res_.result_int()
+                      << " body=" << self->res_.body();
+                }
+                boost::system::error_code ignored;
+                self->stream_.socket().shutdown(
+                    boost::asio::ip::tcp::socket::shutdown_both, ignored);
+              });
+        });
+  }
+
+  void Fail(boost::system::error_code ec, const char* what) {
+    RTC_LOG(LS_WARNING) << "RequestSimulcastRid failed: " << what << ": "
+                        << ec.message();
+  }
+
+  boost::asio::ip::tcp::resolver resolver_;
+  boost::beast::tcp_stream stream_;
+  boost::beast::flat_buffer buffer_;
+  http::request<http::string_body> req_;
+  http::response<http::string_body> res_;
+};
+
+}  // namespace
+
+std::string SelectSimulcastRid(const std::string& current_rid,
+                               int width,
+                               int height) {
+  int64_t pixels = (int64_t)width * height;
+  int current = RidIndex(current_rid);
+  int selected = 2;
+  for (int i = 0; i < 2; i++) {
+    if (pixels <= kRidLayers[i].max_pixels) {
+      selected = i;
+      break;
+    }
+  }
+  if (current < 0 || selected == current) {
+    return kRidLayers[selected].rid;
+  }
+
+  // ヒステリシス
+  if (selected > current) {
+    // 上げるのは、今の rid の上限を十分に超えた場合だけ
+    if (pixels <= kRidLayers[current].max_pixels * 5 / 4) {
+      return current_rid;
+    }
+  } else {
+    // 下げるのは、下げた先の rid の上限を十分に下回った場合だけ
+    if (pixels >= kRidLayers[selected].max_pixels * 4 / 5) {
+      selected++;
+    }
+  }
+  return kRidLayers[selected].rid;
+}
+
+SimulcastRidController::SimulcastRidController(
+    boost::asio::io_context& ioc,
+    SimulcastRidControllerConfig config)
+    : ioc_(ioc), config_(config), timer_(ioc) {
+  std::smatch m;
+  std::regex re("^http://([^/:]+)(?::([0-9]+))?(/.*)?$");
+  if (!std::regex_match(config_.api_url, m, re)) {
+    RTC_LOG(LS_ERROR) << "Invalid Sora API URL: " << config_.api_url;
+    return;
+  }
+  host_ = m[1].str();
+  port_ = m[2].matched ? m[2].str() : "80";
+  target_ = m[3].matched ? m[3].str() : "/";
+}
+
+void SimulcastRidController::SetConnectionID(
+    const std::string& connection_id) {
+  connection_id_ = connection_id;
+  ScheduleEvaluate(config_.debounce_time);
+}
+
+void SimulcastRidController::AddTrack(const std::string& track_id,
+                                      const std::string& sender_connection_id) {
+  tracks_[track_id] = sender_connection_id;
+}
+
+void SimulcastRidController::RemoveTrack(const std::string& track_id) {
+  auto it = tracks_.find(track_id);
+  if (it == tracks_.end()) {
+    return;
+  }
+  senders_.erase(it->second);
+  tracks_.erase(it);
+}
+
+void SimulcastRidController::SetTileSize(const std::string& track_id,
+                                         int width,
+                                         int height) {
+  auto it = tracks_.find(track_id);
+  if (it == tracks_.end()) {
+    return;
+  }
+  Sender& sender = senders_[it->second];
+  sender.width = width;
+  sender.height = height;
+  ScheduleEvaluate(config_.debounce_time);
+}
+
+void SimulcastRidController::ScheduleEvaluate(
+    std::chrono::milliseconds delay) {
+  timer_.expires_after(delay);
+  timer_.async_wait([this](const boost::system::error_code& ec) {
+    if (ec) {
+      return;
+    }
+    Evaluate();
+  });
+}
+
+void SimulcastRidController::Evaluate() {
+  if (connection_id_.empty() || host_.empty()) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  std::chrono::milliseconds retry(0);
+  for (auto& p : senders_) {
+    Sender& sender = p.second;
+    if (sender.width == 0 || sender.height == 0) {
+      continue;
+    }
+    std::string rid =
+        SelectSimulcastRid(sender.rid, sender.width, sender.height);
+    if (rid == sender.rid) {
+      continue;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        now - sender.changed_at);
+    if (!sender.rid.empty() && elapsed < config_.hold_time) {
+      // 切り替えたばかりなので、後でもう一度評価する
+      auto wait = config_.hold_time - elapsed;
+      if (retry.count() == 0 || wait < retry) {
+        retry = wait;
+      }
+      continue;
+    }
+    RTC_LOG(LS_INFO) << "Request simulcast rid: sender=" << p.first
+                     << " rid=" << sender.rid << "->" << rid
+                     << " tile=" << sender.width << "x" << sender.height;
+    sender.rid = rid;
+    sender.changed_at = now;
+    SendRequest(p.first, rid);
+  }
+  if (retry.count() != 0) {
+    ScheduleEvaluate(retry);
+  }
+}
+
+void SimulcastRidController::SendRequest(
+    const std::string& sender_connection_id,
+    const std::string& rid) {
+  boost::json::object body;
+  body["channel_id"] = config_.channel_id;
+  body["recv_connection_id"] = connection_id_;
+  body["send_connection_id"] = sender_connection_id;
+  body["rid"] = rid;
+
+  http::request<http::string_body> req(http::verb::post, target_, 11);
+  req.set(http::field::host, host_);
+  req.set(http::field::content_type, "application/json");
+  req.set("x-sora-target", "Sora_20201005.RequestSimulcastRid");
+  req.body() = boost::json::serialize(body);
+  req.prepare_payload();
+
+  std::make_shared<RequestSession>(ioc_)->Run(host_, port_, std::move(req));
+}
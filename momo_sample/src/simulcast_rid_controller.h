@@ -0,0 +1,69 @@
+#ifndef SIMULCAST_RID_CONTROLLER_H_
+#define SIMULCAST_RID_CONTROLLER_H_
+
+#include <chrono>
+#include <map>
+#include <string>
+
+// Boost
+#include <boost/asio.hpp>
+
+// タイルの画素数から受信する rid を選ぶ。
+// 閾値付近でタイルの大きさが揺れても切り替わり続けないように、
+// 上げる時は閾値の 1.25 倍、下げる時は閾値の 0.8 倍を基準にする。
+std::string SelectSimulcastRid(const std::string& current_rid,
+                               int width,
+                               int height);
+
+struct SimulcastRidControllerConfig {
+  // Sora API の URL (例: http://127.0.0.1:3000/)
+  std::string api_url;
+  std::string channel_id;
+  // 同じ送信者の rid を切り替えた後、次に切り替えるまでの最短間隔
+  std::chrono::milliseconds hold_time = std::chrono::milliseconds(3000);
+  // ウインドウのリサイズ中などに連続で通知された場合にまとめるための待ち時間
+  std::chrono::milliseconds debounce_time = std::chrono::milliseconds(500);
+};
+
+// 受信している映像のタイルの大きさに応じて、送信者毎に受信するサイマルキャストの rid を
+// Sora API の RequestSimulcastRid で要求する。
+//
+// 全てのメソッドは io_context のスレッドから呼ぶこと。
+class SimulcastRidController {
+ public:
+  SimulcastRidController(boost::asio::io_context& ioc,
+                         SimulcastRidControllerConfig config);
+
+  void SetConnectionID(const std::string& connection_id);
+  void AddTrack(const std::string& track_id,
+                const std::string& sender_connection_id);
+  void RemoveTrack(const std::string& track_id);
+  void SetTileSize(const std::string& track_id, int width, int height);
+
+ private:
+  struct Sender {
+    int width = 0;
+    int height = 0;
+    std::string rid;
+    std::chrono::steady_clock::time_point changed_at;
+  };
+
+  void ScheduleEvaluate(std::chrono::milliseconds delay);
+  void Evaluate();
+  void SendRequest(const std::string& sender_connection_id,
+                   const std::string& rid);
+
+  boost::asio::io_context& ioc_;
+  SimulcastRidControllerConfig config_;
+  boost::asio::steady_timer timer_;
+  std::string connection_id_;
+  std::string host_;
+  std::string port_;
+  std::string target_;
+  // track_id -> sender_connection_id
+  std::map<std::string, std::string> tracks_;
+  // sender_connection_id -> Sender
+  std::map<std::string, Sender> senders_;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include "startup_profiler.h"
+
+#include <sstream>
+
+// WebRTC
+#include <rtc_base/time_utils.h>
+
+StartupProfiler::StartupProfiler() : start_us_(rtc::TimeMicros()) {}
+
+void StartupProfiler::Mark(const std::string& name) {
+  double elapsed_ms = (rtc::TimeMicros() - start_us_) / 1000.0;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& mark : marks_) {
+    if (mark.first == name) {
+      return;
+    }
+  }
+  marks_.push_back(std::make_pair(name, elapsed_ms));
+}
+
+bool StartupProfiler::Has(const std::string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& mark : marks_) {
+    if (mark.first == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string StartupProfiler::ToJson() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::stringstream ss;
+  ss << "{";
+  for (size_t i = 0; i < marks_.size(); i++) {
+    if (i != 0) {
+      ss << ",";
+    }
+    ss << "\"" << marks_[i].first << "\":" << marks_[i].second;
+  }
+  ss << "}";
+  return ss.str();
+}
+
+FirstFrameSink::FirstFrameSink(std::function<void()> on_first_frame)
+    : on_first_frame_(std::move(on_first_frame)), called_(false) {}
+
+void FirstFrameSink::OnFrame(const webrtc::VideoFrame& frame) {
+  if (called_.exchange(true)) {
+    return;
+  }
+  on_first_frame_();
+}
@@ -0,0 +1,46 @@
+#ifndef STARTUP_PROFILER_H_
+#define STARTUP_PROFILER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// WebRTC
+#include <api/video/video_frame.h>
+#include <api/video/video_sink_interface.h>
+
+// 生成した時刻から、起動の各段階が終わるまでの時間を記録する。
+// どのスレッドから呼んでも良い。
+class StartupProfiler {
+ public:
+  StartupProfiler();
+
+  // 同じ名前で複数回呼んだ場合は最初の時刻だけを記録する
+  void Mark(const std::string& name);
+  bool Has(const std::string& name) const;
+  // {"context_ready":123.4,...} のように、経過時間 (ms) を記録した順に出力する
+  std::string ToJson() const;
+
+ private:
+  int64_t start_us_;
+  mutable std::mutex mutex_;
+  std::vector<std::pair<std::string, double>> marks_;
+};
+
+// 最初のフレームが届いた時に 1 回だけ on_first_frame を呼ぶシンク
+class FirstFrameSink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  FirstFrameSink(std::function<void()> on_first_frame);
+
+  void OnFrame(const webrtc::VideoFrame& frame) override;
+
+ private:
+  std::function<void()> on_first_frame_;
+  std::atomic<bool> called_;
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef THREAD_AFFINITY_H_
+#define THREAD_AFFINITY_H_
+
+#include <string>
+#include <vector>
+
+// "0,2-3" のような CPU 番号のリストをパースする。空文字列の場合は空のリストを返す
+bool ParseCpuList(const std::string& text, std::vector<int>& cpus);
+
+// 呼び出したスレッドを指定した CPU でだけ動かす。
+// macOS はスレッドを CPU に固定できないので、常に false を返す
+bool SetCurrentThreadAffinity(const std::vector<int>& cpus);
+
+// 呼び出したスレッドをリアルタイムスケジューリング (SCHED_FIFO) にする。
+// Linux 以外の場合や、権限が無い場合は false を返す
+bool SetCurrentThreadRealtime();
+
+// 呼び出したスレッドの優先度を下げて、他のスレッドの邪魔をしないようにする。
+// 下げられなかった場合は false を返す
+bool SetCurrentThreadLowPriority();
+
+#endif
@@ -0,0 +1,180 @@
+#include "async_log_sink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace {
+
+size_t RoundUpToPowerOfTwo(size_t n) {
+  size_t size = 1;
+  while (size < n) {
+    size <<= 1;
+  }
+  return size;
+}
+
+}  // namespace
+
+std::unique_ptr<AsyncLogSink> AsyncLogSink::Create(AsyncLogSinkConfig config) {
+  std::unique_ptr<AsyncLogSink> sink(new AsyncLogSink(config));
+  if (!sink->Open()) {
+    return nullptr;
+  }
+  sink->running_ = true;
+  sink->thread_.reset(new std::thread([p = sink.get()]() {
+    p->WriterThread();
+  }));
+  return sink;
+}
+
+AsyncLogSink::AsyncLogSink(AsyncLogSinkConfig config)
+    : config_(config),
+      slots_(RoundUpToPowerOfTwo(std::max<size_t>(config.queue_size, 2))),
+      mask_(slots_.size() - 1),
+      enqueue_pos_(0),
+      dequeue_pos_(0),
+      written_(0),
+      dropped_(0),
+      running_(false) {
+  for (size_t i = 0; i < slots_.size(); i++) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+AsyncLogSink::~AsyncLogSink() {
+  rtc::LogMessage::RemoveLogToStream(this);
+  running_ = false;
+  if (thread_ != nullptr) {
+    thread_->join();
+  }
+  if (file_ != nullptr) {
+    fclose(file_);
+  }
+}
+
+void AsyncLogSink::OnLogMessage(const std::string& message) {
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  Slot* slot;
+  while (true) {
+    slot = &slots_[pos & mask_];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // 書き込みが追いついていないので、待たずに捨てる
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->message = message;
+  slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+uint64_t AsyncLogSink::GetWrittenMessages() const {
+  return written_.load();
+}
+
+uint64_t AsyncLogSink::GetDroppedMessages() const {
+  return dropped_.load();
+}
+
+void AsyncLogSink::Flush() {
+  while (running_ && dequeue_pos_.load() < enqueue_pos_.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+bool AsyncLogSink::Open() {
+  file_ = fopen(config_.file.c_str(), "ab");
+  if (file_ == nullptr) {
+    RTC_LOG(LS_ERROR) << "Failed to open log file: " << config_.file;
+    return false;
+  }
+  fseek(file_, 0, SEEK_END);
+  file_size_ = ftell(file_);
+  return true;
+}
+
+bool AsyncLogSink::Pop(std::string& message) {
+  size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+  Slot& slot = slots_[pos & mask_];
+  size_t sequence = slot.sequence.load(std::memory_order_acquire);
+  if ((intptr_t)sequence - (intptr_t)(pos + 1) < 0) {
+    return false;
+  }
+  message.swap(slot.message);
+  slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+  dequeue_pos_.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+void AsyncLogSink::WriterThread() {
+  std::string message;
+  while (true) {
+    // running_ が false になってもリングバッファに残っている分は書き出す
+    bool running = running_;
+    int count = 0;
+    while (Pop(message)) {
+      Write(message);
+      count++;
+    }
+    uint64_t dropped = dropped_.load();
+    if (dropped != reported_dropped_) {
+      Write("AsyncLogSink: dropped " +
+            std::to_string(dropped - reported_dropped_) + " messages\n");
+      reported_dropped_ = dropped;
+      count++;
+    }
+    if (count > 0) {
+      fflush(file_);
+    }
+    if (!running) {
+      break;
+    }
+    if (count == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+}
+
+void AsyncLogSink::Write(const std::string& message) {
+  if (file_ == nullptr) {
+    return;
+  }
+  if (file_size_ > 0 &&
+      file_size_ + (int64_t)message.size() > config_.max_file_size) {
+    Rotate();
+    if (file_ == nullptr) {
+      return;
+    }
+  }
+  fwrite(message.data(), 1, message.size(), file_);
+  file_size_ += message.size();
+  written_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AsyncLogSink::Rotate() {
+  fclose(file_);
+  file_ = nullptr;
+  // file.(N-1) -> file.N, ..., file -> file.1 の順にずらす。
+  // Windows では上書きできないので、先に移動先を消しておく
+  auto name = [this](int n) {
+    return n == 0 ? config_.file : config_.file + "." + std::to_string(n);
+  };
+  for (int n = config_.max_files - 1; n >= 0; n--) {
+    std::remove(name(n + 1).c_str());
+    std::rename(name(n).c_str(), name(n + 1).c_str());
+  }
+  if (config_.max_files <= 0) {
+    std::remove(name(0).c_str());
+  }
+  file_ = fopen(config_.file.c_str(), "wb");
+  file_size_ = 0;
+}
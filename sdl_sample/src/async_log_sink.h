@@ -0,0 +1,75 @@
+#ifndef ASYNC_LOG_SINK_H_
+#define ASYNC_LOG_SINK_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// WebRTC
+#include <rtc_base/logging.h>
+
+struct AsyncLogSinkConfig {
+  std::string file;
+  // ファイルがこの大きさを超えたら file.1, file.2, ... にずらして新しいファイルに書く
+  int64_t max_file_size = 10 * 1024 * 1024;
+  // 残しておく古いファイルの数
+  int max_files = 5;
+  // 書き込みを待っていられるメッセージの数。2 のべき乗に切り上げる
+  size_t queue_size = 8192;
+};
+
+// ログをリングバッファに積んで、別スレッドでファイルに書き出す rtc::LogSink。
+//
+// ログを出力するスレッドはリングバッファに積むだけで、ファイルへの書き込みを待たない。
+// リングバッファが一杯の場合は待たずにメッセージを捨てて、捨てた数を数える。
+// 捨てた数は書き込みスレッドがログファイルに出力する。
+class AsyncLogSink : public rtc::LogSink {
+ public:
+  static std::unique_ptr<AsyncLogSink> Create(AsyncLogSinkConfig config);
+  ~AsyncLogSink() override;
+
+  void OnLogMessage(const std::string& message) override;
+
+  uint64_t GetWrittenMessages() const;
+  uint64_t GetDroppedMessages() const;
+  // リングバッファに残っているメッセージを全て書き出すまで待つ
+  void Flush();
+
+ private:
+  // 複数のスレッドから積んで 1 つのスレッドから取り出すための、
+  // 各スロットにシーケンス番号を持たせた固定長のキュー
+  struct Slot {
+    std::atomic<size_t> sequence;
+    std::string message;
+  };
+
+  AsyncLogSink(AsyncLogSinkConfig config);
+
+  bool Open();
+  bool Pop(std::string& message);
+  void WriterThread();
+  void Write(const std::string& message);
+  void Rotate();
+
+  AsyncLogSinkConfig config_;
+  std::vector<Slot> slots_;
+  size_t mask_;
+  std::atomic<size_t> enqueue_pos_;
+  std::atomic<size_t> dequeue_pos_;
+
+  std::atomic<uint64_t> written_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<bool> running_;
+  std::unique_ptr<std::thread> thread_;
+
+  // 以下は書き込みスレッドからしか触らない
+  FILE* file_ = nullptr;
+  int64_t file_size_ = 0;
+  uint64_t reported_dropped_ = 0;
+};
+
+#endif
@@ -0,0 +1,399 @@
+#include "encoded_frame_recorder.h"
+
+#include <cstring>
+
+// WebRTC
+#include <api/make_ref_counted.h>
+#include <api/video_codecs/video_decoder.h>
+#include <modules/video_coding/include/video_error_codes.h>
+#include <rtc_base/logging.h>
+
+namespace {
+
+constexpr size_t kIvfFileHeaderSize = 32;
+constexpr size_t kIvfFrameHeaderSize = 12;
+// RTP タイムスタンプをそのまま pts にする
+constexpr uint32_t kIvfTimebaseDenominator = 90000;
+
+const char* GetFourcc(webrtc::VideoCodecType codec) {
+  switch (codec) {
+    case webrtc::kVideoCodecVP8:
+      return "VP80";
+    case webrtc::kVideoCodecVP9:
+      return "VP90";
+    case webrtc::kVideoCodecAV1:
+      return "AV01";
+    case webrtc::kVideoCodecH264:
+      return "H264";
+    default:
+      return nullptr;
+  }
+}
+
+void PutLe16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+void PutLe32(uint8_t* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = (uint8_t)(v >> (8 * i));
+  }
+}
+
+void PutLe64(uint8_t* p, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = (uint8_t)(v >> (8 * i));
+  }
+}
+
+// フレームを受け取るだけで何もしないデコーダ
+class NullVideoDecoder : public webrtc::VideoDecoder {
+ public:
+  bool Configure(const Settings& settings) override { return true; }
+  int32_t Decode(const webrtc::EncodedImage& input_image,
+                 bool missing_frames,
+                 int64_t render_time_ms) override {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  int32_t RegisterDecodeCompleteCallback(
+      webrtc::DecodedImageCallback* callback) override {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  int32_t Release() override { return WEBRTC_VIDEO_CODEC_OK; }
+};
+
+// デコーダを作らないと受信側がキーフレームを要求し続けるので、
+// 何もしないデコーダを渡してフレームを読み捨てる
+class NullVideoDecoderFactory : public webrtc::VideoDecoderFactory {
+ public:
+  NullVideoDecoderFactory(std::unique_ptr<webrtc::VideoDecoderFactory> factory)
+      : factory_(std::move(factory)) {}
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override {
+    if (factory_ == nullptr) {
+      return {};
+    }
+    return factory_->GetSupportedFormats();
+  }
+  std::unique_ptr<webrtc::VideoDecoder> CreateVideoDecoder(
+      const webrtc::SdpVideoFormat& format) override {
+    return std::make_unique<NullVideoDecoder>();
+  }
+
+ private:
+  std::unique_ptr<webrtc::VideoDecoderFactory> factory_;
+};
+
+}  // namespace
+
+std::unique_ptr<webrtc::VideoDecoderFactory> CreateRecordOnlyVideoDecoderFactory(
+    std::unique_ptr<webrtc::VideoDecoderFactory> factory) {
+  return std::make_unique<NullVideoDecoderFactory>(std::move(factory));
+}
+
+class EncodedFrameRecorder::Transformer
+    : public webrtc::FrameTransformerInterface {
+ public:
+  Transformer(std::shared_ptr<Shared> shared, std::string track_id)
+      : shared_(shared),
+        track_id_(track_id),
+        stopped_(false),
+        waiting_key_frame_(true),
+        dropping_(false) {}
+
+  // 受信したフレームはデコーダに渡す前にここを通る。
+  // 録画用にデータをコピーしたら、元のフレームはそのままデコーダに流す。
+  void Transform(
+      std::unique_ptr<webrtc::TransformableFrameInterface> frame) override {
+    Record(static_cast<webrtc::TransformableVideoFrameInterface*>(frame.get()));
+
+    rtc::scoped_refptr<webrtc::TransformedFrameCallback> callback;
+    {
+      webrtc::MutexLock lock(&callback_lock_);
+      auto it = sink_callbacks_.find(frame->GetSsrc());
+      callback = it != sink_callbacks_.end() ? it->second : callback_;
+    }
+    if (callback != nullptr) {
+      callback->OnTransformedFrame(std::move(frame));
+    }
+  }
+  void RegisterTransformedFrameCallback(
+      rtc::scoped_refptr<webrtc::TransformedFrameCallback> callback) override {
+    webrtc::MutexLock lock(&callback_lock_);
+    callback_ = callback;
+  }
+  void RegisterTransformedFrameSinkCallback(
+      rtc::scoped_refptr<webrtc::TransformedFrameCallback> callback,
+      uint32_t ssrc) override {
+    webrtc::MutexLock lock(&callback_lock_);
+    sink_callbacks_[ssrc] = callback;
+  }
+  void UnregisterTransformedFrameCallback() override {
+    webrtc::MutexLock lock(&callback_lock_);
+    callback_ = nullptr;
+  }
+  void UnregisterTransformedFrameSinkCallback(uint32_t ssrc) override {
+    webrtc::MutexLock lock(&callback_lock_);
+    sink_callbacks_.erase(ssrc);
+  }
+
+  // shared_->mutex をロックした状態で呼ぶこと
+  void Stop() { stopped_ = true; }
+
+ private:
+  void Record(webrtc::TransformableVideoFrameInterface* frame) {
+    // Transform は常に同じスレッドから呼ばれるので、
+    // waiting_key_frame_ と dropping_ はロックしなくて良い
+    bool key_frame = frame->IsKeyFrame();
+    if (waiting_key_frame_ && !key_frame) {
+      if (dropping_) {
+        CountDropped();
+      }
+      return;
+    }
+
+    auto metadata = frame->GetMetadata();
+    auto data = frame->GetData();
+    auto f = std::make_shared<Frame>();
+    f->track_id = track_id_;
+    f->codec = metadata.GetCodec();
+    f->width = metadata.GetWidth();
+    f->height = metadata.GetHeight();
+    f->key_frame = key_frame;
+    f->timestamp = frame->GetTimestamp();
+    f->data.assign(data.begin(), data.end());
+
+    webrtc::MutexLock lock(&shared_->mutex);
+    EncodedFrameRecorder* recorder = shared_->recorder;
+    if (recorder == nullptr || stopped_) {
+      return;
+    }
+    if (!recorder->Enqueue(std::move(f))) {
+      // 途中のフレームが欠けると次のキーフレームまで再生できないので、
+      // 書き込みが追いつくまでキーフレーム以外は捨てる
+      waiting_key_frame_ = true;
+      dropping_ = true;
+      return;
+    }
+    waiting_key_frame_ = false;
+    dropping_ = false;
+  }
+
+  void CountDropped() {
+    webrtc::MutexLock lock(&shared_->mutex);
+    if (shared_->recorder != nullptr) {
+      shared_->recorder->dropped_frames_++;
+    }
+  }
+
+  std::shared_ptr<Shared> shared_;
+  std::string track_id_;
+  bool stopped_;
+  bool waiting_key_frame_;
+  bool dropping_;
+
+  webrtc::Mutex callback_lock_;
+  rtc::scoped_refptr<webrtc::TransformedFrameCallback> callback_;
+  std::map<uint32_t, rtc::scoped_refptr<webrtc::TransformedFrameCallback>>
+      sink_callbacks_;
+};
+
+EncodedFrameRecorder::EncodedFrameRecorder(EncodedFrameRecorderConfig config)
+    : config_(config),
+      work_guard_(ioc_.get_executor()),
+      shared_(std::make_shared<Shared>()),
+      pending_bytes_(0),
+      written_frames_(0),
+      written_bytes_(0),
+      dropped_frames_(0) {
+  shared_->recorder = this;
+}
+
+EncodedFrameRecorder::~EncodedFrameRecorder() {
+  {
+    webrtc::MutexLock lock(&shared_->mutex);
+    shared_->recorder = nullptr;
+    // トランスフォーマーは RtpReceiver に残るが、以降はフレームを素通りさせるだけになる
+    for (auto& p : transformers_) {
+      p.second->Stop();
+    }
+    transformers_.clear();
+  }
+  // 書き込み待ちのフレームを全て書き出してから終了する
+  work_guard_.reset();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  for (auto& p : tracks_) {
+    CloseFile(p.second);
+  }
+}
+
+void EncodedFrameRecorder::Start() {
+  RTC_LOG(LS_INFO) << "Start recording encoded frames: dir=" << config_.dir;
+  thread_ = std::thread([this]() { ioc_.run(); });
+}
+
+void EncodedFrameRecorder::AddReceiver(
+    rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver) {
+  auto track = receiver->track();
+  if (track->kind() != webrtc::MediaStreamTrackInterface::kVideoKind) {
+    return;
+  }
+  std::string track_id = track->id();
+  auto transformer = rtc::make_ref_counted<Transformer>(shared_, track_id);
+  receiver->SetDepacketizerToDecoderFrameTransformer(transformer);
+
+  webrtc::MutexLock lock(&shared_->mutex);
+  transformers_[track_id] = transformer;
+}
+
+void EncodedFrameRecorder::RemoveReceiver(
+    rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver) {
+  auto track = receiver->track();
+  if (track->kind() != webrtc::MediaStreamTrackInterface::kVideoKind) {
+    return;
+  }
+  std::string track_id = track->id();
+
+  // Stop した後に積まれるフレームは無いので、
+  // CloseTrack はそのトラックの最後のフレームより後に実行される
+  webrtc::MutexLock lock(&shared_->mutex);
+  auto it = transformers_.find(track_id);
+  if (it == transformers_.end()) {
+    return;
+  }
+  it->second->Stop();
+  transformers_.erase(it);
+  boost::asio::post(ioc_, [this, track_id]() { CloseTrack(track_id); });
+}
+
+uint64_t EncodedFrameRecorder::GetWrittenFrames() const {
+  return written_frames_;
+}
+
+uint64_t EncodedFrameRecorder::GetWrittenBytes() const {
+  return written_bytes_;
+}
+
+uint64_t EncodedFrameRecorder::GetDroppedFrames() const {
+  return dropped_frames_;
+}
+
+bool EncodedFrameRecorder::Enqueue(std::shared_ptr<Frame> frame) {
+  size_t size = frame->data.size();
+  if (pending_bytes_ + size > config_.max_pending_bytes) {
+    dropped_frames_++;
+    return false;
+  }
+  pending_bytes_ += size;
+  boost::asio::post(ioc_, [this, frame]() {
+    WriteFrame(*frame);
+    pending_bytes_ -= frame->data.size();
+  });
+  return true;
+}
+
+void EncodedFrameRecorder::WriteFrame(const Frame& frame) {
+  Track& track = tracks_[frame.track_id];
+  if (track.file != nullptr && track.codec != frame.codec) {
+    CloseFile(track);
+  }
+  if (track.file == nullptr) {
+    // コーデックが変わった直後のフレームがキーフレームでなければ、キーフレームまで待つ
+    if (!frame.key_frame || !OpenFile(frame, track)) {
+      return;
+    }
+  } else {
+    track.pts += (int32_t)(frame.timestamp - track.last_timestamp);
+  }
+  track.last_timestamp = frame.timestamp;
+
+  uint8_t header[kIvfFrameHeaderSize];
+  PutLe32(header, (uint32_t)frame.data.size());
+  PutLe64(header + 4, (uint64_t)track.pts);
+  if (std::fwrite(header, 1, sizeof(header), track.file) != sizeof(header) ||
+      std::fwrite(frame.data.data(), 1, frame.data.size(), track.file) !=
+          frame.data.size()) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__
+                      << ": Failed to write frame: track_id=" << frame.track_id;
+    CloseFile(track);
+    return;
+  }
+  track.frame_count++;
+  written_frames_++;
+  written_bytes_ += sizeof(header) + frame.data.size();
+}
+
+bool EncodedFrameRecorder::OpenFile(const Frame& frame, Track& track) {
+  const char* fourcc = GetFourcc(frame.codec);
+  if (fourcc == nullptr) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__
+                        << ": Unsupported codec: track_id=" << frame.track_id
+                        << " codec=" << frame.codec;
+    return false;
+  }
+
+  int& count = file_counts_[frame.track_id];
+  std::string path = config_.dir + "/" + frame.track_id;
+  if (count > 0) {
+    path += "_" + std::to_string(count);
+  }
+  path += ".ivf";
+  count++;
+
+  FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Failed to open " << path;
+    return false;
+  }
+  // 小さいフレームを何度も書き込むので、バッファを大きくしてシステムコールを減らす
+  std::setvbuf(file, nullptr, _IOFBF, 1024 * 1024);
+
+  uint8_t header[kIvfFileHeaderSize] = {};
+  std::memcpy(header, "DKIF", 4);
+  PutLe16(header + 4, 0);
+  PutLe16(header + 6, kIvfFileHeaderSize);
+  std::memcpy(header + 8, fourcc, 4);
+  PutLe16(header + 12, (uint16_t)frame.width);
+  PutLe16(header + 14, (uint16_t)frame.height);
+  PutLe32(header + 16, kIvfTimebaseDenominator);
+  PutLe32(header + 20, 1);
+  // フレーム数は閉じる時に書き込む
+  PutLe32(header + 24, 0);
+  if (std::fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Failed to write " << path;
+    std::fclose(file);
+    return false;
+  }
+
+  RTC_LOG(LS_INFO) << "Recording " << frame.track_id << " to " << path;
+  track.file = file;
+  track.codec = frame.codec;
+  track.frame_count = 0;
+  track.pts = 0;
+  return true;
+}
+
+void EncodedFrameRecorder::CloseFile(Track& track) {
+  if (track.file == nullptr) {
+    return;
+  }
+  uint8_t count[4];
+  PutLe32(count, track.frame_count);
+  if (std::fseek(track.file, 24, SEEK_SET) == 0) {
+    std::fwrite(count, 1, sizeof(count), track.file);
+  }
+  std::fclose(track.file);
+  track.file = nullptr;
+}
+
+void EncodedFrameRecorder::CloseTrack(const std::string& track_id) {
+  auto it = tracks_.find(track_id);
+  if (it == tracks_.end()) {
+    return;
+  }
+  CloseFile(it->second);
+  tracks_.erase(it);
+}
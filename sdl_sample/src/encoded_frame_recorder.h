@@ -0,0 +1,109 @@
+#ifndef ENCODED_FRAME_RECORDER_H_
+#define ENCODED_FRAME_RECORDER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+
+// WebRTC
+#include <api/frame_transformer_interface.h>
+#include <api/rtp_receiver_interface.h>
+#include <api/scoped_refptr.h>
+#include <api/video/video_codec_type.h>
+#include <api/video_codecs/video_decoder_factory.h>
+#include <rtc_base/synchronization/mutex.h>
+
+// 録画専用モード用のデコーダファクトリを作る。
+// 対応するコーデックは factory と同じだが、作られるデコーダはフレームを受け取るだけで何もしない。
+std::unique_ptr<webrtc::VideoDecoderFactory> CreateRecordOnlyVideoDecoderFactory(
+    std::unique_ptr<webrtc::VideoDecoderFactory> factory);
+
+struct EncodedFrameRecorderConfig {
+  // IVF ファイルを書き出すディレクトリ
+  std::string dir = ".";
+  // 書き込み待ちのデータの上限 (バイト)。
+  // 書き込みが追いつかずにこれを超えた場合は、次のキーフレームまでそのトラックのフレームを捨てる。
+  size_t max_pending_bytes = 256 * 1024 * 1024;
+};
+
+// 受信した映像のエンコード済みフレームを、デコードせずにトラック毎の IVF ファイルに書き出す。
+//
+// RtpReceiver にフレームトランスフォーマーを設定してフレームを取り出し、
+// ファイルへの書き込みは専用のスレッドで行う。
+// ファイルはキーフレームから始まり、コーデックが変わった場合は別のファイルに書き出す。
+class EncodedFrameRecorder {
+ public:
+  EncodedFrameRecorder(EncodedFrameRecorderConfig config);
+  ~EncodedFrameRecorder();
+
+  void Start();
+  // シグナリングスレッドから呼ぶこと
+  void AddReceiver(rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver);
+  void RemoveReceiver(
+      rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver);
+
+  uint64_t GetWrittenFrames() const;
+  uint64_t GetWrittenBytes() const;
+  uint64_t GetDroppedFrames() const;
+
+ private:
+  class Transformer;
+
+  struct Frame {
+    std::string track_id;
+    webrtc::VideoCodecType codec;
+    int width;
+    int height;
+    bool key_frame;
+    uint32_t timestamp;
+    std::vector<uint8_t> data;
+  };
+
+  struct Track {
+    FILE* file = nullptr;
+    webrtc::VideoCodecType codec = webrtc::kVideoCodecGeneric;
+    uint32_t frame_count = 0;
+    int64_t pts = 0;
+    uint32_t last_timestamp = 0;
+  };
+
+  struct Shared {
+    webrtc::Mutex mutex;
+    EncodedFrameRecorder* recorder = nullptr;
+  };
+
+  bool Enqueue(std::shared_ptr<Frame> frame);
+  void WriteFrame(const Frame& frame);
+  bool OpenFile(const Frame& frame, Track& track);
+  void CloseFile(Track& track);
+  void CloseTrack(const std::string& track_id);
+
+  EncodedFrameRecorderConfig config_;
+  boost::asio::io_context ioc_;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+      work_guard_;
+  std::thread thread_;
+  std::shared_ptr<Shared> shared_;
+  // 以下は shared_->mutex で保護する
+  std::map<std::string, rtc::scoped_refptr<Transformer>> transformers_;
+
+  std::atomic<size_t> pending_bytes_;
+  std::atomic<uint64_t> written_frames_;
+  std::atomic<uint64_t> written_bytes_;
+  std::atomic<uint64_t> dropped_frames_;
+
+  // 以下は全て ioc_ のスレッドからしか触らない
+  std::map<std::string, Track> tracks_;
+  // 同じトラックのファイルを上書きしないように、トラック毎に開いたファイルの数を数えておく
+  std::map<std::string, int> file_counts_;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef EVENT_TRACE_H_
+#define EVENT_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// 処理にかかった時間を記録して、Chrome のトレース形式の JSON で書き出す。
+// 書き出したファイルは chrome://tracing や https://ui.perfetto.dev で開ける。
+//
+// イベントはスレッド毎のリングバッファに記録するので、記録時にロックは取らない。
+// リングバッファが一杯になったら古いイベントから上書きする。
+// StartEventTrace を呼ぶまでは、TRACE_EVENT はアトミック変数を 1 回読むだけで何もしない。
+
+extern std::atomic<bool> g_event_trace_enabled;
+
+void StartEventTrace();
+inline bool IsEventTraceEnabled() {
+  return g_event_trace_enabled.load(std::memory_order_relaxed);
+}
+// ここまでに記録したイベントを書き出す。記録は止めない
+bool WriteEventTrace(const std::string& file);
+
+// name は文字列リテラルなど、プロセスが終わるまで有効な文字列にすること
+void AddTraceEvent(const char* name, int64_t start_us, int64_t duration_us);
+int64_t GetTraceTimeUs();
+
+class ScopedTraceEvent {
+ public:
+  explicit ScopedTraceEvent(const char* name)
+      : name_(IsEventTraceEnabled() ? name : nullptr),
+        start_us_(name_ != nullptr ? GetTraceTimeUs() : 0) {}
+  ~ScopedTraceEvent() {
+    if (name_ != nullptr) {
+      AddTraceEvent(name_, start_us_, GetTraceTimeUs() - start_us_);
+    }
+  }
+
+ private:
+  const char* name_;
+  int64_t start_us_;
+};
+
+#define TRACE_EVENT_CONCAT_INNER(a, b) a##b
+#define TRACE_EVENT_CONCAT(a, b) TRACE_EVENT_CONCAT_INNER(a, b)
+// スコープを抜けるまでの時間を記録する
+#define TRACE_EVENT(name) \
+  ScopedTraceEvent TRACE_EVENT_CONCAT(trace_event_, __LINE__)(name)
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef LATENCY_PATTERN_H_
+#define LATENCY_PATTERN_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// 映像の輝度プレーンの上端にタイムスタンプ (UTC のミリ秒) を白黒のブロックで埋め込む。
+//
+// 横幅を kLatencyPatternCells 個のセルに分割して、以下のように配置する。
+//   [0] 白 [1] 黒 [2..49] タイムスタンプ 48 bit [50..57] チェックサム 8 bit
+//   [58] 黒 [59] 白
+// セルの幅は映像の横幅に比例するので、途中で解像度が変わってもデコードできる。
+constexpr int kLatencyPatternCells = 60;
+
+void EncodeLatencyPattern(uint8_t* y,
+                          int stride,
+                          int width,
+                          int height,
+                          int64_t timestamp_ms);
+// パターンが見つからなかった場合やチェックサムが一致しなかった場合は false を返す
+bool DecodeLatencyPattern(const uint8_t* y,
+                          int stride,
+                          int width,
+                          int height,
+                          int64_t* timestamp_ms);
+
+// 遅延のヒストグラム。
+// 複数のスレッドから Add されることを想定して、全てアトミック変数で扱う。
+class LatencyHistogram {
+ public:
+  static constexpr int kBucketWidthMs = 5;
+  // 最後のバケツは kBucketWidthMs * (kBucketCount - 1) ms 以上の値を全て含む
+  static constexpr int kBucketCount = 400;
+
+  LatencyHistogram();
+
+  void Add(int64_t latency_ms);
+  uint32_t GetCount() const;
+  // percentile は 0〜1。値が無い場合は 0 を返す
+  int64_t GetPercentileMs(double percentile) const;
+  std::string ToJson(const std::string& name) const;
+
+ private:
+  int64_t GetPercentile(uint32_t count, double percentile) const;
+
+  std::array<std::atomic<uint32_t>, kBucketCount> buckets_;
+  std::atomic<uint32_t> count_;
+  std::atomic<int64_t> sum_;
+  std::atomic<int64_t> max_;
+};
+
+#endif
@@ -0,0 +1,273 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+// SDL
+#include <SDL2/SDL.h>
+
+// WebRTC
+#include <api/make_ref_counted.h>
+#include <api/video/i420_buffer.h>
+#include <media/base/adapted_video_track_source.h>
+#include <rtc_base/logging.h>
+#include <rtc_base/time_utils.h>
+
+// Sora
+#include <sora/sora_client_context.h>
+
+#include "metrics_server.h"
+#include "sdl_renderer.h"
+
+#ifdef _WIN32
+#include <rtc_base/win/scoped_com_initializer.h>
+#endif
+
+// MetricsServer をポート 0 で起動して、SDLRenderer にトラックを追加した状態で
+// Beast で GET /metrics を取得し、期待する # TYPE の行とトラック毎のラベルが
+// 含まれているかを確認する。期待と異なる場合は 0 以外で終了する。
+//
+// ディスプレイが無い環境でも動くように、SDL_VIDEODRIVER が未指定の場合は dummy を使う。
+
+namespace http = boost::beast::http;
+using tcp = boost::asio::ip::tcp;
+
+namespace {
+
+const char kTrackA[] = "track-a";
+// ラベルの値のエスケープを確認するために、ダブルクォートを含める
+const char kTrackB[] = "track-\"b\"";
+const int kFramesA = 5;
+
+// 任意のタイミングでフレームを流せるソース
+class CheckVideoSource : public rtc::AdaptedVideoTrackSource {
+ public:
+  void PushFrame(const webrtc::VideoFrame& frame) { OnFrame(frame); }
+
+  bool is_screencast() const override { return false; }
+  absl::optional<bool> needs_denoising() const override { return false; }
+  webrtc::MediaSourceInterface::SourceState state() const override {
+    return webrtc::MediaSourceInterface::kLive;
+  }
+  bool remote() const override { return false; }
+};
+
+// GET して、ステータスコードと本文を返す。通信に失敗した場合は false を返す
+bool Get(unsigned short port,
+         const std::string& target,
+         int& status,
+         std::string& body) {
+  boost::asio::io_context ioc;
+  boost::beast::tcp_stream stream(ioc);
+  boost::system::error_code ec;
+  stream.expires_after(std::chrono::seconds(5));
+  stream.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port),
+                 ec);
+  if (ec) {
+    std::cerr << "connect failed: " << ec.message() << std::endl;
+    return false;
+  }
+  http::request<http::empty_body> req(http::verb::get, target, 11);
+  req.set(http::field::host, "127.0.0.1");
+  http::write(stream, req, ec);
+  if (ec) {
+    std::cerr << "write failed: " << ec.message() << std::endl;
+    return false;
+  }
+  boost::beast::flat_buffer buffer;
+  http::response<http::string_body> res;
+  http::read(stream, buffer, res, ec);
+  if (ec) {
+    std::cerr << "read failed: " << ec.message() << std::endl;
+    return false;
+  }
+  stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+  status = res.result_int();
+  body = res.body();
+  return true;
+}
+
+size_t Count(const std::string& text, const std::string& s) {
+  size_t count = 0;
+  for (size_t pos = text.find(s); pos != std::string::npos;
+       pos = text.find(s, pos + s.size())) {
+    count++;
+  }
+  return count;
+}
+
+std::string TrackLabel(const char* name, const std::string& track_id) {
+  std::string label;
+  for (char c : track_id) {
+    if (c == '\\' || c == '"') {
+      label += '\\';
+    }
+    label += c;
+  }
+  return std::string(name) + "{track=\"" + label + "\"}";
+}
+
+class MetricsCheck {
+ public:
+  int Run() {
+    sora::SoraClientContextConfig context_config;
+    context_config.use_audio_device = false;
+    context_config.use_hardware_encoder = false;
+    auto context = sora::SoraClientContext::Create(context_config);
+
+    boost::asio::io_context ioc(1);
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+        work_guard(ioc.get_executor());
+
+    SDLRenderer renderer(320, 240, false);
+    renderer.SetDispatchFunction([&ioc](std::function<void()> f) {
+      if (ioc.stopped())
+        return;
+      boost::asio::dispatch(ioc.get_executor(), f);
+    });
+
+    auto source_a = rtc::make_ref_counted<CheckVideoSource>();
+    auto source_b = rtc::make_ref_counted<CheckVideoSource>();
+    auto track_a = context->peer_connection_factory()->CreateVideoTrack(
+        kTrackA, source_a.get());
+    auto track_b = context->peer_connection_factory()->CreateVideoTrack(
+        kTrackB, source_b.get());
+    renderer.AddTrack(track_a.get());
+    renderer.AddTrack(track_b.get());
+
+    rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+        webrtc::I420Buffer::Create(64, 36);
+    webrtc::I420Buffer::SetBlack(buffer.get());
+    for (int i = 0; i < kFramesA; i++) {
+      source_a->PushFrame(webrtc::VideoFrame::Builder()
+                              .set_video_frame_buffer(buffer)
+                              .set_timestamp_us(rtc::TimeMicros())
+                              .build());
+    }
+
+    // 実際のサンプルと同じように、collect は io_context のスレッドから呼ばれる
+    MetricsServerConfig metrics_config;
+    metrics_config.port = 0;
+    std::unique_ptr<MetricsServer> server = MetricsServer::Create(
+        ioc, metrics_config, [&renderer](MetricsWriter& writer) {
+          renderer.AppendMetrics(writer, "0");
+        });
+    if (server == nullptr) {
+      std::cerr << "Failed to start MetricsServer" << std::endl;
+      return 1;
+    }
+    unsigned short port = (unsigned short)server->GetPort();
+    std::thread thread([&ioc]() { ioc.run(); });
+
+    int status = 0;
+    std::string body;
+    if (Expect(Get(port, "/metrics", status, body), "GET /metrics")) {
+      Expect(status == 200, "GET /metrics returns 200");
+      CheckTypes(body);
+      Expect(Count(body, "sora_renderer_renders_total{window=\"0\"} ") == 1,
+             "renders_total has window label");
+      Expect(Count(body, TrackLabel("sora_renderer_frames_received_total",
+                                    kTrackA) +
+                             " " + std::to_string(kFramesA) + "\n") == 1,
+             "frames_received_total of track-a");
+      Expect(Count(body, TrackLabel("sora_renderer_frames_received_total",
+                                    kTrackB) +
+                             " 0\n") == 1,
+             "frames_received_total of track-b is escaped");
+      CheckTrackLabels(body, kTrackA, true);
+      CheckTrackLabels(body, kTrackB, true);
+    }
+
+    // 削除したトラックはスナップショットから消える
+    renderer.RemoveTrack(track_b.get());
+    if (Expect(Get(port, "/metrics", status, body),
+               "GET /metrics after RemoveTrack")) {
+      CheckTypes(body);
+      CheckTrackLabels(body, kTrackA, true);
+      CheckTrackLabels(body, kTrackB, false);
+    }
+
+    if (Expect(Get(port, "/", status, body), "GET /")) {
+      Expect(status == 404, "GET / returns 404");
+    }
+
+    boost::asio::post(ioc, [&server]() { server.reset(); });
+    work_guard.reset();
+    thread.join();
+    renderer.RemoveTrack(track_a.get());
+
+    std::cout << "{\"failures\":" << failures_ << "}" << std::endl;
+    return failures_ == 0 ? 0 : 1;
+  }
+
+ private:
+  bool Expect(bool ok, const std::string& what) {
+    if (!ok) {
+      std::cerr << "FAILED: " << what << std::endl;
+      failures_++;
+    }
+    return ok;
+  }
+
+  // 同じ名前のメトリクスは 1 か所にまとめて出力するので、# TYPE の行は 1 回だけ出る
+  void CheckTypes(const std::string& body) {
+    const std::vector<std::pair<std::string, std::string>> types = {
+        {"sora_renderer_renders_total", "counter"},
+        {"sora_renderer_render_seconds_total", "counter"},
+        {"sora_renderer_governor_level", "gauge"},
+        {"sora_renderer_frames_received_total", "counter"},
+        {"sora_renderer_frames_rendered_total", "counter"},
+        {"sora_renderer_frames_dropped_total", "counter"},
+        {"sora_renderer_frames_overwritten_total", "counter"},
+        {"sora_renderer_convert_seconds_total", "counter"},
+    };
+    for (const auto& type : types) {
+      std::string line = "# TYPE " + type.first + " " + type.second + "\n";
+      Expect(Count(body, line) == 1, line.substr(0, line.size() - 1));
+    }
+  }
+
+  void CheckTrackLabels(const std::string& body,
+                        const std::string& track_id,
+                        bool exists) {
+    const char* names[] = {
+        "sora_renderer_frames_received_total",
+        "sora_renderer_frames_rendered_total",
+        "sora_renderer_frames_dropped_total",
+        "sora_renderer_frames_overwritten_total",
+        "sora_renderer_convert_seconds_total",
+    };
+    for (const char* name : names) {
+      std::string label = TrackLabel(name, track_id);
+      Expect(Count(body, label + " ") == (exists ? 1 : 0),
+             label + (exists ? " exists" : " does not exist"));
+    }
+  }
+
+  int failures_ = 0;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+  webrtc::ScopedCOMInitializer com_initializer(
+      webrtc::ScopedCOMInitializer::kMTA);
+  if (!com_initializer.Succeeded()) {
+    std::cerr << "CoInitializeEx failed" << std::endl;
+    return 1;
+  }
+#endif
+
+  rtc::LogMessage::LogToDebug(rtc::LS_WARNING);
+  // 既に指定されている場合は上書きしない
+  SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+
+  MetricsCheck check;
+  return check.Run();
+}
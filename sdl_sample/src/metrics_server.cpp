@@ -0,0 +1,241 @@
+#include "metrics_server.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// Boost
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+// WebRTC
+#include <rtc_base/logging.h>
+
+// accept に失敗した場合にやり直すまで待つ時間。失敗が続く場合は最大値まで倍にする
+#define METRICS_ACCEPT_RETRY_MIN_MS 100
+#define METRICS_ACCEPT_RETRY_MAX_MS 5000
+
+namespace http = boost::beast::http;
+
+namespace {
+
+void AppendValue(std::string& text, double value) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), " %.15g\n", value);
+  text += buf;
+}
+
+void AppendLabelValue(std::string& text, const std::string& value) {
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      text += '\\';
+      text += c;
+    } else if (c == '\n') {
+      text += "\\n";
+    } else {
+      text += c;
+    }
+  }
+}
+
+class MetricsSession : public std::enable_shared_from_this<MetricsSession> {
+ public:
+  MetricsSession(boost::asio::ip::tcp::socket socket,
+                 std::function<void(MetricsWriter&)> collect)
+      : stream_(std::move(socket)), collect_(std::move(collect)) {}
+
+  void Read() {
+    req_ = {};
+    stream_.expires_after(std::chrono::seconds(30));
+    auto self = shared_from_this();
+    http::async_read(stream_, buffer_, req_,
+                     [self](boost::system::error_code ec, std::size_t) {
+                       if (ec) {
+                         return self->Close();
+                       }
+                       self->OnRead();
+                     });
+  }
+
+ private:
+  void OnRead() {
+    auto res = std::make_shared<http::response<http::string_body>>();
+    res->version(req_.version());
+    res->keep_alive(req_.keep_alive());
+    res->set(http::field::server, "Sora C++ SDK Samples");
+    if (req_.method() != http::verb::get) {
+      res->result(http::status::method_not_allowed);
+    } else if (req_.target() != "/metrics") {
+      res->result(http::status::not_found);
+    } else {
+      MetricsWriter writer;
+      collect_(writer);
+      res->result(http::status::ok);
+      res->set(http::field::content_type, "text/plain; version=0.0.4");
+      res->body() = writer.GetText();
+    }
+    res->prepare_payload();
+
+    auto self = shared_from_this();
+    http::async_write(stream_, *res,
+                      [self, res](boost::system::error_code ec, std::size_t) {
+                        if (ec || !res->keep_alive()) {
+                          return self->Close();
+                        }
+                        self->Read();
+                      });
+  }
+
+  void Close() {
+    boost::system::error_code ec;
+    stream_.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send,
+                              ec);
+  }
+
+  boost::beast::tcp_stream stream_;
+  boost::beast::flat_buffer buffer_;
+  http::request<http::string_body> req_;
+  std::function<void(MetricsWriter&)> collect_;
+};
+
+}  // namespace
+
+void MetricsWriter::Add(const char* name, const char* type, double value) {
+  std::string& text = GetFamily(name, type);
+  text += name;
+  AppendValue(text, value);
+}
+
+void MetricsWriter::Add(const char* name,
+                        const char* type,
+                        const char* label_name,
+                        const std::string& label_value,
+                        double value) {
+  std::string& text = GetFamily(name, type);
+  text += name;
+  text += '{';
+  text += label_name;
+  text += "=\"";
+  AppendLabelValue(text, label_value);
+  text += "\"}";
+  AppendValue(text, value);
+}
+
+std::string MetricsWriter::GetText() const {
+  std::string text;
+  for (const std::string& family : families_) {
+    text += family;
+  }
+  return text;
+}
+
+std::string& MetricsWriter::GetFamily(const char* name, const char* type) {
+  auto it = family_indices_.find(name);
+  if (it != family_indices_.end()) {
+    return families_[it->second];
+  }
+  family_indices_[name] = families_.size();
+  families_.push_back("# TYPE ");
+  std::string& text = families_.back();
+  text += name;
+  text += ' ';
+  text += type;
+  text += '\n';
+  return text;
+}
+
+std::unique_ptr<MetricsServer> MetricsServer::Create(
+    boost::asio::io_context& ioc,
+    MetricsServerConfig config,
+    std::function<void(MetricsWriter&)> collect) {
+  std::unique_ptr<MetricsServer> server(
+      new MetricsServer(ioc, std::move(collect)));
+
+  boost::system::error_code ec;
+  auto address = boost::asio::ip::make_address(config.address, ec);
+  if (ec) {
+    RTC_LOG(LS_ERROR) << "Invalid metrics address: " << config.address;
+    return nullptr;
+  }
+  boost::asio::ip::tcp::endpoint endpoint(address, (uint16_t)config.port);
+  server->acceptor_.open(endpoint.protocol(), ec);
+  if (!ec) {
+    server->acceptor_.set_option(
+        boost::asio::socket_base::reuse_address(true), ec);
+  }
+  if (!ec) {
+    server->acceptor_.bind(endpoint, ec);
+  }
+  if (!ec) {
+    server->acceptor_.listen(boost::asio::socket_base::max_listen_connections,
+                             ec);
+  }
+  if (ec) {
+    RTC_LOG(LS_ERROR) << "Failed to listen metrics endpoint: "
+                      << config.address << ":" << config.port << ": "
+                      << ec.message();
+    return nullptr;
+  }
+
+  RTC_LOG(LS_INFO) << "Serving metrics on http://" << config.address << ":"
+                   << server->GetPort() << "/metrics";
+  server->Accept();
+  return server;
+}
+
+MetricsServer::MetricsServer(boost::asio::io_context& ioc,
+                             std::function<void(MetricsWriter&)> collect)
+    : acceptor_(ioc),
+      retry_timer_(ioc),
+      retry_delay_ms_(METRICS_ACCEPT_RETRY_MIN_MS),
+      collect_(std::move(collect)) {}
+
+MetricsServer::~MetricsServer() {
+  boost::system::error_code ec;
+  acceptor_.close(ec);
+  retry_timer_.cancel();
+}
+
+int MetricsServer::GetPort() const {
+  boost::system::error_code ec;
+  return acceptor_.local_endpoint(ec).port();
+}
+
+void MetricsServer::Accept() {
+  acceptor_.async_accept(
+      [this](boost::system::error_code ec,
+             boost::asio::ip::tcp::socket socket) {
+        // 破棄された後に呼ばれた場合は operation_aborted になるので、this に触らずに抜ける
+        if (ec == boost::asio::error::operation_aborted) {
+          return;
+        }
+        if (ec) {
+          RetryAccept(ec);
+          return;
+        }
+        retry_delay_ms_ = METRICS_ACCEPT_RETRY_MIN_MS;
+        std::make_shared<MetricsSession>(std::move(socket), collect_)->Read();
+        Accept();
+      });
+}
+
+void MetricsServer::RetryAccept(const boost::system::error_code& ec) {
+  // acceptor が閉じられている場合はやり直しても失敗し続けるので止める
+  if (ec == boost::asio::error::bad_descriptor || !acceptor_.is_open()) {
+    RTC_LOG(LS_ERROR) << "Stop accepting metrics connections: "
+                      << ec.message();
+    return;
+  }
+  // ファイルディスクリプタが足りない (EMFILE) 場合などは、すぐにやり直すと
+  // 同じエラーで CPU を使い続けるので、待つ時間を倍にしながらやり直す
+  RTC_LOG(LS_WARNING) << "Failed to accept metrics connection: "
+                      << ec.message() << ", retry after " << retry_delay_ms_
+                      << " ms";
+  retry_timer_.expires_after(std::chrono::milliseconds(retry_delay_ms_));
+  retry_delay_ms_ = std::min(retry_delay_ms_ * 2, METRICS_ACCEPT_RETRY_MAX_MS);
+  retry_timer_.async_wait([this](const boost::system::error_code& ec) {
+    if (ec) {
+      return;
+    }
+    Accept();
+  });
+}
@@ -0,0 +1,68 @@
+#ifndef METRICS_SERVER_H_
+#define METRICS_SERVER_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Boost
+#include <boost/asio.hpp>
+
+// Prometheus のテキスト形式でメトリクスを組み立てる
+class MetricsWriter {
+ public:
+  // type は "counter" か "gauge"。
+  // 同じ名前のメトリクスは、間に他のメトリクスを追加しても 1 か所にまとめて出力する
+  void Add(const char* name, const char* type, double value);
+  void Add(const char* name,
+           const char* type,
+           const char* label_name,
+           const std::string& label_value,
+           double value);
+
+  std::string GetText() const;
+
+ private:
+  std::string& GetFamily(const char* name, const char* type);
+
+  // 追加した順に出力するので、名前から families_ の位置を引けるようにしておく
+  std::vector<std::string> families_;
+  std::map<std::string, size_t> family_indices_;
+};
+
+struct MetricsServerConfig {
+  std::string address = "127.0.0.1";
+  int port = 0;
+};
+
+// GET /metrics にメトリクスを返す HTTP サーバー。
+//
+// 渡した io_context のスレッドで動くので、collect も io_context のスレッドから呼ばれる。
+// collect の間は io_context のスレッドが止まるので、重い処理はしないこと。
+class MetricsServer {
+ public:
+  static std::unique_ptr<MetricsServer> Create(
+      boost::asio::io_context& ioc,
+      MetricsServerConfig config,
+      std::function<void(MetricsWriter&)> collect);
+  ~MetricsServer();
+
+  int GetPort() const;
+
+ private:
+  MetricsServer(boost::asio::io_context& ioc,
+                std::function<void(MetricsWriter&)> collect);
+
+  void Accept();
+  // accept に失敗した場合は、少し待ってからやり直す
+  void RetryAccept(const boost::system::error_code& ec);
+
+  boost::asio::ip::tcp::acceptor acceptor_;
+  boost::asio::steady_timer retry_timer_;
+  int retry_delay_ms_;
+  std::function<void(MetricsWriter&)> collect_;
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <string>
+
+// Boost
+#include <boost/asio.hpp>
+
+// SDL
+#include <SDL2/SDL.h>
+
+// WebRTC
+#include <api/make_ref_counted.h>
+#include <media/base/video_broadcaster.h>
+#include <pc/video_track_source.h>
+#include <rtc_base/logging.h>
+
+// Sora
+#include <sora/sora_client_context.h>
+
+#include "multi_window_renderer.h"
+
+#ifdef _WIN32
+#include <rtc_base/win/scoped_com_initializer.h>
+#endif
+
+// MultiWindowRenderer で 2 つのウインドウにトラックを 1 つずつ表示して、RenderGovernor が
+// 働いた時に、最初のウインドウ以外のタイルにもフレームレートを制限した VideoSinkWants が
+// 届くかを確認する。期待と異なる場合は 0 以外で終了する。
+//
+// RenderGovernor の予算を 1 マイクロ秒にして、必ず描画が予算を超えている状態にする。
+// 描画スレッドを動かすためにウインドウを作れる必要があるので、ディスプレイが無い環境では
+// SDL_VIDEODRIVER=offscreen (EGL が必要) を指定して実行する。
+
+// 期待する VideoSinkWants が届くのを待つ最大時間
+#define MULTI_WINDOW_CHECK_DEADLINE_MS 10000
+#define MULTI_WINDOW_CHECK_POLL_INTERVAL_MS 50
+
+namespace {
+
+const char kTrackA[] = "track-a";
+const char kTrackB[] = "track-b";
+
+// シンクが要求した VideoSinkWants を確認できる、受信した映像のソース
+class CheckVideoSource : public webrtc::VideoTrackSource {
+ public:
+  // SDLRenderer は受信した映像にだけ VideoSinkWants を設定するので remote にする
+  CheckVideoSource() : webrtc::VideoTrackSource(true) {}
+
+  rtc::VideoSinkWants GetWants() const { return broadcaster_.wants(); }
+
+ protected:
+  rtc::VideoSourceInterface<webrtc::VideoFrame>* source() override {
+    return &broadcaster_;
+  }
+
+ private:
+  rtc::VideoBroadcaster broadcaster_;
+};
+
+bool IsLimited(const rtc::VideoSinkWants& wants) {
+  return wants.max_framerate_fps < std::numeric_limits<int>::max();
+}
+
+// 条件を満たすまで io_context を回しながら待つ。時間内に満たさなかった場合は false を返す
+template <class F>
+bool WaitFor(boost::asio::io_context& ioc, F condition) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(MULTI_WINDOW_CHECK_DEADLINE_MS);
+  while (!condition()) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    ioc.run_for(
+        std::chrono::milliseconds(MULTI_WINDOW_CHECK_POLL_INTERVAL_MS));
+  }
+  return true;
+}
+
+class MultiWindowCheck {
+ public:
+  int Run() {
+    sora::SoraClientContextConfig context_config;
+    context_config.use_audio_device = false;
+    context_config.use_hardware_encoder = false;
+    auto context = sora::SoraClientContext::Create(context_config);
+
+    // 実際のサンプルと同じように、dispatch はメインスレッドの io_context に渡す
+    boost::asio::io_context ioc(1);
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+        work_guard(ioc.get_executor());
+
+    MultiWindowRendererConfig config;
+    config.window_count = 2;
+    config.width = 320;
+    config.height = 240;
+    MultiWindowRenderer renderer(config);
+    renderer.SetDispatchFunction([&ioc](std::function<void()> f) {
+      if (ioc.stopped())
+        return;
+      boost::asio::dispatch(ioc.get_executor(), f);
+    });
+
+    auto source_a = rtc::make_ref_counted<CheckVideoSource>();
+    auto source_b = rtc::make_ref_counted<CheckVideoSource>();
+    auto track_a = context->peer_connection_factory()->CreateVideoTrack(
+        kTrackA, source_a.get());
+    auto track_b = context->peer_connection_factory()->CreateVideoTrack(
+        kTrackB, source_b.get());
+    renderer.AssignTrack(kTrackA, 0);
+    renderer.AssignTrack(kTrackB, 1);
+    renderer.AddTrack(track_a.get());
+    renderer.AddTrack(track_b.get());
+
+    Expect(!IsLimited(source_a->GetWants()) && !IsLimited(source_b->GetWants()),
+           "tiles are not limited before enabling the governor");
+
+    renderer.SetRenderGovernorBudget(1);
+    renderer.SetRenderGovernor(true);
+    bool engaged = WaitFor(
+        ioc, [&renderer]() { return renderer.GetRenderGovernorLevel() > 0; });
+    if (Expect(engaged, "render governor engages (is a window created?)")) {
+      Expect(WaitFor(ioc,
+                     [&source_a]() { return IsLimited(source_a->GetWants()); }),
+             "tile in window 1 gets a reduced max_framerate_fps");
+      Expect(WaitFor(ioc,
+                     [&source_b]() { return IsLimited(source_b->GetWants()); }),
+             "tile in window 2 gets a reduced max_framerate_fps");
+      std::cout << "{\"governor_level\":" << renderer.GetRenderGovernorLevel()
+                << ",\"window1_max_fps\":"
+                << source_a->GetWants().max_framerate_fps
+                << ",\"window2_max_fps\":"
+                << source_b->GetWants().max_framerate_fps << "}" << std::endl;
+    }
+
+    // 無効にすると全てのウインドウで制限が外れる
+    renderer.SetRenderGovernor(false);
+    Expect(WaitFor(ioc,
+                   [&source_a, &source_b]() {
+                     return !IsLimited(source_a->GetWants()) &&
+                            !IsLimited(source_b->GetWants());
+                   }),
+           "tiles are not limited after disabling the governor");
+
+    renderer.RemoveTrack(track_a.get());
+    renderer.RemoveTrack(track_b.get());
+    // 描画スレッドが最後に渡した処理を実行してから終わる
+    work_guard.reset();
+    ioc.poll();
+
+    std::cout << "{\"failures\":" << failures_ << "}" << std::endl;
+    return failures_ == 0 ? 0 : 1;
+  }
+
+ private:
+  bool Expect(bool ok, const std::string& what) {
+    if (!ok) {
+      std::cerr << "FAILED: " << what << std::endl;
+      failures_++;
+    }
+    return ok;
+  }
+
+  int failures_ = 0;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+  webrtc::ScopedCOMInitializer com_initializer(
+      webrtc::ScopedCOMInitializer::kMTA);
+  if (!com_initializer.Succeeded()) {
+    std::cerr << "CoInitializeEx failed" << std::endl;
+    return 1;
+  }
+#endif
+
+  rtc::LogMessage::LogToDebug(rtc::LS_WARNING);
+
+  MultiWindowCheck check;
+  return check.Run();
+}
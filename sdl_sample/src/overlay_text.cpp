@@ -0,0 +1,72 @@
+#include "overlay_text.h"
+
+#include <cctype>
+
+namespace {
+
+struct Glyph {
+  char c;
+  // 上の行から順に、左のドットを 4、右のドットを 1 にしたビット
+  uint8_t rows[5];
+};
+
+const Glyph kGlyphs[] = {
+    {'0', {7, 5, 5, 5, 7}}, {'1', {2, 6, 2, 2, 7}}, {'2', {7, 1, 7, 4, 7}},
+    {'3', {7, 1, 7, 1, 7}}, {'4', {5, 5, 7, 1, 1}}, {'5', {7, 4, 7, 1, 7}},
+    {'6', {7, 4, 7, 5, 7}}, {'7', {7, 1, 1, 1, 1}}, {'8', {7, 5, 7, 5, 7}},
+    {'9', {7, 5, 7, 1, 7}}, {'A', {2, 5, 7, 5, 5}}, {'B', {6, 5, 6, 5, 6}},
+    {'C', {3, 4, 4, 4, 3}}, {'D', {6, 5, 5, 5, 6}}, {'E', {7, 4, 6, 4, 7}},
+    {'F', {7, 4, 6, 4, 4}}, {'G', {3, 4, 5, 5, 3}}, {'H', {5, 5, 7, 5, 5}},
+    {'I', {7, 2, 2, 2, 7}}, {'J', {1, 1, 1, 5, 2}}, {'K', {5, 5, 6, 5, 5}},
+    {'L', {4, 4, 4, 4, 7}}, {'M', {5, 7, 7, 5, 5}}, {'N', {6, 5, 5, 5, 5}},
+    {'O', {2, 5, 5, 5, 2}}, {'P', {6, 5, 6, 4, 4}}, {'Q', {2, 5, 5, 6, 3}},
+    {'R', {6, 5, 6, 5, 5}}, {'S', {3, 4, 2, 1, 6}}, {'T', {7, 2, 2, 2, 2}},
+    {'U', {5, 5, 5, 5, 7}}, {'V', {5, 5, 5, 5, 2}}, {'W', {5, 5, 7, 7, 5}},
+    {'X', {5, 5, 2, 5, 5}}, {'Y', {5, 5, 2, 2, 2}}, {'Z', {7, 1, 2, 4, 7}},
+    {'.', {0, 0, 0, 0, 2}}, {'/', {1, 1, 2, 4, 4}}, {':', {0, 2, 0, 2, 0}},
+    {'-', {0, 0, 7, 0, 0}}, {'%', {5, 1, 2, 4, 5}},
+};
+
+const Glyph* FindGlyph(char c) {
+  c = (char)std::toupper((unsigned char)c);
+  for (const Glyph& glyph : kGlyphs) {
+    if (glyph.c == c) {
+      return &glyph;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+void AppendOverlayTextRects(const std::string& text,
+                            int x,
+                            int y,
+                            int scale,
+                            const SDL_Rect& clip,
+                            std::vector<SDL_Rect>& rects) {
+  int left = x;
+  for (char c : text) {
+    if (c == '\n') {
+      x = left;
+      y += kOverlayLineHeight * scale;
+      continue;
+    }
+    const Glyph* glyph = FindGlyph(c);
+    if (glyph != nullptr) {
+      for (int row = 0; row < 5; row++) {
+        for (int col = 0; col < 3; col++) {
+          if ((glyph->rows[row] & (4 >> col)) == 0) {
+            continue;
+          }
+          SDL_Rect dot = {x + col * scale, y + row * scale, scale, scale};
+          SDL_Rect clipped;
+          if (SDL_IntersectRect(&dot, &clip, &clipped)) {
+            rects.push_back(clipped);
+          }
+        }
+      }
+    }
+    x += kOverlayCharWidth * scale;
+  }
+}
@@ -0,0 +1,26 @@
+#ifndef OVERLAY_TEXT_H_
+#define OVERLAY_TEXT_H_
+
+#include <string>
+#include <vector>
+
+// SDL
+#include <SDL2/SDL.h>
+
+// フォントを使わずに、3x5 ドットの文字を矩形の塗りつぶしで描く。
+// 数字と英字 (小文字は大文字で描く) と . / : - % に対応していて、それ以外の文字は空白になる。
+
+// 1 文字の幅と 1 行の高さ (ドット数)。文字の間と行の間の 1 ドットを含む
+constexpr int kOverlayCharWidth = 4;
+constexpr int kOverlayLineHeight = 6;
+
+// (x, y) を左上にして text を描く矩形を rects に追加する。
+// 1 ドットは scale x scale ピクセルで、clip からはみ出す部分は追加しない
+void AppendOverlayTextRects(const std::string& text,
+                            int x,
+                            int y,
+                            int scale,
+                            const SDL_Rect& clip,
+                            std::vector<SDL_Rect>& rects);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef RENDER_GOVERNOR_H_
+#define RENDER_GOVERNOR_H_
+
+#include <stdint.h>
+
+// 描画スレッドの 1 回の描画にかかった時間から、タイル毎に更新するフレームレートの上限を決める。
+//
+// 描画が予算を超え続けた場合は段階を上げて、重要度の低いタイルから順にフレームレートを落とす。
+// 予算に十分な余裕がある状態が続いた場合は段階を下げて、重要度の高いタイルから順に元に戻す。
+// 段階を変えた直後は効果が出るまで判断しないので、段階が行ったり来たりしにくい。
+class RenderGovernor {
+ public:
+  explicit RenderGovernor(int64_t budget_us);
+
+  // 描画 1 回分の時間を追加する。段階が変わった場合は true を返す
+  bool AddRenderTime(int64_t render_us);
+  void Reset();
+  void SetBudget(int64_t budget_us);
+  int GetLevel() const;
+  // 最後に判断した時の、描画 1 回あたりの平均の時間
+  int64_t GetMeanRenderUs() const;
+  // 重要度の低い順に並べた tile_count 個のタイルのうち、index 番目のタイルの
+  // フレームレートの上限を返す。0 の場合は制限しない
+  int GetMaxFramerate(int index, int tile_count) const;
+
+ private:
+  int64_t budget_us_;
+  int level_;
+  int samples_;
+  int64_t total_us_;
+  int64_t mean_us_;
+  // 予算に余裕がある判断が続いた回数
+  int headroom_windows_;
+  // 段階を変えた直後の判断を捨てる
+  bool settling_;
+};
+
+#endif
@@ -0,0 +1,366 @@
+#include "rtc_stats_sampler.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <fstream>
+
+// WebRTC
+#include <api/make_ref_counted.h>
+#include <api/stats/rtc_stats_collector_callback.h>
+#include <api/stats/rtcstats_objects.h>
+#include <rtc_base/logging.h>
+
+namespace {
+
+template <typename T>
+T ValueOr(const webrtc::RTCStatsMember<T>& member, T default_value) {
+  return member.is_defined() ? *member : default_value;
+}
+
+// カウンタが巻き戻った場合 (SSRC の再利用など) は 0 とみなす
+template <typename T>
+double Delta(T now, T prev) {
+  return now >= prev ? (double)(now - prev) : 0.0;
+}
+
+void AppendFormat(std::string* buf, const char* format, ...) {
+  char tmp[256];
+  va_list args;
+  va_start(args, format);
+  int n = std::vsnprintf(tmp, sizeof(tmp), format, args);
+  va_end(args);
+  if (n > 0) {
+    buf->append(tmp, std::min<size_t>(n, sizeof(tmp) - 1));
+  }
+}
+
+}  // namespace
+
+class RTCStatsSampler::Callback : public webrtc::RTCStatsCollectorCallback {
+ public:
+  Callback(std::shared_ptr<Shared> shared) : shared_(shared) {}
+
+  // シグナリングスレッドから呼ばれるので、ここでは結果を渡すだけにする
+  void OnStatsDelivered(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report)
+      override {
+    webrtc::MutexLock lock(&shared_->mutex);
+    RTCStatsSampler* sampler = shared_->sampler;
+    if (sampler == nullptr) {
+      return;
+    }
+    boost::asio::post(sampler->ioc_, [sampler, report]() {
+      sampler->OnStatsDelivered(report);
+    });
+  }
+
+ private:
+  std::shared_ptr<Shared> shared_;
+};
+
+RTCStatsSampler::RTCStatsSampler(RTCStatsSamplerConfig config)
+    : config_(config),
+      timer_(ioc_),
+      work_guard_(ioc_.get_executor()),
+      shared_(std::make_shared<Shared>()),
+      collecting_(false),
+      connection_rtt_ms_(0) {
+  shared_->sampler = this;
+  buffer_.reserve(64 * 1024);
+}
+
+RTCStatsSampler::~RTCStatsSampler() {
+  {
+    webrtc::MutexLock lock(&shared_->mutex);
+    shared_->sampler = nullptr;
+  }
+  ioc_.stop();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void RTCStatsSampler::Start() {
+  if (config_.interval <= 0 || config_.file.empty()) {
+    return;
+  }
+  if (config_.format == "json") {
+    // 前回の実行結果を消さないように追記する
+    std::ofstream ofs(config_.file, std::ios::app);
+    if (!ofs) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__
+                        << ": Failed to open stats file: " << config_.file;
+      return;
+    }
+  }
+  boost::asio::post(ioc_, [this]() { ScheduleNext(); });
+  thread_ = std::thread([this]() { ioc_.run(); });
+}
+
+void RTCStatsSampler::SetPeerConnection(
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc) {
+  webrtc::MutexLock lock(&pc_lock_);
+  pc_ = pc;
+  collecting_ = false;
+}
+
+void RTCStatsSampler::ScheduleNext() {
+  timer_.expires_after(std::chrono::seconds(config_.interval));
+  timer_.async_wait([this](const boost::system::error_code& ec) {
+    if (ec) {
+      return;
+    }
+    Collect();
+    ScheduleNext();
+  });
+}
+
+void RTCStatsSampler::Collect() {
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc;
+  {
+    webrtc::MutexLock lock(&pc_lock_);
+    pc = pc_;
+  }
+  if (pc == nullptr) {
+    return;
+  }
+  // 前回の結果がまだ返ってきていない場合は、リクエストを積み上げずに今回の分を飛ばす
+  if (collecting_.exchange(true)) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Previous GetStats is pending";
+    return;
+  }
+  auto callback = rtc::make_ref_counted<Callback>(shared_);
+  pc->GetStats(callback.get());
+}
+
+RTCStatsSampler::Slot* RTCStatsSampler::FindSlot(uint32_t ssrc,
+                                                 bool outbound) {
+  Slot* empty = nullptr;
+  for (auto& slot : slots_) {
+    if (slot.used && slot.ssrc == ssrc && slot.outbound == outbound) {
+      return &slot;
+    }
+    if (!slot.used && empty == nullptr) {
+      empty = &slot;
+    }
+  }
+  if (empty == nullptr) {
+    return nullptr;
+  }
+  *empty = Slot();
+  empty->used = true;
+  empty->ssrc = ssrc;
+  empty->outbound = outbound;
+  return empty;
+}
+
+void RTCStatsSampler::OnStatsDelivered(
+    rtc::scoped_refptr<const webrtc::RTCStatsReport> report) {
+  collecting_ = false;
+
+  for (auto& slot : slots_) {
+    slot.seen = false;
+  }
+
+  connection_rtt_ms_ = 0;
+  for (const auto* s :
+       report->GetStatsOfType<webrtc::RTCIceCandidatePairStats>()) {
+    if (ValueOr(s->nominated, false) &&
+        s->current_round_trip_time.is_defined()) {
+      connection_rtt_ms_ = *s->current_round_trip_time * 1000;
+    }
+  }
+
+  for (const auto* s :
+       report->GetStatsOfType<webrtc::RTCInboundRTPStreamStats>()) {
+    if (!s->ssrc.is_defined()) {
+      continue;
+    }
+    Slot* slot = FindSlot(*s->ssrc, false);
+    if (slot == nullptr) {
+      continue;
+    }
+    int64_t timestamp_us = s->timestamp_us();
+    uint64_t bytes = ValueOr(s->bytes_received, (uint64_t)0);
+    uint64_t packets = ValueOr(s->packets_received, (uint32_t)0);
+    int64_t packets_lost = ValueOr(s->packets_lost, (int32_t)0);
+    uint64_t frames = ValueOr(s->frames_decoded, (uint32_t)0);
+    double jitter_buffer_delay = ValueOr(s->jitter_buffer_delay, 0.0);
+    uint64_t jitter_buffer_emitted_count =
+        ValueOr(s->jitter_buffer_emitted_count, (uint64_t)0);
+
+    double elapsed = (timestamp_us - slot->timestamp_us) / 1000000.0;
+    if (slot->timestamp_us != 0 && elapsed > 0) {
+      slot->bitrate_bps = Delta(bytes, slot->bytes) * 8 / elapsed;
+      slot->fps = Delta(frames, slot->frames) / elapsed;
+      double lost = Delta(packets_lost, slot->packets_lost);
+      double received = Delta(packets, slot->packets);
+      slot->loss_rate = lost + received > 0 ? lost / (lost + received) : 0;
+      double emitted =
+          Delta(jitter_buffer_emitted_count, slot->jitter_buffer_emitted_count);
+      slot->jitter_buffer_delay_ms =
+          emitted > 0
+              ? Delta(jitter_buffer_delay, slot->jitter_buffer_delay) * 1000 /
+                    emitted
+              : 0;
+    }
+    slot->seen = true;
+    slot->video = ValueOr(s->kind, std::string()) == "video";
+    slot->timestamp_us = timestamp_us;
+    slot->bytes = bytes;
+    slot->packets = packets;
+    slot->packets_lost = packets_lost;
+    slot->frames = frames;
+    slot->frames_dropped = ValueOr(s->frames_dropped, (uint32_t)0);
+    slot->jitter_buffer_delay = jitter_buffer_delay;
+    slot->jitter_buffer_emitted_count = jitter_buffer_emitted_count;
+    slot->jitter_ms = ValueOr(s->jitter, 0.0) * 1000;
+    slot->rtt_ms = connection_rtt_ms_;
+  }
+
+  for (const auto* s :
+       report->GetStatsOfType<webrtc::RTCOutboundRTPStreamStats>()) {
+    if (!s->ssrc.is_defined()) {
+      continue;
+    }
+    Slot* slot = FindSlot(*s->ssrc, true);
+    if (slot == nullptr) {
+      continue;
+    }
+    int64_t timestamp_us = s->timestamp_us();
+    uint64_t bytes = ValueOr(s->bytes_sent, (uint64_t)0);
+    uint64_t frames = ValueOr(s->frames_encoded, (uint32_t)0);
+
+    double elapsed = (timestamp_us - slot->timestamp_us) / 1000000.0;
+    if (slot->timestamp_us != 0 && elapsed > 0) {
+      slot->bitrate_bps = Delta(bytes, slot->bytes) * 8 / elapsed;
+      slot->fps = Delta(frames, slot->frames) / elapsed;
+    }
+    slot->seen = true;
+    slot->video = ValueOr(s->kind, std::string()) == "video";
+    slot->timestamp_us = timestamp_us;
+    slot->bytes = bytes;
+    slot->frames = frames;
+    slot->rtt_ms = connection_rtt_ms_;
+  }
+
+  // 送信側のロス率と RTT は受信側からのレポートを元に計算する
+  for (const auto* s :
+       report->GetStatsOfType<webrtc::RTCRemoteInboundRtpStreamStats>()) {
+    if (!s->ssrc.is_defined()) {
+      continue;
+    }
+    Slot* slot = FindSlot(*s->ssrc, true);
+    if (slot == nullptr || !slot->seen) {
+      continue;
+    }
+    slot->loss_rate = ValueOr(s->fraction_lost, 0.0);
+    if (s->round_trip_time.is_defined()) {
+      slot->rtt_ms = *s->round_trip_time * 1000;
+    }
+  }
+
+  for (auto& slot : slots_) {
+    if (slot.used && !slot.seen) {
+      slot = Slot();
+    }
+  }
+
+  if (config_.format == "prometheus") {
+    WritePrometheus();
+  } else {
+    WriteJson(report->timestamp_us());
+  }
+}
+
+void RTCStatsSampler::WriteJson(int64_t timestamp_us) {
+  buffer_.clear();
+  AppendFormat(&buffer_,
+               "{\"timestamp_us\":%lld,\"rtt_ms\":%.3f,\"streams\":[",
+               (long long)timestamp_us, connection_rtt_ms_);
+  bool first = true;
+  for (const auto& slot : slots_) {
+    if (!slot.used) {
+      continue;
+    }
+    AppendFormat(&buffer_,
+                 "%s{\"ssrc\":%u,\"direction\":\"%s\",\"kind\":\"%s\","
+                 "\"bitrate_bps\":%.0f,\"fps\":%.2f,\"loss_rate\":%.4f,",
+                 first ? "" : ",", slot.ssrc,
+                 slot.outbound ? "outbound" : "inbound",
+                 slot.video ? "video" : "audio", slot.bitrate_bps, slot.fps,
+                 slot.loss_rate);
+    AppendFormat(&buffer_,
+                 "\"frames_dropped\":%llu,\"jitter_buffer_delay_ms\":%.3f,"
+                 "\"jitter_ms\":%.3f,\"rtt_ms\":%.3f}",
+                 (unsigned long long)slot.frames_dropped,
+                 slot.jitter_buffer_delay_ms, slot.jitter_ms, slot.rtt_ms);
+    first = false;
+  }
+  buffer_ += "]}\n";
+
+  std::ofstream ofs(config_.file, std::ios::app | std::ios::binary);
+  ofs.write(buffer_.data(), buffer_.size());
+}
+
+void RTCStatsSampler::WritePrometheus() {
+  struct Metric {
+    const char* name;
+    double Slot::*value;
+  };
+  static const Metric metrics[] = {
+      {"sora_stats_bitrate_bps", &Slot::bitrate_bps},
+      {"sora_stats_fps", &Slot::fps},
+      {"sora_stats_loss_rate", &Slot::loss_rate},
+      {"sora_stats_jitter_buffer_delay_ms", &Slot::jitter_buffer_delay_ms},
+      {"sora_stats_jitter_ms", &Slot::jitter_ms},
+      {"sora_stats_rtt_ms", &Slot::rtt_ms},
+  };
+
+  buffer_.clear();
+  AppendFormat(&buffer_, "# TYPE sora_stats_connection_rtt_ms gauge\n");
+  AppendFormat(&buffer_, "sora_stats_connection_rtt_ms %.3f\n",
+               connection_rtt_ms_);
+  for (const auto& metric : metrics) {
+    AppendFormat(&buffer_, "# TYPE %s gauge\n", metric.name);
+    for (const auto& slot : slots_) {
+      if (!slot.used) {
+        continue;
+      }
+      AppendFormat(&buffer_,
+                   "%s{ssrc=\"%u\",direction=\"%s\",kind=\"%s\"} %.4f\n",
+                   metric.name, slot.ssrc,
+                   slot.outbound ? "outbound" : "inbound",
+                   slot.video ? "video" : "audio", slot.*metric.value);
+    }
+  }
+  AppendFormat(&buffer_, "# TYPE sora_stats_frames_dropped_total counter\n");
+  for (const auto& slot : slots_) {
+    if (!slot.used || slot.outbound) {
+      continue;
+    }
+    AppendFormat(&buffer_,
+                 "sora_stats_frames_dropped_total{ssrc=\"%u\",kind=\"%s\"} "
+                 "%llu\n",
+                 slot.ssrc, slot.video ? "video" : "audio",
+                 (unsigned long long)slot.frames_dropped);
+  }
+
+  // 読み取り側が書きかけのファイルを読まないように、一時ファイルに書いてから置き換える
+  std::string tmp = config_.file + ".tmp";
+  {
+    std::ofstream ofs(tmp, std::ios::trunc | std::ios::binary);
+    if (!ofs) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Failed to open " << tmp;
+      return;
+    }
+    ofs.write(buffer_.data(), buffer_.size());
+  }
+#ifdef _WIN32
+  std::remove(config_.file.c_str());
+#endif
+  if (std::rename(tmp.c_str(), config_.file.c_str()) != 0) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Failed to rename " << tmp;
+  }
+}
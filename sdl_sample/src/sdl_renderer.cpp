@@ -1,27 +1,100 @@
 #include "sdl_renderer.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <csignal>
+#include <cstdio>
+#include <iostream>
 
 // WebRTC
-#include <api/video/i420_buffer.h>
-#include <libyuv/convert_from.h>
-#include <libyuv/video_common.h>
+#include <rtc_base/event.h>
 #include <rtc_base/logging.h>
+#include <rtc_base/time_utils.h>
+
+#include "event_trace.h"
+#include "frame_converter.h"
+#include "metrics_server.h"
+#include "overlay_text.h"
+#include "thread_affinity.h"
 
 #define STD_ASPECT 1.33
 #define WIDE_ASPECT 1.78
 #define FRAME_INTERVAL (1000 / 30)
+#define THUMBNAIL_HEIGHT_RATIO 4
+#define THUMBNAIL_FPS 10
+#define MAX_ZOOM 16.0f
+#define ZOOM_STEP 1.25f
+#define OVERLAY_SCALE 2
+#define OVERLAY_MARGIN 4
+
+namespace {
+
+// GPU が無い環境などで SDL_RENDERER_ACCELERATED に対応したドライバが無い場合は、
+// ソフトウェアレンダラで描画する
+SDL_Renderer* CreateRenderer(SDL_Window* window) {
+  SDL_Renderer* renderer =
+      SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+  if (renderer == nullptr) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__
+                        << ": Accelerated renderer is not available "
+                        << SDL_GetError();
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+  }
+  return renderer;
+}
 
-SDLRenderer::SDLRenderer(int width, int height, bool fullscreen)
+std::string SinkStatsToJson(const SDLRenderer::SinkStats& stats) {
+  std::string json = "{\"name\":\"sink_stats\"";
+  json += ",\"track_id\":\"" + stats.track_id + "\"";
+  json += ",\"frames_received\":" + std::to_string(stats.frames_received);
+  json += ",\"frames_skipped\":" + std::to_string(stats.frames_skipped);
+  json +=
+      ",\"frames_overwritten\":" + std::to_string(stats.frames_overwritten);
+  json += ",\"frames_rendered\":" + std::to_string(stats.frames_rendered);
+  json += ",\"frames_converted\":" + std::to_string(stats.frames_converted);
+  json += ",\"convert_ms_mean\":" + std::to_string(stats.convert_ms_mean);
+  json += ",\"interval_p50_ms\":" + std::to_string(stats.interval_p50_ms);
+  json += ",\"interval_p90_ms\":" + std::to_string(stats.interval_p90_ms);
+  json += ",\"interval_p99_ms\":" + std::to_string(stats.interval_p99_ms);
+  json += "}";
+  return json;
+}
+
+}  // namespace
+
+SDLRenderer::SDLRenderer(int width,
+                         int height,
+                         bool fullscreen,
+                         int software_compositor_threads)
     : running_(true),
+      software_compositor_threads_(software_compositor_threads),
       window_(nullptr),
       renderer_(nullptr),
       dispatch_(nullptr),
+      poll_event_(true),
       width_(width),
       height_(height),
       rows_(1),
-      cols_(1) {
+      cols_(1),
+      spotlight_(false),
+      tiles_per_page_(0),
+      page_(0),
+      measure_latency_(false),
+      render_count_(0),
+      render_time_us_(0),
+      render_thread_options_changed_(false),
+      record_present_intervals_(false),
+      last_present_us_(0),
+      stats_overlay_(false),
+      governor_enabled_(false),
+      governor_layout_changed_(false),
+      governor_(FRAME_INTERVAL * 1000),
+      governor_level_(0),
+      composite_all_(true),
+      composite_surface_(nullptr),
+      composite_surface_width_(0),
+      composite_surface_height_(0) {
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     RTC_LOG(LS_ERROR) << __FUNCTION__ << ": SDL_Init failed " << SDL_GetError();
     return;
@@ -44,11 +117,13 @@ SDLRenderer::SDLRenderer(int width, int height, bool fullscreen)
 #if defined(__APPLE__)
   // Apple Silicon Mac + macOS 11.0 だと、
   // SDL_CreateRenderer をメインスレッドで呼ばないとエラーになる
-  renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_ACCELERATED);
-  if (renderer_ == nullptr) {
-    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": SDL_CreateRenderer failed "
-                      << SDL_GetError();
-    return;
+  if (software_compositor_threads_ == 0) {
+    renderer_ = CreateRenderer(window_);
+    if (renderer_ == nullptr) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << ": SDL_CreateRenderer failed "
+                        << SDL_GetError();
+      return;
+    }
   }
 #endif
 
@@ -68,7 +143,22 @@ SDLRenderer::~SDLRenderer() {
   if (window_) {
     SDL_DestroyWindow(window_);
   }
-  SDL_Quit();
+  SDL_QuitSubSystem(SDL_INIT_VIDEO);
+  // 他のウインドウの SDLRenderer が残っている間は終了しない
+  if (SDL_WasInit(SDL_INIT_EVERYTHING) == 0) {
+    SDL_Quit();
+  }
+
+  // タイルがカクつく原因が送信側か、デコーダか、描画かを後から調べられるように出力しておく
+  for (const SinkStats& stats : GetSinkStats()) {
+    std::cout << SinkStatsToJson(stats) << std::endl;
+  }
+
+  if (measure_latency_) {
+    // バージョン間で比較できるように、ヒストグラムを JSON で出力しておく
+    std::cout << decode_latency_.ToJson("capture_to_decode") << std::endl;
+    std::cout << present_latency_.ToJson("capture_to_present") << std::endl;
+  }
 }
 
 bool SDLRenderer::IsFullScreen() {
@@ -82,30 +172,97 @@ void SDLRenderer::SetFullScreen(bool fullscreen) {
 }
 
 void SDLRenderer::PollEvent() {
+  TRACE_EVENT("SDLRenderer::PollEvent");
   SDL_Event e;
   // 必ずメインスレッドから呼び出す
   while (SDL_PollEvent(&e) > 0) {
-    if (e.type == SDL_WINDOWEVENT &&
-        e.window.event == SDL_WINDOWEVENT_RESIZED &&
-        e.window.windowID == SDL_GetWindowID(window_)) {
+    if (event_callback_) {
+      event_callback_(e);
+    } else {
+      HandleEvent(e);
+    }
+  }
+}
+
+bool SDLRenderer::HandleEvent(const SDL_Event& e) {
+  uint32_t window_id = SDL_GetWindowID(window_);
+  if (e.type == SDL_WINDOWEVENT && e.window.windowID == window_id) {
+    if (e.window.event == SDL_WINDOWEVENT_RESIZED) {
       webrtc::MutexLock lock(&sinks_lock_);
       width_ = e.window.data1;
       height_ = e.window.data2;
       SetOutlines();
     }
-    if (e.type == SDL_KEYUP) {
-      switch (e.key.keysym.sym) {
-        case SDLK_f:
-          SetFullScreen(!IsFullScreen());
-          break;
-        case SDLK_q:
-          std::raise(SIGTERM);
-          break;
+    return true;
+  }
+  if (e.type == SDL_KEYUP && e.key.windowID == window_id) {
+    switch (e.key.keysym.sym) {
+      case SDLK_f:
+        SetFullScreen(!IsFullScreen());
+        break;
+      case SDLK_s: {
+        webrtc::MutexLock lock(&sinks_lock_);
+        spotlight_ = !spotlight_;
+        SetOutlines();
+        break;
+      }
+      case SDLK_RIGHT:
+      case SDLK_PAGEDOWN: {
+        webrtc::MutexLock lock(&sinks_lock_);
+        page_++;
+        SetOutlines();
+        break;
       }
+      case SDLK_LEFT:
+      case SDLK_PAGEUP: {
+        webrtc::MutexLock lock(&sinks_lock_);
+        page_--;
+        SetOutlines();
+        break;
+      }
+      case SDLK_0:
+        ResetZoom();
+        break;
+      case SDLK_i:
+        SetStatsOverlay(!stats_overlay_);
+        break;
+      case SDLK_q:
+        std::raise(SIGTERM);
+        break;
+    }
+    return true;
+  }
+  if (e.type == SDL_MOUSEWHEEL && e.wheel.windowID == window_id) {
+    if (e.wheel.y != 0) {
+      int x, y;
+      SDL_GetMouseState(&x, &y);
+      ZoomAt(x, y, e.wheel.y > 0 ? ZOOM_STEP : 1.0f / ZOOM_STEP);
     }
-    if (e.type == SDL_QUIT) {
-      std::raise(SIGTERM);
+    return true;
+  }
+  if (e.type == SDL_MOUSEMOTION && e.motion.windowID == window_id) {
+    if (e.motion.state & SDL_BUTTON_LMASK) {
+      PanAt(e.motion.x, e.motion.y, e.motion.xrel, e.motion.yrel);
     }
+    return true;
+  }
+  if (e.type == SDL_QUIT) {
+    std::raise(SIGTERM);
+    return true;
+  }
+  return false;
+}
+
+void SDLRenderer::MoveToDisplay(int display) {
+  // フルスクリーンのままだと移動できないので、一旦解除する
+  bool fullscreen = IsFullScreen();
+  if (fullscreen) {
+    SetFullScreen(false);
+  }
+  SDL_SetWindowPosition(window_, SDL_WINDOWPOS_CENTERED_DISPLAY(display),
+                        SDL_WINDOWPOS_CENTERED_DISPLAY(display));
+  if (fullscreen) {
+    SetFullScreen(true);
   }
 }
 
@@ -115,73 +272,584 @@ void SDLRenderer::SetDispatchFunction(
   dispatch_ = std::move(dispatch);
 }
 
+void SDLRenderer::SetEventCallback(
+    std::function<void(const SDL_Event&)> callback) {
+  event_callback_ = std::move(callback);
+}
+
+void SDLRenderer::SetPollEvent(bool poll_event) {
+  poll_event_ = poll_event;
+}
+
+void SDLRenderer::SetMeasureLatency(bool measure_latency) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  measure_latency_ = measure_latency;
+}
+
+void SDLRenderer::SetTileSizeCallback(
+    std::function<void(std::string track_id, int width, int height)>
+        callback) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  tile_size_callback_ = std::move(callback);
+}
+
+void SDLRenderer::SetSpotlightLayout(bool spotlight) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  spotlight_ = spotlight;
+  SetOutlines();
+}
+
+void SDLRenderer::SetTilesPerPage(int tiles_per_page) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  tiles_per_page_ = tiles_per_page;
+  SetOutlines();
+}
+
+void SDLRenderer::SetSpotlightTrack(const std::string& track_id) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  if (spotlight_track_id_ == track_id) {
+    return;
+  }
+  spotlight_track_id_ = track_id;
+  if (spotlight_) {
+    SetOutlines();
+  }
+}
+
+void SDLRenderer::SetRenderThreadOptions(const std::vector<int>& cpus,
+                                         const std::string& priority) {
+  {
+    webrtc::MutexLock lock(&sinks_lock_);
+    render_thread_cpus_ = cpus;
+    render_thread_priority_ = priority;
+  }
+  render_thread_options_changed_ = true;
+}
+
+void SDLRenderer::SetZoom(const std::string& track_id,
+                          float zoom,
+                          float center_x,
+                          float center_y) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+    if (sinks.first->id() == track_id) {
+      sinks.second->SetZoom(zoom, center_x, center_y);
+    }
+  }
+}
+
+void SDLRenderer::ResetZoom() {
+  webrtc::MutexLock lock(&sinks_lock_);
+  for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+    sinks.second->SetZoom(1.0f, 0.5f, 0.5f);
+  }
+}
+
+SDLRenderer::Sink* SDLRenderer::FindSinkAt(int x, int y) {
+  for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+    Sink* sink = sinks.second.get();
+    if (!sink->IsVisible() || sink->GetWidth() == 0 ||
+        sink->GetHeight() == 0) {
+      continue;
+    }
+    int left = sink->GetOffsetX();
+    int top = sink->GetOffsetY();
+    if (x >= left && x < left + sink->GetWidth() && y >= top &&
+        y < top + sink->GetHeight()) {
+      return sink;
+    }
+  }
+  return nullptr;
+}
+
+void SDLRenderer::ZoomAt(int x, int y, float ratio) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  Sink* sink = FindSinkAt(x, y);
+  if (sink == nullptr) {
+    return;
+  }
+  float zoom, center_x, center_y;
+  sink->GetZoom(zoom, center_x, center_y);
+  // カーソルの下に表示している位置が動かないように、拡大の中心をずらす
+  float rel_x = (float)(x - sink->GetOffsetX()) / sink->GetWidth() - 0.5f;
+  float rel_y = (float)(y - sink->GetOffsetY()) / sink->GetHeight() - 0.5f;
+  float point_x = center_x + rel_x / zoom;
+  float point_y = center_y + rel_y / zoom;
+  float new_zoom = std::max(1.0f, std::min(zoom * ratio, MAX_ZOOM));
+  sink->SetZoom(new_zoom, point_x - rel_x / new_zoom,
+                point_y - rel_y / new_zoom);
+}
+
+void SDLRenderer::PanAt(int x, int y, int dx, int dy) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  Sink* sink = FindSinkAt(x, y);
+  if (sink == nullptr) {
+    return;
+  }
+  float zoom, center_x, center_y;
+  sink->GetZoom(zoom, center_x, center_y);
+  if (zoom <= 1.0f) {
+    return;
+  }
+  sink->SetZoom(zoom, center_x - (float)dx / sink->GetWidth() / zoom,
+                center_y - (float)dy / sink->GetHeight() / zoom);
+}
+
+std::vector<SDLRenderer::SinkStats> SDLRenderer::GetSinkStats() {
+  webrtc::MutexLock lock(&sinks_lock_);
+  std::vector<SinkStats> stats = removed_sink_stats_;
+  for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+    stats.push_back(sinks.second->GetStats());
+  }
+  return stats;
+}
+
+void SDLRenderer::SetStatsOverlay(bool overlay) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  stats_overlay_ = overlay;
+  // 統計を消すために全体を描き直す
+  composite_all_ = true;
+}
+
+void SDLRenderer::AppendStatsOverlayRects(Sink* sink,
+                                          std::vector<SDL_Rect>& backgrounds,
+                                          std::vector<SDL_Rect>& texts) {
+  SinkStats stats = sink->GetStats();
+  char text[256];
+  snprintf(text, sizeof(text),
+           "RX %llu RD %llu\nOW %llu SK %llu\nCV %.1fMS\nIV %lld/%lld/%lldMS",
+           (unsigned long long)stats.frames_received,
+           (unsigned long long)stats.frames_rendered,
+           (unsigned long long)stats.frames_overwritten,
+           (unsigned long long)stats.frames_skipped, stats.convert_ms_mean,
+           (long long)stats.interval_p50_ms, (long long)stats.interval_p90_ms,
+           (long long)stats.interval_p99_ms);
+  int columns = 0;
+  int lines = 1;
+  int column = 0;
+  for (const char* p = text; *p != '\0'; p++) {
+    if (*p == '\n') {
+      lines++;
+      column = 0;
+    } else {
+      columns = std::max(columns, ++column);
+    }
+  }
+  SDL_Rect tile = {sink->GetOffsetX(), sink->GetOffsetY(), sink->GetWidth(),
+                   sink->GetHeight()};
+  SDL_Rect background = {tile.x, tile.y,
+                         columns * kOverlayCharWidth * OVERLAY_SCALE +
+                             OVERLAY_MARGIN * 2,
+                         lines * kOverlayLineHeight * OVERLAY_SCALE +
+                             OVERLAY_MARGIN * 2};
+  SDL_Rect clipped;
+  if (!SDL_IntersectRect(&background, &tile, &clipped)) {
+    return;
+  }
+  backgrounds.push_back(clipped);
+  AppendOverlayTextRects(text, tile.x + OVERLAY_MARGIN, tile.y + OVERLAY_MARGIN,
+                         OVERLAY_SCALE, tile, texts);
+}
+
+void SDLRenderer::SetRenderGovernor(bool enabled) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  if (governor_enabled_ == enabled) {
+    return;
+  }
+  governor_enabled_ = enabled;
+  governor_.Reset();
+  // 無効にした場合は全てのタイルの制限を外す
+  ApplyRenderGovernor();
+}
+
+int SDLRenderer::GetRenderGovernorLevel() {
+  return governor_level_.load(std::memory_order_relaxed);
+}
+
+void SDLRenderer::SetRenderGovernorBudget(int64_t budget_us) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  governor_.SetBudget(budget_us);
+}
+
+void SDLRenderer::ApplyRenderGovernor() {
+  governor_layout_changed_ = false;
+  int level = governor_enabled_ ? governor_.GetLevel() : 0;
+  if (level != governor_level_.exchange(level, std::memory_order_relaxed)) {
+    RTC_LOG(LS_INFO) << __FUNCTION__ << ": level:" << level
+                     << " render_ms:" << governor_.GetMeanRenderUs() / 1000.0;
+  }
+
+  // タイルが小さいほど重要度が低いとみなす。スポットライトレイアウトの話者は一番大きいので最後に制限する
+  governor_order_.clear();
+  for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+    Sink* sink = sinks.second.get();
+    if (sink->IsVisible() && level > 0) {
+      governor_order_.push_back(sink);
+    } else {
+      sink->SetGovernorMaxFramerate(0);
+    }
+  }
+  std::stable_sort(governor_order_.begin(), governor_order_.end(),
+                   [](Sink* a, Sink* b) {
+                     SDL_Rect ra = a->GetOutlineRect();
+                     SDL_Rect rb = b->GetOutlineRect();
+                     return ra.w * ra.h < rb.w * rb.h;
+                   });
+  int tile_count = governor_order_.size();
+  for (int i = 0; i < tile_count; i++) {
+    governor_order_[i]->SetGovernorMaxFramerate(
+        governor_.GetMaxFramerate(i, tile_count));
+  }
+}
+
+void SDLRenderer::SetRecordPresentIntervals(bool record) {
+  webrtc::MutexLock lock(&present_intervals_lock_);
+  record_present_intervals_ = record;
+  present_intervals_us_.clear();
+}
+
+std::vector<int64_t> SDLRenderer::TakePresentIntervalsUs() {
+  webrtc::MutexLock lock(&present_intervals_lock_);
+  std::vector<int64_t> intervals;
+  intervals.swap(present_intervals_us_);
+  return intervals;
+}
+
+void SDLRenderer::ApplyRenderThreadOptions() {
+  std::vector<int> cpus;
+  std::string priority;
+  {
+    webrtc::MutexLock lock(&sinks_lock_);
+    cpus = render_thread_cpus_;
+    priority = render_thread_priority_;
+  }
+  if (!cpus.empty() && SetCurrentThreadAffinity(cpus)) {
+    RTC_LOG(LS_INFO) << __FUNCTION__ << ": Pinned render thread to "
+                     << cpus.size() << " CPUs";
+  }
+  if (priority == "realtime") {
+    // SCHED_FIFO にできない場合は、SDL で設定できる一番高い優先度にする
+    if (SetCurrentThreadRealtime()) {
+      RTC_LOG(LS_INFO) << __FUNCTION__ << ": Render thread is SCHED_FIFO";
+    } else if (SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL) != 0) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": SDL_SetThreadPriority failed "
+                          << SDL_GetError();
+    }
+  } else if (priority == "high") {
+    if (SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH) != 0) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": SDL_SetThreadPriority failed "
+                          << SDL_GetError();
+    }
+  }
+}
+
 int SDLRenderer::RenderThreadExec(void* data) {
   return ((SDLRenderer*)data)->RenderThread();
 }
 
 int SDLRenderer::RenderThread() {
+  if (software_compositor_threads_ > 0) {
+    // libyuv で書き込めるのは 32 bit の xRGB のサーフェスだけ
+    SDL_Surface* surface = SDL_GetWindowSurface(window_);
+    if (surface == nullptr ||
+        (surface->format->format != SDL_PIXELFORMAT_ARGB8888 &&
+         surface->format->format != SDL_PIXELFORMAT_RGB888)) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__
+                        << ": Window surface is not supported for software "
+                           "compositing "
+                        << (surface == nullptr
+                                ? SDL_GetError()
+                                : SDL_GetPixelFormatName(
+                                      surface->format->format));
+      return 1;
+    }
+    compositor_pool_.reset(
+        new boost::asio::thread_pool(software_compositor_threads_));
+  } else {
 #if !defined(__APPLE__)
-  // Apple 以外の OpenGL あたりの実装だと、
-  // SDL_CreateRenderer を描画スレッドと同一のスレッドで呼ばないと何も表示されない
-  renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_ACCELERATED);
-  if (renderer_ == nullptr) {
-    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": SDL_CreateRenderer failed "
-                      << SDL_GetError();
-    return 1;
-  }
+    // Apple 以外の OpenGL あたりの実装だと、
+    // SDL_CreateRenderer を描画スレッドと同一のスレッドで呼ばないと何も表示されない
+    renderer_ = CreateRenderer(window_);
+    if (renderer_ == nullptr) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << ": SDL_CreateRenderer failed "
+                        << SDL_GetError();
+      return 1;
+    }
 #endif
 
-  SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 255);
+    SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 255);
+  }
 
   uint32_t start_time, duration;
   while (running_) {
+    if (render_thread_options_changed_.exchange(false)) {
+      ApplyRenderThreadOptions();
+    }
     start_time = SDL_GetTicks();
     {
+      int64_t render_start_us = rtc::TimeMicros();
       webrtc::MutexLock lock(&sinks_lock_);
-      SDL_RenderClear(renderer_);
-      for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
-        Sink* sink = sinks.second.get();
+      if (compositor_pool_) {
+        CompositeSinks();
+      } else {
+        RenderSinks();
+      }
+      int64_t present_us = rtc::TimeMicros();
+      if (last_present_us_ != 0) {
+        webrtc::MutexLock intervals_lock(&present_intervals_lock_);
+        if (record_present_intervals_) {
+          present_intervals_us_.push_back(present_us - last_present_us_);
+        }
+      }
+      last_present_us_ = present_us;
+
+      if (!presented_capture_times_.empty()) {
+        int64_t now_ms = rtc::TimeUTCMillis();
+        for (int64_t capture_time_ms : presented_capture_times_) {
+          present_latency_.Add(now_ms - capture_time_ms);
+        }
+        presented_capture_times_.clear();
+      }
+      int64_t render_us = rtc::TimeMicros() - render_start_us;
+      render_time_us_.fetch_add(render_us, std::memory_order_relaxed);
+      render_count_.fetch_add(1, std::memory_order_relaxed);
+
+      if (governor_enabled_ &&
+          (governor_.AddRenderTime(render_us) || governor_layout_changed_)) {
+        ApplyRenderGovernor();
+      }
+
+      if (dispatch_ && poll_event_) {
+        dispatch_(std::bind(&SDLRenderer::PollEvent, this));
+      }
+    }
+    duration = SDL_GetTicks() - start_time;
+    SDL_Delay(FRAME_INTERVAL - (duration % FRAME_INTERVAL));
+  }
+
+  if (compositor_pool_) {
+    compositor_pool_->join();
+    compositor_pool_.reset();
+  }
+  {
+    // テクスチャは作った描画スレッドで破棄する
+    webrtc::MutexLock lock(&sinks_lock_);
+    for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+      sinks.second->ReleaseTexture();
+    }
+    for (SDL_Texture* texture : retired_textures_) {
+      SDL_DestroyTexture(texture);
+    }
+    retired_textures_.clear();
+  }
+  if (renderer_) {
+    SDL_DestroyRenderer(renderer_);
+    renderer_ = nullptr;
+  }
 
-        webrtc::MutexLock frame_lock(sink->GetMutex());
+  return 0;
+}
+
+void SDLRenderer::RenderSinks() {
+  for (SDL_Texture* texture : retired_textures_) {
+    SDL_DestroyTexture(texture);
+  }
+  retired_textures_.clear();
+
+  SDL_RenderClear(renderer_);
+  for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+    Sink* sink = sinks.second.get();
 
-        if (!sink->GetOutlineChanged())
-          continue;
+    if (!sink->IsVisible())
+      continue;
 
-        int width = sink->GetFrameWidth();
-        int height = sink->GetFrameHeight();
+    webrtc::MutexLock frame_lock(sink->GetMutex());
 
-        if (width == 0 || height == 0)
-          continue;
+    if (!sink->GetOutlineChanged())
+      continue;
 
-        SDL_Surface* surface = SDL_CreateRGBSurfaceFrom(
-            sink->GetImage(), width, height, 32, width * 4, 0, 0, 0, 0);
-        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer_, surface);
-        SDL_FreeSurface(surface);
+    int width = sink->GetFrameWidth();
+    int height = sink->GetFrameHeight();
 
-        SDL_Rect image_rect = {0, 0, width, height};
-        SDL_Rect draw_rect = {sink->GetOffsetX(), sink->GetOffsetY(),
-                              sink->GetWidth(), sink->GetHeight()};
+    if (width == 0 || height == 0)
+      continue;
 
-        // flip (自画像とか？)
-        // SDL_RenderCopyEx(renderer_, texture, &image_rect, &draw_rect, 0, nullptr, SDL_FLIP_HORIZONTAL);
-        SDL_RenderCopy(renderer_, texture, &image_rect, &draw_rect);
+    // 新しいフレームが届いていないタイルは、前回転送したテクスチャをそのまま使う
+    SDL_Texture* texture = sink->UpdateTexture(renderer_);
+    if (texture == nullptr)
+      continue;
 
-        SDL_DestroyTexture(texture);
+    SDL_Rect image_rect = {0, 0, width, height};
+    SDL_Rect draw_rect = {sink->GetOffsetX(), sink->GetOffsetY(),
+                          sink->GetWidth(), sink->GetHeight()};
+
+    // flip (自画像とか？)
+    // SDL_RenderCopyEx(renderer_, texture, &image_rect, &draw_rect, 0, nullptr, SDL_FLIP_HORIZONTAL);
+    SDL_RenderCopy(renderer_, texture, &image_rect, &draw_rect);
+
+    sink->OnRendered();
+
+    if (measure_latency_) {
+      int64_t capture_time_ms = sink->TakeCaptureTimeMs();
+      if (capture_time_ms != 0) {
+        presented_capture_times_.push_back(capture_time_ms);
       }
-      SDL_RenderPresent(renderer_);
+    }
+  }
+  if (stats_overlay_) {
+    overlay_backgrounds_.clear();
+    overlay_texts_.clear();
+    for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+      Sink* sink = sinks.second.get();
+      if (!sink->IsVisible())
+        continue;
+      webrtc::MutexLock frame_lock(sink->GetMutex());
+      if (!sink->GetOutlineChanged() || sink->GetWidth() == 0)
+        continue;
+      AppendStatsOverlayRects(sink, overlay_backgrounds_, overlay_texts_);
+    }
+    SDL_RenderFillRects(renderer_, overlay_backgrounds_.data(),
+                        overlay_backgrounds_.size());
+    SDL_SetRenderDrawColor(renderer_, 255, 255, 255, 255);
+    SDL_RenderFillRects(renderer_, overlay_texts_.data(),
+                        overlay_texts_.size());
+    SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 255);
+  }
+  {
+    TRACE_EVENT("SDL_RenderPresent");
+    SDL_RenderPresent(renderer_);
+  }
+}
 
-      if (dispatch_) {
-        dispatch_(std::bind(&SDLRenderer::PollEvent, this));
+void SDLRenderer::CompositeSinks() {
+  TRACE_EVENT("SDLRenderer::CompositeSinks");
+  SDL_Surface* surface = SDL_GetWindowSurface(window_);
+  if (surface == nullptr) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": SDL_GetWindowSurface failed "
+                        << SDL_GetError();
+    return;
+  }
+  // ウインドウの大きさが変わるとサーフェスが作り直されるので、全体を描き直す
+  if (surface != composite_surface_ || surface->w != composite_surface_width_ ||
+      surface->h != composite_surface_height_) {
+    composite_surface_ = surface;
+    composite_surface_width_ = surface->w;
+    composite_surface_height_ = surface->h;
+    composite_all_ = true;
+  }
+
+  if (SDL_MUSTLOCK(surface)) {
+    SDL_LockSurface(surface);
+  }
+  if (composite_all_) {
+    SDL_FillRect(surface, nullptr, 0);
+  }
+
+  // 新しいフレームが届いたタイルだけを合成する
+  composite_tiles_.clear();
+  composite_rects_.clear();
+  SDL_Rect surface_rect = {0, 0, surface->w, surface->h};
+  for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+    Sink* sink = sinks.second.get();
+
+    if (!sink->IsVisible())
+      continue;
+
+    webrtc::MutexLock frame_lock(sink->GetMutex());
+
+    if (!sink->GetOutlineChanged())
+      continue;
+
+    if (!composite_all_ && !sink->HasPendingFrame())
+      continue;
+
+    CompositeTile tile;
+    tile.sink = sink;
+    tile.buffer = sink->GetBuffer();
+    tile.rect = {sink->GetOffsetX(), sink->GetOffsetY(), sink->GetWidth(),
+                 sink->GetHeight()};
+    SDL_Rect clipped;
+    // レイアウトの変更がまだフレームに反映されていない場合は、サーフェスからはみ出すことがある
+    if (tile.buffer == nullptr || tile.rect.w < 2 || tile.rect.h < 2 ||
+        !SDL_IntersectRect(&tile.rect, &surface_rect, &clipped) ||
+        !SDL_RectEquals(&tile.rect, &clipped))
+      continue;
+    sink->GetCropRect(tile.crop_x, tile.crop_y, tile.crop_width,
+                      tile.crop_height);
+
+    // 映像の大きさや拡大率が変わってタイル内の位置が変わった場合は、前の映像を消しておく
+    if (sink->SetCompositedRect(tile.rect) && !composite_all_) {
+      SDL_Rect outline = sink->GetOutlineRect();
+      SDL_FillRect(surface, &outline, 0);
+      composite_rects_.push_back(outline);
+    } else {
+      composite_rects_.push_back(tile.rect);
+    }
+    composite_tiles_.push_back(tile);
+    sink->OnRendered();
+
+    if (measure_latency_) {
+      int64_t capture_time_ms = sink->TakeCaptureTimeMs();
+      if (capture_time_ms != 0) {
+        presented_capture_times_.push_back(capture_time_ms);
       }
     }
-    duration = SDL_GetTicks() - start_time;
-    SDL_Delay(FRAME_INTERVAL - (duration % FRAME_INTERVAL));
   }
 
-  SDL_DestroyRenderer(renderer_);
-  renderer_ = nullptr;
+  // タイル同士は重ならないので、それぞれのスレッドがサーフェスに直接書き込む
+  if (!composite_tiles_.empty()) {
+    uint8_t* pixels = (uint8_t*)surface->pixels;
+    int pitch = surface->pitch;
+    std::atomic<int> remaining(composite_tiles_.size());
+    rtc::Event done;
+    for (const CompositeTile& tile : composite_tiles_) {
+      boost::asio::post(*compositor_pool_, [&tile, pixels, pitch, &remaining,
+                                            &done]() {
+        TRACE_EVENT("SDLRenderer::CompositeTile");
+        int64_t convert_start_us = rtc::TimeMicros();
+        // レイアウトは回転前の大きさで決めているので、ここでも回転はしない
+        ConvertToARGB(tile.buffer, tile.crop_x, tile.crop_y, tile.crop_width,
+                      tile.crop_height, webrtc::kVideoRotation_0, tile.rect.w,
+                      tile.rect.h,
+                      pixels + tile.rect.y * pitch + tile.rect.x * 4, pitch);
+        tile.sink->AddConvertTime(rtc::TimeMicros() - convert_start_us);
+        if (remaining.fetch_sub(1) == 1) {
+          done.Set();
+        }
+      });
+    }
+    done.Wait(rtc::Event::kForever);
+  }
+
+  // 統計は合成したタイルの上に描く
+  if (stats_overlay_ && !composite_tiles_.empty()) {
+    overlay_backgrounds_.clear();
+    overlay_texts_.clear();
+    for (const CompositeTile& tile : composite_tiles_) {
+      webrtc::MutexLock frame_lock(tile.sink->GetMutex());
+      AppendStatsOverlayRects(tile.sink, overlay_backgrounds_, overlay_texts_);
+    }
+    SDL_FillRects(surface, overlay_backgrounds_.data(),
+                  overlay_backgrounds_.size(),
+                  SDL_MapRGB(surface->format, 0, 0, 0));
+    SDL_FillRects(surface, overlay_texts_.data(), overlay_texts_.size(),
+                  SDL_MapRGB(surface->format, 255, 255, 255));
+  }
 
-  return 0;
+  if (SDL_MUSTLOCK(surface)) {
+    SDL_UnlockSurface(surface);
+  }
+
+  {
+    TRACE_EVENT("SDL_UpdateWindowSurface");
+    if (composite_all_) {
+      SDL_UpdateWindowSurface(window_);
+    } else if (!composite_rects_.empty()) {
+      SDL_UpdateWindowSurfaceRects(window_, composite_rects_.data(),
+                                   composite_rects_.size());
+    }
+  }
+  composite_all_ = false;
 }
 
 SDLRenderer::Sink::Sink(SDLRenderer* renderer,
@@ -196,22 +864,77 @@ SDLRenderer::Sink::Sink(SDLRenderer* renderer,
       input_width_(0),
       input_height_(0),
       scaled_(false),
+      zoom_(1.0f),
+      zoom_center_x_(0.5f),
+      zoom_center_y_(0.5f),
+      zoom_changed_(false),
+      crop_x_(0),
+      crop_y_(0),
+      crop_width_(0),
+      crop_height_(0),
+      composited_rect_({0, 0, 0, 0}),
       width_(0),
-      height_(0) {
+      height_(0),
+      capture_time_ms_(0),
+      remote_(track->GetSource() != nullptr && track->GetSource()->remote()),
+      max_pixel_count_(0),
+      max_fps_(0),
+      governor_max_fps_(0),
+      wants_pending_(false),
+      wants_state_(std::make_shared<WantsState>()),
+      min_frame_interval_us_(0),
+      last_frame_time_us_(0),
+      visible_(true),
+      counters_(new SinkCounters(track->id())),
+      frame_pending_(false),
+      last_receive_time_us_(0),
+      texture_(nullptr),
+      texture_width_(0),
+      texture_height_(0) {
+  wants_state_->sink = this;
   track_->AddOrUpdateSink(this, rtc::VideoSinkWants());
 }
 
 SDLRenderer::Sink::~Sink() {
-  track_->RemoveSink(this);
+  {
+    webrtc::MutexLock lock(&wants_state_->mutex);
+    wants_state_->sink = nullptr;
+    if (visible_) {
+      track_->RemoveSink(this);
+    }
+  }
+  // シンクは sinks_lock_ を保持して破棄するので、テクスチャを描画スレッドに渡せる
+  if (texture_ != nullptr) {
+    renderer_->retired_textures_.push_back(texture_);
+  }
 }
 
 void SDLRenderer::Sink::OnFrame(const webrtc::VideoFrame& frame) {
-  if (outline_width_ == 0 || outline_height_ == 0)
-    return;
-  if (frame.width() == 0 || frame.height() == 0)
+  TRACE_EVENT("SDLRenderer::Sink::OnFrame");
+  counters_->delivery.frames_received.fetch_add(1,
+                                                std::memory_order_relaxed);
+  int64_t now_us = rtc::TimeMicros();
+  if (last_receive_time_us_ != 0) {
+    receive_intervals_.Add((now_us - last_receive_time_us_) / 1000);
+  }
+  last_receive_time_us_ = now_us;
+  if (outline_width_ == 0 || outline_height_ == 0 || frame.width() == 0 ||
+      frame.height() == 0) {
+    counters_->delivery.frames_skipped.fetch_add(1, std::memory_order_relaxed);
     return;
+  }
+  int64_t min_frame_interval_us = min_frame_interval_us_;
+  if (min_frame_interval_us != 0) {
+    // サムネイルや RenderGovernor が制限したタイルはフレームレートを落として、変換の処理を減らす
+    if (now_us - last_frame_time_us_ < min_frame_interval_us) {
+      counters_->delivery.frames_skipped.fetch_add(1,
+                                                   std::memory_order_relaxed);
+      return;
+    }
+    last_frame_time_us_ = now_us;
+  }
   webrtc::MutexLock lock(GetMutex());
-  if (outline_changed_ || frame.width() != input_width_ ||
+  if (outline_changed_ || zoom_changed_ || frame.width() != input_width_ ||
       frame.height() != input_height_) {
     int width, height;
     float frame_aspect = (float)frame.width() / (float)frame.height();
@@ -230,41 +953,77 @@ void SDLRenderer::Sink::OnFrame(const webrtc::VideoFrame& frame) {
       width_ = width;
       height_ = height;
     }
+    int image_width = GetFrameWidth();
+    int image_height = GetFrameHeight();
     input_width_ = frame.width();
     input_height_ = frame.height();
-    scaled_ = width_ < input_width_;
-    if (scaled_) {
-      image_.reset(new uint8_t[width_ * height_ * 4]);
+    if (zoom_ <= 1.0f) {
+      crop_x_ = 0;
+      crop_y_ = 0;
+      crop_width_ = input_width_;
+      crop_height_ = input_height_;
     } else {
-      image_.reset(new uint8_t[input_width_ * input_height_ * 4]);
+      // 映像と同じアスペクト比の範囲を切り出す。色差プレーンに合わせて位置と大きさを偶数にする
+      crop_width_ = std::max(2, (int)(input_width_ / zoom_) & ~1);
+      crop_height_ = std::max(2, (int)(input_height_ / zoom_) & ~1);
+      crop_x_ = std::max(0, std::min((int)(zoom_center_x_ * input_width_) -
+                                         crop_width_ / 2,
+                                     input_width_ - crop_width_)) &
+                ~1;
+      crop_y_ = std::max(0, std::min((int)(zoom_center_y_ * input_height_) -
+                                         crop_height_ / 2,
+                                     input_height_ - crop_height_)) &
+                ~1;
+    }
+    scaled_ = width_ < crop_width_;
+    // ソフトウェア合成の場合はサーフェスに直接書き込むので、変換先の画像は持たない
+    if (renderer_->software_compositor_threads_ == 0 &&
+        (image_ == nullptr || image_width != GetFrameWidth() ||
+         image_height != GetFrameHeight())) {
+      image_.reset(new uint8_t[GetFrameWidth() * GetFrameHeight() * 4]);
     }
     RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": scaled_=" << scaled_;
     outline_changed_ = false;
+    zoom_changed_ = false;
   }
-  rtc::scoped_refptr<webrtc::I420BufferInterface> buffer_if;
-  if (scaled_) {
-    rtc::scoped_refptr<webrtc::I420Buffer> buffer =
-        webrtc::I420Buffer::Create(width_, height_);
-    buffer->ScaleFrom(*frame.video_frame_buffer()->ToI420());
-    if (frame.rotation() != webrtc::kVideoRotation_0) {
-      buffer = webrtc::I420Buffer::Rotate(*buffer, frame.rotation());
+  // NV12 は I420 に変換せずにそのまま縮小と ARGB への変換を行う
+  int64_t convert_start_us = rtc::TimeMicros();
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      ToNV12OrI420(frame.video_frame_buffer());
+  int64_t convert_us = rtc::TimeMicros() - convert_start_us;
+  if (renderer_->measure_latency_) {
+    // 縮小するとパターンが読み取りにくくなるので、縮小前の映像から読み取る
+    int64_t capture_time_ms;
+    if (DecodeLatencyPattern(GetDataY(*buffer), GetStrideY(*buffer),
+                             buffer->width(), buffer->height(),
+                             &capture_time_ms)) {
+      renderer_->decode_latency_.Add(rtc::TimeUTCMillis() - capture_time_ms);
+      capture_time_ms_ = capture_time_ms;
     }
-    buffer_if = buffer;
+  }
+  if (renderer_->software_compositor_threads_ > 0) {
+    // 縮小と変換は描画スレッドがタイル毎に並列に行う
+    buffer_ = buffer;
   } else {
-    buffer_if = frame.video_frame_buffer()->ToI420();
+    // 拡大している場合は、表示する範囲だけを変換する
+    convert_start_us = rtc::TimeMicros();
+    ConvertToARGB(buffer, crop_x_, crop_y_, crop_width_, crop_height_,
+                  frame.rotation(), GetFrameWidth(), GetFrameHeight(),
+                  image_.get(), GetFrameWidth() * 4);
+    AddConvertTime(convert_us + rtc::TimeMicros() - convert_start_us);
+  }
+  // 前のフレームを描画する前に上書きした
+  if (frame_pending_.exchange(true, std::memory_order_relaxed)) {
+    counters_->delivery.frames_overwritten.fetch_add(1,
+                                                     std::memory_order_relaxed);
   }
-  libyuv::ConvertFromI420(
-      buffer_if->DataY(), buffer_if->StrideY(), buffer_if->DataU(),
-      buffer_if->StrideU(), buffer_if->DataV(), buffer_if->StrideV(),
-      image_.get(), (scaled_ ? width_ : input_width_) * 4, buffer_if->width(),
-      buffer_if->height(), libyuv::FOURCC_ARGB);
 }
 
-void SDLRenderer::Sink::SetOutlineRect(int x, int y, int width, int height) {
+bool SDLRenderer::Sink::SetOutlineRect(int x, int y, int width, int height) {
   outline_offset_x_ = x;
   outline_offset_y_ = y;
   if (outline_width_ == width && outline_height_ == height) {
-    return;
+    return false;
   }
   webrtc::MutexLock lock(GetMutex());
   offset_y_ = 0;
@@ -273,6 +1032,118 @@ void SDLRenderer::Sink::SetOutlineRect(int x, int y, int width, int height) {
   outline_height_ = height;
   outline_aspect_ = (float)outline_width_ / (float)outline_height_;
   outline_changed_ = true;
+  return true;
+}
+
+void SDLRenderer::Sink::SetMaxResolutionAndFramerate(int max_pixel_count,
+                                                     int max_fps) {
+  if (max_pixel_count_ == max_pixel_count && max_fps_ == max_fps) {
+    return;
+  }
+  max_pixel_count_ = max_pixel_count;
+  max_fps_ = max_fps;
+  UpdateFrameInterval();
+  webrtc::MutexLock lock(&wants_state_->mutex);
+  UpdateWants();
+}
+
+void SDLRenderer::Sink::SetGovernorMaxFramerate(int max_fps) {
+  if (governor_max_fps_.exchange(max_fps) == max_fps) {
+    return;
+  }
+  UpdateFrameInterval();
+  // 前に渡した処理がまだ実行されていなければ、その処理が最新の値で設定する
+  if (!remote_ || !renderer_->dispatch_ || wants_pending_.exchange(true)) {
+    return;
+  }
+  std::shared_ptr<WantsState> state = wants_state_;
+  renderer_->dispatch_([state]() {
+    webrtc::MutexLock lock(&state->mutex);
+    if (state->sink == nullptr) {
+      return;
+    }
+    state->sink->wants_pending_ = false;
+    state->sink->UpdateWants();
+  });
+}
+
+int SDLRenderer::Sink::GetMaxFramerate() {
+  int max_fps = max_fps_;
+  int governor_max_fps = governor_max_fps_;
+  if (max_fps > 0 && governor_max_fps > 0) {
+    return std::min(max_fps, governor_max_fps);
+  }
+  return std::max(max_fps, governor_max_fps);
+}
+
+void SDLRenderer::Sink::UpdateFrameInterval() {
+  int max_fps = GetMaxFramerate();
+  min_frame_interval_us_ = max_fps > 0 ? 1000000 / max_fps : 0;
+}
+
+void SDLRenderer::Sink::UpdateWants() {
+  // 自分の映像に対して制限すると送信する映像まで縮小されてしまうので、受信した映像にだけ設定する
+  if (!remote_ || !visible_) {
+    return;
+  }
+  track_->AddOrUpdateSink(this, GetWants());
+}
+
+rtc::VideoSinkWants SDLRenderer::Sink::GetWants() {
+  rtc::VideoSinkWants wants;
+  if (!remote_) {
+    return wants;
+  }
+  int max_pixel_count = max_pixel_count_;
+  if (max_pixel_count > 0) {
+    wants.max_pixel_count = max_pixel_count;
+  }
+  int max_fps = GetMaxFramerate();
+  if (max_fps > 0) {
+    wants.max_framerate_fps = max_fps;
+  }
+  return wants;
+}
+
+void SDLRenderer::Sink::SetVisible(bool visible) {
+  if (visible_ == visible) {
+    return;
+  }
+  if (visible) {
+    // 非表示だった間の古い映像を描画しないように、次のフレームが来るまで描画を止める
+    webrtc::MutexLock lock(GetMutex());
+    outline_changed_ = true;
+  }
+  webrtc::MutexLock lock(&wants_state_->mutex);
+  visible_ = visible;
+  if (visible) {
+    track_->AddOrUpdateSink(this, GetWants());
+  } else {
+    // 表示しないトラックはシンクを外して、フレームの変換を一切行わないようにする
+    track_->RemoveSink(this);
+  }
+}
+
+void SDLRenderer::Sink::SetZoom(float zoom, float center_x, float center_y) {
+  zoom = std::max(1.0f, std::min(zoom, MAX_ZOOM));
+  // 映像の外側を表示しないように、中心の位置を制限する
+  float half = 0.5f / zoom;
+  webrtc::MutexLock lock(GetMutex());
+  zoom_ = zoom;
+  zoom_center_x_ = std::max(half, std::min(center_x, 1.0f - half));
+  zoom_center_y_ = std::max(half, std::min(center_y, 1.0f - half));
+  zoom_changed_ = true;
+}
+
+void SDLRenderer::Sink::GetZoom(float& zoom, float& center_x, float& center_y) {
+  webrtc::MutexLock lock(GetMutex());
+  zoom = zoom_;
+  center_x = zoom_center_x_;
+  center_y = zoom_center_y_;
+}
+
+bool SDLRenderer::Sink::IsVisible() {
+  return visible_;
 }
 
 webrtc::Mutex* SDLRenderer::Sink::GetMutex() {
@@ -292,11 +1163,11 @@ int SDLRenderer::Sink::GetOffsetY() {
 }
 
 int SDLRenderer::Sink::GetFrameWidth() {
-  return scaled_ ? width_ : input_width_;
+  return scaled_ ? width_ : crop_width_;
 }
 
 int SDLRenderer::Sink::GetFrameHeight() {
-  return scaled_ ? height_ : input_height_;
+  return scaled_ ? height_ : crop_height_;
 }
 
 int SDLRenderer::Sink::GetWidth() {
@@ -307,11 +1178,205 @@ int SDLRenderer::Sink::GetHeight() {
   return height_;
 }
 
-uint8_t* SDLRenderer::Sink::GetImage() {
-  return image_.get();
+int64_t SDLRenderer::Sink::TakeCaptureTimeMs() {
+  int64_t capture_time_ms = capture_time_ms_;
+  capture_time_ms_ = 0;
+  return capture_time_ms;
+}
+
+void SDLRenderer::Sink::OnRendered() {
+  if (frame_pending_.exchange(false, std::memory_order_relaxed)) {
+    counters_->render.frames_rendered.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void SDLRenderer::Sink::AddConvertTime(int64_t convert_us) {
+  counters_->delivery.frames_converted.fetch_add(1,
+                                                 std::memory_order_relaxed);
+  counters_->delivery.convert_time_us.fetch_add(convert_us,
+                                                std::memory_order_relaxed);
+}
+
+SDLRenderer::SinkStats SDLRenderer::Sink::GetStats() {
+  SinkStats stats;
+  const SinkCounters& counters = *counters_;
+  stats.track_id = counters.track_id;
+  stats.frames_received =
+      counters.delivery.frames_received.load(std::memory_order_relaxed);
+  stats.frames_skipped =
+      counters.delivery.frames_skipped.load(std::memory_order_relaxed);
+  stats.frames_overwritten =
+      counters.delivery.frames_overwritten.load(std::memory_order_relaxed);
+  stats.frames_rendered =
+      counters.render.frames_rendered.load(std::memory_order_relaxed);
+  stats.frames_converted =
+      counters.delivery.frames_converted.load(std::memory_order_relaxed);
+  if (stats.frames_converted > 0) {
+    stats.convert_ms_mean =
+        counters.delivery.convert_time_us.load(std::memory_order_relaxed) /
+        1000.0 / stats.frames_converted;
+  }
+  stats.interval_p50_ms = receive_intervals_.GetPercentileMs(0.50);
+  stats.interval_p90_ms = receive_intervals_.GetPercentileMs(0.90);
+  stats.interval_p99_ms = receive_intervals_.GetPercentileMs(0.99);
+  return stats;
+}
+
+std::shared_ptr<SDLRenderer::SinkCounters> SDLRenderer::Sink::GetCounters() {
+  return counters_;
+}
+
+bool SDLRenderer::Sink::HasPendingFrame() {
+  return frame_pending_.load(std::memory_order_relaxed);
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> SDLRenderer::Sink::GetBuffer() {
+  return buffer_;
+}
+
+void SDLRenderer::Sink::GetCropRect(int& x, int& y, int& width, int& height) {
+  x = crop_x_;
+  y = crop_y_;
+  width = crop_width_;
+  height = crop_height_;
+}
+
+SDL_Rect SDLRenderer::Sink::GetOutlineRect() {
+  return {outline_offset_x_, outline_offset_y_, outline_width_,
+          outline_height_};
+}
+
+bool SDLRenderer::Sink::SetCompositedRect(const SDL_Rect& rect) {
+  if (SDL_RectEquals(&composited_rect_, &rect)) {
+    return false;
+  }
+  composited_rect_ = rect;
+  return true;
+}
+
+SDL_Texture* SDLRenderer::Sink::UpdateTexture(SDL_Renderer* renderer) {
+  int width = GetFrameWidth();
+  int height = GetFrameHeight();
+  if (texture_ != nullptr &&
+      (texture_width_ != width || texture_height_ != height)) {
+    SDL_DestroyTexture(texture_);
+    texture_ = nullptr;
+  }
+  if (texture_ == nullptr) {
+    texture_ = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888,
+                                 SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (texture_ == nullptr) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": SDL_CreateTexture failed "
+                          << SDL_GetError();
+      return nullptr;
+    }
+    texture_width_ = width;
+    texture_height_ = height;
+  } else if (!HasPendingFrame()) {
+    return texture_;
+  }
+  TRACE_EVENT("SDLRenderer::UploadTexture");
+  SDL_UpdateTexture(texture_, nullptr, image_.get(), width * 4);
+  return texture_;
+}
+
+void SDLRenderer::Sink::ReleaseTexture() {
+  if (texture_ != nullptr) {
+    SDL_DestroyTexture(texture_);
+    texture_ = nullptr;
+  }
 }
 
 void SDLRenderer::SetOutlines() {
+  composite_all_ = true;
+  governor_layout_changed_ = true;
+  int sinks_count = sinks_.size();
+  int speaker = -1;
+  if (spotlight_ && sinks_count > 1) {
+    speaker = 0;
+    for (int i = 0; i < sinks_count; i++) {
+      if (sinks_[i].first->id() == spotlight_track_id_) {
+        speaker = i;
+        break;
+      }
+    }
+  }
+
+  // 話者以外のシンクをページに分けて、今のページのシンクだけを表示する
+  int candidates_count = speaker < 0 ? sinks_count : sinks_count - 1;
+  int tiles_per_page = tiles_per_page_ > 0 ? tiles_per_page_ : candidates_count;
+  int pages = tiles_per_page > 0
+                  ? (candidates_count + tiles_per_page - 1) / tiles_per_page
+                  : 1;
+  page_ = std::max(0, std::min(page_, pages - 1));
+  int first = page_ * tiles_per_page;
+  int last = first + tiles_per_page;
+
+  visible_indices_.clear();
+  int n = 0;
+  for (int i = 0; i < sinks_count; i++) {
+    bool visible;
+    if (i == speaker) {
+      visible = true;
+    } else {
+      visible = n >= first && n < last;
+      if (visible) {
+        visible_indices_.push_back(i);
+      }
+      n++;
+    }
+    sinks_[i].second->SetVisible(visible);
+  }
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " page:" << page_ + 1 << "/"
+                      << pages << " visible:" << visible_indices_.size();
+
+  if (speaker < 0) {
+    SetGridOutlines(visible_indices_);
+  } else if (visible_indices_.empty()) {
+    SetGridOutlines({speaker});
+  } else {
+    SetSpotlightOutlines(speaker, visible_indices_);
+  }
+}
+
+void SDLRenderer::SetSinkOutline(int index,
+                                 int x,
+                                 int y,
+                                 int width,
+                                 int height) {
+  bool size_changed = sinks_[index].second->SetOutlineRect(x, y, width, height);
+  if (size_changed && tile_size_callback_) {
+    tile_size_callback_(sinks_[index].first->id(), width, height);
+  }
+}
+
+void SDLRenderer::SetSpotlightOutlines(int speaker,
+                                       const std::vector<int>& thumbnails) {
+  // 下の 1/THUMBNAIL_HEIGHT_RATIO をサムネイルの列にして、残りを話者に使う
+  int thumbnail_count = thumbnails.size();
+  int thumbnail_height = height_ / THUMBNAIL_HEIGHT_RATIO;
+  int thumbnail_width = std::min<int>(width_ / thumbnail_count,
+                                      thumbnail_height * STD_ASPECT);
+  int speaker_height = height_ - thumbnail_height;
+  int thumbnail_offset_x = (width_ - thumbnail_width * thumbnail_count) / 2;
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " speaker:" << speaker
+                      << " thumbnail_width:" << thumbnail_width
+                      << " thumbnail_height:" << thumbnail_height;
+
+  // 話者が切り替わっても、大きさが変わるのは新旧の話者のタイルだけになる
+  SetSinkOutline(speaker, 0, 0, width_, speaker_height);
+  sinks_[speaker].second->SetMaxResolutionAndFramerate(0, 0);
+  for (int n = 0; n < thumbnail_count; n++) {
+    int i = thumbnails[n];
+    SetSinkOutline(i, thumbnail_offset_x + thumbnail_width * n,
+                   speaker_height, thumbnail_width, thumbnail_height);
+    sinks_[i].second->SetMaxResolutionAndFramerate(
+        thumbnail_width * thumbnail_height, THUMBNAIL_FPS);
+  }
+}
+
+void SDLRenderer::SetGridOutlines(const std::vector<int>& indices) {
+  int tiles_count = indices.size();
   float window_aspect = (float)width_ / (float)height_;
   bool window_is_wide = window_aspect > ((STD_ASPECT + WIDE_ASPECT) / 2.0);
   float frame_aspect = window_is_wide ? WIDE_ASPECT : STD_ASPECT;
@@ -321,7 +1386,7 @@ void SDLRenderer::SetOutlines() {
     int times = std::floor(window_aspect / frame_aspect);
     if (times < 1)
       times = 1;
-    while (rows * cols < sinks_.size()) {
+    while (rows * cols < tiles_count) {
       if (times < (cols / rows)) {
         rows++;
       } else {
@@ -332,7 +1397,7 @@ void SDLRenderer::SetOutlines() {
     int times = std::floor(frame_aspect / window_aspect);
     if (times < 1)
       times = 1;
-    while (rows * cols < sinks_.size()) {
+    while (rows * cols < tiles_count) {
       if (times < (rows / cols)) {
         cols++;
       } else {
@@ -343,12 +1408,13 @@ void SDLRenderer::SetOutlines() {
   RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " rows:" << rows << " cols:" << cols;
   int outline_width = std::floor(width_ / cols);
   int outline_height = std::floor(height_ / rows);
-  int sinks_count = sinks_.size();
-  for (int i = 0; i < sinks_count; i++) {
+  for (int n = 0; n < tiles_count; n++) {
+    int i = indices[n];
     Sink* sink = sinks_[i].second.get();
-    int offset_x = outline_width * (i % cols);
-    int offset_y = outline_height * std::floor(i / cols);
-    sink->SetOutlineRect(offset_x, offset_y, outline_width, outline_height);
+    int offset_x = outline_width * (n % cols);
+    int offset_y = outline_height * std::floor(n / cols);
+    SetSinkOutline(i, offset_x, offset_y, outline_width, outline_height);
+    sink->SetMaxResolutionAndFramerate(0, 0);
     RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " offset_x:" << offset_x
                         << " offset_y:" << offset_y
                         << " outline_width:" << outline_width
@@ -362,16 +1428,74 @@ void SDLRenderer::AddTrack(webrtc::VideoTrackInterface* track) {
   std::unique_ptr<Sink> sink(new Sink(this, track));
   webrtc::MutexLock lock(&sinks_lock_);
   sinks_.push_back(std::make_pair(track, std::move(sink)));
+  UpdateSinkCounters();
   SetOutlines();
 }
 
 void SDLRenderer::RemoveTrack(webrtc::VideoTrackInterface* track) {
   webrtc::MutexLock lock(&sinks_lock_);
+  for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+    if (sinks.first == track) {
+      removed_sink_stats_.push_back(sinks.second->GetStats());
+    }
+  }
   sinks_.erase(
       std::remove_if(sinks_.begin(), sinks_.end(),
                      [track](const VideoTrackSinkVector::value_type& sink) {
                        return sink.first == track;
                      }),
       sinks_.end());
+  UpdateSinkCounters();
   SetOutlines();
 }
+
+void SDLRenderer::UpdateSinkCounters() {
+  std::shared_ptr<SinkCountersVector> counters(new SinkCountersVector());
+  counters->reserve(sinks_.size());
+  for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+    counters->push_back(sinks.second->GetCounters());
+  }
+  std::atomic_store(&sink_counters_,
+                    std::shared_ptr<const SinkCountersVector>(counters));
+}
+
+void SDLRenderer::AppendMetrics(MetricsWriter& writer,
+                                const std::string& window) {
+  writer.Add("sora_renderer_renders_total", "counter", "window", window,
+             render_count_.load(std::memory_order_relaxed));
+  writer.Add("sora_renderer_render_seconds_total", "counter", "window", window,
+             render_time_us_.load(std::memory_order_relaxed) / 1000000.0);
+  writer.Add("sora_renderer_governor_level", "gauge", "window", window,
+             GetRenderGovernorLevel());
+
+  // 描画スレッドは描画している間 sinks_lock_ を保持しているので、
+  // ロックを取らずにスナップショットからカウンタを読む
+  std::shared_ptr<const SinkCountersVector> snapshot =
+      std::atomic_load(&sink_counters_);
+  if (snapshot == nullptr) {
+    return;
+  }
+  for (const std::shared_ptr<SinkCounters>& counters : *snapshot) {
+    const std::string& track_id = counters->track_id;
+    uint64_t frames_skipped =
+        counters->delivery.frames_skipped.load(std::memory_order_relaxed);
+    uint64_t frames_overwritten =
+        counters->delivery.frames_overwritten.load(std::memory_order_relaxed);
+    writer.Add(
+        "sora_renderer_frames_received_total", "counter", "track", track_id,
+        (double)counters->delivery.frames_received.load(
+            std::memory_order_relaxed));
+    writer.Add(
+        "sora_renderer_frames_rendered_total", "counter", "track", track_id,
+        (double)counters->render.frames_rendered.load(
+            std::memory_order_relaxed));
+    writer.Add("sora_renderer_frames_dropped_total", "counter", "track",
+               track_id, (double)(frames_skipped + frames_overwritten));
+    writer.Add("sora_renderer_frames_overwritten_total", "counter", "track",
+               track_id, (double)frames_overwritten);
+    writer.Add(
+        "sora_renderer_convert_seconds_total", "counter", "track", track_id,
+        counters->delivery.convert_time_us.load(std::memory_order_relaxed) /
+            1000000.0);
+  }
+}
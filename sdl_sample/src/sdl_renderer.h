@@ -1,6 +1,7 @@
 #ifndef SDL_RENDERER_H_
 #define SDL_RENDERER_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -18,12 +19,98 @@
 #include <api/video/video_sink_interface.h>
 #include <rtc_base/synchronization/mutex.h>
 
+#include "latency_pattern.h"
+#include "render_governor.h"
+
+class MetricsWriter;
+
 class SDLRenderer {
  public:
-  SDLRenderer(int width, int height, bool fullscreen);
+  // シンク毎のフレームの統計
+  struct SinkStats {
+    std::string track_id;
+    uint64_t frames_received = 0;
+    // 変換する前に捨てたフレーム (タイルの大きさが決まる前や、サムネイルのフレームレートの制限)
+    uint64_t frames_skipped = 0;
+    // 変換したが、描画する前に次のフレームで上書きされたフレーム
+    uint64_t frames_overwritten = 0;
+    uint64_t frames_rendered = 0;
+    // 描画用の ARGB に変換 (縮小を含む) したフレームの数と、1 フレームあたりの平均の時間
+    uint64_t frames_converted = 0;
+    double convert_ms_mean = 0;
+    // フレームが届いた間隔
+    int64_t interval_p50_ms = 0;
+    int64_t interval_p90_ms = 0;
+    int64_t interval_p99_ms = 0;
+  };
+
+  // software_compositor_threads が 0 の場合は SDL_Renderer で描画する。
+  // 1 以上の場合は SDL_Renderer を使わずに、各タイルの映像をウインドウのサーフェスに直接縮小・変換して、
+  // 更新したタイルの範囲だけをウインドウに反映する。変換は指定した数のスレッドでタイル毎に並列に行う。
+  SDLRenderer(int width,
+              int height,
+              bool fullscreen,
+              int software_compositor_threads = 0);
   ~SDLRenderer();
 
   void SetDispatchFunction(std::function<void(std::function<void()>)> dispatch);
+  // PollEvent で取り出したイベントを、このレンダラで処理する代わりに callback に渡す。
+  // 複数のウインドウのイベントを 1 か所で取り出して振り分けるために使う。SetDispatchFunction より前に呼ぶこと。
+  void SetEventCallback(std::function<void(const SDL_Event&)> callback);
+  // false の場合、描画スレッドから dispatch_ で PollEvent を呼ばない。
+  // 複数のウインドウのうち、イベントを取り出すウインドウ以外で使う。SetDispatchFunction より前に呼ぶこと。
+  void SetPollEvent(bool poll_event);
+  // このレンダラのウインドウに対するイベントなら処理して true を返す。メインスレッドから呼ぶこと
+  bool HandleEvent(const SDL_Event& e);
+  // ウインドウを指定したディスプレイの中央に移動する。メインスレッドから呼ぶこと
+  void MoveToDisplay(int display);
+  // 受信した映像に埋め込まれたキャプチャ時刻を読み取って、
+  // デコードまでの遅延と表示までの遅延を計測する。AddTrack より前に呼ぶこと。
+  void SetMeasureLatency(bool measure_latency);
+  // タイルの大きさが変わった時に呼ばれる関数を設定する。
+  // sinks_lock_ を保持したまま呼ばれるので、重い処理は別のスレッドに渡すこと。
+  void SetTileSizeCallback(
+      std::function<void(std::string track_id, int width, int height)>
+          callback);
+
+  // スポットライトレイアウトにすると、SetSpotlightTrack で指定したトラックを大きく表示して、
+  // それ以外のトラックは解像度とフレームレートを落としたサムネイルとして表示する
+  void SetSpotlightLayout(bool spotlight);
+  void SetSpotlightTrack(const std::string& track_id);
+  // 1 ページに表示するタイルの最大数。0 の場合は全てのタイルを表示する。
+  // 表示していないページのトラックはシンクを外すので、変換や描画の処理が行われない。
+  void SetTilesPerPage(int tiles_per_page);
+
+  // 描画スレッドを動かす CPU と優先度を設定する。描画スレッドの次のループで反映する。
+  // cpus が空の場合は CPU を固定しない。priority は "normal", "high", "realtime" のどれか
+  void SetRenderThreadOptions(const std::vector<int>& cpus,
+                              const std::string& priority);
+  // track_id の映像の一部を拡大して表示する。zoom は 1 で全体を表示して、
+  // center_x, center_y は拡大の中心の映像全体に対する位置 (0〜1)。
+  // 拡大した範囲だけを変換して描画するので、拡大するほど変換と描画の処理が減る。
+  void SetZoom(const std::string& track_id,
+               float zoom,
+               float center_x,
+               float center_y);
+  void ResetZoom();
+
+  // 削除したトラックも含めて、これまでに追加した全てのシンクの統計を返す。
+  // 統計は終了時にも JSON で標準出力に出力する
+  std::vector<SinkStats> GetSinkStats();
+  // 各タイルの左上にシンクの統計を表示する。実行中に i キーでも切り替えられる
+  void SetStatsOverlay(bool overlay);
+
+  // 描画が FRAME_INTERVAL に間に合わない状態が続いた場合に、小さいタイルから順に
+  // 更新するフレームレートを落として、余裕が戻ったら元に戻す
+  void SetRenderGovernor(bool enabled);
+  // RenderGovernor の今の段階。0 の場合は制限していない
+  int GetRenderGovernorLevel();
+  // RenderGovernor が描画 1 回にかけてよいとみなす時間。デフォルトは FRAME_INTERVAL
+  void SetRenderGovernorBudget(int64_t budget_us);
+
+  // SDL_RenderPresent の間隔を記録して、TakePresentIntervalsUs で取り出せるようにする
+  void SetRecordPresentIntervals(bool record);
+  std::vector<int64_t> TakePresentIntervalsUs();
 
   static int RenderThreadExec(void* data);
   int RenderThread();
@@ -33,7 +120,36 @@ class SDLRenderer {
   void AddTrack(webrtc::VideoTrackInterface* track);
   void RemoveTrack(webrtc::VideoTrackInterface* track);
 
+  // シンク毎の受信・描画・破棄したフレーム数と、描画にかかった時間を書き出す。
+  // カウンタはアトミック変数で、シンクの一覧は AddTrack/RemoveTrack で差し替えるスナップショットから読むので、
+  // フレームを受け取るスレッドも、sinks_lock_ を保持して描画する描画スレッドも止めない。
+  // window は描画の回数と時間に付けるラベル
+  void AppendMetrics(MetricsWriter& writer, const std::string& window);
+
  protected:
+  // シンク毎のカウンタ。シンクを削除した後もスナップショットから読めるように、シンクと共有する
+  struct SinkCounters {
+    explicit SinkCounters(std::string track_id)
+        : track_id(std::move(track_id)) {}
+
+    const std::string track_id;
+    // フレームを受け取るスレッドが更新するカウンタと描画スレッドが更新するカウンタを
+    // 別のキャッシュラインに置いて、お互いの更新でキャッシュラインを取り合わないようにする
+    struct alignas(64) DeliveryCounters {
+      std::atomic<uint64_t> frames_received{0};
+      std::atomic<uint64_t> frames_skipped{0};
+      std::atomic<uint64_t> frames_overwritten{0};
+      std::atomic<uint64_t> frames_converted{0};
+      std::atomic<int64_t> convert_time_us{0};
+    };
+    struct alignas(64) RenderCounters {
+      std::atomic<uint64_t> frames_rendered{0};
+    };
+    DeliveryCounters delivery;
+    RenderCounters render;
+  };
+  typedef std::vector<std::shared_ptr<SinkCounters>> SinkCountersVector;
+
   class Sink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
    public:
     Sink(SDLRenderer* renderer, webrtc::VideoTrackInterface* track);
@@ -41,7 +157,17 @@ class SDLRenderer {
 
     void OnFrame(const webrtc::VideoFrame& frame) override;
 
-    void SetOutlineRect(int x, int y, int width, int height);
+    bool SetOutlineRect(int x, int y, int width, int height);
+    // 0 の場合は制限しない
+    void SetMaxResolutionAndFramerate(int max_pixel_count, int max_fps);
+    // RenderGovernor が決めたフレームレートの上限。レイアウトで決めた上限と小さい方を使う。
+    // 描画スレッドから呼ばれるので、ここでは変換するフレームの間隔だけを更新して、
+    // トラックの AddOrUpdateSink は dispatch_ で渡して描画スレッドを待たせない
+    void SetGovernorMaxFramerate(int max_fps);
+    void SetVisible(bool visible);
+    bool IsVisible();
+    void SetZoom(float zoom, float center_x, float center_y);
+    void GetZoom(float& zoom, float& center_x, float& center_y);
 
     webrtc::Mutex* GetMutex();
     bool GetOutlineChanged();
@@ -51,9 +177,37 @@ class SDLRenderer {
     int GetFrameHeight();
     int GetWidth();
     int GetHeight();
-    uint8_t* GetImage();
+    int64_t TakeCaptureTimeMs();
+    // 描画スレッドが描画した時に呼ぶ
+    void OnRendered();
+    bool HasPendingFrame();
+    void AddConvertTime(int64_t convert_us);
+    SinkStats GetStats();
+    std::shared_ptr<SinkCounters> GetCounters();
+    // ソフトウェア合成で使う、変換前の映像と切り出す範囲
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> GetBuffer();
+    void GetCropRect(int& x, int& y, int& width, int& height);
+    SDL_Rect GetOutlineRect();
+    // 前回合成した範囲と違う場合は true を返す。描画スレッドからしか呼ばない
+    bool SetCompositedRect(const SDL_Rect& rect);
+    // 新しいフレームが届いている場合だけテクスチャに転送して、テクスチャを返す。
+    // 描画スレッドから GetMutex() を保持して呼ぶこと
+    SDL_Texture* UpdateTexture(SDL_Renderer* renderer);
+    void ReleaseTexture();
 
    private:
+    // dispatch_ で渡した処理から、破棄された後のシンクに触らないようにする
+    struct WantsState {
+      webrtc::Mutex mutex;
+      Sink* sink = nullptr;
+    };
+
+    int GetMaxFramerate();
+    void UpdateFrameInterval();
+    // トラックに今の VideoSinkWants を設定する。wants_state_->mutex を保持して呼ぶこと
+    void UpdateWants();
+    rtc::VideoSinkWants GetWants();
+
     SDLRenderer* renderer_;
     rtc::scoped_refptr<webrtc::VideoTrackInterface> track_;
     webrtc::Mutex frame_params_lock_;
@@ -66,32 +220,147 @@ class SDLRenderer {
     int input_width_;
     int input_height_;
     bool scaled_;
+    // 拡大する場合の表示する範囲
+    float zoom_;
+    float zoom_center_x_;
+    float zoom_center_y_;
+    bool zoom_changed_;
+    int crop_x_;
+    int crop_y_;
+    int crop_width_;
+    int crop_height_;
     std::unique_ptr<uint8_t[]> image_;
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer_;
+    SDL_Rect composited_rect_;
     int offset_x_;
     int offset_y_;
     int width_;
     int height_;
+    int64_t capture_time_ms_;
+    bool remote_;
+    // 以下の 3 つは描画スレッドと dispatch_ で渡した処理からも読むのでアトミック変数にする
+    std::atomic<int> max_pixel_count_;
+    std::atomic<int> max_fps_;
+    std::atomic<int> governor_max_fps_;
+    // dispatch_ で渡した UpdateWants がまだ実行されていない
+    std::atomic<bool> wants_pending_;
+    std::shared_ptr<WantsState> wants_state_;
+    std::atomic<int64_t> min_frame_interval_us_;
+    int64_t last_frame_time_us_;
+    std::atomic<bool> visible_;
+    std::shared_ptr<SinkCounters> counters_;
+    // 変換したフレームをまだ描画していない
+    std::atomic<bool> frame_pending_;
+    // フレームを受け取るスレッドからしか触らない
+    int64_t last_receive_time_us_;
+    LatencyHistogram receive_intervals_;
+    // 描画スレッドからしか触らない
+    SDL_Texture* texture_;
+    int texture_width_;
+    int texture_height_;
   };
 
  private:
   bool IsFullScreen();
   void SetFullScreen(bool fullscreen);
   void PollEvent();
+  // ウインドウ上の位置に表示しているシンク。sinks_lock_ を保持して呼ぶこと
+  Sink* FindSinkAt(int x, int y);
+  // マウスホイールでカーソルの位置を中心に拡大・縮小する
+  void ZoomAt(int x, int y, float ratio);
+  // ドラッグで拡大している範囲を動かす
+  void PanAt(int x, int y, int dx, int dy);
+  void ApplyRenderThreadOptions();
+  void RenderSinks();
+  void CompositeSinks();
+  // 表示しているタイルを小さい順に並べて、RenderGovernor の段階に応じたフレームレートの上限を設定する。
+  // sinks_lock_ を保持して呼ぶこと
+  void ApplyRenderGovernor();
+  // sink のタイルの左上に統計を描く矩形を追加する。sink の GetMutex() を保持して呼ぶこと
+  void AppendStatsOverlayRects(Sink* sink,
+                               std::vector<SDL_Rect>& backgrounds,
+                               std::vector<SDL_Rect>& texts);
+  void SetGridOutlines(const std::vector<int>& indices);
+  void SetSpotlightOutlines(int speaker, const std::vector<int>& thumbnails);
+  void SetSinkOutline(int index, int x, int y, int width, int height);
+  // sinks_ から SinkCounters のスナップショットを作り直す。sinks_lock_ を保持して呼ぶこと
+  void UpdateSinkCounters();
 
   webrtc::Mutex sinks_lock_;
   typedef std::vector<
       std::pair<webrtc::VideoTrackInterface*, std::unique_ptr<Sink>>>
       VideoTrackSinkVector;
   VideoTrackSinkVector sinks_;
+  // AppendMetrics が sinks_lock_ を取らずに読むスナップショット。
+  // std::atomic_load/std::atomic_store で読み書きする
+  std::shared_ptr<const SinkCountersVector> sink_counters_;
   std::atomic<bool> running_;
+  int software_compositor_threads_;
   SDL_Thread* thread_;
   SDL_Window* window_;
   SDL_Renderer* renderer_;
   std::function<void(std::function<void()>)> dispatch_;
+  std::function<void(const SDL_Event&)> event_callback_;
+  bool poll_event_;
+  std::function<void(std::string, int, int)> tile_size_callback_;
   int width_;
   int height_;
   int rows_;
   int cols_;
+  bool spotlight_;
+  std::string spotlight_track_id_;
+  int tiles_per_page_;
+  int page_;
+  std::vector<int> visible_indices_;
+  bool measure_latency_;
+  LatencyHistogram decode_latency_;
+  LatencyHistogram present_latency_;
+  std::vector<int64_t> presented_capture_times_;
+  std::atomic<uint64_t> render_count_;
+  std::atomic<int64_t> render_time_us_;
+  std::vector<int> render_thread_cpus_;
+  std::string render_thread_priority_;
+  std::atomic<bool> render_thread_options_changed_;
+  webrtc::Mutex present_intervals_lock_;
+  bool record_present_intervals_;
+  std::vector<int64_t> present_intervals_us_;
+  // 描画スレッドからしか触らない
+  int64_t last_present_us_;
+  std::atomic<bool> stats_overlay_;
+  std::vector<SDL_Rect> overlay_backgrounds_;
+  std::vector<SDL_Rect> overlay_texts_;
+  // 削除したシンクの統計。sinks_lock_ で保護する
+  std::vector<SinkStats> removed_sink_stats_;
+  // 削除したシンクのテクスチャ。描画スレッドで破棄する。sinks_lock_ で保護する
+  std::vector<SDL_Texture*> retired_textures_;
+  // 以下の 4 つは sinks_lock_ で保護する
+  bool governor_enabled_;
+  // レイアウトが変わってタイルの重要度の順番が変わった
+  bool governor_layout_changed_;
+  RenderGovernor governor_;
+  std::vector<Sink*> governor_order_;
+  // メトリクスを書き出す時に sinks_lock_ を待たずに読めるようにする
+  std::atomic<int> governor_level_;
+
+  // ソフトウェア合成で 1 つのタイルに書き込む内容
+  struct CompositeTile {
+    Sink* sink;
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+    int crop_x;
+    int crop_y;
+    int crop_width;
+    int crop_height;
+    SDL_Rect rect;
+  };
+  std::unique_ptr<boost::asio::thread_pool> compositor_pool_;
+  // レイアウトが変わった時に sinks_lock_ を保持して立てて、サーフェス全体を描き直す
+  bool composite_all_;
+  // 以下は描画スレッドからしか触らない
+  SDL_Surface* composite_surface_;
+  int composite_surface_width_;
+  int composite_surface_height_;
+  std::vector<CompositeTile> composite_tiles_;
+  std::vector<SDL_Rect> composite_rects_;
 };
 
 #endif
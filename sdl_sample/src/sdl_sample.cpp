@@ -2,13 +2,24 @@
 #include <sora/camera_device_capturer.h>
 #include <sora/sora_client_context.h>
 
+#include <future>
+#include <map>
+
 // CLI11
 #include <CLI/CLI.hpp>
 
 // Boost
 #include <boost/optional/optional.hpp>
 
-#include "sdl_renderer.h"
+#include "async_log_sink.h"
+#include "encoded_frame_recorder.h"
+#include "event_trace.h"
+#include "headless_audio_device.h"
+#include "metrics_server.h"
+#include "rtc_stats_sampler.h"
+#include "multi_window_renderer.h"
+#include "thread_affinity.h"
+#include "thumbnail_exporter.h"
 
 #ifdef _WIN32
 #include <rtc_base/win/scoped_com_initializer.h>
@@ -30,33 +41,81 @@ struct SDLSampleConfig {
   boost::json::value metadata;
   bool show_me = false;
   bool fullscreen = false;
+  int tiles_per_page = 0;
+  std::vector<int> render_cpus;
+  std::string render_thread_priority = "normal";
+  // 0 の場合は SDL_Renderer で描画する
+  int software_compositor_threads = 0;
+  int window_count = 1;
+  bool render_governor = false;
+
+  bool latency_receiver = false;
+
+  int stats_interval = 0;
+  std::string stats_file;
+  std::string stats_format = "json";
+
+  std::string record_dir;
+  bool record_only = false;
+
+  std::string thumbnail_dir;
+  int thumbnail_interval = 5;
+  int thumbnail_width = 320;
+
+  bool headless_audio = false;
+  HeadlessAudioDeviceConfig headless_audio_config;
+
+  std::string trace_file;
+
+  int metrics_port = 0;
+  std::string metrics_address = "127.0.0.1";
 };
 
 class SDLSample : public std::enable_shared_from_this<SDLSample>,
                   public sora::SoraSignalingObserver {
  public:
-  SDLSample(std::shared_ptr<sora::SoraClientContext> context,
+  SDLSample(std::future<std::shared_ptr<sora::SoraClientContext>> context,
             SDLSampleConfig config)
-      : context_(context), config_(config) {}
+      : context_future_(std::move(context)), config_(config) {}
 
   void Run() {
-    renderer_.reset(
-        new SDLRenderer(config_.width, config_.height, config_.fullscreen));
+    // 起動を速くするために、SoraClientContext の生成 (main で開始している) と
+    // カメラのオープンを別スレッドで行い、その間にメインスレッドで SDL を初期化する。
+    // シグナリングはカメラのオープンを待たずに開始して、トラックは offer を受け取るまでに作る。
+    ioc_.reset(new boost::asio::io_context(1));
 
     if (config_.video && config_.role != "recvonly") {
-      sora::CameraDeviceCapturerConfig cam_config;
-      cam_config.width = 640;
-      cam_config.height = 480;
-      cam_config.fps = 30;
-      auto video_source = sora::CreateCameraDeviceCapturer(cam_config);
-
-      std::string video_track_id = rtc::CreateRandomString(16);
-      video_track_ = context_->peer_connection_factory()->CreateVideoTrack(
-          video_track_id, video_source.get());
-      if (config_.show_me) {
-        renderer_->AddTrack(video_track_.get());
-      }
+      video_source_future_ = std::async(std::launch::async, [this]() {
+        sora::CameraDeviceCapturerConfig cam_config;
+        cam_config.width = 640;
+        cam_config.height = 480;
+        cam_config.fps = 30;
+        auto video_source = sora::CreateCameraDeviceCapturer(cam_config);
+        // 自分の映像をすぐに表示できるように、offer を待たずにトラックを作る
+        boost::asio::post(*ioc_, [this]() { CreateVideoTrack(); });
+        return video_source;
+      });
     }
+
+    // 録画専用の場合は映像をデコードしないので、ウインドウも作らない
+    if (!config_.record_only) {
+      MultiWindowRendererConfig renderer_config;
+      renderer_config.window_count = config_.window_count;
+      renderer_config.width = config_.width;
+      renderer_config.height = config_.height;
+      renderer_config.fullscreen = config_.fullscreen;
+      renderer_config.software_compositor_threads =
+          config_.software_compositor_threads;
+      renderer_.reset(new MultiWindowRenderer(renderer_config));
+      renderer_->SetMeasureLatency(config_.latency_receiver);
+      renderer_->SetTilesPerPage(config_.tiles_per_page);
+      renderer_->SetRenderThreadOptions(config_.render_cpus,
+                                        config_.render_thread_priority);
+      renderer_->SetRenderGovernor(config_.render_governor);
+    }
+
+    context_ = context_future_.get();
+
     if (config_.audio && config_.role != "recvonly") {
       std::string audio_track_id = rtc::CreateRandomString(16);
       audio_track_ = context_->peer_connection_factory()->CreateAudioTrack(
@@ -65,8 +124,6 @@ class SDLSample : public std::enable_shared_from_this<SDLSample>,
                               .get());
     }
 
-    ioc_.reset(new boost::asio::io_context(1));
-
     sora::SoraSignalingConfig config;
     config.pc_factory = context_->peer_connection_factory();
     config.io_context = ioc_.get();
@@ -84,6 +141,43 @@ class SDLSample : public std::enable_shared_from_this<SDLSample>,
     config.metadata = config_.metadata;
     conn_ = sora::SoraSignaling::Create(config);
 
+    if (config_.stats_interval > 0) {
+      RTCStatsSamplerConfig stats_config;
+      stats_config.interval = config_.stats_interval;
+      stats_config.file = config_.stats_file;
+      stats_config.format = config_.stats_format;
+      stats_sampler_.reset(new RTCStatsSampler(stats_config));
+      stats_sampler_->Start();
+    }
+
+    if (!config_.record_dir.empty()) {
+      EncodedFrameRecorderConfig recorder_config;
+      recorder_config.dir = config_.record_dir;
+      recorder_.reset(new EncodedFrameRecorder(recorder_config));
+      recorder_->Start();
+    }
+
+    if (!config_.thumbnail_dir.empty()) {
+      ThumbnailExporterConfig exporter_config;
+      exporter_config.dir = config_.thumbnail_dir;
+      exporter_config.interval = config_.thumbnail_interval;
+      exporter_config.width = config_.thumbnail_width;
+      thumbnail_exporter_.reset(new ThumbnailExporter(exporter_config));
+      thumbnail_exporter_->Start();
+    }
+
+    if (config_.metrics_port > 0) {
+      MetricsServerConfig metrics_config;
+      metrics_config.address = config_.metrics_address;
+      metrics_config.port = config_.metrics_port;
+      metrics_server_ = MetricsServer::Create(
+          *ioc_, metrics_config,
+          [this](MetricsWriter& writer) { CollectMetrics(writer); });
+      if (metrics_server_ == nullptr) {
+        return;
+      }
+    }
+
     boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
         work_guard(ioc_->get_executor());
 
@@ -91,18 +185,35 @@ class SDLSample : public std::enable_shared_from_this<SDLSample>,
     signals.async_wait(
         [this](const boost::system::error_code&, int) { conn_->Disconnect(); });
 
+#ifndef _WIN32
+    // SIGUSR1 を受け取ったら、終了せずにそこまでのトレースを書き出す
+    boost::asio::signal_set trace_signals(*ioc_);
+    if (!config_.trace_file.empty()) {
+      trace_signals.add(SIGUSR1);
+      WaitTraceSignal(trace_signals);
+    }
+#endif
+
     conn_->Connect();
 
-    renderer_->SetDispatchFunction([this](std::function<void()> f) {
-      if (ioc_->stopped())
-        return;
-      boost::asio::dispatch(ioc_->get_executor(), f);
-    });
+    if (renderer_ != nullptr) {
+      renderer_->SetDispatchFunction([this](std::function<void()> f) {
+        if (ioc_->stopped())
+          return;
+        boost::asio::dispatch(ioc_->get_executor(), f);
+      });
+    }
 
     ioc_->run();
   }
 
   void OnSetOffer(std::string offer) override {
+    TRACE_EVENT("SDLSample::OnSetOffer");
+    // カメラのオープンがまだ終わっていない場合は、ここで待つ
+    CreateVideoTrack();
+    if (stats_sampler_ != nullptr) {
+      stats_sampler_->SetPeerConnection(conn_->GetPeerConnection());
+    }
     std::string stream_id = rtc::CreateRandomString(16);
     if (audio_track_ != nullptr) {
       webrtc::RTCErrorOr<rtc::scoped_refptr<webrtc::RtpSenderInterface>>
@@ -117,26 +228,83 @@ class SDLSample : public std::enable_shared_from_this<SDLSample>,
   }
   void OnDisconnect(sora::SoraSignalingErrorCode ec,
                     std::string message) override {
+    TRACE_EVENT("SDLSample::OnDisconnect");
     RTC_LOG(LS_INFO) << "OnDisconnect: " << message;
+    stats_sampler_.reset();
+    recorder_.reset();
+    thumbnail_exporter_.reset();
     renderer_.reset();
     ioc_->stop();
   }
-  void OnNotify(std::string text) override {}
+  void OnNotify(std::string text) override {
+    if (metrics_server_ == nullptr) {
+      return;
+    }
+    boost::json::error_code ec;
+    auto json = boost::json::parse(text, ec);
+    if (ec || !json.is_object()) {
+      return;
+    }
+    const auto& obj = json.as_object();
+    auto event_type = obj.if_contains("event_type");
+    auto connection_id = obj.if_contains("connection_id");
+    if (event_type == nullptr || !event_type->is_string() ||
+        connection_id == nullptr || !connection_id->is_string()) {
+      return;
+    }
+    // 自分の接続が作られたら接続完了とする
+    if (event_type->as_string() == "connection.created" &&
+        connection_id->as_string() == conn_->GetConnectionID()) {
+      boost::asio::post(*ioc_, [this]() { connected_ = true; });
+    }
+  }
   void OnPush(std::string text) override {}
-  void OnMessage(std::string label, std::string data) override {}
+  void OnMessage(std::string label, std::string data) override {
+    if (metrics_server_ == nullptr) {
+      return;
+    }
+    size_t size = data.size();
+    boost::asio::post(*ioc_, [this, label, size]() {
+      MessageCounter& counter = received_messages_[label];
+      counter.messages++;
+      counter.bytes += size;
+    });
+  }
 
   void OnTrack(rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver)
       override {
+    TRACE_EVENT("SDLSample::OnTrack");
+    if (recorder_ != nullptr) {
+      recorder_->AddReceiver(transceiver->receiver());
+    }
     auto track = transceiver->receiver()->track();
-    if (track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
+    if (track->kind() != webrtc::MediaStreamTrackInterface::kVideoKind) {
+      return;
+    }
+    if (thumbnail_exporter_ != nullptr) {
+      thumbnail_exporter_->AddTrack(
+          static_cast<webrtc::VideoTrackInterface*>(track.get()));
+    }
+    if (renderer_ != nullptr) {
       renderer_->AddTrack(
           static_cast<webrtc::VideoTrackInterface*>(track.get()));
     }
   }
   void OnRemoveTrack(
       rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver) override {
+    TRACE_EVENT("SDLSample::OnRemoveTrack");
+    if (recorder_ != nullptr) {
+      recorder_->RemoveReceiver(receiver);
+    }
     auto track = receiver->track();
-    if (track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
+    if (track->kind() != webrtc::MediaStreamTrackInterface::kVideoKind) {
+      return;
+    }
+    if (thumbnail_exporter_ != nullptr) {
+      thumbnail_exporter_->RemoveTrack(
+          static_cast<webrtc::VideoTrackInterface*>(track.get()));
+    }
+    if (renderer_ != nullptr) {
       renderer_->RemoveTrack(
           static_cast<webrtc::VideoTrackInterface*>(track.get()));
     }
@@ -145,13 +313,82 @@ class SDLSample : public std::enable_shared_from_this<SDLSample>,
   void OnDataChannel(std::string label) override {}
 
  private:
+  // カメラのオープンが終わるのを待って映像のトラックを作る。
+  // 映像を送信しない場合と、既にトラックを作った場合は何もしない。
+  // ioc_ のスレッドから呼ぶこと
+  void CreateVideoTrack() {
+    if (!video_source_future_.valid()) {
+      return;
+    }
+    auto video_source = video_source_future_.get();
+    if (video_source == nullptr) {
+      RTC_LOG(LS_ERROR) << "Failed to create video source.";
+      return;
+    }
+    std::string video_track_id = rtc::CreateRandomString(16);
+    video_track_ = context_->peer_connection_factory()->CreateVideoTrack(
+        video_track_id, video_source.get());
+    if (config_.show_me && renderer_ != nullptr) {
+      renderer_->AddTrack(video_track_.get());
+    }
+  }
+
+  void CollectMetrics(MetricsWriter& writer) {
+    writer.Add("sora_connection_connected", "gauge", connected_ ? 1 : 0);
+    for (const auto& counter : received_messages_) {
+      writer.Add("sora_messaging_received_messages_total", "counter",
+                 "label", counter.first, counter.second.messages);
+    }
+    for (const auto& counter : received_messages_) {
+      writer.Add("sora_messaging_received_bytes_total", "counter", "label",
+                 counter.first, counter.second.bytes);
+    }
+    if (renderer_ != nullptr) {
+      renderer_->AppendMetrics(writer);
+    }
+    if (thumbnail_exporter_ != nullptr) {
+      writer.Add("sora_thumbnails_written_total", "counter",
+                 thumbnail_exporter_->GetWrittenThumbnails());
+      writer.Add("sora_thumbnails_skipped_total", "counter",
+                 thumbnail_exporter_->GetSkippedThumbnails());
+    }
+  }
+
+#ifndef _WIN32
+  void WaitTraceSignal(boost::asio::signal_set& signals) {
+    signals.async_wait(
+        [this, &signals](const boost::system::error_code& ec, int) {
+          if (ec) {
+            return;
+          }
+          WriteEventTrace(config_.trace_file);
+          WaitTraceSignal(signals);
+        });
+  }
+#endif
+
+  std::future<std::shared_ptr<sora::SoraClientContext>> context_future_;
   std::shared_ptr<sora::SoraClientContext> context_;
   SDLSampleConfig config_;
+  std::future<rtc::scoped_refptr<webrtc::VideoTrackSourceInterface>>
+      video_source_future_;
   rtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track_;
   rtc::scoped_refptr<webrtc::VideoTrackInterface> video_track_;
   std::shared_ptr<sora::SoraSignaling> conn_;
   std::unique_ptr<boost::asio::io_context> ioc_;
-  std::unique_ptr<SDLRenderer> renderer_;
+  std::unique_ptr<MultiWindowRenderer> renderer_;
+  std::unique_ptr<RTCStatsSampler> stats_sampler_;
+  std::unique_ptr<EncodedFrameRecorder> recorder_;
+  std::unique_ptr<ThumbnailExporter> thumbnail_exporter_;
+  std::unique_ptr<MetricsServer> metrics_server_;
+  // 以下は ioc_ のスレッドからしか触らない
+  struct MessageCounter {
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+  };
+  // label -> MessageCounter
+  std::map<std::string, MessageCounter> received_messages_;
+  bool connected_ = false;
 };
 
 void add_optional_bool(CLI::App& app,
@@ -239,6 +476,111 @@ int main(int argc, char* argv[]) {
   app.add_option("--height", config.height, "SDL window height");
   app.add_flag("--fullscreen", config.fullscreen);
   app.add_flag("--show-me", config.show_me);
+  app.add_option("--tiles-per-page", config.tiles_per_page,
+                 "Max tiles per page (0: show all tiles)")
+      ->check(CLI::Range(0, 1000));
+  app.add_option_function<std::string>(
+      "--render-cpus",
+      [&config](const std::string& input) {
+        if (!ParseCpuList(input, config.render_cpus)) {
+          throw CLI::ValidationError("--render-cpus", input);
+        }
+      },
+      "CPUs to pin the render thread to (e.g. 2,4-5)");
+  app.add_option("--render-thread-priority", config.render_thread_priority,
+                 "Scheduling priority of the render thread (default: normal)")
+      ->check(CLI::IsMember({"normal", "high", "realtime"}));
+  app.add_option("--software-compositor-threads",
+                 config.software_compositor_threads,
+                 "Compose tiles on the CPU with N threads (0: disabled)")
+      ->check(CLI::Range(0, 64));
+  app.add_option("--window-count", config.window_count,
+                 "Number of windows to spread videos over")
+      ->check(CLI::Range(1, 16));
+  app.add_flag("--render-governor", config.render_governor,
+               "Lower frame rate of small tiles when rendering falls behind");
+
+  // 遅延計測に関するオプション
+  app.add_flag("--latency-receiver", config.latency_receiver,
+               "Measure glass-to-glass latency of received video");
+
+  // ログファイルに関するオプション
+  std::string log_file;
+  int log_file_size = 10;
+  int log_file_count = 5;
+  app.add_option("--log-file", log_file,
+                 "Write logs to the file from a background thread instead of "
+                 "stderr");
+  app.add_option("--log-file-size", log_file_size,
+                 "Max size of a log file in MiB before rotation")
+      ->check(CLI::Range(1, 1024));
+  app.add_option("--log-file-count", log_file_count,
+                 "Number of rotated log files to keep")
+      ->check(CLI::Range(0, 100));
+
+  // メトリクスに関するオプション
+  auto metrics_port =
+      app.add_option("--metrics-port", config.metrics_port,
+                     "Port to serve Prometheus metrics on /metrics "
+                     "(0: disabled)")
+          ->check(CLI::Range(0, 65535));
+  app.add_option("--metrics-address", config.metrics_address,
+                 "Address to serve Prometheus metrics (default: 127.0.0.1)")
+      ->needs(metrics_port);
+
+  // トレースに関するオプション
+  app.add_option("--trace-file", config.trace_file,
+                 "Record timings of rendering and signaling callbacks and "
+                 "write them as Chrome trace JSON on exit (or on SIGUSR1)");
+
+  // 統計情報に関するオプション
+  app.add_option("--stats-interval", config.stats_interval,
+                 "Interval in seconds to collect WebRTC stats (0: disabled)")
+      ->check(CLI::Range(0, 3600));
+  app.add_option("--stats-file", config.stats_file,
+                 "File to write WebRTC stats (default: sora_stats.jsonl or "
+                 "sora_stats.prom)");
+  app.add_option("--stats-format", config.stats_format,
+                 "Format of WebRTC stats file (default: json)")
+      ->check(CLI::IsMember({"json", "prometheus"}));
+
+  // 音声デバイスを使わない場合のオプション
+  auto headless_audio = app.add_flag(
+      "--headless-audio", config.headless_audio,
+      "Use a timer-driven audio device instead of the sound card");
+  app.add_option("--audio-input-file",
+                 config.headless_audio_config.input_file,
+                 "WAV file to send in a loop (default: 440 Hz tone)")
+      ->check(CLI::ExistingFile)
+      ->needs(headless_audio);
+  app.add_option("--audio-output-file",
+                 config.headless_audio_config.output_file,
+                 "WAV file to write received audio (default: discard)")
+      ->needs(headless_audio);
+
+  // 録画に関するオプション
+  auto record_dir =
+      app.add_option("--record-dir", config.record_dir,
+                     "Directory to write received video as IVF files "
+                     "without decoding");
+  auto record_only_flag =
+      app.add_flag("--record-only", config.record_only,
+                   "Record received video without decoding or rendering")
+          ->needs(record_dir);
+
+  // サムネイルに関するオプション
+  auto thumbnail_dir =
+      app.add_option("--thumbnail-dir", config.thumbnail_dir,
+                     "Directory to write JPEG thumbnails of received video")
+          ->excludes(record_only_flag);
+  app.add_option("--thumbnail-interval", config.thumbnail_interval,
+                 "Interval of writing thumbnails in seconds (default: 5)")
+      ->check(CLI::Range(1, 3600))
+      ->needs(thumbnail_dir);
+  app.add_option("--thumbnail-width", config.thumbnail_width,
+                 "Width of thumbnails (default: 320)")
+      ->check(CLI::Range(16, 1920))
+      ->needs(thumbnail_dir);
 
   try {
     app.parse(argc, argv);
@@ -251,15 +593,71 @@ int main(int argc, char* argv[]) {
     config.metadata = boost::json::parse(metadata);
   }
 
+  if (config.stats_file.empty()) {
+    config.stats_file = config.stats_format == "prometheus"
+                            ? "sora_stats.prom"
+                            : "sora_stats.jsonl";
+  }
+
+  std::unique_ptr<AsyncLogSink> log_sink;
   if (log_level != rtc::LS_NONE) {
-    rtc::LogMessage::LogToDebug((rtc::LoggingSeverity)log_level);
+    if (log_file.empty()) {
+      rtc::LogMessage::LogToDebug((rtc::LoggingSeverity)log_level);
+    } else {
+      // ログを出力するスレッドがファイルへの書き込みを待たないようにする
+      AsyncLogSinkConfig log_config;
+      log_config.file = log_file;
+      log_config.max_file_size = (int64_t)log_file_size * 1024 * 1024;
+      log_config.max_files = log_file_count;
+      log_sink = AsyncLogSink::Create(log_config);
+      if (log_sink == nullptr) {
+        std::cerr << "Failed to open log file: " << log_file << std::endl;
+        return 1;
+      }
+      rtc::LogMessage::LogToDebug(rtc::LS_NONE);
+      rtc::LogMessage::AddLogToStream(log_sink.get(),
+                                      (rtc::LoggingSeverity)log_level);
+    }
     rtc::LogMessage::LogTimestamps();
     rtc::LogMessage::LogThreads();
   }
 
-  auto context = sora::SoraClientContext::Create(sora::SoraClientContextConfig());
-  auto sdlsample = std::make_shared<SDLSample>(context, config);
+  if (!config.trace_file.empty()) {
+    StartEventTrace();
+  }
+
+  sora::SoraClientContextConfig context_config;
+  if (config.record_only || config.headless_audio) {
+    context_config.use_audio_device = false;
+    bool record_only = config.record_only;
+    bool headless_audio = config.headless_audio;
+    HeadlessAudioDeviceConfig headless_audio_config =
+        config.headless_audio_config;
+    context_config.configure_media_dependencies =
+        [record_only, headless_audio, headless_audio_config](
+            const webrtc::PeerConnectionFactoryDependencies& dependencies,
+            cricket::MediaEngineDependencies& media_dependencies) {
+          if (record_only) {
+            media_dependencies.video_decoder_factory =
+                CreateRecordOnlyVideoDecoderFactory(
+                    std::move(media_dependencies.video_decoder_factory));
+          }
+          if (headless_audio) {
+            media_dependencies.adm = CreateHeadlessAudioDeviceModule(
+                dependencies.task_queue_factory.get(), headless_audio_config);
+          }
+        };
+  }
+  // SoraClientContext の生成は時間がかかるので、SDL の初期化やカメラのオープンと並行して行う
+  auto context = std::async(std::launch::async, [context_config]() {
+    return sora::SoraClientContext::Create(context_config);
+  });
+  auto sdlsample = std::make_shared<SDLSample>(std::move(context), config);
   sdlsample->Run();
 
+  if (!config.trace_file.empty()) {
+    WriteEventTrace(config.trace_file);
+  }
+
   return 0;
 }
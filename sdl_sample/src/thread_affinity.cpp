@@ -0,0 +1,142 @@
+#include "thread_affinity.h"
+
+#include <cerrno>
+#include <cstdlib>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+// WebRTC
+#include <rtc_base/logging.h>
+
+namespace {
+
+bool ParseCpu(const std::string& text, int& cpu) {
+  if (text.empty()) {
+    return false;
+  }
+  char* end = nullptr;
+  long value = std::strtol(text.c_str(), &end, 10);
+  if (*end != '\0' || value < 0 || value > 1023) {
+    return false;
+  }
+  cpu = (int)value;
+  return true;
+}
+
+}  // namespace
+
+bool ParseCpuList(const std::string& text, std::vector<int>& cpus) {
+  cpus.clear();
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t comma = text.find(',', pos);
+    if (comma == std::string::npos) {
+      comma = text.size();
+    }
+    std::string item = text.substr(pos, comma - pos);
+    size_t dash = item.find('-');
+    int first, last;
+    if (dash == std::string::npos) {
+      if (!ParseCpu(item, first)) {
+        return false;
+      }
+      last = first;
+    } else if (!ParseCpu(item.substr(0, dash), first) ||
+               !ParseCpu(item.substr(dash + 1), last) || first > last) {
+      return false;
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+    pos = comma + 1;
+  }
+  return true;
+}
+
+bool SetCurrentThreadAffinity(const std::vector<int>& cpus) {
+  if (cpus.empty()) {
+    return false;
+  }
+#if defined(_WIN32)
+  DWORD_PTR mask = 0;
+  for (int cpu : cpus) {
+    if (cpu < (int)(sizeof(DWORD_PTR) * 8)) {
+      mask |= (DWORD_PTR)1 << cpu;
+    }
+  }
+  if (mask == 0 || SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+    RTC_LOG(LS_WARNING) << "SetThreadAffinityMask failed: " << GetLastError();
+    return false;
+  }
+  return true;
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (ret != 0) {
+    RTC_LOG(LS_WARNING) << "pthread_setaffinity_np failed: " << ret;
+    return false;
+  }
+  return true;
+#else
+  RTC_LOG(LS_WARNING) << "Thread affinity is not supported on this platform";
+  return false;
+#endif
+}
+
+bool SetCurrentThreadRealtime() {
+#if defined(__linux__)
+  // 他のリアルタイムスレッドを邪魔しないように、一番低い優先度にする
+  sched_param param = {};
+  param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+  int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (ret != 0) {
+    RTC_LOG(LS_WARNING) << "pthread_setschedparam(SCHED_FIFO) failed: " << ret
+                        << " (CAP_SYS_NICE or RLIMIT_RTPRIO is required)";
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool SetCurrentThreadLowPriority() {
+#if defined(_WIN32)
+  if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST)) {
+    RTC_LOG(LS_WARNING) << "SetThreadPriority failed: " << GetLastError();
+    return false;
+  }
+  return true;
+#elif defined(__linux__)
+  // Linux の nice 値はスレッド毎に設定できる
+  if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 10) != 0) {
+    RTC_LOG(LS_WARNING) << "setpriority failed: " << errno;
+    return false;
+  }
+  return true;
+#elif defined(__APPLE__)
+  if (setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG) != 0) {
+    RTC_LOG(LS_WARNING) << "setpriority failed: " << errno;
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
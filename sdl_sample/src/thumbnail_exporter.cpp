@@ -0,0 +1,322 @@
+#include "thumbnail_exporter.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+// WebRTC
+#include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_sink_interface.h>
+#include <libyuv/rotate_argb.h>
+#include <rtc_base/logging.h>
+// libwebrtc に含まれている libjpeg-turbo を使う。シンボル名を合わせるために MANGLE_JPEG_NAMES を定義してビルドすること
+#include <third_party/libjpeg_turbo/jpeglib.h>
+
+#include "frame_converter.h"
+#include "thread_affinity.h"
+
+namespace {
+
+// 書き込み済みのファイルを置き換える。読む側からは古いファイルか新しいファイルのどちらかしか見えない
+bool RenameReplacing(const std::string& from, const std::string& to) {
+#if defined(_WIN32)
+  return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+struct JpegErrorManager {
+  jpeg_error_mgr pub;
+  jmp_buf jump;
+};
+
+// libjpeg のデフォルトのエラー処理はプロセスを終了するので、エンコードを中断して戻る
+void OnJpegError(j_common_ptr cinfo) {
+  char message[JMSG_LENGTH_MAX];
+  (*cinfo->err->format_message)(cinfo, message);
+  RTC_LOG(LS_ERROR) << "libjpeg error: " << message;
+  longjmp(((JpegErrorManager*)cinfo->err)->jump, 1);
+}
+
+}  // namespace
+
+class ThumbnailExporter::Sink
+    : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  Sink(ThumbnailExporter* exporter, webrtc::VideoTrackInterface* track)
+      : exporter_(exporter),
+        track_(track),
+        track_id_(track->id()),
+        state_(kIdle),
+        rotation_(webrtc::kVideoRotation_0) {
+    track_->AddOrUpdateSink(this, rtc::VideoSinkWants());
+  }
+  // RemoveSink が戻った後は OnFrame が呼ばれない
+  ~Sink() { track_->RemoveSink(this); }
+
+  // 次のフレームを要求する。前回の要求がまだ終わっていない場合は false を返す
+  bool Request() {
+    int state = kIdle;
+    return state_.compare_exchange_strong(state, kRequested);
+  }
+
+  // デコーダのスレッドから呼ばれる。要求されていない間は何もしない
+  void OnFrame(const webrtc::VideoFrame& frame) override {
+    if (state_.load(std::memory_order_acquire) != kRequested) {
+      return;
+    }
+    buffer_ = frame.video_frame_buffer();
+    rotation_ = frame.rotation();
+    state_.store(kCaptured, std::memory_order_release);
+    std::string track_id = track_id_;
+    ThumbnailExporter* exporter = exporter_;
+    boost::asio::post(exporter_->ioc_, [exporter, track_id]() {
+      exporter->Export(track_id);
+    });
+  }
+
+  // 以下は ioc_ のスレッドからしか呼ばない
+
+  // 受け取ったフレームを縮小して BGRX にする。フレームが無い場合は false を返す
+  bool Convert(int max_width) {
+    if (state_.load(std::memory_order_acquire) != kCaptured) {
+      return false;
+    }
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+        ToNV12OrI420(buffer_);
+    webrtc::VideoRotation rotation = rotation_;
+    // フレームの参照はすぐに手放して、デコーダのバッファプールに返す
+    buffer_ = nullptr;
+
+    int width = std::max(2, std::min(max_width, buffer->width()) & ~1);
+    int height = std::max(2, buffer->height() * width / buffer->width() & ~1);
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> scaled;
+    if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+      if (nv12_ == nullptr || nv12_->width() != width ||
+          nv12_->height() != height) {
+        nv12_ = webrtc::NV12Buffer::Create(width, height);
+      }
+      nv12_->CropAndScaleFrom(*buffer->GetNV12(), 0, 0, buffer->width(),
+                              buffer->height());
+      scaled = nv12_;
+    } else {
+      if (i420_ == nullptr || i420_->width() != width ||
+          i420_->height() != height) {
+        i420_ = webrtc::I420Buffer::Create(width, height);
+      }
+      i420_->ScaleFrom(*buffer->GetI420());
+      scaled = i420_;
+    }
+    state_.store(kIdle, std::memory_order_release);
+
+    image_.resize(width * height * 4);
+    ConvertToARGB(scaled, 0, 0, width, height, webrtc::kVideoRotation_0,
+                  width, height, image_.data(), width * 4);
+    width_ = width;
+    height_ = height;
+    if (rotation != webrtc::kVideoRotation_0) {
+      if (rotation != webrtc::kVideoRotation_180) {
+        std::swap(width_, height_);
+      }
+      rotated_image_.resize(image_.size());
+      libyuv::ARGBRotate(image_.data(), width * 4, rotated_image_.data(),
+                         width_ * 4, width, height,
+                         (libyuv::RotationMode)rotation);
+      image_.swap(rotated_image_);
+    }
+    return true;
+  }
+
+  const uint8_t* GetImage() const { return image_.data(); }
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+
+ private:
+  enum State {
+    kIdle,
+    // 次のフレームを待っている
+    kRequested,
+    // buffer_ にフレームがあって、ioc_ のスレッドが処理するのを待っている
+    kCaptured,
+  };
+
+  ThumbnailExporter* exporter_;
+  rtc::scoped_refptr<webrtc::VideoTrackInterface> track_;
+  std::string track_id_;
+  // buffer_ と rotation_ は kRequested の間はデコーダのスレッドが書き込み、
+  // kCaptured の間は ioc_ のスレッドが読む
+  std::atomic<int> state_;
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer_;
+  webrtc::VideoRotation rotation_;
+  // 以下は ioc_ のスレッドからしか触らない
+  rtc::scoped_refptr<webrtc::NV12Buffer> nv12_;
+  rtc::scoped_refptr<webrtc::I420Buffer> i420_;
+  std::vector<uint8_t> image_;
+  std::vector<uint8_t> rotated_image_;
+  int width_ = 0;
+  int height_ = 0;
+};
+
+// jpeg_compress_struct はエンコードの度に作り直さずに使い回す
+class ThumbnailExporter::JpegWriter {
+ public:
+  JpegWriter() {
+    cinfo_.err = jpeg_std_error(&err_.pub);
+    err_.pub.error_exit = OnJpegError;
+    jpeg_create_compress(&cinfo_);
+  }
+  ~JpegWriter() { jpeg_destroy_compress(&cinfo_); }
+
+  bool Write(FILE* file,
+             const uint8_t* bgrx,
+             int width,
+             int height,
+             int quality) {
+    rows_.resize(height);
+    for (int y = 0; y < height; y++) {
+      rows_[y] = (JSAMPROW)(bgrx + y * width * 4);
+    }
+    if (setjmp(err_.jump)) {
+      jpeg_abort_compress(&cinfo_);
+      return false;
+    }
+    jpeg_stdio_dest(&cinfo_, file);
+    cinfo_.image_width = width;
+    cinfo_.image_height = height;
+    cinfo_.input_components = 4;
+    cinfo_.in_color_space = JCS_EXT_BGRX;
+    jpeg_set_defaults(&cinfo_);
+    jpeg_set_quality(&cinfo_, quality, TRUE);
+    jpeg_start_compress(&cinfo_, TRUE);
+    jpeg_write_scanlines(&cinfo_, rows_.data(), height);
+    jpeg_finish_compress(&cinfo_);
+    return true;
+  }
+
+ private:
+  jpeg_compress_struct cinfo_;
+  JpegErrorManager err_;
+  std::vector<JSAMPROW> rows_;
+};
+
+ThumbnailExporter::ThumbnailExporter(ThumbnailExporterConfig config)
+    : config_(config),
+      work_guard_(ioc_.get_executor()),
+      timer_(ioc_),
+      written_thumbnails_(0),
+      skipped_thumbnails_(0) {}
+
+ThumbnailExporter::~ThumbnailExporter() {
+  {
+    webrtc::MutexLock lock(&sinks_lock_);
+    sinks_.clear();
+  }
+  boost::asio::post(ioc_, [this]() { timer_.cancel(); });
+  work_guard_.reset();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void ThumbnailExporter::Start() {
+  RTC_LOG(LS_INFO) << "Start exporting thumbnails: dir=" << config_.dir
+                   << " interval=" << config_.interval;
+  thread_ = std::thread([this]() {
+    SetCurrentThreadLowPriority();
+    jpeg_writer_.reset(new JpegWriter());
+    Tick();
+    ioc_.run();
+    jpeg_writer_.reset();
+  });
+}
+
+void ThumbnailExporter::AddTrack(webrtc::VideoTrackInterface* track) {
+  auto sink = std::make_shared<Sink>(this, track);
+  webrtc::MutexLock lock(&sinks_lock_);
+  sinks_[track->id()] = sink;
+}
+
+void ThumbnailExporter::RemoveTrack(webrtc::VideoTrackInterface* track) {
+  // エンコード中のシンクは、エンコードが終わってから ioc_ のスレッドで破棄される
+  std::shared_ptr<Sink> sink;
+  {
+    webrtc::MutexLock lock(&sinks_lock_);
+    auto it = sinks_.find(track->id());
+    if (it == sinks_.end()) {
+      return;
+    }
+    sink = it->second;
+    sinks_.erase(it);
+  }
+}
+
+uint64_t ThumbnailExporter::GetWrittenThumbnails() const {
+  return written_thumbnails_;
+}
+
+uint64_t ThumbnailExporter::GetSkippedThumbnails() const {
+  return skipped_thumbnails_;
+}
+
+std::shared_ptr<ThumbnailExporter::Sink> ThumbnailExporter::FindSink(
+    const std::string& track_id) {
+  webrtc::MutexLock lock(&sinks_lock_);
+  auto it = sinks_.find(track_id);
+  return it != sinks_.end() ? it->second : nullptr;
+}
+
+void ThumbnailExporter::Tick() {
+  {
+    webrtc::MutexLock lock(&sinks_lock_);
+    for (auto& p : sinks_) {
+      if (!p.second->Request()) {
+        skipped_thumbnails_++;
+      }
+    }
+  }
+  timer_.expires_after(std::chrono::seconds(config_.interval));
+  timer_.async_wait([this](boost::system::error_code ec) {
+    if (ec) {
+      return;
+    }
+    Tick();
+  });
+}
+
+void ThumbnailExporter::Export(const std::string& track_id) {
+  std::shared_ptr<Sink> sink = FindSink(track_id);
+  if (sink == nullptr || !sink->Convert(config_.width)) {
+    return;
+  }
+  if (WriteFile(track_id, *sink)) {
+    written_thumbnails_++;
+  }
+}
+
+bool ThumbnailExporter::WriteFile(const std::string& track_id, Sink& sink) {
+  std::string path = config_.dir + "/" + track_id + ".jpg";
+  std::string tmp_path = path + ".tmp";
+  FILE* file = std::fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Failed to open " << tmp_path;
+    return false;
+  }
+  bool written = jpeg_writer_->Write(file, sink.GetImage(), sink.GetWidth(),
+                                     sink.GetHeight(), config_.quality);
+  if (std::fclose(file) != 0) {
+    written = false;
+  }
+  if (!written || !RenameReplacing(tmp_path, path)) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Failed to write " << path;
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
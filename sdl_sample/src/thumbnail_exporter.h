@@ -0,0 +1,73 @@
+#ifndef THUMBNAIL_EXPORTER_H_
+#define THUMBNAIL_EXPORTER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Boost
+#include <boost/asio.hpp>
+
+// WebRTC
+#include <api/media_stream_interface.h>
+#include <rtc_base/synchronization/mutex.h>
+
+struct ThumbnailExporterConfig {
+  // JPEG を書き出すディレクトリ。/dev/shm の下を指定すると共有メモリに書き出せる
+  std::string dir = ".";
+  // 書き出す間隔 (秒)
+  int interval = 5;
+  // サムネイルの幅。高さは映像のアスペクト比に合わせる
+  int width = 320;
+  int quality = 75;
+};
+
+// 受信した映像のサムネイルを、一定の間隔でトラック毎の JPEG ファイルに書き出す。
+//
+// タイマーで各トラックのシンクに次のフレームを要求して、シンクはそのフレームの参照を渡すだけにする。
+// 縮小と JPEG へのエンコードは優先度を下げた専用のスレッドで行うので、OnFrame は止まらない。
+// 縮小や変換に使うバッファはトラック毎に確保して、映像の大きさが変わるまで使い回す。
+// 一時ファイルに書いてから <track_id>.jpg にリネームするので、読む側が書きかけのファイルを読むことは無い。
+class ThumbnailExporter {
+ public:
+  ThumbnailExporter(ThumbnailExporterConfig config);
+  ~ThumbnailExporter();
+
+  void Start();
+  void AddTrack(webrtc::VideoTrackInterface* track);
+  void RemoveTrack(webrtc::VideoTrackInterface* track);
+
+  uint64_t GetWrittenThumbnails() const;
+  // 前回の要求からフレームが届かなかったか、前回のエンコードが終わっていなかったために書き出さなかった回数
+  uint64_t GetSkippedThumbnails() const;
+
+ private:
+  class Sink;
+  class JpegWriter;
+
+  void Tick();
+  std::shared_ptr<Sink> FindSink(const std::string& track_id);
+  void Export(const std::string& track_id);
+  bool WriteFile(const std::string& track_id, Sink& sink);
+
+  ThumbnailExporterConfig config_;
+  boost::asio::io_context ioc_;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+      work_guard_;
+  boost::asio::steady_timer timer_;
+  std::thread thread_;
+
+  std::atomic<uint64_t> written_thumbnails_;
+  std::atomic<uint64_t> skipped_thumbnails_;
+
+  // OnFrame からは触らないので、OnFrame がこのロックを待つことは無い
+  webrtc::Mutex sinks_lock_;
+  std::map<std::string, std::shared_ptr<Sink>> sinks_;
+  // ioc_ のスレッドからしか触らない
+  std::unique_ptr<JpegWriter> jpeg_writer_;
+};
+
+#endif